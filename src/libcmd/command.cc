@@ -166,6 +166,11 @@ ref<Store> EvalCommand::getEvalStore()
 ref<EvalState> EvalCommand::getEvalState()
 {
     if (!evalState) {
+        if (startReplOnEvalErrors && evalSettings.evalCores != 1U) {
+            warn("'--debugger' does not support parallel evaluation; ignoring 'eval-cores'");
+            evalSettings.evalCores = 1;
+        }
+
         evalState = std::allocate_shared<EvalState>(
             traceable_allocator<EvalState>(), lookupPath, getEvalStore(), fetchSettings, evalSettings, getStore());
 
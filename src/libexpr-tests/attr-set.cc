@@ -0,0 +1,117 @@
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/util/tests/gmock-matchers.hh"
+
+namespace nix {
+
+class AttrShapeTest : public LibExprTest
+{};
+
+TEST_F(AttrShapeTest, sameSiteSharesShape)
+{
+    auto v = eval("map (x: { a = x; b = x + 1; }) [ 1 2 ]");
+    ASSERT_THAT(v, IsListOfSize(2));
+    auto elems = v.listView();
+    state.forceValue(*elems[0], noPos);
+    state.forceValue(*elems[1], noPos);
+
+    auto shape = elems[0]->attrs()->getShape();
+    ASSERT_NE(shape, 0u);
+    ASSERT_EQ(elems[1]->attrs()->getShape(), shape);
+}
+
+TEST_F(AttrShapeTest, shapeDependsOnlyOnNames)
+{
+    auto v1 = eval("{ a = 1; b = 2; }");
+    auto v2 = eval("rec { b = a; a = 3; }");
+    auto v3 = eval("{ a = 1; c = 2; }");
+    ASSERT_NE(v1.attrs()->getShape(), 0u);
+    ASSERT_EQ(v1.attrs()->getShape(), v2.attrs()->getShape());
+    ASSERT_NE(v1.attrs()->getShape(), v3.attrs()->getShape());
+}
+
+TEST_F(AttrShapeTest, noShapeForVariableNames)
+{
+    ASSERT_EQ(eval("{ a = 1; } // { b = 2; }").attrs()->getShape(), 0u);
+    ASSERT_EQ(eval("let n = \"b\"; in { a = 1; ${n} = 2; }").attrs()->getShape(), 0u);
+    ASSERT_EQ(eval("builtins.listToAttrs [ { name = \"a\"; value = 1; } ]").attrs()->getShape(), 0u);
+
+    /* Dynamic attributes with a null name don't change the names. */
+    ASSERT_NE(eval("{ a = 1; ${null} = 2; }").attrs()->getShape(), 0u);
+}
+
+TEST_F(AttrShapeTest, selectWithMixedShapes)
+{
+    /* The same select sees sets of different shapes, sets without a
+       shape and sets where the attribute is missing. */
+    auto v = eval(R"(
+        let
+          sets = [
+            { x = 1; y = 2; }
+            { y = 3; z = 4; }
+            ({ y = 5; } // { x = 6; })
+            { x = 7; y = 8; }
+            { z = 9; }
+          ];
+        in map (s: s.y or 0) (sets ++ sets)
+    )");
+    ASSERT_THAT(v, IsListOfSize(10));
+    auto elems = v.listView();
+    std::vector<NixInt::Inner> expected{2, 3, 5, 8, 0};
+    for (size_t i = 0; i < elems.size(); ++i) {
+        state.forceValue(*elems[i], noPos);
+        ASSERT_THAT(*elems[i], IsIntEq(expected[i % expected.size()]));
+    }
+}
+
+TEST_F(AttrShapeTest, selectWithDynamicNames)
+{
+    auto v = eval(R"(
+        let s = { a = 1; b = 2; c = 3; };
+        in map (n: s.${n}) [ "a" "b" "c" "a" ]
+    )");
+    auto elems = v.listView();
+    std::vector<NixInt::Inner> expected{1, 2, 3, 1};
+    for (size_t i = 0; i < elems.size(); ++i) {
+        state.forceValue(*elems[i], noPos);
+        ASSERT_THAT(*elems[i], IsIntEq(expected[i]));
+    }
+}
+
+TEST_F(AttrShapeTest, withLookupsAcrossScopes)
+{
+    /* The inner `with` has a shape but no `a`, so every lookup has to
+       fall through to the outer one, whose shape varies. */
+    auto v = eval(R"(
+        map (s: with s; with { b = 0; }; a + b) [
+          { a = 1; }
+          { a = 2; c = 3; }
+          ({ c = 5; } // { a = 4; })
+          { a = 6; }
+        ]
+    )");
+    auto elems = v.listView();
+    std::vector<NixInt::Inner> expected{1, 2, 4, 6};
+    for (size_t i = 0; i < elems.size(); ++i) {
+        state.forceValue(*elems[i], noPos);
+        ASSERT_THAT(*elems[i], IsIntEq(expected[i]));
+    }
+}
+
+TEST_F(AttrShapeTest, selectFromVariable)
+{
+    auto v = eval(R"(
+        let pkgs = { lib = { x = 1; }; self = pkgs; };
+        in [ pkgs.lib.x pkgs.self.lib.x (pkgs.lib.y or 2) (pkgs.nope or 3) ]
+    )");
+    auto elems = v.listView();
+    std::vector<NixInt::Inner> expected{1, 1, 2, 3};
+    for (size_t i = 0; i < elems.size(); ++i) {
+        state.forceValue(*elems[i], noPos);
+        ASSERT_THAT(*elems[i], IsIntEq(expected[i]));
+    }
+
+    ASSERT_THROW(eval("let x = 1; in x.a"), TypeError);
+    ASSERT_THROW(eval("let x = {}; in x.a"), EvalError);
+}
+
+} // namespace nix
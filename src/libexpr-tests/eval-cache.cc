@@ -0,0 +1,200 @@
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/expr/eval-cache.hh"
+#include "nix/expr/eval-cache-snapshot.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/finally.hh"
+
+#include <latch>
+#include <thread>
+
+namespace nix::eval_cache {
+
+class EvalCacheTest : public LibExprTest
+{
+protected:
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir};
+
+    Hash fingerprint = hashString(HashAlgorithm::SHA256, "eval-cache-test");
+
+    EvalCacheTest()
+    {
+        setEnvOs(OS_STR("NIX_CACHE_HOME"), (tmpDir / "cache").native());
+    }
+
+    ~EvalCacheTest()
+    {
+        unsetEnvOs(OS_STR("NIX_CACHE_HOME"));
+    }
+
+    ref<EvalCache> openCache(std::optional<std::string> expr)
+    {
+        return make_ref<EvalCache>(std::cref(fingerprint), state, [this, expr]() -> Value * {
+            if (!expr)
+                throw Error("the evaluation cache should have been used");
+            auto v = state.allocValue();
+            state.eval(state.parseExprFromString(*expr, state.rootPath(CanonPath::root)), *v);
+            return v;
+        });
+    }
+};
+
+TEST_F(EvalCacheTest, snapshotRoundTrip)
+{
+    AttrSnapshot::Builder builder;
+    auto & root = builder.child(builder.root(), "");
+    root.type = AttrType::FullAttrs;
+    auto & b = builder.child(root, "b");
+    b.type = AttrType::String;
+    b.string = "hello";
+    b.context = "/nix/store/00000000000000000000000000000000-foo";
+    auto & a = builder.child(root, "a");
+    a.type = AttrType::Int;
+    a.number = -42;
+    auto & c = builder.child(root, "c");
+    c.type = AttrType::ListOfStrings;
+    c.string = "x\ty";
+    builder.child(c, "unused");
+
+    auto path = tmpDir / "snapshot";
+    AttrSnapshot::write(path, builder);
+    auto snapshot = AttrSnapshot::open(path);
+
+    auto rootId = snapshot->lookup(0, "");
+    ASSERT_TRUE(rootId);
+    ASSERT_EQ(snapshot->type(*rootId), AttrType::FullAttrs);
+
+    /* Children are contiguous and sorted. */
+    auto [first, count] = snapshot->children(*rootId);
+    ASSERT_EQ(count, 3u);
+    ASSERT_EQ(snapshot->name(first), "a");
+    ASSERT_EQ(snapshot->name(first + 1), "b");
+    ASSERT_EQ(snapshot->name(first + 2), "c");
+    ASSERT_EQ(snapshot->parent(first), *rootId);
+
+    ASSERT_EQ(snapshot->lookup(*rootId, "a"), first);
+    ASSERT_EQ(snapshot->numberValue(first), -42);
+    ASSERT_EQ(snapshot->stringValue(first + 1), "hello");
+    ASSERT_EQ(snapshot->contextValue(first + 1), "/nix/store/00000000000000000000000000000000-foo");
+    ASSERT_EQ(snapshot->contextValue(first + 2), std::nullopt);
+    ASSERT_EQ(snapshot->lookup(*rootId, "d"), std::nullopt);
+    ASSERT_EQ(snapshot->lookup(*rootId, ""), std::nullopt);
+
+    /* Reading it back and writing it again gives the same file. */
+    AttrSnapshot::Builder builder2;
+    snapshot->read(builder2);
+    auto path2 = tmpDir / "snapshot2";
+    AttrSnapshot::write(path2, builder2);
+    ASSERT_EQ(readFile(path), readFile(path2));
+}
+
+TEST_F(EvalCacheTest, corruptSnapshotsAreRejected)
+{
+    AttrSnapshot::Builder builder;
+    builder.child(builder.child(builder.root(), ""), "a").type = AttrType::Bool;
+
+    auto path = tmpDir / "snapshot";
+    AttrSnapshot::write(path, builder);
+    auto contents = readFile(path);
+
+    writeFile(path, contents.substr(0, contents.size() - 1));
+    ASSERT_THROW(AttrSnapshot::open(path), SerialisationError);
+
+    /* Point the first node's name past the string table. */
+    auto corrupt = contents;
+    corrupt[32 + 3 * 4] = '\x7f';
+    writeFile(path, corrupt);
+    ASSERT_THROW(AttrSnapshot::open(path), SerialisationError);
+}
+
+TEST_F(EvalCacheTest, cachedAttributesSurviveReopening)
+{
+    auto expr = R"({
+        a = { b = "hello"; c = true; d = 42; };
+        e = [ "x" "y" ];
+        f = throw "oops";
+    })";
+
+    {
+        auto cache = openCache(expr);
+        auto root = cache->getRoot();
+        ASSERT_EQ(root->getAttrs().size(), 3u);
+        auto a = root->getAttr("a");
+        ASSERT_EQ(a->getAttr("b")->getString(), "hello");
+        ASSERT_TRUE(a->getAttr("c")->getBool());
+        ASSERT_EQ(a->getAttr("d")->getInt(), 42);
+        ASSERT_EQ(a->maybeGetAttr("missing"), nullptr);
+        ASSERT_EQ(root->getAttr("e")->getListOfStrings(), (std::vector<std::string>{"x", "y"}));
+        ASSERT_THROW(root->getAttr("f")->getString(), EvalError);
+    }
+
+    /* Now everything must come from the cache. */
+    auto cache = openCache(std::nullopt);
+    auto root = cache->getRoot();
+    auto attrs = root->getAttrs();
+    ASSERT_EQ(attrs.size(), 3u);
+    ASSERT_EQ(state.symbols[attrs[0]], "a");
+    auto a = root->getAttr("a");
+    ASSERT_EQ(a->getAttr("b")->getString(), "hello");
+    ASSERT_TRUE(a->getAttr("c")->getBool());
+    ASSERT_EQ(a->getAttr("d")->getInt(), 42);
+    ASSERT_EQ(a->maybeGetAttr("missing"), nullptr);
+    ASSERT_EQ(root->getAttr("e")->getListOfStrings(), (std::vector<std::string>{"x", "y"}));
+    ASSERT_THROW(root->getAttr("f")->getString(), CachedEvalError);
+}
+
+TEST_F(EvalCacheTest, writersMergeTheirAttributes)
+{
+    auto expr = "{ a = 1; b = 2; }";
+
+    auto cache1 = openCache(expr);
+    auto cache2 = openCache(expr);
+    ASSERT_EQ(cache1->getRoot()->getAttr("a")->getInt(), 1);
+    ASSERT_EQ(cache2->getRoot()->getAttr("b")->getInt(), 2);
+
+    /* Normally these would be different processes. `EvalCache` closes
+       its database when the last reference goes away. */
+    cache1 = openCache(std::nullopt);
+    cache2 = openCache(std::nullopt);
+
+    auto cache = openCache(std::nullopt);
+    ASSERT_EQ(cache->getRoot()->getAttr("a")->getInt(), 1);
+    ASSERT_EQ(cache->getRoot()->getAttr("b")->getInt(), 2);
+}
+
+TEST_F(EvalCacheTest, concurrentWritersMergeTheirAttributes)
+{
+    constexpr size_t nrWriters = 8;
+
+    std::string expr = "{";
+    for (size_t i = 0; i < nrWriters; ++i)
+        expr += fmt(" a%d = %d;", i, i);
+    expr += " }";
+
+    /* Every writer caches a different attribute. */
+    std::vector<std::shared_ptr<EvalCache>> caches;
+    for (size_t i = 0; i < nrWriters; ++i) {
+        auto cache = openCache(expr);
+        ASSERT_EQ(cache->getRoot()->getAttr(fmt("a%d", i))->getInt(), (NixInt::Inner) i);
+        caches.push_back(cache.get_ptr());
+    }
+
+    /* Close them all at the same time, which merges their attributes
+       into the snapshot. */
+    std::latch ready(nrWriters);
+    std::vector<std::thread> threads;
+    for (auto & cache : caches)
+        threads.emplace_back([&ready, cache = std::move(cache)]() mutable {
+            ready.arrive_and_wait();
+            cache.reset();
+        });
+    for (auto & thread : threads)
+        thread.join();
+
+    auto cache = openCache(std::nullopt);
+    for (size_t i = 0; i < nrWriters; ++i)
+        ASSERT_EQ(cache->getRoot()->getAttr(fmt("a%d", i))->getInt(), (NixInt::Inner) i);
+}
+
+} // namespace nix::eval_cache
@@ -0,0 +1,132 @@
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/expr/function-memo.hh"
+
+namespace nix {
+
+class FunctionMemoTest : public LibExprTest
+{
+protected:
+    FunctionMemoTest()
+        : LibExprTest(openStore("dummy://"), [](bool & readOnlyMode) {
+            EvalSettings settings{readOnlyMode};
+            settings.nixPath = {};
+            settings.evalMemoSize = 1000;
+            return settings;
+        })
+    {
+    }
+
+    FunctionMemo memo{1000};
+
+    /**
+     * Whether `arg1` and `arg2` give the same key.
+     */
+    bool sameKey(Value arg1, Value arg2)
+    {
+        static int fun;
+        Value * args1[] = {&arg1};
+        Value * args2[] = {&arg2};
+        auto key1 = FunctionMemo::makeKey(&fun, nullptr, args1);
+        auto key2 = FunctionMemo::makeKey(&fun, nullptr, args2);
+        if (!key1 || !key2)
+            return false;
+        Value result;
+        result.mkNull();
+        memo.insert(*key1, result);
+        return memo.lookup(*key2);
+    }
+};
+
+TEST_F(FunctionMemoTest, argumentsAreComparedStructurally)
+{
+    ASSERT_TRUE(sameKey(eval("{ a = 1; b = [ \"x\" null ]; }"), eval("{ b = [ \"x\" null ]; a = 1; }")));
+    ASSERT_TRUE(sameKey(eval("1.5"), eval("3.0 / 2")));
+
+    ASSERT_FALSE(sameKey(eval("{ a = 1; }"), eval("{ a = 2; }")));
+    ASSERT_FALSE(sameKey(eval("1"), eval("1.0")));
+    ASSERT_FALSE(sameKey(eval("0.0"), eval("-0.0")));
+    ASSERT_FALSE(sameKey(
+        eval("\"foo\""),
+        eval("builtins.appendContext \"foo\" { \"/nix/store/00000000000000000000000000000000-bar\" = { path = true; }; }")));
+}
+
+TEST_F(FunctionMemoTest, keysDontForceArguments)
+{
+    auto v = eval("{ a = throw \"a\"; b = { c = throw \"c\"; }; }");
+    ASSERT_TRUE(sameKey(v, v));
+    ASSERT_THAT(*v.attrs()->get(createSymbol("a"))->value, IsThunk());
+
+    /* Different thunks are different, even if they would evaluate to
+       the same value. */
+    ASSERT_FALSE(sameKey(eval("{ a = 1 + 1; }"), eval("{ a = 1 + 1; }")));
+}
+
+TEST_F(FunctionMemoTest, largeArgumentsAreNotMemoised)
+{
+    static int fun;
+    auto v = eval("builtins.genList (x: x) 1000");
+    Value * args[] = {&v};
+    ASSERT_FALSE(FunctionMemo::makeKey(&fun, nullptr, args));
+}
+
+TEST_F(FunctionMemoTest, memoisedCallsGiveTheSameResults)
+{
+    auto v = eval(R"(
+        let
+          f = { x, y ? 10 }: x * y;
+          g = x: { inherit x; y = x + 1; };
+          args = [ { x = 1; } { x = 2; y = 3; } { x = 1; } { x = 2; } ];
+        in map f args ++ map (n: (g n).y) [ 1 2 1 2 ] ++ map (s: builtins.fromJSON s) [ "1" "[2]" "1" ]
+    )");
+    ASSERT_THAT(v, IsListOfSize(11));
+    auto elems = v.listView();
+    for (size_t i = 0; i < elems.size(); ++i)
+        state.forceValue(*elems[i], noPos);
+    std::vector<NixInt::Inner> expected{10, 6, 10, 20, 2, 3, 2, 3, 1};
+    for (size_t i = 0; i < expected.size(); ++i)
+        ASSERT_THAT(*elems[i], IsIntEq(expected[i]));
+    ASSERT_THAT(*elems[9], IsListOfSize(1));
+    ASSERT_THAT(*elems[10], IsIntEq(1));
+
+    /* Repeated calls come from the memo, so they share their result. */
+    auto v2 = eval("let g = x: { inherit x; }; in [ (g 1) (g 1) (g 2) ]");
+    auto elems2 = v2.listView();
+    for (auto elem : elems2)
+        state.forceValue(*elem, noPos);
+    ASSERT_EQ(elems2[0]->attrs(), elems2[1]->attrs());
+    ASSERT_NE(elems2[0]->attrs(), elems2[2]->attrs());
+    ASSERT_THAT(eval("let f = x: { g = y: y; }; in f 1 == f 1"), IsTrue());
+}
+
+TEST_F(FunctionMemoTest, callsWithSideEffectsAreNotMemoised)
+{
+    auto v = eval(R"(
+        let
+          f = x: builtins.trace "f" { inherit x; };
+          g = x: builtins.warn "g" { inherit x; };
+          h = x: { inherit x; };
+        in [ (f 1) (f 1) (g 1) (g 1) (h 1) (h 1) ]
+    )");
+    auto elems = v.listView();
+    for (auto elem : elems)
+        state.forceValue(*elem, noPos);
+    ASSERT_NE(elems[0]->attrs(), elems[1]->attrs());
+    ASSERT_NE(elems[2]->attrs(), elems[3]->attrs());
+    ASSERT_EQ(elems[4]->attrs(), elems[5]->attrs());
+}
+
+TEST_F(FunctionMemoTest, errorsAreNotMemoised)
+{
+    ASSERT_THROW(eval("builtins.fromJSON (throw \"no\")"), ThrownError);
+    ASSERT_THROW(eval("builtins.fromJSON \"{\""), EvalError);
+    ASSERT_THAT(eval("builtins.fromJSON \"{}\""), IsAttrsOfSize(0));
+
+    auto v = eval("let f = x: if x then throw \"no\" else 1; in [ (f false) (f true) (f true) ]");
+    auto elems = v.listView();
+    state.forceValue(*elems[0], noPos);
+    ASSERT_THAT(*elems[0], IsIntEq(1));
+    ASSERT_THROW(state.forceValue(*elems[1], noPos), ThrownError);
+    ASSERT_THROW(state.forceValue(*elems[2], noPos), ThrownError);
+}
+
+} // namespace nix
@@ -0,0 +1,117 @@
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/expr/parallel-eval.hh"
+
+#include <latch>
+
+namespace nix {
+
+class ParallelEvalTest : public LibExprTest
+{
+protected:
+    ParallelEvalTest()
+        : LibExprTest(openStore("dummy://"), [](bool & readOnlyMode) {
+            EvalSettings settings{readOnlyMode};
+            settings.nixPath = {};
+            settings.evalCores = 4;
+            return settings;
+        })
+    {
+    }
+};
+
+TEST_F(ParallelEvalTest, enabled)
+{
+    ASSERT_TRUE(state.executor->enabled);
+}
+
+TEST_F(ParallelEvalTest, sharedThunksAgree)
+{
+    /* Every element depends on the previous one, so threads that force
+       different elements end up waiting for each other. */
+    auto v = eval(R"(
+        let
+          xs = builtins.genList (i: if i == 0 then 0 else builtins.elemAt xs (i - 1) + sum i) 300;
+          sum = n: builtins.foldl' (a: b: a + b) 0 (builtins.genList (j: j) n);
+        in xs
+    )");
+    ASSERT_EQ(v.listSize(), 300);
+
+    std::vector<Executor::Work> work;
+    for (size_t t = 0; t < 16; ++t)
+        work.push_back([&, t]() {
+            auto elems = v.listView();
+            for (size_t i = 0; i < elems.size(); ++i)
+                state.forceValue(*elems[(i * 7 + t * 31) % elems.size()], noPos);
+        });
+    state.executor->runAll(std::move(work));
+
+    NixInt::Inner expected = 0;
+    auto elems = v.listView();
+    for (size_t i = 0; i < elems.size(); ++i) {
+        if (i > 0)
+            expected += i * (i - 1) / 2;
+        ASSERT_EQ(elems[i]->type(), nInt);
+        ASSERT_EQ(elems[i]->integer().value, expected);
+    }
+}
+
+TEST_F(ParallelEvalTest, infiniteRecursion)
+{
+    auto v = eval("let x = { a = x.a + 1; }; in x");
+    auto a = v.attrs()->get(createSymbol("a"));
+    ASSERT_NE(a, nullptr);
+
+    std::vector<Executor::Work> work;
+    for (size_t t = 0; t < 4; ++t)
+        work.push_back([&]() { ASSERT_THROW(state.forceValue(*a->value, noPos), InfiniteRecursionError); });
+    state.executor->runAll(std::move(work));
+
+    /* The failure is memoised. */
+    ASSERT_THROW(state.forceValue(*a->value, noPos), InfiniteRecursionError);
+}
+
+TEST_F(ParallelEvalTest, infiniteRecursionBetweenThreads)
+{
+    /* `a` and `b` need each other, and take a while before they say
+       so, which gives two threads time to start one each. */
+    auto v = eval(R"(
+        let
+          slow = builtins.foldl' (x: y: x + y) 0 (builtins.genList (i: i) 100000);
+          a = builtins.seq slow b;
+          b = builtins.seq slow a;
+        in { p = a; q = b; }
+    )");
+
+    std::latch started(2);
+    std::vector<Executor::Work> work;
+    for (auto name : {"p", "q"})
+        work.push_back([&, name]() {
+            auto attr = v.attrs()->get(createSymbol(name));
+            /* Make sure that two different threads run these. */
+            started.arrive_and_wait();
+            ASSERT_THROW(state.forceValue(*attr->value, noPos), InfiniteRecursionError);
+        });
+    state.executor->runAll(std::move(work));
+}
+
+TEST_F(ParallelEvalTest, runAllRethrows)
+{
+    std::atomic<size_t> done{0};
+
+    std::vector<Executor::Work> work;
+    for (size_t i = 0; i < 100; ++i)
+        work.push_back([&, i]() {
+            if (i == 42)
+                throw Error("task %d failed", i);
+            /* Nested work must not deadlock. */
+            std::vector<Executor::Work> nested;
+            for (size_t j = 0; j < 10; ++j)
+                nested.push_back([&]() { done++; });
+            state.executor->runAll(std::move(nested));
+        });
+
+    ASSERT_THROW(state.executor->runAll(std::move(work)), Error);
+    ASSERT_EQ(done, 99 * 10);
+}
+
+} // namespace nix
@@ -0,0 +1,96 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/fmt.hh"
+
+namespace nix {
+namespace {
+
+/**
+ * A directory of generated Nix files that look vaguely like Nixpkgs
+ * package expressions, plus a parse cache directory.
+ */
+struct ParseTree
+{
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir};
+    std::vector<std::filesystem::path> files;
+    size_t bytes = 0;
+
+    explicit ParseTree(size_t fileCount)
+    {
+        for (size_t i = 0; i < fileCount; ++i) {
+            std::string s;
+            s += "{ lib, stdenv, fetchurl, ... }:\n\n";
+            s += fmt("let\n  version = \"%d.0\";\nin\nstdenv.mkDerivation rec {\n", i);
+            s += fmt("  pname = \"pkg%d\";\n  inherit version;\n", i);
+            s += "  src = fetchurl {\n    url = \"https://example.org/${pname}-${version}.tar.gz\";\n";
+            s += "    hash = \"sha256-AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA=\";\n  };\n";
+            for (size_t j = 0; j < 20; ++j)
+                s += fmt(
+                    "  attr%d = if stdenv.isLinux then [ ./patch%d.patch \"--flag-%d\" ] else { x = %d; y = x: x + %d; };\n",
+                    j,
+                    j,
+                    j,
+                    j,
+                    j);
+            s += "  meta = with lib; {\n    description = \"A generated package\";\n";
+            s += "    license = licenses.mit;\n    platforms = platforms.all;\n  };\n}\n";
+            auto path = tmpDir / fmt("pkg%d.nix", i);
+            writeFile(path, s);
+            files.push_back(path);
+            bytes += s.size();
+        }
+        setEnvOs(OS_STR("NIX_CACHE_HOME"), (tmpDir / "cache").native());
+        evalSettings.nixPath = {};
+    }
+
+    std::unique_ptr<EvalState> makeState(bool useParseCache)
+    {
+        evalSettings.useParseCache = useParseCache;
+        return std::make_unique<EvalState>(LookupPath{}, store, fetchSettings, evalSettings, nullptr);
+    }
+
+    void parseAll(EvalState & st)
+    {
+        for (auto & file : files)
+            benchmark::DoNotOptimize(st.parseExprFromFile(st.rootPath(CanonPath(file.string()))));
+    }
+
+    ref<Store> store = openStore("dummy://");
+    fetchers::Settings fetchSettings{};
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+};
+
+} // namespace
+
+static void BM_ParseFiles(benchmark::State & state, bool useParseCache)
+{
+    ParseTree tree(static_cast<size_t>(state.range(0)));
+
+    /* Populate the cache outside of the measurement. */
+    if (useParseCache)
+        tree.parseAll(*tree.makeState(true));
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto st = tree.makeState(useParseCache);
+        state.ResumeTiming();
+
+        tree.parseAll(*st);
+    }
+
+    state.SetBytesProcessed(state.iterations() * tree.bytes);
+    unsetEnvOs(OS_STR("NIX_CACHE_HOME"));
+}
+
+BENCHMARK_CAPTURE(BM_ParseFiles, cold, false)->Arg(100)->Arg(1'000);
+BENCHMARK_CAPTURE(BM_ParseFiles, warm, true)->Arg(100)->Arg(1'000);
+
+} // namespace nix
@@ -0,0 +1,202 @@
+#include "nix/expr/parse-cache.hh"
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/finally.hh"
+
+namespace nix {
+
+class ParseCacheTest : public LibExprTest
+{
+protected:
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir};
+
+    std::filesystem::path cacheDir = tmpDir / "cache" / "parse-cache-v1";
+
+    /**
+     * Parse and evaluate `path` with a fresh `EvalState`. Returns the
+     * printed expression and the resulting string.
+     */
+    std::pair<std::string, std::string> parseFile(const std::filesystem::path & path, bool useParseCache)
+    {
+        setEnvOs(OS_STR("NIX_CACHE_HOME"), (tmpDir / "cache").native());
+        Finally restoreEnv([&]() { unsetEnvOs(OS_STR("NIX_CACHE_HOME")); });
+
+        EvalSettings settings{readOnlyMode};
+        settings.nixPath = {};
+        settings.useParseCache = useParseCache;
+        EvalState st({}, store, fetchSettings, settings, nullptr);
+
+        auto e = st.parseExprFromFile(st.rootPath(CanonPath(path.string())));
+
+        std::ostringstream shown;
+        e->show(st.symbols, shown);
+
+        Value v;
+        st.eval(e, v);
+        return {shown.str(), std::string(st.forceStringNoCtx(v, noPos, "while evaluating the test expression"))};
+    }
+
+    size_t cacheEntries()
+    {
+        if (!std::filesystem::exists(cacheDir))
+            return 0;
+        return std::distance(std::filesystem::directory_iterator(cacheDir), std::filesystem::directory_iterator());
+    }
+};
+
+static const std::string_view testFile = R"(
+    let
+      /** Add two numbers. */
+      add = a: b: a + b;
+      f = { x, y ? 2, ... }@args: x * y + builtins.length (builtins.attrNames args);
+      g = { z }: z;
+      inherit (builtins) toJSON;
+      name = "dyn";
+      attrs = rec {
+        a = 1;
+        b = a + 1;
+        ${name} = "interpolated ${toString b}";
+        nested.deeper.value = 3.5;
+        inherit add;
+      };
+    in
+    assert attrs ? nested.deeper;
+    with attrs;
+    toJSON {
+      sum = add a b;
+      call = f { x = 3; w = null; };
+      formal = g { z = [ 1 "two" (if a < b then true else false) ]; };
+      select = attrs.missing or attrs.nested.deeper.value;
+      str = attrs.${name};
+      ops = [ (!false && true || false) (a == 1) (a != b) (true -> false) ([ 1 ] ++ [ 2 ]) ({ p = 1; } // { q = 2; }) (a - b) (b / 2) ];
+      path = toString ./sub/file.nix;
+      line = __curPos.line;
+    }
+)";
+
+TEST_F(ParseCacheTest, coldAndWarmParsesAgree)
+{
+    auto file = tmpDir / "default.nix";
+    writeFile(file, testFile);
+
+    auto uncached = parseFile(file, false);
+    ASSERT_EQ(cacheEntries(), 0);
+
+    /* The first parse populates the cache. */
+    auto cold = parseFile(file, true);
+    ASSERT_EQ(cacheEntries(), 1);
+    ASSERT_EQ(cold, uncached);
+
+    /* The second one is loaded from the cache. */
+    auto warm = parseFile(file, true);
+    ASSERT_EQ(cacheEntries(), 1);
+    ASSERT_EQ(warm, uncached);
+
+    /* The same file in another directory gets its own entry, since
+       relative paths resolve differently. */
+    createDirs(tmpDir / "other");
+    auto file2 = tmpDir / "other" / "default.nix";
+    writeFile(file2, testFile);
+    auto other = parseFile(file2, true);
+    ASSERT_EQ(cacheEntries(), 2);
+    ASSERT_NE(other.second, uncached.second);
+}
+
+TEST_F(ParseCacheTest, corruptEntriesAreReplaced)
+{
+    auto file = tmpDir / "default.nix";
+    writeFile(file, testFile);
+
+    auto expected = parseFile(file, true);
+    ASSERT_EQ(cacheEntries(), 1);
+
+    auto entry = std::filesystem::directory_iterator(cacheDir)->path();
+    auto contents = readFile(entry);
+    writeFile(entry, contents.substr(0, contents.size() / 2));
+
+    ASSERT_EQ(parseFile(file, true), expected);
+    ASSERT_EQ(readFile(entry), contents);
+}
+
+TEST_F(ParseCacheTest, corruptEntriesDontConstructAnything)
+{
+    auto file = tmpDir / "default.nix";
+    writeFile(file, testFile);
+
+    parseFile(file, true);
+    ASSERT_EQ(cacheEntries(), 1);
+    auto contents = readFile(std::filesystem::directory_iterator(cacheDir)->path());
+
+    auto basePath = state.rootPath(CanonPath(tmpDir.string()));
+    auto origin = state.positions.addOrigin(Pos::Origin(state.rootPath(CanonPath(file.string()))), testFile.size());
+
+    auto deserialise = [&](std::string_view data) {
+        DocCommentMap docComments;
+        auto nrSymbols = state.symbols.size();
+        try {
+            deserialiseParsedExpr(
+                data, origin, docComments, state.symbols, state.positions, state.mem.exprs, basePath, state.rootFS);
+        } catch (SerialisationError &) {
+            /* Nothing was built before the corruption was detected. */
+            EXPECT_EQ(state.symbols.size(), nrSymbols);
+            EXPECT_TRUE(docComments.empty());
+            return false;
+        }
+        return true;
+    };
+
+    /* `state` hasn't seen the symbols in `testFile` yet, so building
+       any part of a truncated entry would add to its symbol table. */
+    for (size_t len = 0; len < contents.size(); ++len)
+        ASSERT_FALSE(deserialise(std::string_view(contents).substr(0, len)));
+
+    ASSERT_TRUE(deserialise(contents));
+
+    /* Flipped bytes may still give a well-formed entry, but must never
+       crash. */
+    for (size_t i = 0; i < contents.size(); ++i) {
+        auto flipped = contents;
+        flipped[i] ^= 0xff;
+        deserialise(flipped);
+    }
+}
+
+TEST_F(ParseCacheTest, evictsLeastRecentlyUsedEntries)
+{
+    ParseCache cache(cacheDir, 100);
+
+    auto key = [](std::string_view s) { return hashString(HashAlgorithm::SHA256, s); };
+    auto entryPath = [&](std::string_view s) { return cacheDir / key(s).to_string(HashFormat::Nix32, false); };
+    std::string entry(40, 'x');
+
+    cache.insert(key("a"), entry);
+    cache.insert(key("b"), entry);
+    ASSERT_EQ(cacheEntries(), 2);
+
+    setWriteTime(entryPath("a"), 1000, 1000);
+    setWriteTime(entryPath("b"), 2000, 2000);
+
+    /* Looking up `a` makes `b` the least recently used entry. */
+    ExprInt dummy(NixInt::Inner(1));
+    ASSERT_EQ(cache.lookup(key("a"), [&](std::string_view data) -> Expr * { return &dummy; }), &dummy);
+
+    cache.insert(key("c"), entry);
+    ASSERT_EQ(cacheEntries(), 2);
+    ASSERT_TRUE(std::filesystem::exists(entryPath("a")));
+    ASSERT_FALSE(std::filesystem::exists(entryPath("b")));
+    ASSERT_TRUE(std::filesystem::exists(entryPath("c")));
+}
+
+TEST_F(ParseCacheTest, homePathsAreNotCached)
+{
+    /* `~/...` depends on $HOME at parse time. */
+    auto file = tmpDir / "default.nix";
+    writeFile(file, "let f = _: ~/foo; in \"ok\"");
+
+    ASSERT_EQ(parseFile(file, true).second, "ok");
+    ASSERT_EQ(cacheEntries(), 0);
+}
+
+} // namespace nix
@@ -2,22 +2,18 @@
 
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-settings.hh"
+#include "nix/expr/print.hh"
 #include "nix/fetchers/fetch-settings.hh"
 #include "nix/store/store-open.hh"
 
 namespace nix {
 
-static void BM_EvalManyBuiltinsMatchSameRegex(benchmark::State & state)
+/**
+ * Evaluate `exprStr` in a fresh `EvalState` per iteration, timing only
+ * the evaluation.
+ */
+static void runEvalBenchmark(benchmark::State & state, std::string_view exprStr, int iterations)
 {
-    static constexpr int iterations = 5'000;
-
-    static constexpr std::string_view exprStr =
-        "builtins.foldl' "
-        "(acc: _: acc + builtins.length (builtins.match \"a\" \"a\")) "
-        "0 "
-        "(builtins.genList (x: x) "
-        "5000)";
-
     for (auto _ : state) {
         state.PauseTiming();
 
@@ -43,6 +39,93 @@ static void BM_EvalManyBuiltinsMatchSameRegex(benchmark::State & state)
     state.SetItemsProcessed(state.iterations() * iterations);
 }
 
+static void BM_EvalManyBuiltinsMatchSameRegex(benchmark::State & state)
+{
+    runEvalBenchmark(
+        state,
+        "builtins.foldl' "
+        "(acc: _: acc + builtins.length (builtins.match \"a\" \"a\")) "
+        "0 "
+        "(builtins.genList (x: x) "
+        "5000)",
+        5'000);
+}
+
 BENCHMARK(BM_EvalManyBuiltinsMatchSameRegex);
 
+static std::string literal(std::string_view s)
+{
+    std::ostringstream str;
+    printLiteralString(str, s);
+    return str.str();
+}
+
+/**
+ * An expression that applies `builtins.<fun>` with `re` 100 times to a
+ * string made of `prefix`, `length` copies of `fill`, and `suffix`.
+ */
+static std::string longInputExpr(
+    std::string_view fun,
+    std::string_view re,
+    std::string_view prefix,
+    std::string_view fill,
+    std::string_view suffix,
+    int64_t length)
+{
+    return fmt(
+        "let s = %s + builtins.concatStringsSep \"\" (builtins.genList (_: %s) %d) + %s; "
+        "in builtins.length (builtins.filter (r: r != null) (builtins.genList (_: builtins.%s %s s) 100))",
+        literal(prefix),
+        literal(fill),
+        length,
+        literal(suffix),
+        fun,
+        literal(re));
+}
+
+/* Regular expressions that Nixpkgs applies to file names, versions and
+   URLs, on increasingly long inputs. */
+
+static void BM_EvalBuiltinsMatchFileName(benchmark::State & state)
+{
+    runEvalBenchmark(
+        state, longInputExpr("match", "((.*)/)?([^/]*)\\.(nix|cc)", "/nix/store/", "pkgs/", "default.nix", state.range(0)), 100);
+}
+
+BENCHMARK(BM_EvalBuiltinsMatchFileName)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_EvalBuiltinsMatchVersion(benchmark::State & state)
+{
+    runEvalBenchmark(
+        state, longInputExpr("match", "^([0-9][0-9\\.]*)(.*)$", "1.2.", "3.", "pre-git", state.range(0)), 100);
+}
+
+BENCHMARK(BM_EvalBuiltinsMatchVersion)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_EvalBuiltinsMatchMirrorUrl(benchmark::State & state)
+{
+    runEvalBenchmark(
+        state, longInputExpr("match", "mirror://([a-z]+)/(.*)", "mirror://gnu/", "hello/", "hello.tar.gz", state.range(0)), 100);
+}
+
+BENCHMARK(BM_EvalBuiltinsMatchMirrorUrl)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_EvalBuiltinsMatchAmbiguous(benchmark::State & state)
+{
+    /* Takes exponential time with a backtracking matcher. */
+    runEvalBenchmark(state, longInputExpr("match", "(a|aa)*b", "", "a", "", state.range(0)), 100);
+}
+
+BENCHMARK(BM_EvalBuiltinsMatchAmbiguous)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_EvalBuiltinsSplitStorePathName(benchmark::State & state)
+{
+    runEvalBenchmark(
+        state,
+        longInputExpr("split", "[[:alnum:]+_?=-][[:alnum:]+._?=-]*", "", "hello-2.12.1 ", "", state.range(0)),
+        100);
+}
+
+BENCHMARK(BM_EvalBuiltinsSplitStorePathName)->Arg(16)->Arg(256)->Arg(4096);
+
 } // namespace nix
@@ -0,0 +1,74 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+namespace nix {
+
+/**
+ * Expressions that each do `n` lookups of the kinds that dominate
+ * evaluating Nixpkgs. `n` is bound by the benchmark.
+ *
+ * These only depend on the language, so they can be run against
+ * evaluators without the attribute lookup caches to compare (see
+ * "Comparing Two Commits" in the benchmarking guide).
+ */
+static constexpr std::string_view shapedSelect = R"(
+    let mk = i: { name = "a"; value = i; meta = { priority = i; }; };
+    in builtins.foldl' (acc: i: acc + (mk i).meta.priority) 0 (builtins.genList (x: x) n)
+)";
+
+static constexpr std::string_view layeredSelect = R"(
+    let mk = i: { name = "a"; } // { value = i; meta = { priority = i; }; };
+    in builtins.foldl' (acc: i: acc + (mk i).meta.priority) 0 (builtins.genList (x: x) n)
+)";
+
+static constexpr std::string_view varSelect = R"(
+    let
+      pkgs = { lib = { x = 1; y = 2; }; self = pkgs; };
+    in builtins.foldl' (acc: i: acc + pkgs.lib.x + pkgs.self.lib.y) 0 (builtins.genList (x: x) n)
+)";
+
+static constexpr std::string_view withLookup = R"(
+    let lib = { a = 1; b = 2; };
+    in builtins.foldl' (acc: i: with lib; with { c = i; }; acc + a + b + c) 0 (builtins.genList (x: x) n)
+)";
+
+static void BM_EvalSelect(benchmark::State & state, std::string_view body)
+{
+    const auto n = static_cast<size_t>(state.range(0));
+    const auto exprStr = "let n = " + std::to_string(n) + "; in " + std::string(body);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+
+        auto store = openStore("dummy://");
+        fetchers::Settings fetchSettings{};
+        bool readOnlyMode = true;
+        EvalSettings evalSettings{readOnlyMode};
+        evalSettings.nixPath = {};
+
+        auto stPtr = std::make_shared<EvalState>(LookupPath{}, store, fetchSettings, evalSettings, nullptr);
+        auto & st = *stPtr;
+        Expr * expr = st.parseExprFromString(exprStr, st.rootPath(CanonPath::root));
+
+        Value v;
+
+        state.ResumeTiming();
+
+        st.eval(expr, v);
+        st.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v);
+    }
+
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK_CAPTURE(BM_EvalSelect, shaped, shapedSelect)->Arg(100'000);
+BENCHMARK_CAPTURE(BM_EvalSelect, layered, layeredSelect)->Arg(100'000);
+BENCHMARK_CAPTURE(BM_EvalSelect, var, varSelect)->Arg(100'000);
+BENCHMARK_CAPTURE(BM_EvalSelect, with, withLookup)->Arg(100'000);
+
+} // namespace nix
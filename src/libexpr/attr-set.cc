@@ -1,12 +1,53 @@
 #include "nix/expr/attr-set.hh"
 #include "nix/expr/eval-inline.hh"
 
+#include <boost/unordered/concurrent_flat_map.hpp>
+
 #include <algorithm>
 
 namespace nix {
 
 Bindings Bindings::emptyBindings;
 
+/**
+ * The shapes of all attribute sets, keyed by the IDs of their
+ * attribute names. Shapes only depend on symbols, so all evaluators in
+ * a process can share them.
+ */
+static boost::concurrent_flat_map<std::vector<uint32_t>, Bindings::Shape, boost::hash<std::vector<uint32_t>>> shapes;
+
+static constexpr Bindings::Shape maxShape = (1 << 28) - 1;
+
+static std::atomic<Bindings::Shape> nextShape{1};
+
+Bindings::Shape Bindings::internShape(std::span<const Symbol> names)
+{
+    std::vector<uint32_t> key;
+    key.reserve(names.size());
+    for (auto name : names)
+        key.push_back(name.getId());
+
+    Shape shape = 0;
+    if (shapes.visit(key, [&](auto & i) { shape = i.second; }))
+        return shape;
+
+    if (nextShape.load(std::memory_order_relaxed) > maxShape)
+        return 0;
+
+    /* If another thread adds the same key first, this shape is simply
+       never used. */
+    shape = nextShape++;
+    if (shape > maxShape)
+        return 0;
+    shapes.try_emplace_or_visit(std::move(key), shape, [&](auto & i) { shape = i.second; });
+    return shape;
+}
+
+size_t Bindings::shapeCount()
+{
+    return shapes.size();
+}
+
 /* Allocate a new array of attributes for an attribute set with a specific
    capacity. The space is implicitly reserved after the Bindings
    structure. */
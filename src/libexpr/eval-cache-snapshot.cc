@@ -0,0 +1,315 @@
+#include "nix/expr/eval-cache-snapshot.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/file-system-at.hh"
+#include "nix/util/serialise.hh"
+
+#include <cstring>
+#include <unordered_map>
+
+#ifndef _WIN32
+#  include <sys/mman.h>
+#endif
+
+namespace nix::eval_cache {
+
+static constexpr std::string_view snapshotMagic = "nixevc7\n";
+
+namespace {
+
+struct Header
+{
+    char magic[8];
+    uint32_t nodeCount;
+    uint32_t stringCount;
+    uint64_t stringBytes;
+    uint64_t reserved;
+};
+
+static_assert(sizeof(Header) == 32);
+
+size_t padTo8(size_t n)
+{
+    return (n + 7) & ~size_t(7);
+}
+
+/**
+ * The offsets of the columns in a snapshot file.
+ */
+struct Layout
+{
+    size_t parents, names, firstChildren, childCounts, types, values, stringOffsets, stringData, end;
+
+    Layout(uint32_t nodeCount, uint32_t stringCount, uint64_t stringBytes)
+    {
+        parents = sizeof(Header);
+        names = parents + 4 * size_t(nodeCount);
+        firstChildren = names + 4 * size_t(nodeCount);
+        childCounts = firstChildren + 4 * size_t(nodeCount);
+        types = childCounts + 4 * size_t(nodeCount);
+        values = padTo8(types + nodeCount);
+        stringOffsets = values + 8 * size_t(nodeCount);
+        stringData = stringOffsets + 8 * (size_t(stringCount) + 1);
+        end = stringData + stringBytes;
+    }
+};
+
+} // namespace
+
+AttrSnapshot::Builder::Node & AttrSnapshot::Builder::child(Node & parent, std::string_view name)
+{
+    auto i = parent.children.find(name);
+    if (i != parent.children.end())
+        return *i->second;
+    auto & node = nodes.emplace_back();
+    parent.children.emplace(name, &node);
+    return node;
+}
+
+AttrSnapshot::~AttrSnapshot()
+{
+#ifndef _WIN32
+    if (mapping)
+        munmap(mapping, mappingSize);
+#endif
+}
+
+std::unique_ptr<AttrSnapshot> AttrSnapshot::open(const std::filesystem::path & path)
+{
+    std::unique_ptr<AttrSnapshot> snapshot(new AttrSnapshot);
+
+#ifndef _WIN32
+    AutoCloseFD fd = openFileReadonly(path);
+    if (!fd)
+        throw NativeSysError("opening %s", PathFmt(path));
+
+    auto size = nix::fstat(fd.get()).st_size;
+    if (size < (off_t) sizeof(Header))
+        throw SerialisationError("evaluation cache %s is truncated", PathFmt(path));
+
+    auto p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+    if (p == MAP_FAILED)
+        throw SysError("mapping %s", PathFmt(path));
+    snapshot->mapping = p;
+    snapshot->mappingSize = size;
+
+    snapshot->parse(std::string_view(static_cast<const char *>(p), size));
+#else
+    snapshot->buffer = readFile(path);
+    snapshot->parse(snapshot->buffer);
+#endif
+
+    return snapshot;
+}
+
+void AttrSnapshot::parse(std::string_view data)
+{
+    if (data.size() < sizeof(Header))
+        throw SerialisationError("evaluation cache is truncated");
+
+    Header header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::string_view(header.magic, sizeof(header.magic)) != snapshotMagic)
+        throw SerialisationError("evaluation cache has an unsupported format");
+
+    if (header.nodeCount == 0)
+        throw SerialisationError("evaluation cache has no root");
+
+    Layout layout(header.nodeCount, header.stringCount, header.stringBytes);
+    if (layout.end != data.size())
+        throw SerialisationError("evaluation cache has the wrong size");
+
+    nodeCount = header.nodeCount;
+    stringCount = header.stringCount;
+
+    auto base = data.data();
+    parents = reinterpret_cast<const uint32_t *>(base + layout.parents);
+    names = reinterpret_cast<const uint32_t *>(base + layout.names);
+    firstChildren = reinterpret_cast<const uint32_t *>(base + layout.firstChildren);
+    childCounts = reinterpret_cast<const uint32_t *>(base + layout.childCounts);
+    types = reinterpret_cast<const uint8_t *>(base + layout.types);
+    values = reinterpret_cast<const uint64_t *>(base + layout.values);
+    stringOffsets = reinterpret_cast<const uint64_t *>(base + layout.stringOffsets);
+    stringData = base + layout.stringData;
+
+    /* Check all indices up front, so that lookups don't have to. */
+    for (uint32_t i = 0; i < stringCount; ++i)
+        if (stringOffsets[i] > stringOffsets[i + 1])
+            throw SerialisationError("evaluation cache has a bad string table");
+    if (stringOffsets[0] != 0 || stringOffsets[stringCount] != header.stringBytes)
+        throw SerialisationError("evaluation cache has a bad string table");
+
+    auto checkString = [&](uint32_t i) {
+        if (i >= stringCount)
+            throw SerialisationError("evaluation cache has a bad string reference");
+    };
+
+    for (NodeId i = 0; i < nodeCount; ++i) {
+        if (parents[i] >= nodeCount || (i > 0 && parents[i] >= i)
+            || uint64_t(firstChildren[i]) + childCounts[i] > nodeCount
+            || (childCounts[i] > 0 && firstChildren[i] <= i))
+            throw SerialisationError("evaluation cache has a bad node %d", i);
+        checkString(names[i]);
+        switch (type(i)) {
+        case AttrType::String:
+            if (auto context = uint32_t(values[i] >> 32); context != noString)
+                checkString(context);
+            [[fallthrough]];
+        case AttrType::ListOfStrings:
+            checkString(uint32_t(values[i]));
+            break;
+        case AttrType::Placeholder:
+        case AttrType::FullAttrs:
+        case AttrType::Missing:
+        case AttrType::Misc:
+        case AttrType::Failed:
+        case AttrType::Bool:
+        case AttrType::Int:
+            break;
+        default:
+            throw SerialisationError("evaluation cache has a node with unknown type %d", types[i]);
+        }
+    }
+}
+
+std::optional<AttrSnapshot::NodeId> AttrSnapshot::lookup(NodeId parent, std::string_view name) const
+{
+    auto [first, count] = children(parent);
+    auto lo = first, hi = first + count;
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+        auto cmp = this->name(mid).compare(name);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return std::nullopt;
+}
+
+void AttrSnapshot::read(Builder & builder) const
+{
+    std::vector<Builder::Node *> nodes(nodeCount, nullptr);
+    nodes[0] = &builder.root();
+
+    /* Parents come before their children. */
+    for (NodeId i = 1; i < nodeCount; ++i) {
+        auto parent = nodes[parents[i]];
+        if (!parent)
+            continue;
+        auto & node = builder.child(*parent, name(i));
+        node.type = type(i);
+        switch (node.type) {
+        case AttrType::String:
+            if (auto context = contextValue(i))
+                node.context = std::string(*context);
+            [[fallthrough]];
+        case AttrType::ListOfStrings:
+            node.string = stringValue(i);
+            break;
+        case AttrType::Bool:
+        case AttrType::Int:
+            node.number = numberValue(i);
+            break;
+        case AttrType::Placeholder:
+        case AttrType::FullAttrs:
+        case AttrType::Missing:
+        case AttrType::Misc:
+        case AttrType::Failed:
+            break;
+        }
+        nodes[i] = &node;
+    }
+}
+
+void AttrSnapshot::write(const std::filesystem::path & path, Builder & builder)
+{
+    std::vector<uint32_t> parents, names, firstChildren, childCounts;
+    std::vector<uint8_t> types;
+    std::vector<uint64_t> values;
+
+    std::unordered_map<std::string_view, uint32_t> stringIds;
+    std::vector<uint64_t> stringOffsets{0};
+    std::string stringData;
+
+    auto intern = [&](std::string_view s) -> uint32_t {
+        auto [i, inserted] = stringIds.try_emplace(s, stringIds.size());
+        if (inserted) {
+            stringData.append(s);
+            stringOffsets.push_back(stringData.size());
+        }
+        return i->second;
+    };
+
+    /* Number the nodes in breadth-first order, so that the children
+       of each node are contiguous. */
+    std::vector<const Builder::Node *> order{&builder.root()};
+    parents.push_back(0);
+    names.push_back(intern(""));
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        auto & node = *order[i];
+
+        if (order.size() + node.children.size() > UINT32_MAX)
+            throw Error("evaluation cache is too large");
+
+        firstChildren.push_back(node.children.size() ? order.size() : 0);
+        childCounts.push_back(node.children.size());
+        for (auto & [name, child] : node.children) {
+            order.push_back(child);
+            parents.push_back(i);
+            names.push_back(intern(name));
+        }
+
+        types.push_back(node.type);
+        switch (node.type) {
+        case AttrType::String:
+        case AttrType::ListOfStrings:
+            values.push_back(
+                intern(node.string) | (uint64_t(node.context ? intern(*node.context) : noString) << 32));
+            break;
+        case AttrType::Bool:
+        case AttrType::Int:
+            values.push_back(uint64_t(node.number));
+            break;
+        case AttrType::Placeholder:
+        case AttrType::FullAttrs:
+        case AttrType::Missing:
+        case AttrType::Misc:
+        case AttrType::Failed:
+            values.push_back(0);
+            break;
+        }
+    }
+
+    Header header{
+        .nodeCount = uint32_t(order.size()),
+        .stringCount = uint32_t(stringIds.size()),
+        .stringBytes = stringData.size(),
+        .reserved = 0,
+    };
+    std::memcpy(header.magic, snapshotMagic.data(), sizeof(header.magic));
+
+    Layout layout(header.nodeCount, header.stringCount, header.stringBytes);
+
+    std::string data(layout.end, '\0');
+    auto put = [&](size_t offset, const auto & column) {
+        std::memcpy(data.data() + offset, column.data(), column.size() * sizeof(column[0]));
+    };
+    std::memcpy(data.data(), &header, sizeof(header));
+    put(layout.parents, parents);
+    put(layout.names, names);
+    put(layout.firstChildren, firstChildren);
+    put(layout.childCounts, childCounts);
+    put(layout.types, types);
+    put(layout.values, values);
+    put(layout.stringOffsets, stringOffsets);
+    put(layout.stringData, stringData);
+
+    auto tmpPath = makeTempPath(path.parent_path(), ".tmp");
+    writeFile(tmpPath, data);
+    std::filesystem::rename(tmpPath, path);
+}
+
+} // namespace nix::eval_cache
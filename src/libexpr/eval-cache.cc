@@ -1,5 +1,6 @@
 #include "nix/util/users.hh"
 #include "nix/expr/eval-cache.hh"
+#include "nix/expr/eval-cache-snapshot.hh"
 #include "nix/store/sqlite.hh"
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-inline.hh"
@@ -32,259 +33,342 @@ void CachedEvalError::force()
         state, "evaluation of cached failed attribute '%s' unexpectedly succeeded", cursor->getAttrPathStr(attr));
 }
 
+/* The snapshots themselves are files; SQLite only records which
+   snapshot is current for each fingerprint, so that concurrent
+   writers don't lose each other's updates. */
 static const char * schema = R"sql(
-create table if not exists Attributes (
-    parent      integer not null,
-    name        text,
-    type        integer not null,
-    value       text,
-    context     text,
-    primary key (parent, name)
+create table if not exists Snapshots (
+    fingerprint text primary key not null,
+    name        text not null
 );
 )sql";
 
+/**
+ * The evaluation cache for one fingerprint. Lookups go to the
+ * immutable `AttrSnapshot` written by earlier evaluations, and new
+ * attributes are kept in memory until they are merged into a new
+ * snapshot when the cache is closed.
+ *
+ * `AttrId`s below `firstRowId` are snapshot nodes, the others index
+ * `rows`.
+ */
 struct AttrDb
 {
-    std::atomic_bool failed{false};
-
     const StoreDirConfig & cfg;
 
+    /**
+     * An attribute that was set during this evaluation.
+     */
+    struct Row
+    {
+        AttrKey key;
+        AttrType type;
+        std::string string;
+        std::optional<std::string> context;
+        int64_t number = 0;
+        std::vector<Symbol> attrs;
+    };
+
     struct State
     {
         SQLite db;
-        SQLiteStmt insertAttribute;
-        SQLiteStmt insertAttributeWithContext;
-        SQLiteStmt queryAttribute;
-        SQLiteStmt queryAttributes;
-        std::unique_ptr<SQLiteTxn> txn;
+        SQLiteStmt querySnapshot;
+        SQLiteStmt setSnapshot;
+        /**
+         * The file name of `snapshot`, or empty if there is none.
+         */
+        std::string snapshotName;
+        std::unique_ptr<AttrSnapshot> snapshot;
+        AttrId firstRowId = 1;
+        std::vector<Row> rows;
+        /**
+         * The most recent row for each key.
+         */
+        std::map<AttrKey, AttrId> latest;
     };
 
     std::unique_ptr<Sync<State>> _state;
 
     SymbolTable & symbols;
 
+    std::filesystem::path cacheDir;
+
+    std::string fingerprint;
+
     AttrDb(const StoreDirConfig & cfg, const Hash & fingerprint, SymbolTable & symbols)
         : cfg(cfg)
         , _state(std::make_unique<Sync<State>>())
         , symbols(symbols)
+        , cacheDir(getCacheDir() / "eval-cache-v7")
+        , fingerprint(fingerprint.to_string(HashFormat::Base16, false))
     {
         auto state(_state->lock());
 
-        auto cacheDir = getCacheDir() / "eval-cache-v6";
         createDirs(cacheDir);
 
-        auto dbPath = cacheDir / (fingerprint.to_string(HashFormat::Base16, false) + ".sqlite");
-
-        state->db = SQLite(dbPath, {.useWAL = settings.useSQLiteWAL});
+        state->db = SQLite(cacheDir / "index.sqlite", {.useWAL = settings.useSQLiteWAL});
         state->db.isCache();
         state->db.exec(schema);
 
-        state->insertAttribute.create(
-            state->db, "insert or replace into Attributes(parent, name, type, value) values (?, ?, ?, ?)");
-
-        state->insertAttributeWithContext.create(
-            state->db, "insert or replace into Attributes(parent, name, type, value, context) values (?, ?, ?, ?, ?)");
+        state->querySnapshot.create(state->db, "select name from Snapshots where fingerprint = ?");
 
-        state->queryAttribute.create(
-            state->db, "select rowid, type, value, context from Attributes where parent = ? and name = ?");
+        state->setSnapshot.create(state->db, "insert or replace into Snapshots(fingerprint, name) values (?, ?)");
 
-        state->queryAttributes.create(state->db, "select name from Attributes where parent = ?");
-
-        state->txn = std::make_unique<SQLiteTxn>(state->db);
+        state->snapshotName = querySnapshot(*state);
+        if (!state->snapshotName.empty()) {
+            try {
+                state->snapshot = AttrSnapshot::open(cacheDir / state->snapshotName);
+                state->firstRowId = state->snapshot->size();
+            } catch (Error & e) {
+                debug("ignoring evaluation cache: %s", e.msg());
+            }
+        }
     }
 
     ~AttrDb()
     {
         try {
-            auto state(_state->lock());
-            if (!failed && state->txn->active)
-                state->txn->commit();
-            state->txn.reset();
+            commit();
         } catch (...) {
             ignoreExceptionInDestructor();
         }
     }
 
-    template<typename F>
-    AttrId doSQLite(const F & fun)
+    std::string querySnapshot(State & state)
     {
-        if (failed)
-            return 0;
-        try {
-            return fun();
-        } catch (SQLiteError &) {
-            ignoreExceptionExceptInterrupt();
-            failed = true;
-            return 0;
-        }
+        auto query(state.querySnapshot.use()(fingerprint));
+        return query.next() ? query.getStr(0) : "";
     }
 
-    AttrId setAttrs(AttrKey key, const std::vector<Symbol> & attrs)
+    /**
+     * Merge the new rows into the latest snapshot, which may have been
+     * written by another process since we opened ours.
+     */
+    void commit()
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::FullAttrs) (0, false).exec();
+        auto state(_state->lock());
 
-            AttrId rowId = state->db.getLastInsertedRowId();
-            assert(rowId);
+        if (state->rows.empty())
+            return;
 
-            for (auto & attr : attrs)
-                state->insertAttribute.use()(rowId)(symbols[attr])(AttrType::Placeholder) (0, false).exec();
+        while (true) {
+            auto current = retrySQLite<std::string>([&]() { return querySnapshot(*state); });
 
-            return rowId;
-        });
-    }
+            AttrSnapshot::Builder builder;
+            if (current == state->snapshotName) {
+                if (state->snapshot)
+                    state->snapshot->read(builder);
+            } else {
+                try {
+                    AttrSnapshot::open(cacheDir / current)->read(builder);
+                } catch (Error & e) {
+                    debug("ignoring evaluation cache: %s", e.msg());
+                }
+            }
 
-    AttrId setString(AttrKey key, std::string_view s, const Value::StringWithContext::Context * context = nullptr)
-    {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            if (context) {
-                std::string ctx;
-                bool first = true;
-                for (auto * elem : *context) {
-                    if (!first)
-                        ctx.push_back(' ');
-                    ctx.append(elem->view());
-                    first = false;
+            /* Map our IDs to nodes in the new tree. Snapshot nodes are
+               matched by attribute path. */
+            std::unordered_map<AttrId, AttrSnapshot::Builder::Node *> nodes;
+            nodes.emplace(0, &builder.root());
+
+            auto resolve = [&](this const auto & resolve, AttrId id) -> AttrSnapshot::Builder::Node & {
+                auto i = nodes.find(id);
+                if (i != nodes.end())
+                    return *i->second;
+                assert(state->snapshot && id < state->firstRowId);
+                auto & node = builder.child(
+                    resolve(state->snapshot->parent(id)), state->snapshot->name(AttrSnapshot::NodeId(id)));
+                nodes.emplace(id, &node);
+                return node;
+            };
+
+            for (auto [i, row] : enumerate(state->rows)) {
+                auto & node = builder.child(resolve(row.key.first), symbols[row.key.second]);
+                node.type = row.type;
+                node.string = row.string;
+                node.context = row.context;
+                node.number = row.number;
+                if (row.type == AttrType::FullAttrs) {
+                    /* Like `insert or replace`, this forgets about
+                       children that no longer exist. */
+                    std::set<std::string_view> names;
+                    for (auto & attr : row.attrs)
+                        names.insert(symbols[attr]);
+                    std::erase_if(node.children, [&](auto & child) { return !names.contains(child.first); });
                 }
-                state->insertAttributeWithContext.use()(key.first)(symbols[key.second])(AttrType::String) (s) (ctx)
-                    .exec();
-            } else {
-                state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::String) (s).exec();
+                nodes.insert_or_assign(state->firstRowId + i, &node);
             }
 
-            return state->db.getLastInsertedRowId();
-        });
+            /* Every writer uses a file of its own, so that concurrent
+               writers can't overwrite each other's snapshots. */
+            auto newName = makeTempPath(cacheDir, fingerprint).filename().string() + ".attrs";
+            AttrSnapshot::write(cacheDir / newName, builder);
+            AutoDelete delNew(cacheDir / newName, false);
+
+            /* Publish it, unless another process published a
+               snapshot in the meantime, in which case we have to
+               merge with that one. */
+            bool published = retrySQLite<bool>([&]() {
+                SQLiteTxn txn(state->db);
+                if (querySnapshot(*state) != current)
+                    return false;
+                state->setSnapshot.use()(fingerprint)(newName).exec();
+                txn.commit();
+                return true;
+            });
+            if (!published)
+                continue;
+            delNew.cancel();
+
+            for (auto & old : {current, state->snapshotName})
+                if (!old.empty())
+                    std::filesystem::remove(cacheDir / old);
+
+            return;
+        }
     }
 
-    AttrId setBool(AttrKey key, bool b)
+    AttrId addRow(Row && row)
+    {
+        auto state(_state->lock());
+        AttrId rowId = state->firstRowId + state->rows.size();
+        state->latest.insert_or_assign(row.key, rowId);
+        state->rows.push_back(std::move(row));
+        return rowId;
+    }
+
+    AttrId setAttrs(AttrKey key, const std::vector<Symbol> & attrs)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
+        auto rowId = addRow({.key = key, .type = AttrType::FullAttrs, .attrs = attrs});
 
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Bool) (b ? 1 : 0).exec();
+        for (auto & attr : attrs)
+            addRow({.key = {rowId, attr}, .type = AttrType::Placeholder});
 
-            return state->db.getLastInsertedRowId();
-        });
+        return rowId;
     }
 
-    AttrId setInt(AttrKey key, int n)
+    AttrId setString(AttrKey key, std::string_view s, const Value::StringWithContext::Context * context = nullptr)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
+        std::optional<std::string> ctx;
+        if (context) {
+            ctx.emplace();
+            bool first = true;
+            for (auto * elem : *context) {
+                if (!first)
+                    ctx->push_back(' ');
+                ctx->append(elem->view());
+                first = false;
+            }
+        }
+        return addRow({.key = key, .type = AttrType::String, .string = std::string(s), .context = std::move(ctx)});
+    }
 
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Int) (n).exec();
+    AttrId setBool(AttrKey key, bool b)
+    {
+        return addRow({.key = key, .type = AttrType::Bool, .number = b ? 1 : 0});
+    }
 
-            return state->db.getLastInsertedRowId();
-        });
+    AttrId setInt(AttrKey key, int n)
+    {
+        return addRow({.key = key, .type = AttrType::Int, .number = n});
     }
 
     AttrId setListOfStrings(AttrKey key, const std::vector<std::string> & l)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute
-                .use()(key.first)(symbols[key.second])(
-                    AttrType::ListOfStrings) (dropEmptyInitThenConcatStringsSep("\t", l))
-                .exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow(
+            {.key = key, .type = AttrType::ListOfStrings, .string = dropEmptyInitThenConcatStringsSep("\t", l)});
     }
 
     AttrId setPlaceholder(AttrKey key)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Placeholder) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow({.key = key, .type = AttrType::Placeholder});
     }
 
     AttrId setMissing(AttrKey key)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Missing) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow({.key = key, .type = AttrType::Missing});
     }
 
     AttrId setMisc(AttrKey key)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Misc) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow({.key = key, .type = AttrType::Misc});
     }
 
     AttrId setFailed(AttrKey key)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Failed) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow({.key = key, .type = AttrType::Failed});
     }
 
-    std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key)
+    static AttrValue decode(AttrType type, std::string_view string, std::optional<std::string_view> context, int64_t number)
     {
-        auto state(_state->lock());
-
-        auto queryAttribute(state->queryAttribute.use()(key.first)(symbols[key.second]));
-        if (!queryAttribute.next())
-            return {};
-
-        auto rowId = (AttrId) queryAttribute.getInt(0);
-        auto type = (AttrType) queryAttribute.getInt(1);
-
         switch (type) {
         case AttrType::Placeholder:
-            return {{rowId, placeholder_t()}};
-        case AttrType::FullAttrs: {
-            // FIXME: expensive, should separate this out.
-            std::vector<Symbol> attrs;
-            auto queryAttributes(state->queryAttributes.use()(rowId));
-            while (queryAttributes.next())
-                attrs.emplace_back(symbols.create(queryAttributes.getStr(0)));
-            return {{rowId, attrs}};
-        }
+            return placeholder_t();
         case AttrType::String: {
-            NixStringContext context;
-            if (!queryAttribute.isNull(3))
-                for (auto & s : tokenizeString<std::vector<std::string>>(queryAttribute.getStr(3), " "))
-                    context.insert(NixStringContextElem::parse(s));
-            return {{rowId, string_t{queryAttribute.getStr(2), context}}};
+            NixStringContext ctx;
+            if (context)
+                for (auto & s : tokenizeString<std::vector<std::string>>(*context, " "))
+                    ctx.insert(NixStringContextElem::parse(s));
+            return string_t{std::string(string), ctx};
         }
         case AttrType::Bool:
-            return {{rowId, queryAttribute.getInt(2) != 0}};
+            return number != 0;
         case AttrType::Int:
-            return {{rowId, int_t{NixInt{queryAttribute.getInt(2)}}}};
+            return int_t{NixInt{number}};
         case AttrType::ListOfStrings:
-            return {{rowId, tokenizeString<std::vector<std::string>>(queryAttribute.getStr(2), "\t")}};
+            return tokenizeString<std::vector<std::string>>(string, "\t");
         case AttrType::Missing:
-            return {{rowId, missing_t()}};
+            return missing_t();
         case AttrType::Misc:
-            return {{rowId, misc_t()}};
+            return misc_t();
         case AttrType::Failed:
-            return {{rowId, failed_t()}};
+            return failed_t();
+        case AttrType::FullAttrs:
+            /* The callers handle this, since they know the children. */
+            unreachable();
         default:
             throw Error("unexpected type in evaluation cache");
         }
     }
+
+    std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key)
+    {
+        auto state(_state->lock());
+
+        if (auto i = state->latest.find(key); i != state->latest.end()) {
+            auto & row = state->rows[i->second - state->firstRowId];
+            if (row.type == AttrType::FullAttrs)
+                return {{i->second, row.attrs}};
+            return {{i->second, decode(row.type, row.string, row.context, row.number)}};
+        }
+
+        if (!state->snapshot || key.first >= state->firstRowId)
+            return {};
+
+        auto & snapshot = *state->snapshot;
+        auto node = snapshot.lookup(key.first, symbols[key.second]);
+        if (!node)
+            return {};
+
+        auto type = snapshot.type(*node);
+
+        if (type == AttrType::FullAttrs) {
+            std::vector<Symbol> attrs;
+            auto [first, count] = snapshot.children(*node);
+            attrs.reserve(count);
+            for (auto child = first; child < first + count; ++child)
+                attrs.push_back(symbols.create(snapshot.name(child)));
+            return {{*node, attrs}};
+        }
+
+        return {
+            {*node,
+             decode(
+                 type,
+                 type == AttrType::String || type == AttrType::ListOfStrings ? snapshot.stringValue(*node) : "",
+                 type == AttrType::String ? snapshot.contextValue(*node) : std::nullopt,
+                 snapshot.numberValue(*node))}};
+    }
 };
 
 static std::shared_ptr<AttrDb> makeAttrDb(const StoreDirConfig & cfg, const Hash & fingerprint, SymbolTable & symbols)
@@ -333,6 +417,7 @@ AttrKey AttrCursor::getKey()
 {
     if (!parent)
         return {0, root->state.s.epsilon};
+    std::lock_guard lock(parent->first->lazyMutex);
     if (!parent->first->cachedValue) {
         parent->first->cachedValue = root->db->getAttr(parent->first->getKey());
         assert(parent->first->cachedValue);
@@ -342,6 +427,7 @@ AttrKey AttrCursor::getKey()
 
 Value & AttrCursor::getValue()
 {
+    std::lock_guard lock(lazyMutex);
     if (!_value) {
         if (parent) {
             auto & vParent = parent->first->getValue();
@@ -6,6 +6,8 @@
 
 #include "expr-config-private.hh"
 
+#include <atomic>
+
 #if NIX_USE_BOEHMGC
 
 #  include <pthread.h>
@@ -44,6 +46,31 @@ static void * oomHandler(size_t requested)
     throw std::bad_alloc();
 }
 
+static std::atomic<uint64_t> gcPauses{0};
+static std::atomic<uint64_t> gcPauseTotalNs{0};
+static std::atomic<uint64_t> gcPauseMaxNs{0};
+
+/* Called by the collector, with the allocation lock held, around each
+   phase of a collection. The world is stopped from
+   `GC_EVENT_PRE_STOP_WORLD` until `GC_EVENT_POST_START_WORLD`; in
+   incremental mode that happens once per increment rather than once
+   per collection. */
+static void onCollectionEvent(GC_EventType event)
+{
+    static std::chrono::steady_clock::time_point stopped;
+
+    if (event == GC_EVENT_PRE_STOP_WORLD)
+        stopped = std::chrono::steady_clock::now();
+    else if (event == GC_EVENT_POST_START_WORLD) {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - stopped)
+                          .count();
+        gcPauses.fetch_add(1, std::memory_order_relaxed);
+        gcPauseTotalNs.fetch_add(ns, std::memory_order_relaxed);
+        if (ns > gcPauseMaxNs.load(std::memory_order_relaxed))
+            gcPauseMaxNs.store(ns, std::memory_order_relaxed);
+    }
+}
+
 static inline void initGCReal()
 {
     /* Initialise the Boehm garbage collector. */
@@ -74,6 +101,8 @@ static inline void initGCReal()
 
     GC_set_oom_fn(oomHandler);
 
+    GC_set_on_collection_event(onCollectionEvent);
+
     /* Set the initial heap size to something fairly big (25% of
        physical RAM, up to a maximum of 384 MiB) so that in most cases
        we don't need to garbage collect at all.  (Collection has a
@@ -107,6 +136,34 @@ size_t getGCCycles()
     return static_cast<size_t>(GC_get_gc_no()) - gcCyclesAfterInit;
 }
 
+void enableIncrementalGC()
+{
+    assertGCInitialized();
+
+    /* The collector finds the objects that were modified since the
+       last collection through the dirty bits of the pages they are on
+       (soft-dirty bits or mprotect()), so mutating a `Value` in place,
+       e.g. when `forceValue()` overwrites a thunk with its result,
+       doesn't need an explicit write barrier. Boehm's manual mode,
+       where every pointer store into the heap must be followed by
+       `GC_end_stubborn_change()`, is not enabled because attribute
+       sets, lists and environments are filled in after allocation
+       without one. */
+    if (!GC_is_incremental_mode()) {
+        debug("enabling incremental garbage collection");
+        GC_enable_incremental();
+    }
+}
+
+GCPauseStats getGCPauseStats()
+{
+    return {
+        .count = gcPauses.load(std::memory_order_relaxed),
+        .total = std::chrono::nanoseconds(gcPauseTotalNs.load(std::memory_order_relaxed)),
+        .max = std::chrono::nanoseconds(gcPauseMaxNs.load(std::memory_order_relaxed)),
+    };
+}
+
 #endif
 
 static bool gcInitialised = false;
@@ -3,6 +3,24 @@
 #include "nix/expr/eval.hh"
 #include "nix/util/lru-cache.hh"
 
+#include <condition_variable>
+#include <thread>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#  include <signal.h>
+#  include <sys/time.h>
+#endif
+
+#ifdef __linux__
+#  include <time.h>
+#  include <unistd.h>
+/* Older glibc doesn't define this. */
+#  ifndef sigev_notify_thread_id
+#    define sigev_notify_thread_id _sigev_un._tid
+#  endif
+#endif
+
 namespace nix {
 
 void EvalProfiler::preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) {}
@@ -43,6 +61,48 @@ void MultiEvalProfiler::addProfiler(ref<EvalProfiler> profiler)
     invalidateNeededHooks();
 }
 
+ShadowStack::ShadowStack(size_t capacity)
+    : frames(std::make_unique<Frame[]>(capacity))
+    , capacity(capacity)
+{
+}
+
+void ShadowStack::push(const Value & fun, PosIdx pos)
+{
+    auto d = depth.load(std::memory_order_relaxed);
+    if (d < capacity) {
+        auto & frame = frames[d];
+        frame.pos = pos;
+        /* Don't force anything or hold on to values, just record what
+           is needed to symbolize the frame later. */
+        if (fun.isLambda()) {
+            frame.kind = Kind::Lambda;
+            frame.lambda = fun.lambda().fun;
+        } else if (fun.isPrimOp()) {
+            frame.kind = Kind::PrimOp;
+            frame.primOp = fun.primOp();
+        } else if (fun.isPrimOpApp()) {
+            frame.kind = Kind::PrimOp;
+            frame.primOp = fun.primOpAppPrimOp();
+        } else if (fun.type() == nAttrs)
+            frame.kind = Kind::Functor;
+        else
+            frame.kind = Kind::Other;
+    }
+    /* The frame must be complete before a signal handler can see it. */
+    std::atomic_signal_fence(std::memory_order_release);
+    depth.store(d + 1, std::memory_order_relaxed);
+}
+
+std::span<ShadowStack::Frame> ShadowStack::snapshot(std::span<Frame> out) const
+{
+    auto top = std::min(depth.load(std::memory_order_relaxed), capacity);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    auto n = std::min(top, out.size());
+    std::copy(&frames[top - n], &frames[top], out.begin());
+    return out.first(n);
+}
+
 namespace {
 
 class PosCache : private LRUCache<PosIdx, Pos>
@@ -111,9 +171,60 @@ struct GenericFrameInfo
     auto operator<=>(const GenericFrameInfo & rhs) const = default;
 };
 
-using FrameInfo =
-    std::variant<LambdaFrameInfo, PrimOpFrameInfo, FunctorFrameInfo, DerivationStrictFrameInfo, GenericFrameInfo>;
+/** Stands for the outermost frames of a sample that were not recorded. */
+struct TruncatedFrameInfo
+{
+    std::ostream & symbolize(const EvalState & state, std::ostream & os, PosCache & posCache) const;
+    auto operator<=>(const TruncatedFrameInfo & rhs) const = default;
+};
+
+using FrameInfo = std::variant<
+    LambdaFrameInfo,
+    PrimOpFrameInfo,
+    FunctorFrameInfo,
+    DerivationStrictFrameInfo,
+    GenericFrameInfo,
+    TruncatedFrameInfo>;
 using FrameStack = std::vector<FrameInfo>;
+using CallCount = std::map<FrameStack, uint32_t>;
+
+AutoCloseFD openProfileFile(const std::filesystem::path & profileFile)
+{
+    auto fd = openNewFileForWrite(
+        profileFile,
+        0660,
+        {
+            .truncateExisting = true,
+            .followSymlinksOnTruncate = true, /* FIXME: Probably shouldn't follow symlinks. */
+        });
+    if (!fd)
+        throw SysError("opening file %s", PathFmt(profileFile));
+    return fd;
+}
+
+/**
+ * Write `callCount` to `fd` in the folded format of `flamegraph.pl`.
+ */
+void writeProfile(const EvalState & state, Descriptor fd, PosCache & posCache, const CallCount & callCount)
+{
+    auto os = std::ostringstream{};
+    for (auto & [stack, count] : callCount) {
+        auto first = true;
+        for (auto & pos : stack) {
+            if (first)
+                first = false;
+            else
+                os << ";";
+
+            std::visit([&](auto && info) { info.symbolize(state, os, posCache); }, pos);
+        }
+        os << " " << count;
+        writeLine(fd, os.str());
+        /* Clear ostringstream. */
+        os.str("");
+        os.clear();
+    }
+}
 
 /**
  * Stack sampling profiler.
@@ -136,18 +247,7 @@ public:
     SampleStack(EvalState & state, const std::filesystem::path & profileFile, std::chrono::nanoseconds period)
         : state(state)
         , sampleInterval(period)
-        , profileFd([&]() {
-            auto fd = openNewFileForWrite(
-                profileFile,
-                0660,
-                {
-                    .truncateExisting = true,
-                    .followSymlinksOnTruncate = true, /* FIXME: Probably shouldn't follow symlinks. */
-                });
-            if (!fd)
-                throw SysError("opening file %s", PathFmt(profileFile));
-            return fd;
-        }())
+        , profileFd(openProfileFile(profileFile))
         , posCache(state)
     {
     }
@@ -172,7 +272,7 @@ private:
     std::chrono::nanoseconds sampleInterval;
     AutoCloseFD profileFd;
     FrameStack stack;
-    std::map<FrameStack, uint32_t> callCount;
+    CallCount callCount;
     std::chrono::time_point<std::chrono::high_resolution_clock> lastStackSample =
         std::chrono::high_resolution_clock::now();
     std::chrono::time_point<std::chrono::high_resolution_clock> lastDump = std::chrono::high_resolution_clock::now();
@@ -300,6 +400,12 @@ DerivationStrictFrameInfo::symbolize(const EvalState & state, std::ostream & os,
     return os;
 }
 
+std::ostream & TruncatedFrameInfo::symbolize(const EvalState & state, std::ostream & os, PosCache & posCache) const
+{
+    os << "«truncated»";
+    return os;
+}
+
 void SampleStack::maybeSaveProfile(std::chrono::time_point<std::chrono::high_resolution_clock> now)
 {
     if (now - lastDump >= profileDumpInterval)
@@ -318,23 +424,7 @@ void SampleStack::maybeSaveProfile(std::chrono::time_point<std::chrono::high_res
 
 void SampleStack::saveProfile()
 {
-    auto os = std::ostringstream{};
-    for (auto & [stack, count] : callCount) {
-        auto first = true;
-        for (auto & pos : stack) {
-            if (first)
-                first = false;
-            else
-                os << ";";
-
-            std::visit([&](auto && info) { info.symbolize(state, os, posCache); }, pos);
-        }
-        os << " " << count;
-        writeLine(profileFd.get(), os.str());
-        /* Clear ostringstream. */
-        os.str("");
-        os.clear();
-    }
+    writeProfile(state, profileFd.get(), posCache, callCount);
 }
 
 SampleStack::~SampleStack()
@@ -347,6 +437,293 @@ SampleStack::~SampleStack()
     }
 }
 
+#ifndef _WIN32
+
+/**
+ * Stack sampling profiler that doesn't do any work on function calls
+ * beyond maintaining a `ShadowStack`. A `SIGPROF` timer interrupts the
+ * evaluating thread, whose signal handler copies the shadow stack into
+ * a ring buffer. A separate thread drains the buffer, symbolizes the
+ * samples and periodically writes them to the profile.
+ *
+ * On Linux, the timer measures the CPU time of the evaluating thread
+ * and signals only that thread. Elsewhere, it measures the CPU time of
+ * the whole process, and signals delivered to other threads are
+ * ignored.
+ */
+class SignalSampleStack : public EvalProfiler
+{
+    static constexpr std::chrono::microseconds profileDumpInterval = std::chrono::milliseconds(2000);
+
+    /** How often the writer thread drains the ring buffer. */
+    static constexpr std::chrono::microseconds drainInterval = std::chrono::milliseconds(10);
+
+    /** The maximum number of (innermost) frames in a sample. */
+    static constexpr size_t maxSampleDepth = 256;
+
+    static constexpr size_t ringSize = 256;
+
+    struct Sample
+    {
+        bool truncated;
+        size_t nrFrames;
+        ShadowStack::Frame frames[maxSampleDepth];
+    };
+
+    /**
+     * The profiler that the signal handler samples. There can be only
+     * one, since there is only one `SIGPROF` handler.
+     */
+    static inline std::atomic<SignalSampleStack *> active = nullptr;
+
+    EvalState & state;
+    ShadowStack stack;
+
+    /** The evaluating thread. */
+    pthread_t thread;
+
+    /**
+     * Single-producer single-consumer queue of samples. `head` is
+     * advanced by the signal handler, `tail` by the writer thread.
+     */
+    std::unique_ptr<Sample[]> ring;
+    std::atomic<size_t> head = 0, tail = 0;
+    std::atomic<uint64_t> dropped = 0;
+
+    struct sigaction oldAction;
+
+#ifdef __linux__
+    timer_t timer;
+#endif
+
+    AutoCloseFD profileFd;
+    PosCache posCache;
+    CallCount callCount;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool quit = false;
+    std::thread writer;
+
+    static void handleSignal(int)
+    {
+        auto sampler = active.load(std::memory_order_acquire);
+        /* Without a per-thread timer, the signal may be delivered to
+           any thread. */
+        if (sampler && pthread_equal(pthread_self(), sampler->thread))
+            sampler->takeSample();
+    }
+
+    /**
+     * Called from the signal handler, so this must be
+     * async-signal-safe.
+     */
+    void takeSample()
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= ringSize) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        auto & sample = ring[h % ringSize];
+        auto frames = stack.snapshot(sample.frames);
+        sample.nrFrames = frames.size();
+        sample.truncated = frames.size() < stack.size();
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    static FrameInfo getFrameInfo(const ShadowStack::Frame & frame)
+    {
+        switch (frame.kind) {
+        case ShadowStack::Kind::Lambda:
+            return LambdaFrameInfo{.expr = frame.lambda, .callPos = frame.pos};
+        case ShadowStack::Kind::PrimOp:
+            return PrimOpFrameInfo{.expr = frame.primOp, .callPos = frame.pos};
+        case ShadowStack::Kind::Functor:
+            return FunctorFrameInfo{.pos = frame.pos};
+        case ShadowStack::Kind::Other:
+            return GenericFrameInfo{.pos = frame.pos};
+        }
+        unreachable();
+    }
+
+    void drain()
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        auto h = head.load(std::memory_order_acquire);
+        FrameStack frames;
+        for (; t != h; ++t) {
+            auto & sample = ring[t % ringSize];
+            /* Like `SampleStack`, only count time spent in function
+               calls. */
+            if (sample.nrFrames == 0 && !sample.truncated) {
+                tail.store(t + 1, std::memory_order_release);
+                continue;
+            }
+            frames.clear();
+            if (sample.truncated)
+                frames.push_back(TruncatedFrameInfo{});
+            for (size_t i = 0; i < sample.nrFrames; ++i)
+                frames.push_back(getFrameInfo(sample.frames[i]));
+            callCount[frames] += 1;
+            /* Hand the slot back to the signal handler. */
+            tail.store(t + 1, std::memory_order_release);
+        }
+    }
+
+    void writerLoop()
+    {
+        auto lastDump = std::chrono::steady_clock::now();
+        std::unique_lock lock(mutex);
+        while (true) {
+            auto done = wakeup.wait_for(lock, drainInterval, [&]() { return quit; });
+            try {
+                drain();
+                auto now = std::chrono::steady_clock::now();
+                if (done || now - lastDump >= profileDumpInterval) {
+                    writeProfile(state, profileFd.get(), posCache, callCount);
+                    callCount.clear();
+                    lastDump = now;
+                }
+            } catch (...) {
+                /* There is nobody to rethrow to, not even on
+                   interrupts, which the evaluating thread will also
+                   notice. */
+                ignoreExceptionInDestructor();
+            }
+            if (done)
+                return;
+        }
+    }
+
+    /**
+     * Start sending `SIGPROF` to the evaluating thread `frequency`
+     * times per second of CPU time.
+     */
+    void startTimer(uint64_t frequency)
+    {
+        auto period = std::max<uint64_t>(1'000'000'000 / frequency, 1);
+        struct timespec interval{
+            .tv_sec = time_t(period / 1'000'000'000),
+            .tv_nsec = long(period % 1'000'000'000),
+        };
+
+#ifdef __linux__
+        clockid_t clock;
+        if (auto err = pthread_getcpuclockid(thread, &clock))
+            throw SysError(err, "getting the CPU time clock of the evaluating thread");
+
+        struct sigevent event{};
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+        event.sigev_notify_thread_id = gettid();
+        if (timer_create(clock, &event, &timer))
+            throw SysError("creating the profiling timer");
+
+        struct itimerspec spec{.it_interval = interval, .it_value = interval};
+        if (timer_settime(timer, 0, &spec, nullptr)) {
+            timer_delete(timer);
+            throw SysError("starting the profiling timer");
+        }
+#else
+        struct itimerval spec{};
+        spec.it_interval.tv_sec = interval.tv_sec;
+        spec.it_interval.tv_usec = std::max<long>(interval.tv_nsec / 1000, interval.tv_sec ? 0 : 1);
+        spec.it_value = spec.it_interval;
+        if (setitimer(ITIMER_PROF, &spec, nullptr))
+            throw SysError("starting the profiling timer");
+#endif
+    }
+
+    void stopTimer()
+    {
+#ifdef __linux__
+        timer_delete(timer);
+#else
+        struct itimerval spec{};
+        setitimer(ITIMER_PROF, &spec, nullptr);
+#endif
+    }
+
+public:
+    SignalSampleStack(
+        EvalState & state, const std::filesystem::path & profileFile, uint64_t frequency, size_t maxDepth)
+        : state(state)
+        , stack(maxDepth)
+        , thread(pthread_self())
+        , ring(std::make_unique<Sample[]>(ringSize))
+        , profileFd(openProfileFile(profileFile))
+        , posCache(state)
+    {
+        if (frequency == 0)
+            throw UsageError("the 'sampling' evaluation profiler requires a non-zero 'eval-profiler-frequency'");
+
+        SignalSampleStack * expected = nullptr;
+        if (!active.compare_exchange_strong(expected, this))
+            throw Error("only one evaluation can be profiled at a time with the 'sampling' profiler");
+
+        struct sigaction act{};
+        act.sa_handler = handleSignal;
+        sigemptyset(&act.sa_mask);
+        act.sa_flags = SA_RESTART;
+        if (sigaction(SIGPROF, &act, &oldAction)) {
+            active = nullptr;
+            throw SysError("installing handler for SIGPROF");
+        }
+
+        try {
+            startTimer(frequency);
+        } catch (...) {
+            sigaction(SIGPROF, &oldAction, nullptr);
+            active = nullptr;
+            throw;
+        }
+
+        /* The writer thread inherits our signal mask, so block SIGPROF
+           while creating it. It should never be interrupted to take a
+           sample. */
+        sigset_t set, oldSet;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPROF);
+        pthread_sigmask(SIG_BLOCK, &set, &oldSet);
+        try {
+            writer = std::thread([this]() { writerLoop(); });
+        } catch (...) {
+            pthread_sigmask(SIG_SETMASK, &oldSet, nullptr);
+            stopTimer();
+            sigaction(SIGPROF, &oldAction, nullptr);
+            active = nullptr;
+            throw;
+        }
+        pthread_sigmask(SIG_SETMASK, &oldSet, nullptr);
+
+        state.shadowStack = &stack;
+    }
+
+    SignalSampleStack(const SignalSampleStack &) = delete;
+    SignalSampleStack & operator=(const SignalSampleStack &) = delete;
+
+    ~SignalSampleStack()
+    {
+        stopTimer();
+        sigaction(SIGPROF, &oldAction, nullptr);
+        active = nullptr;
+        state.shadowStack = nullptr;
+
+        {
+            std::lock_guard lock(mutex);
+            quit = true;
+        }
+        wakeup.notify_one();
+        writer.join();
+
+        if (auto n = dropped.load())
+            warn("the evaluation profiler dropped %d samples", n);
+    }
+};
+
+#endif
+
 } // namespace
 
 ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency)
@@ -358,4 +735,14 @@ ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::pa
     return make_ref<SampleStack>(state, profileFile, period);
 }
 
+ref<EvalProfiler> makeSignalSampleStackProfiler(
+    EvalState & state, std::filesystem::path profileFile, uint64_t frequency, size_t maxDepth)
+{
+#ifndef _WIN32
+    return make_ref<SignalSampleStack>(state, profileFile, frequency, maxDepth);
+#else
+    throw Error("the 'sampling' evaluation profiler is not supported on this platform");
+#endif
+}
+
 } // namespace nix
@@ -15,6 +15,9 @@
 #include "nix/expr/eval-inline.hh"
 #include "nix/store/filetransfer.hh"
 #include "nix/expr/function-trace.hh"
+#include "nix/expr/function-memo.hh"
+#include "nix/expr/parallel-eval.hh"
+#include "nix/expr/parse-cache.hh"
 #include "nix/store/profiles.hh"
 #include "nix/expr/print.hh"
 #include "nix/fetchers/filtering-source-accessor.hh"
@@ -26,6 +29,7 @@
 #include "nix/fetchers/tarball.hh"
 #include "nix/fetchers/input-cache.hh"
 #include "nix/util/current-process.hh"
+#include "nix/util/signals.hh"
 
 #include "parser-tab.hh"
 
@@ -37,6 +41,7 @@
 #include <sstream>
 #include <cstring>
 #include <optional>
+#include <condition_variable>
 #include <unistd.h>
 #include <sys/time.h>
 #include <fstream>
@@ -208,7 +213,7 @@ PosIdx Value::determinePos(const PosIdx pos) const
 
 bool Value::isTrivial() const
 {
-    return !isa<tApp, tPrimOpApp>()
+    return !isa<tApp, tPrimOpApp, tPending, tAwaited>()
            && (!isa<tThunk>()
                || (dynamic_cast<ExprAttrs *>(thunk().expr) && ((ExprAttrs *) thunk().expr)->dynamicAttrs->empty())
                || dynamic_cast<ExprLambda *>(thunk().expr) || dynamic_cast<ExprList *>(thunk().expr));
@@ -300,6 +305,7 @@ EvalState::EvalState(
     , store(store)
     , buildStore(buildStore ? buildStore : store)
     , inputCache(fetchers::InputCache::create())
+    , executor(make_ref<Executor>(settings))
     , debugRepl(nullptr)
     , debugStop(false)
     , trylevel(0)
@@ -317,11 +323,18 @@ EvalState::EvalState(
 #endif
     , staticBaseEnv{std::make_shared<StaticEnv>(nullptr, nullptr)}
 {
+    if (settings.useParseCache) {
+        try {
+            parseCache = ParseCache::openDefault(settings.parseCacheSize);
+        } catch (Error & e) {
+            logWarning(e.info());
+        }
+    }
+
 #ifndef _WIN32
     static std::once_flag stackSizeBumped;
     std::call_once(stackSizeBumped, []() {
-        // Increase the default stack size for the evaluator and for
-        // libstdc++'s std::regex.
+        // Increase the default stack size for the evaluator.
         // This used to be 64 MiB, but macOS as deployed on GitHub Actions has a
         // hard limit slightly under that, so we round it down a bit.
         nix::ensureStackSizeAtLeast(60 * 1024 * 1024);
@@ -331,7 +344,17 @@ EvalState::EvalState(
     corepkgsFS->setPathDisplay("<nix", ">");
     internalFS->setPathDisplay("«nix-internal»", "");
 
-    countCalls = getEnv("NIX_COUNT_CALLS").value_or("0") != "0";
+#if NIX_USE_BOEHMGC
+    if (settings.gcIncremental)
+        enableIncrementalGC();
+#endif
+
+    /* The call counters aren't thread-safe. */
+    countCalls = getEnv("NIX_COUNT_CALLS").value_or("0") != "0" && !executor->enabled;
+
+    /* Neither is the memo table. */
+    if (settings.evalMemoSize && !executor->enabled)
+        functionMemo = std::make_unique<FunctionMemo>(settings.evalMemoSize);
 
     static_assert(sizeof(Env) <= 16, "environment must be <= 16 bytes");
 
@@ -373,6 +396,10 @@ EvalState::EvalState(
         profiler.addProfiler(
             makeSampleStackProfiler(*this, settings.evalProfileFile.get(), settings.evalProfilerFrequency));
         break;
+    case EvalProfilerMode::sampling:
+        profiler.addProfiler(makeSignalSampleStackProfiler(
+            *this, settings.evalProfileFile.get(), settings.evalProfilerFrequency, settings.maxCallDepth + 1));
+        break;
     case EvalProfilerMode::disabled:
         break;
     }
@@ -925,7 +952,7 @@ void Value::mkPath(const SourcePath & path, EvalMemory & mem)
     auto * fromWith = var.fromWith;
     while (1) {
         forceAttrs(*env->values[0], fromWith->pos, "while evaluating the first subexpression of a with expression");
-        if (auto j = env->values[0]->attrs()->get(var.name)) {
+        if (auto j = env->values[0]->attrs()->get(var.name, var.withCache)) {
             if (countCalls) [[unlikely]]
                 attrSelects[j->pos]++;
             return j->value;
@@ -1176,6 +1203,9 @@ void EvalState::resetFileCache()
     lookupPathResolved->clear();
     positions.clear();
     rootFS->invalidateCache();
+    /* Memoised calls of e.g. `builtins.readFile` may be stale. */
+    if (functionMemo)
+        functionMemo->clear();
 }
 
 void EvalState::eval(Expr * e, Value & v)
@@ -1347,7 +1377,24 @@ void ExprAttrs::eval(EvalState & state, Env & env, Value & v)
 
     bindings.bindings->pos = pos;
 
-    v.mkAttrs(sort ? bindings.finish() : bindings.alreadySorted());
+    if (sort)
+        v.mkAttrs(bindings.finish());
+    else if (bindings.bindings->size() != attrs->size())
+        v.mkAttrs(bindings.alreadySorted());
+    else {
+        /* The attribute names are exactly those in `attrs`, so all
+           attribute sets created here have the same shape. */
+        auto shape = this->shape.load(std::memory_order_relaxed);
+        if (!shape) {
+            std::vector<Symbol> names;
+            names.reserve(attrs->size());
+            for (auto & i : *attrs)
+                names.push_back(i.first);
+            shape = Bindings::internShape(names);
+            this->shape.store(shape, std::memory_order_relaxed);
+        }
+        v.mkAttrs(bindings.alreadySortedWithShape(shape));
+    }
 }
 
 void ExprLet::eval(EvalState & state, Env & env, Value & v)
@@ -1424,7 +1471,14 @@ void ExprSelect::eval(EvalState & state, Env & env, Value & v)
     PosIdx pos2;
     Value * vAttrs = &vTmp;
 
-    e->eval(state, env, vTmp);
+    /* For the common case of selecting from a variable (`pkgs.lib.x`,
+       `self.y`), select from the variable's value directly rather than
+       copying it through `ExprVar::eval()`. */
+    if (var) {
+        vAttrs = state.lookupVar(&env, *var, false);
+        state.forceValue(*vAttrs, var->pos);
+    } else
+        e->eval(state, env, vTmp);
 
     try {
         auto dts = state.debugRepl ? makeDebugTraceStacker(
@@ -1436,19 +1490,25 @@ void ExprSelect::eval(EvalState & state, Env & env, Value & v)
                                          showAttrSelectionPath(state, env, getAttrPath()))
                                    : nullptr;
 
-        for (auto & i : getAttrPath()) {
+        for (uint32_t n = 0; n < nAttrPath; ++n) {
+            auto & i = attrPathStart[n];
             state.nrLookups++;
             const Attr * j;
             auto name = getName(i, state, env);
+            /* Only attribute names that don't depend on the
+               environment can be cached. */
+            auto get = [&](const Bindings & attrs) {
+                return i.expr ? attrs.get(name) : attrs.get(name, lookupCaches[n]);
+            };
             if (def) {
                 state.forceValue(*vAttrs, pos);
-                if (vAttrs->type() != nAttrs || !(j = vAttrs->attrs()->get(name))) {
+                if (vAttrs->type() != nAttrs || !(j = get(*vAttrs->attrs()))) {
                     def->eval(state, env, v);
                     return;
                 }
             } else {
                 state.forceAttrs(*vAttrs, pos, "while selecting an attribute");
-                if (!(j = vAttrs->attrs()->get(name))) {
+                if (!(j = get(*vAttrs->attrs()))) {
                     StringSet allAttrNames;
                     for (auto & attr : *vAttrs->attrs())
                         allAttrNames.insert(std::string(state.symbols[attr.name]));
@@ -1533,7 +1593,12 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
     if (neededHooks.test(EvalProfiler::preFunctionCall)) [[unlikely]]
         profiler.preFunctionCallHook(*this, fun, args, pos);
 
+    if (shadowStack) [[unlikely]]
+        shadowStack->push(fun, pos);
+
     Finally traceExit_{[&]() {
+        if (shadowStack) [[unlikely]]
+            shadowStack->pop();
         if (profiler.getNeededHooks().test(EvalProfiler::postFunctionCall)) [[unlikely]]
             profiler.postFunctionCallHook(*this, fun, args, pos);
     }};
@@ -1559,6 +1624,19 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
 
             ExprLambda & lambda(*vCur.lambda().fun);
 
+            std::optional<FunctionMemo::Key> memoKey;
+            uint64_t sideEffectsBefore = 0;
+            if (functionMemo && !debugRepl) [[unlikely]] {
+                sideEffectsBefore = nrSideEffects;
+                memoKey = FunctionMemo::makeKey(&lambda, vCur.lambda().env, args.first(1));
+                if (memoKey)
+                    if (auto res = functionMemo->lookup(*memoKey)) {
+                        vCur = *res;
+                        args = args.subspan(1);
+                        continue;
+                    }
+            }
+
             auto size = (!lambda.arg ? 0 : 1) + (lambda.getFormals() ? lambda.getFormals()->formals.size() : 0);
             Env & env2(mem.allocEnv(size));
             env2.up = vCur.lambda().env;
@@ -1658,6 +1736,9 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                 throw;
             }
 
+            if (memoKey && nrSideEffects == sideEffectsBefore)
+                functionMemo->insert(*memoKey, vCur);
+
             args = args.subspan(1);
         }
 
@@ -1678,7 +1759,7 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                     primOpCalls[fn->name]++;
 
                 try {
-                    fn->impl(*this, vCur.determinePos(noPos), args.data(), vCur);
+                    callPrimOp(*fn, vCur.determinePos(noPos), args.data(), vCur);
                 } catch (Error & e) {
                     if (fn->addTrace)
                         addErrorTrace(e, pos, "while calling the '%1%' builtin", fn->name);
@@ -1728,7 +1809,7 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                     // 2. Create a fake env (arg1, arg2, etc.) and a fake expr (arg1: arg2: etc: builtins.name arg1 arg2
                     // etc)
                     //    so the debugger allows to inspect the wrong parameters passed to the builtin.
-                    fn->impl(*this, vCur.determinePos(noPos), vArgs, vCur);
+                    callPrimOp(*fn, vCur.determinePos(noPos), vArgs, vCur);
                 } catch (Error & e) {
                     if (fn->addTrace)
                         addErrorTrace(e, pos, "while calling the '%1%' builtin", fn->name);
@@ -1787,6 +1868,33 @@ void ExprCall::eval(EvalState & state, Env & env, Value & v)
     state.callFunction(vFun, vArgs, v, pos);
 }
 
+void EvalState::callPrimOp(const PrimOp & fn, const PosIdx pos, Value ** args, Value & vRes)
+{
+    std::optional<FunctionMemo::Key> memoKey;
+
+    if (functionMemo && fn.memoise && !debugRepl) [[unlikely]] {
+        /* The primop is strict, so force the arguments to compare
+           them structurally. If that fails, let the primop force them
+           again to report the error. */
+        try {
+            for (size_t i = 0; i < fn.arity; ++i)
+                forceValue(*args[i], pos);
+            memoKey = FunctionMemo::makeKey(&fn, nullptr, {args, fn.arity});
+        } catch (Error &) {
+        }
+        if (memoKey)
+            if (auto res = functionMemo->lookup(*memoKey)) {
+                vRes = *res;
+                return;
+            }
+    }
+
+    fn.impl(*this, pos, args, vRes);
+
+    if (memoKey)
+        functionMemo->insert(*memoKey, vRes);
+}
+
 // Lifted out of callFunction() because it creates a temporary that
 // prevents tail-call optimisation.
 void EvalState::incrFunctionCall(ExprLambda * fun)
@@ -2239,9 +2347,91 @@ void EvalState::handleEvalExceptionForApp(Value & v, const Value & savedApp)
     v.mkFailed(e, recovery);
 }
 
+/**
+ * A small number for each thread, used to detect a thread that waits
+ * for a value that it is forcing itself.
+ */
+static uint32_t evalThreadId()
+{
+    static std::atomic<uint32_t> nextId{1};
+    static thread_local uint32_t id = nextId++;
+    return id;
+}
+
+/**
+ * The value that each thread is waiting for, indexed by
+ * `evalThreadId()`, used to detect cycles between threads. Threads
+ * with higher IDs don't take part in this.
+ */
+static std::array<std::atomic<Value *>, 1024> waitingFor;
+
+/**
+ * Whether waiting for `v` would close a cycle of threads that each
+ * wait for a value owned by the next one, ending with `self`.
+ */
+static bool waitWouldDeadlock(Value & v, uint32_t self)
+{
+    Value * cur = &v;
+    for (size_t steps = 0; steps < waitingFor.size(); ++steps) {
+        Value observed;
+        cur->loadAcquire(observed);
+        if (!observed.isPending())
+            return false;
+        auto owner = observed.pendingOwner();
+        if (owner == self)
+            return true;
+        if (owner >= waitingFor.size())
+            return false;
+        cur = waitingFor[owner].load();
+        if (!cur)
+            return false;
+    }
+    return false;
+}
+
+/**
+ * Threads waiting for a pending value sleep on one of these, chosen
+ * by the address of the value.
+ */
+struct alignas(64) WaitShard
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+static std::array<WaitShard, 128> waitShards;
+
+static WaitShard & waitShardFor(const Value & v)
+{
+    return waitShards[(reinterpret_cast<uintptr_t>(&v) >> 4) % waitShards.size()];
+}
+
 [[gnu::noinline]]
 void EvalState::handleEvalFailed(Value & v, const PosIdx pos)
 {
+    if (executor->enabled) {
+        Value observed;
+        v.loadAcquire(observed);
+        if (!observed.isFailed())
+            return forceValue(v, pos);
+        auto recoveryValue = observed.failed().recoveryValue;
+        if (!recoveryValue)
+            observed.failed().rethrow();
+        /* Retry the evaluation, making other threads wait for it like
+           for a thunk. */
+        if (!v.tryLock(observed, evalThreadId()))
+            return forceValue(v, pos);
+        Value result = *recoveryValue;
+        try {
+            forceValue(result, pos);
+        } catch (...) {
+            finishForcing(v, result);
+            throw;
+        }
+        finishForcing(v, result);
+        return;
+    }
+
     assert(v.isFailed());
     if (auto recoveryValue = v.failed().recoveryValue) {
         v = *recoveryValue;
@@ -2251,6 +2441,97 @@ void EvalState::handleEvalFailed(Value & v, const PosIdx pos)
     }
 }
 
+[[gnu::noinline]]
+void EvalState::forceValueParallel(Value & v, const PosIdx pos)
+{
+    auto self = evalThreadId();
+
+    while (true) {
+        Value observed;
+        v.loadAcquire(observed);
+
+        if (observed.isThunk()) {
+            if (!v.tryLock(observed, self))
+                continue;
+            Env * env = observed.thunk().env;
+            Expr * expr = observed.thunk().expr;
+            Value result;
+            try {
+                if (env) [[likely]]
+                    expr->eval(*this, *env, result);
+                else
+                    ExprBlackHole::throwInfiniteRecursionError(*this, v);
+            } catch (...) {
+                handleEvalExceptionForThunk(env, expr, result, pos);
+                finishForcing(v, result);
+                throw;
+            }
+            finishForcing(v, result);
+            return;
+        }
+
+        else if (observed.isApp()) {
+            if (!v.tryLock(observed, self))
+                continue;
+            Value result;
+            try {
+                callFunction(*observed.app().left, *observed.app().right, result, pos);
+            } catch (...) {
+                handleEvalExceptionForApp(result, observed);
+                finishForcing(v, result);
+                throw;
+            }
+            finishForcing(v, result);
+            return;
+        }
+
+        else if (observed.isPending()) {
+            if (observed.pendingOwner() == self)
+                error<InfiniteRecursionError>("infinite recursion encountered").atPos(pos).debugThrow();
+
+            /* Announce what we're waiting for before looking for a
+               cycle. Of two threads that close a cycle at the same
+               time, at least one sees the other's announcement. */
+            std::atomic<Value *> dummy;
+            auto & waiting = self < waitingFor.size() ? waitingFor[self] : dummy;
+            waiting.store(&v);
+            Finally clearWaiting([&]() { waiting.store(nullptr); });
+
+            /* Look twice, since a value on the chain may have been
+               finished while we were walking it. */
+            if (self < waitingFor.size() && waitWouldDeadlock(v, self) && waitWouldDeadlock(v, self))
+                error<InfiniteRecursionError>("infinite recursion encountered").atPos(pos).debugThrow();
+
+            auto & shard = waitShardFor(v);
+            std::unique_lock lock(shard.mutex);
+            while (v.tryMarkAwaited(observed)) {
+                shard.cv.wait_for(lock, std::chrono::milliseconds(100));
+                checkInterrupt();
+                v.loadAcquire(observed);
+                if (!observed.isPending())
+                    break;
+            }
+        }
+
+        else if (observed.isFailed())
+            return handleEvalFailed(v, pos);
+
+        else
+            return;
+    }
+}
+
+void EvalState::finishForcing(Value & v, const Value & result)
+{
+    if (v.finish(result)) {
+        /* Taking the lock ensures that a waiter either hasn't checked
+           the value yet or is already waiting. */
+        auto & shard = waitShardFor(v);
+        std::lock_guard lock(shard.mutex);
+        shard.cv.notify_all();
+    }
+}
+
 void EvalState::tryFixupBlackHolePos(Value & v, PosIdx pos)
 {
     if (!v.isBlackhole())
@@ -2265,6 +2546,8 @@ void EvalState::tryFixupBlackHolePos(Value & v, PosIdx pos)
     }
 }
 
+thread_local size_t EvalState::callDepth = 0;
+
 void EvalState::forceValueDeep(Value & v)
 {
     std::set<const Value *> seen;
@@ -3060,6 +3343,7 @@ void EvalState::printStatistics()
         ms * 0.001;
     });
     auto gcCycles = getGCCycles();
+    auto gcPauses = getGCPauseStats();
 #endif
 
     auto outPath = getEnv("NIX_SHOW_STATS_PATH").value_or("-");
@@ -3098,6 +3382,7 @@ void EvalState::printStatistics()
         {"number", memstats.nrAttrsets.load()},
         {"bytes", bAttrsets},
         {"elements", memstats.nrAttrsInAttrsets.load()},
+        {"shapes", Bindings::shapeCount()},
     };
     topObj["sizes"] = {
         {"Env", sizeof(Env)},
@@ -3112,11 +3397,24 @@ void EvalState::printStatistics()
     topObj["nrLookups"] = nrLookups.load();
     topObj["nrPrimOpCalls"] = nrPrimOpCalls.load();
     topObj["nrFunctionCalls"] = nrFunctionCalls.load();
+    if (functionMemo)
+        topObj["memo"] = {
+            {"hits", functionMemo->hits.load()},
+            {"misses", functionMemo->misses.load()},
+            {"size", functionMemo->size()},
+        };
 #if NIX_USE_BOEHMGC
     topObj["gc"] = {
         {"heapSize", heapSize},
         {"totalBytes", totalBytes},
         {"cycles", gcCycles},
+        {"incremental", (bool) GC_is_incremental_mode()},
+        {"pauses",
+         {
+             {"number", gcPauses.count},
+             {"totalTime", std::chrono::duration<double>(gcPauses.total).count()},
+             {"maxTime", std::chrono::duration<double>(gcPauses.max).count()},
+         }},
     };
 #endif
 
@@ -3202,9 +3500,12 @@ Expr * EvalState::parseExprFromFile(const SourcePath & path)
 Expr * EvalState::parseExprFromFile(const SourcePath & path, const std::shared_ptr<StaticEnv> & staticEnv)
 {
     auto buffer = path.resolveSymlinks().readFile();
+    std::optional<Hash> cacheKey;
+    if (parseCache)
+        cacheKey = ParseCache::key(buffer, path.parent(), settings);
     // readFile hopefully have left some extra space for terminators
     buffer.append("\0\0", 2);
-    return parse(buffer.data(), buffer.size(), Pos::Origin(path), path.parent(), staticEnv);
+    return parse(buffer.data(), buffer.size(), Pos::Origin(path), path.parent(), staticEnv, cacheKey);
 }
 
 Expr * EvalState::parseExprFromString(
@@ -3379,12 +3680,39 @@ Expr * EvalState::parse(
     size_t length,
     Pos::Origin origin,
     const SourcePath & basePath,
-    const std::shared_ptr<StaticEnv> & staticEnv)
+    const std::shared_ptr<StaticEnv> & staticEnv,
+    const std::optional<Hash> & cacheKey)
 {
     auto tmpDocComments = make_ref<DocCommentMap>();
 
-    auto result = parseExprFromBuf(
-        text, length, origin, basePath, mem.exprs, symbols, settings, positions, *tmpDocComments, rootFS);
+    auto posOrigin = positions.addOrigin(origin, length);
+
+    Expr * result = nullptr;
+
+    if (cacheKey)
+        result = parseCache->lookup(*cacheKey, [&](std::string_view data) {
+            return deserialiseParsedExpr(
+                data, posOrigin, *tmpDocComments, symbols, positions, mem.exprs, basePath, rootFS);
+        });
+
+    if (!result) {
+        bool cacheable = true;
+        result = parseExprFromBuf(
+            text,
+            length,
+            posOrigin,
+            basePath,
+            mem.exprs,
+            symbols,
+            settings,
+            positions,
+            *tmpDocComments,
+            rootFS,
+            &cacheable);
+        if (cacheKey && cacheable)
+            if (auto data = serialiseParsedExpr(result, posOrigin, *tmpDocComments, symbols, basePath, rootFS))
+                parseCache->insert(*cacheKey, *data);
+    }
 
     result->bindVars(*this, staticEnv);
 
@@ -0,0 +1,229 @@
+#include "nix/expr/function-memo.hh"
+#include "nix/expr/eval.hh"
+#include "nix/util/std-hash.hh"
+
+#include <bit>
+
+namespace nix {
+
+namespace {
+
+/**
+ * The maximum number of values that are hashed for the arguments of a
+ * call. This bounds the cost of a lookup.
+ */
+constexpr size_t maxNodes = 64;
+
+struct Hasher
+{
+    size_t hash = 0;
+    size_t nodes = 0;
+
+    /**
+     * Hash `v`, returning false if it is too large or can't be
+     * compared.
+     */
+    bool add(const Value & v)
+    {
+        if (++nodes > maxNodes)
+            return false;
+
+        /* Unevaluated values are identified by what they would
+           evaluate to. Black holes (values that are being evaluated)
+           have no such identity. */
+        if (v.isThunk()) {
+            if (v.isBlackhole())
+                return false;
+            hash_combine(hash, (const void *) v.thunk().expr, (const void *) v.thunk().env);
+            return true;
+        }
+        if (v.isApp()) {
+            hash_combine(hash, (const void *) v.app().left, (const void *) v.app().right);
+            return true;
+        }
+
+        auto type = v.type();
+        hash_combine(hash, int(type));
+
+        switch (type) {
+        case nInt:
+            hash_combine(hash, v.integer().value);
+            return true;
+        case nFloat:
+            hash_combine(hash, std::bit_cast<uint64_t>(v.fpoint()));
+            return true;
+        case nBool:
+            hash_combine(hash, v.boolean());
+            return true;
+        case nNull:
+            return true;
+        case nString:
+            hash_combine(hash, v.string_view());
+            if (auto context = v.context())
+                for (auto elem : *context)
+                    hash_combine(hash, elem->view());
+            return true;
+        case nPath:
+            hash_combine(hash, (const void *) v.pathAccessor(), v.pathStrView());
+            return true;
+        case nAttrs:
+            for (auto & attr : *v.attrs()) {
+                hash_combine(hash, attr.name.getId());
+                if (!add(*attr.value))
+                    return false;
+            }
+            return true;
+        case nList:
+            for (auto elem : v.listView())
+                if (!add(*elem))
+                    return false;
+            return true;
+        case nFunction:
+            if (v.isLambda())
+                hash_combine(hash, (const void *) v.lambda().fun, (const void *) v.lambda().env);
+            else if (v.isPrimOp())
+                hash_combine(hash, (const void *) v.primOp());
+            else
+                hash_combine(hash, (const void *) v.primOpApp().left, (const void *) v.primOpApp().right);
+            return true;
+        case nExternal:
+            hash_combine(hash, (const void *) v.external());
+            return true;
+        case nThunk:
+        case nFailed:
+        default:
+            /* Values that are being evaluated in parallel, and failed
+               values. */
+            return false;
+        }
+    }
+};
+
+/**
+ * Whether `a` and `b` are interchangeable, comparing them the same way
+ * as `Hasher`. Values that would only be equal after evaluating them
+ * compare unequal.
+ */
+bool equal(const Value & a, const Value & b)
+{
+    if (a.isThunk() || b.isThunk())
+        return a.isThunk() && b.isThunk() && !a.isBlackhole() && a.thunk().expr == b.thunk().expr
+               && a.thunk().env == b.thunk().env;
+    if (a.isApp() || b.isApp())
+        return a.isApp() && b.isApp() && a.app().left == b.app().left && a.app().right == b.app().right;
+
+    auto type = a.type();
+    if (type != b.type())
+        return false;
+
+    switch (type) {
+    case nInt:
+        return a.integer() == b.integer();
+    case nFloat:
+        return std::bit_cast<uint64_t>(a.fpoint()) == std::bit_cast<uint64_t>(b.fpoint());
+    case nBool:
+        return a.boolean() == b.boolean();
+    case nNull:
+        return true;
+    case nString: {
+        if (a.string_view() != b.string_view())
+            return false;
+        auto ca = a.context(), cb = b.context();
+        if (!ca || !cb)
+            return !ca && !cb;
+        if (ca->size() != cb->size())
+            return false;
+        for (auto i = ca->begin(), j = cb->begin(); i != ca->end(); ++i, ++j)
+            if ((*i)->view() != (*j)->view())
+                return false;
+        return true;
+    }
+    case nPath:
+        return a.pathAccessor() == b.pathAccessor() && a.pathStrView() == b.pathStrView();
+    case nAttrs: {
+        if (a.attrs() == b.attrs())
+            return true;
+        if (a.attrs()->size() != b.attrs()->size())
+            return false;
+        for (auto i = a.attrs()->begin(), j = b.attrs()->begin(); i != a.attrs()->end(); ++i, ++j)
+            if (i->name != j->name || !equal(*i->value, *j->value))
+                return false;
+        return true;
+    }
+    case nList: {
+        auto la = a.listView(), lb = b.listView();
+        if (la.size() != lb.size())
+            return false;
+        for (size_t i = 0; i < la.size(); ++i)
+            if (!equal(*la[i], *lb[i]))
+                return false;
+        return true;
+    }
+    case nFunction:
+        if (a.isLambda())
+            return b.isLambda() && a.lambda().fun == b.lambda().fun && a.lambda().env == b.lambda().env;
+        if (a.isPrimOp())
+            return b.isPrimOp() && a.primOp() == b.primOp();
+        return b.isPrimOpApp() && a.primOpApp().left == b.primOpApp().left
+               && a.primOpApp().right == b.primOpApp().right;
+    case nExternal:
+        return a.external() == b.external();
+    case nThunk:
+    case nFailed:
+        /* `Hasher` rejects these, so they're never in the memo. */
+        return false;
+    }
+    return false;
+}
+
+} // namespace
+
+std::optional<FunctionMemo::Key>
+FunctionMemo::makeKey(const void * fun, const Env * env, std::span<Value * const> args)
+{
+    if (args.size() > maxArgs)
+        return std::nullopt;
+
+    /* Copy the arguments, since they may be updated in place while the
+       call is being evaluated, and may not be on the heap. */
+    Key key{.fun = fun, .env = env, .nrArgs = args.size()};
+    Hasher hasher;
+    hash_combine(hasher.hash, fun, (const void *) env);
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (!hasher.add(*args[i]))
+            return std::nullopt;
+        key.args[i] = *args[i];
+    }
+    key.hash = hasher.hash;
+    return key;
+}
+
+bool FunctionMemo::KeyEq::operator()(const Key & a, const Key & b) const noexcept
+{
+    if (a.fun != b.fun || a.env != b.env || a.nrArgs != b.nrArgs)
+        return false;
+    for (size_t i = 0; i < a.nrArgs; ++i)
+        if (!equal(a.args[i], b.args[i]))
+            return false;
+    return true;
+}
+
+const Value * FunctionMemo::lookup(const Key & key)
+{
+    auto i = table.find(key);
+    if (i == table.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    return &i->second;
+}
+
+void FunctionMemo::insert(const Key & key, const Value & result)
+{
+    if (table.size() >= maxSize)
+        table.clear();
+    table.insert_or_assign(key, result);
+}
+
+} // namespace nix
@@ -11,6 +11,7 @@
 #include <functional>
 #include <ranges>
 #include <optional>
+#include <span>
 
 namespace nix {
 
@@ -89,7 +90,17 @@ private:
     /**
      * Length of the layers list.
      */
-    uint32_t numLayers = 1;
+    uint32_t numLayers : 4 = 1;
+
+    /**
+     * The shape of this attribute set, or 0 if it doesn't have one.
+     * Attribute sets with the same non-zero shape have exactly the
+     * same attribute names, so an attribute has the same index in all
+     * of them. Only unlayered attribute sets have a shape.
+     *
+     * @see Bindings::internShape
+     */
+    uint32_t shape : 28 = 0;
 
     /**
      * Bindings that this attrset is "layered" on top of.
@@ -372,6 +383,43 @@ public:
         return nullptr;
     }
 
+    /**
+     * Like `get(name)`, but remember the index of the attribute in
+     * `cache` if this attribute set has a shape, so that looking up
+     * `name` in another attribute set of the same shape doesn't need
+     * to search. A cache must only ever be used with the same name.
+     */
+    const Attr * get(Symbol name, AttrLookupCache & cache) const noexcept
+    {
+        auto entry = cache.entry.load(std::memory_order_relaxed);
+        if (shape && uint32_t(entry >> 32) == shape) [[likely]]
+            return &attrs[uint32_t(entry)];
+
+        auto attr = get(name);
+        if (attr && shape)
+            cache.entry.store(uint64_t(shape) << 32 | uint32_t(attr - attrs), std::memory_order_relaxed);
+        return attr;
+    }
+
+    using Shape = uint32_t;
+
+    Shape getShape() const noexcept
+    {
+        return shape;
+    }
+
+    /**
+     * Return the shape of unlayered attribute sets whose attribute
+     * names are exactly `names`, which must be sorted. Returns 0 if
+     * there are too many shapes already.
+     */
+    static Shape internShape(std::span<const Symbol> names);
+
+    /**
+     * The number of shapes returned by `internShape()` so far.
+     */
+    static size_t shapeCount();
+
     /**
      * Check if the layer chain is full.
      */
@@ -563,6 +611,18 @@ public:
         return bindings;
     }
 
+    /**
+     * Like `alreadySorted()`, but also give the bindings the shape
+     * `shape`, which must be the shape of its attribute names.
+     */
+    Bindings * alreadySortedWithShape(Bindings::Shape shape)
+    {
+        assert(!hasBaseLayer());
+        if (bindings->numAttrs)
+            bindings->shape = shape;
+        return bindings;
+    }
+
     size_t capacity() const noexcept
     {
         return capacity_;
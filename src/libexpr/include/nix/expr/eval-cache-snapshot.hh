@@ -0,0 +1,175 @@
+#pragma once
+///@file
+
+#include "nix/expr/eval-cache.hh"
+
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace nix::eval_cache {
+
+/**
+ * An immutable attribute tree stored in a memory-mapped file, used by
+ * the evaluation cache.
+ *
+ * The file stores one column per node field (parent, name, first
+ * child, number of children, type and value), followed by a table of
+ * interned strings. Nodes are numbered in breadth-first order, so the
+ * children of a node are contiguous and sorted by name, and looking up
+ * an attribute is a binary search over the name column.
+ *
+ * Node 0 is a virtual node whose children are the attributes that
+ * have parent 0 in `AttrKey`, i.e. the root of the cache.
+ */
+class AttrSnapshot
+{
+public:
+
+    using NodeId = uint32_t;
+
+    /**
+     * A mutable tree from which a snapshot is written.
+     */
+    struct Builder
+    {
+        struct Node
+        {
+            AttrType type = AttrType::Placeholder;
+            /**
+             * The value of `String` and `ListOfStrings` nodes.
+             */
+            std::string string;
+            std::optional<std::string> context;
+            /**
+             * The value of `Bool` and `Int` nodes.
+             */
+            int64_t number = 0;
+            std::map<std::string, Node *, std::less<>> children;
+        };
+
+        /**
+         * All nodes, including ones that are no longer reachable from
+         * the root. `nodes.front()` is the root.
+         */
+        std::deque<Node> nodes{1};
+
+        Node & root()
+        {
+            return nodes.front();
+        }
+
+        /**
+         * Return the child `name` of `parent`, adding a placeholder if
+         * it doesn't exist.
+         */
+        Node & child(Node & parent, std::string_view name);
+    };
+
+    ~AttrSnapshot();
+
+    /**
+     * Open the snapshot at `path`. Throws `SerialisationError` if it is
+     * not a valid snapshot.
+     */
+    static std::unique_ptr<AttrSnapshot> open(const std::filesystem::path & path);
+
+    /**
+     * Write the tree in `builder` to `path` atomically.
+     */
+    static void write(const std::filesystem::path & path, Builder & builder);
+
+    /**
+     * Copy this snapshot into `builder`, under `builder.root()`.
+     */
+    void read(Builder & builder) const;
+
+    /**
+     * The number of nodes, including the virtual root.
+     */
+    NodeId size() const
+    {
+        return nodeCount;
+    }
+
+    std::optional<NodeId> lookup(NodeId parent, std::string_view name) const;
+
+    NodeId parent(NodeId node) const
+    {
+        return parents[node];
+    }
+
+    std::string_view name(NodeId node) const
+    {
+        return string(names[node]);
+    }
+
+    AttrType type(NodeId node) const
+    {
+        return (AttrType) types[node];
+    }
+
+    /**
+     * The children of `node`, which are `first`, ..., `first + count - 1`.
+     */
+    std::pair<NodeId, NodeId> children(NodeId node) const
+    {
+        return {firstChildren[node], childCounts[node]};
+    }
+
+    std::string_view stringValue(NodeId node) const
+    {
+        return string(uint32_t(values[node]));
+    }
+
+    std::optional<std::string_view> contextValue(NodeId node) const
+    {
+        auto i = uint32_t(values[node] >> 32);
+        if (i == noString)
+            return std::nullopt;
+        return string(i);
+    }
+
+    int64_t numberValue(NodeId node) const
+    {
+        return int64_t(values[node]);
+    }
+
+private:
+
+    static constexpr uint32_t noString = UINT32_MAX;
+
+    AttrSnapshot() = default;
+
+    /**
+     * The mapped file, or a copy of it on platforms without `mmap()`.
+     */
+    void * mapping = nullptr;
+    size_t mappingSize = 0;
+    std::string buffer;
+
+    NodeId nodeCount = 0;
+    uint32_t stringCount = 0;
+
+    const uint32_t * parents;
+    const uint32_t * names;
+    const uint32_t * firstChildren;
+    const uint32_t * childCounts;
+    const uint8_t * types;
+    const uint64_t * values;
+    const uint64_t * stringOffsets;
+    const char * stringData;
+
+    std::string_view string(uint32_t i) const
+    {
+        return {stringData + stringOffsets[i], stringData + stringOffsets[i + 1]};
+    }
+
+    void parse(std::string_view data);
+};
+
+} // namespace nix::eval_cache
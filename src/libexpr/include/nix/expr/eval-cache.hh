@@ -7,6 +7,7 @@
 #include "nix/expr/attr-path.hh"
 
 #include <functional>
+#include <mutex>
 #include <variant>
 
 namespace nix::eval_cache {
@@ -105,6 +106,14 @@ class AttrCursor : public std::enable_shared_from_this<AttrCursor>
     RootValue _value;
     std::optional<std::pair<AttrId, AttrValue>> cachedValue;
 
+    /**
+     * Protects the lazy initialisation of `_value`, and of
+     * `cachedValue` by `getKey()` of a child, since the children of
+     * an attribute set may be visited in parallel (e.g. by `nix
+     * search`).
+     */
+    std::mutex lazyMutex;
+
     AttrKey getKey();
 
     Value & getValue();
@@ -1,7 +1,9 @@
 #pragma once
 ///@file
 
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 
 // For `NIX_USE_BOEHMGC`
 #include "nix/expr/config.hh"
@@ -55,6 +57,26 @@ void assertGCInitialized();
  * The number of GC cycles since initGC().
  */
 size_t getGCCycles();
+
+/**
+ * Switch the collector to incremental, generational mode. Minor
+ * collections then only trace objects on pages that were written to
+ * since the previous collection, which shortens the pauses in
+ * long-running evaluators. Does nothing if it was already enabled.
+ */
+void enableIncrementalGC();
+
+/**
+ * How long the collector stopped the world since initGC().
+ */
+struct GCPauseStats
+{
+    uint64_t count = 0;
+    std::chrono::nanoseconds total{0};
+    std::chrono::nanoseconds max{0};
+};
+
+GCPauseStats getGCPauseStats();
 #endif
 
 } // namespace nix
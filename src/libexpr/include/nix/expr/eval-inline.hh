@@ -5,6 +5,7 @@
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-error.hh"
 #include "nix/expr/eval-settings.hh"
+#include "nix/expr/parallel-eval.hh"
 #include <exception>
 
 namespace nix {
@@ -96,6 +97,8 @@ Env & EvalMemory::allocEnv(size_t size)
 void EvalState::forceValue(Value & v, const PosIdx pos)
 {
     if (v.isThunk()) {
+        if (executor->enabled) [[unlikely]]
+            return forceValueParallel(v, pos);
         Env * env = v.thunk().env;
         assert(env || v.isBlackhole());
         Expr * expr = v.thunk().expr;
@@ -110,6 +113,8 @@ void EvalState::forceValue(Value & v, const PosIdx pos)
             throw;
         }
     } else if (v.isApp()) {
+        if (executor->enabled) [[unlikely]]
+            return forceValueParallel(v, pos);
         Value savedApp = v;
         try {
             callFunction(*v.app().left, *v.app().right, v, pos);
@@ -119,6 +124,8 @@ void EvalState::forceValue(Value & v, const PosIdx pos)
         }
     } else if (v.isFailed()) {
         handleEvalFailed(v, pos);
+    } else if (v.isPending()) [[unlikely]] {
+        forceValueParallel(v, pos);
     }
 }
 
@@ -6,7 +6,10 @@
  */
 
 #include "nix/util/ref.hh"
+#include "nix/util/pos-idx.hh"
 
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <span>
 #include <bitset>
@@ -16,8 +19,9 @@
 namespace nix {
 
 class EvalState;
-class PosIdx;
 struct Value;
+struct ExprLambda;
+struct PrimOp;
 
 class EvalProfiler
 {
@@ -109,6 +113,78 @@ public:
     postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override;
 };
 
+/**
+ * The function calls that are being evaluated, pushed and popped by
+ * `EvalState::callFunction` when `EvalState::shadowStack` is set.
+ *
+ * A frame is just a pointer and a position, so maintaining the stack is
+ * cheap. It can be read at any time from a signal handler running on
+ * the evaluating thread, without locking.
+ */
+class ShadowStack
+{
+public:
+    enum class Kind : uint8_t {
+        Lambda,
+        PrimOp,
+        Functor,
+        Other,
+    };
+
+    struct Frame
+    {
+        Kind kind;
+        /** Position where the function has been called. */
+        PosIdx pos;
+
+        union
+        {
+            ExprLambda * lambda;
+            const PrimOp * primOp;
+        };
+    };
+
+    /**
+     * @param capacity The maximum number of frames that are recorded.
+     * Deeper frames are counted but not recorded.
+     */
+    ShadowStack(size_t capacity);
+
+    void push(const Value & fun, PosIdx pos);
+
+    void pop()
+    {
+        depth.store(depth.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * The number of frames, including those that are not recorded.
+     */
+    size_t size() const
+    {
+        return depth.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Copy the innermost recorded frames to `out`, outermost first, and
+     * return the part of `out` that has been filled. This is
+     * async-signal-safe.
+     */
+    std::span<Frame> snapshot(std::span<Frame> out) const;
+
+private:
+    std::unique_ptr<Frame[]> frames;
+    size_t capacity;
+    std::atomic<size_t> depth = 0;
+};
+
 ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency);
 
+/**
+ * Make a profiler that samples `state.shadowStack` from a `SIGPROF`
+ * timer firing `frequency` times per second of CPU time.
+ */
+ref<EvalProfiler> makeSignalSampleStackProfiler(
+    EvalState & state, std::filesystem::path profileFile, uint64_t frequency, size_t maxDepth);
+
 } // namespace nix
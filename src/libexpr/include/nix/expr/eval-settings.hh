@@ -269,6 +269,10 @@ struct EvalSettings : Config
           Enables evaluation profiling. The following modes are supported:
 
           * `flamegraph` stack sampling profiler. Outputs folded format, one line per stack (suitable for `flamegraph.pl` and compatible tools).
+          * `sampling` stack sampling profiler driven by a timer signal, with much lower overhead than `flamegraph`.
+            Samples are taken in proportion to CPU time.
+            Produces the same format as `flamegraph`, but doesn't show the names of derivations.
+            Not available on Windows.
 
           Use [`eval-profile-file`](#conf-eval-profile-file) to specify where the profile is saved.
 
@@ -289,7 +293,7 @@ struct EvalSettings : Config
         "eval-profiler-frequency",
         R"(
           Specifies the sampling rate in hertz for sampling evaluation profilers.
-          Use `0` to sample the stack after each function call.
+          For the `flamegraph` profiler, use `0` to sample the stack after each function call.
           See [`eval-profiler`](#conf-eval-profiler).
         )"};
 
@@ -303,6 +307,33 @@ struct EvalSettings : Config
             Intermediate results are not cached.
         )"};
 
+    Setting<bool> useParseCache{
+        this,
+        false,
+        "parse-cache",
+        R"(
+          Whether to cache the result of parsing Nix files on disk, in
+          `~/.cache/nix/parse-cache-v1`. When a file with the same
+          contents is evaluated again from the same directory, Nix loads
+          the parsed expression from the cache instead of running the
+          parser. This mostly helps commands that read a large number of
+          files, such as `nix search` on Nixpkgs.
+
+          Files whose parse produces warnings are not cached. See also
+          [`parse-cache-size`](#conf-parse-cache-size).
+        )"};
+
+    Setting<uint64_t> parseCacheSize{
+        this,
+        256 * 1024 * 1024,
+        "parse-cache-size",
+        R"(
+          The maximum size in bytes of the
+          [parse cache](#conf-parse-cache), or `0` for no limit. When the
+          cache grows beyond this size, the least recently used entries
+          are removed.
+        )"};
+
     Setting<bool> ignoreExceptionsDuringTry{
         this,
         false,
@@ -321,6 +352,72 @@ struct EvalSettings : Config
     Setting<unsigned int> maxCallDepth{
         this, 10000, "max-call-depth", "The maximum function call depth to allow before erroring."};
 
+    Setting<unsigned int> evalCores{
+        this,
+        1,
+        "eval-cores",
+        R"(
+          The number of threads to use for evaluation. Commands that
+          evaluate many independent attributes, such as `nix search`,
+          `nix flake check` and `nix eval --json`, spread that work
+          over these threads. The value `0` means to use all CPU cores.
+
+          Parallel evaluation is disabled when the debugger,
+          [`eval-profiler`](#conf-eval-profiler) or
+          [`trace-function-calls`](#conf-trace-function-calls) is
+          enabled.
+        )"};
+
+    Setting<unsigned int> evalMemoSize{
+        this,
+        0,
+        "eval-memo-size",
+        R"(
+          The maximum number of function calls whose results are
+          remembered, so that calling the same function with the same
+          arguments again reuses the earlier result instead of
+          evaluating the function body again. The value `0` disables
+          this.
+
+          Arguments are compared by their structure as far as they
+          have already been evaluated, and are never evaluated just to
+          compare them. Besides lambdas, this applies to
+          `builtins.fromJSON`, `builtins.fromTOML`, `builtins.readFile`
+          and `builtins.hashFile`.
+
+          Calls that run `builtins.trace` or `builtins.warn` are not
+          remembered, so repeating them prints the message again.
+          However, a trace in a part of the result that is evaluated
+          after the call returns is printed only once for all calls
+          that share that result.
+
+          Because results are shared, positions reported by
+          `builtins.unsafeGetAttrPos` and in error traces may refer to
+          the first call. For the same reason, results that contain
+          functions may now compare equal, e.g. `let f = x: { g = y:
+          y; }; in f 1 == f 1` is `true` rather than `false`. This
+          setting has no effect when
+          [`eval-cores`](#conf-eval-cores) is not 1.
+        )"};
+
+    Setting<bool> gcIncremental{
+        this,
+        false,
+        "gc-incremental",
+        R"(
+          Whether to use incremental, generational garbage collection.
+          Instead of tracing the whole heap in one go, the collector
+          then mostly traces the objects that changed since the
+          previous collection, and does so in small steps. This
+          shortens the pauses of long-running evaluators such as
+          [`nix repl`](@docroot@/command-ref/new-cli/nix3-repl.md) or
+          evaluation servers, at the cost of some throughput.
+
+          The number and length of the pauses are reported by
+          `NIX_SHOW_STATS`. Once enabled, incremental collection stays
+          on for the rest of the process.
+        )"};
+
     Setting<bool> builtinsTraceDebugger{
         this,
         false,
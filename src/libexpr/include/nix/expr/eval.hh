@@ -52,6 +52,9 @@ struct SingleDerivedPath;
 enum RepairFlag : bool;
 struct MemorySourceAccessor;
 struct MountedSourceAccessor;
+class ParseCache;
+class FunctionMemo;
+class Executor;
 
 namespace eval_cache {
 class EvalCache;
@@ -133,6 +136,14 @@ struct PrimOp
      */
     bool internal = false;
 
+    /**
+     * Whether calls to this primop may be memoised (see
+     * `eval-memo-size`). This requires that the primop is strict in all
+     * its arguments, that its result depends only on them and that it
+     * has at most `FunctionMemo::maxArgs` arguments.
+     */
+    bool memoise = false;
+
     /**
      * Validity check to be performed by functions that introduce primops,
      * such as RegisterPrimOp() and Value::mkPrimOp().
@@ -411,6 +422,11 @@ public:
 
     const ref<fetchers::InputCache> inputCache;
 
+    /**
+     * The threads used for parallel evaluation, see `eval-cores`.
+     */
+    const ref<Executor> executor;
+
     /**
      * Debugger
      */
@@ -487,6 +503,24 @@ private:
      */
     const ref<boost::concurrent_flat_map<SourcePath, ref<DocCommentMap>>> positionToDocComment;
 
+    /**
+     * The on-disk cache of parsed files, if `parse-cache` is enabled.
+     */
+    std::unique_ptr<ParseCache> parseCache;
+
+    /**
+     * Results of earlier function calls, if `eval-memo-size` is set.
+     */
+    std::unique_ptr<FunctionMemo> functionMemo;
+
+    /**
+     * The number of calls to builtins with side effects, such as
+     * `builtins.trace`. A function call during which this changes is
+     * not memoised, so that repeating the call repeats its side
+     * effects.
+     */
+    std::atomic<uint64_t> nrSideEffects{0};
+
     LookupPath lookupPath;
 
     struct LookupPathResolvedState
@@ -680,6 +714,20 @@ private:
 
     void handleEvalFailed(Value & v, PosIdx pos);
 
+    /**
+     * The slow path of `forceValue()` if parallel evaluation is
+     * enabled. The thread that forces a thunk or application claims
+     * it by moving it to the pending state, and other threads that
+     * need it wait for the result.
+     */
+    void forceValueParallel(Value & v, PosIdx pos);
+
+    /**
+     * Replace the pending value `v` by `result` and wake up any
+     * threads waiting for it.
+     */
+    void finishForcing(Value & v, const Value & result);
+
     void tryFixupBlackHolePos(Value & v, PosIdx pos);
 
 public:
@@ -910,12 +958,17 @@ private:
     friend struct ExprAttrs;
     friend struct ExprLet;
 
+    /**
+     * @param cacheKey If set, look up the result in `parseCache` under
+     * this key, or store it there.
+     */
     Expr * parse(
         char * text,
         size_t length,
         Pos::Origin origin,
         const SourcePath & basePath,
-        const std::shared_ptr<StaticEnv> & staticEnv);
+        const std::shared_ptr<StaticEnv> & staticEnv,
+        const std::optional<Hash> & cacheKey = std::nullopt);
 
     ExprAttrs * parseReplBindings(
         char * text,
@@ -928,7 +981,7 @@ private:
      * Current Nix call stack depth, used with `max-call-depth` setting to throw stack overflow hopefully before we run
      * out of system stack.
      */
-    size_t callDepth = 0;
+    static thread_local size_t callDepth;
 
 public:
 
@@ -1089,6 +1142,12 @@ public:
 
     DocComment getDocCommentForPos(PosIdx pos);
 
+    /**
+     * The function calls being evaluated, if the sampling profiler is
+     * enabled. Owned by the profiler.
+     */
+    ShadowStack * shadowStack = nullptr;
+
 private:
 
     /**
@@ -1127,6 +1186,11 @@ private:
 
     void incrFunctionCall(ExprLambda * fun);
 
+    /**
+     * Call `fn`, using `functionMemo` if possible.
+     */
+    void callPrimOp(const PrimOp & fn, const PosIdx pos, Value ** args, Value & vRes);
+
     typedef boost::unordered_flat_map<PosIdx, size_t, std::hash<PosIdx>> AttrSelects;
     AttrSelects attrSelects;
 
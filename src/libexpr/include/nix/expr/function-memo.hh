@@ -0,0 +1,123 @@
+#pragma once
+///@file
+
+#include "nix/expr/eval-gc.hh"
+#include "nix/expr/value.hh"
+#include "nix/expr/counter.hh"
+
+#include <array>
+#include <optional>
+#include <span>
+#include <unordered_map>
+
+namespace nix {
+
+struct Env;
+
+/**
+ * A table of the results of function applications, so that applying
+ * the same function to the same arguments again doesn't evaluate its
+ * body again. Since evaluation is pure, the earlier result can be
+ * shared.
+ *
+ * A call is identified by the function (a lambda with its environment,
+ * or a primop) and its arguments. Arguments are compared structurally
+ * as far as they have been evaluated. Unevaluated parts are compared
+ * by what they would evaluate, i.e. the expression and environment of
+ * a thunk, so computing a key never forces anything. Arguments that
+ * are too large to hash cheaply are not memoised.
+ *
+ * When the table reaches its maximum size, it is cleared.
+ *
+ * See the `eval-memo-size` setting.
+ */
+class FunctionMemo
+{
+public:
+
+    static constexpr size_t maxArgs = 2;
+
+    struct Key
+    {
+        /**
+         * The `ExprLambda` or `PrimOp` being called.
+         */
+        const void * fun;
+
+        /**
+         * The environment of a lambda.
+         */
+        const Env * env;
+
+        /**
+         * Copies of the arguments as they were when the key was made.
+         */
+        std::array<Value, maxArgs> args;
+        size_t nrArgs;
+
+        size_t hash;
+    };
+
+    FunctionMemo(size_t maxSize)
+        : maxSize(maxSize)
+    {
+    }
+
+    /**
+     * Compute the key for calling `fun` in `env` with `args`, or return
+     * `std::nullopt` if the call should not be memoised.
+     */
+    static std::optional<Key> makeKey(const void * fun, const Env * env, std::span<Value * const> args);
+
+    /**
+     * Return the result of an earlier call with an equal key, if any.
+     */
+    const Value * lookup(const Key & key);
+
+    /**
+     * Record `result` as the result of `key`.
+     */
+    void insert(const Key & key, const Value & result);
+
+    size_t size() const
+    {
+        return table.size();
+    }
+
+    /**
+     * Forget all results, e.g. because files that they were read
+     * from may have changed.
+     */
+    void clear()
+    {
+        table.clear();
+    }
+
+    Counter hits;
+    Counter misses;
+
+private:
+
+    struct KeyHash
+    {
+        size_t operator()(const Key & key) const noexcept
+        {
+            return key.hash;
+        }
+    };
+
+    struct KeyEq
+    {
+        bool operator()(const Key & a, const Key & b) const noexcept;
+    };
+
+    size_t maxSize;
+
+    /**
+     * The keys and results refer to values and environments, so the
+     * table must be traced by the garbage collector.
+     */
+    std::unordered_map<Key, Value, KeyHash, KeyEq, traceable_allocator<std::pair<const Key, Value>>> table;
+};
+
+} // namespace nix
@@ -1,6 +1,7 @@
 #pragma once
 ///@file
 
+#include <atomic>
 #include <map>
 #include <span>
 #include <memory>
@@ -92,6 +93,19 @@ typedef std::vector<AttrName> AttrSelectionPath;
 
 std::string showAttrSelectionPath(const SymbolTable & symbols, std::span<const AttrName> attrPath);
 
+/**
+ * An inline cache for looking up an attribute name at one place in the
+ * program. It holds the shape of the last attribute set with a shape
+ * in which the attribute was found, and the index of the attribute in
+ * it.
+ *
+ * @see Bindings::get(Symbol, AttrLookupCache &)
+ */
+struct AttrLookupCache
+{
+    std::atomic<uint64_t> entry{0};
+};
+
 using UpdateQueue = SmallTemporaryValueVector<conservativeStackReservation>;
 
 /* Abstract syntax of Nix expressions. */
@@ -246,6 +260,12 @@ struct ExprVar : Expr
     Level level = 0;
     Displacement displ = 0;
 
+    /**
+     * The lookup cache for finding `name` in the attribute sets of
+     * `with` expressions.
+     */
+    mutable AttrLookupCache withCache;
+
     ExprVar(Symbol name)
         : name(name) {};
     ExprVar(const PosIdx & pos, Symbol name)
@@ -286,6 +306,17 @@ struct ExprSelect : Expr
     Expr *e, *def;
     AttrName * attrPathStart;
 
+    /**
+     * One lookup cache per element of the attribute path.
+     */
+    AttrLookupCache * lookupCaches;
+
+    /**
+     * `e` if it is a variable, so that `x.a.b` can select from the
+     * value of `x` directly. Set by `bindVars()`.
+     */
+    ExprVar * var = nullptr;
+
     ExprSelect(
         std::pmr::polymorphic_allocator<char> & alloc,
         const PosIdx & pos,
@@ -297,8 +328,10 @@ struct ExprSelect : Expr
         , e(e)
         , def(def)
         , attrPathStart(alloc.allocate_object<AttrName>(nAttrPath))
+        , lookupCaches(alloc.allocate_object<AttrLookupCache>(nAttrPath))
     {
         std::ranges::copy(attrPath, attrPathStart);
+        std::uninitialized_default_construct_n(lookupCaches, nAttrPath);
     };
 
     ExprSelect(std::pmr::polymorphic_allocator<char> & alloc, const PosIdx & pos, Expr * e, Symbol name)
@@ -307,7 +340,9 @@ struct ExprSelect : Expr
         , e(e)
         , def(0)
         , attrPathStart((alloc.allocate_object<AttrName>()))
+        , lookupCaches(alloc.allocate_object<AttrLookupCache>())
     {
+        std::uninitialized_default_construct_n(lookupCaches, 1);
         *attrPathStart = AttrName(name);
     };
 
@@ -419,6 +454,14 @@ struct ExprAttrs : Expr
      * dynamicAttrs will never be null. See comment on AttrDefs above.
      */
     std::optional<DynamicAttrDefs> dynamicAttrs;
+
+    /**
+     * The shape of the attribute sets that consist of exactly the
+     * attributes in `attrs`, or 0 if it hasn't been computed yet. See
+     * `Bindings::internShape()`.
+     */
+    std::atomic<uint32_t> shape{0};
+
     ExprAttrs(const PosIdx & pos)
         : recursive(false)
         , pos(pos)
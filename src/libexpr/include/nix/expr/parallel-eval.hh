@@ -0,0 +1,142 @@
+#pragma once
+///@file
+
+#include "nix/util/sync.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
+
+namespace nix {
+
+struct EvalSettings;
+
+/**
+ * A pool of threads that evaluate independent parts of a value
+ * concurrently, e.g. the attributes of Nixpkgs in `nix search`. See
+ * the `eval-cores` setting.
+ *
+ * Every thread has its own work queue. It runs work from the back of
+ * its own queue, and steals from the front of the other queues when
+ * that is empty. Since work spawned by a thread goes into its own
+ * queue, a thread that walks a deep attribute tree mostly stays in its
+ * own subtree, while idle threads take large chunks of work from
+ * near the root.
+ *
+ * Work items must keep any GC-allocated objects they use reachable by
+ * other means (e.g. through a `RootValue`), since the queues aren't
+ * scanned by the garbage collector.
+ */
+class Executor
+{
+public:
+
+    using Work = std::function<void()>;
+
+    Executor(const EvalSettings & settings);
+
+    ~Executor();
+
+    /**
+     * Whether work runs on other threads. If not, `spawn()` runs the
+     * work immediately on the calling thread.
+     */
+    const bool enabled;
+
+    /**
+     * Queue `items` for execution.
+     */
+    std::vector<std::future<void>> spawn(std::vector<Work> && items);
+
+    /**
+     * Wait until all `futures` are ready, running queued work on the
+     * calling thread in the meantime. Then rethrow the exception of
+     * the first future that failed, if any.
+     *
+     * This must not be called while forcing a value, since the
+     * calling thread may pick up work that needs that value.
+     */
+    void wait(std::vector<std::future<void>> & futures);
+
+    /**
+     * Run `items` concurrently and wait for all of them.
+     */
+    void runAll(std::vector<Work> && items)
+    {
+        auto futures = spawn(std::move(items));
+        wait(futures);
+    }
+
+private:
+
+    explicit Executor(unsigned int nrThreads);
+
+    struct Task
+    {
+        Work work;
+        std::promise<void> promise;
+    };
+
+    /**
+     * One queue per worker thread, plus one (the last) for threads
+     * that don't belong to the executor.
+     */
+    std::vector<std::unique_ptr<Sync<std::deque<Task>>>> queues;
+
+#ifndef _WIN32
+    std::vector<pthread_t> threads;
+#endif
+
+    /**
+     * The number of tasks in all queues.
+     */
+    std::atomic<size_t> queued{0};
+
+    struct State
+    {
+        bool quit = false;
+    };
+
+    Sync<State> state;
+
+    /**
+     * Signalled when new work is queued, to wake up idle workers.
+     */
+    std::condition_variable wakeup;
+
+    /**
+     * The number of threads blocked in `wait()`.
+     */
+    std::atomic<size_t> waiters{0};
+
+    /**
+     * Signalled when a task finishes or new work is queued while
+     * `waiters` is non-zero, to wake up threads in `wait()`.
+     */
+    std::condition_variable taskDone;
+
+    /**
+     * The index of the calling thread's queue.
+     */
+    size_t myQueue();
+
+    /**
+     * Take a task from our own queue or steal one from another.
+     */
+    std::optional<Task> takeTask(size_t self);
+
+    void run(Task & task);
+
+    void worker(size_t self);
+};
+
+} // namespace nix
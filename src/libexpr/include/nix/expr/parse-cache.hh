@@ -0,0 +1,109 @@
+#pragma once
+///@file
+
+#include "nix/expr/eval.hh"
+#include "nix/util/fun.hh"
+#include "nix/util/hash.hh"
+
+#include <atomic>
+#include <filesystem>
+
+namespace nix {
+
+/**
+ * Serialise the result of parsing a file, before `bindVars()`, into the
+ * format used by `ParseCache`. Positions are stored relative to
+ * `origin`, and symbols by name.
+ *
+ * @return `std::nullopt` if the expression can't be cached, e.g.
+ * because it contains path values that don't belong to `basePath` or
+ * `rootFS`.
+ */
+std::optional<std::string> serialiseParsedExpr(
+    Expr * e,
+    const PosTable::Origin & origin,
+    const DocCommentMap & docComments,
+    const SymbolTable & symbols,
+    const SourcePath & basePath,
+    const ref<SourceAccessor> & rootFS);
+
+/**
+ * The inverse of `serialiseParsedExpr()`. The resulting expression
+ * still needs `bindVars()`.
+ *
+ * @throws SerialisationError if `data` is corrupt.
+ */
+Expr * deserialiseParsedExpr(
+    std::string_view data,
+    const PosTable::Origin & origin,
+    DocCommentMap & docComments,
+    SymbolTable & symbols,
+    PosTable & positions,
+    Exprs & exprs,
+    const SourcePath & basePath,
+    const ref<SourceAccessor> & rootFS);
+
+/**
+ * An on-disk cache of parsed Nix files, so that evaluating the same
+ * files again (e.g. Nixpkgs for `nix search`) doesn't need to run the
+ * lexer and parser. Every entry is a file holding the output of
+ * `serialiseParsedExpr()`, which is memory-mapped on lookup. Entries
+ * are keyed by the hash of everything that the parse result depends
+ * on, so they never need to be invalidated. If the cache exceeds its
+ * maximum size, the least recently used entries are evicted.
+ *
+ * See the `parse-cache` and `parse-cache-size` settings.
+ */
+class ParseCache
+{
+    std::filesystem::path dir;
+
+    /**
+     * Maximum total size in bytes of the entries in `dir`, or 0 for no
+     * limit.
+     */
+    uint64_t maxSize;
+
+    /**
+     * Number of bytes written by `insert()`, used to decide when to
+     * check the size of the cache.
+     */
+    std::atomic<uint64_t> bytesWritten{0};
+
+    /**
+     * Delete the least recently used entries until the cache is no
+     * larger than `maxSize`.
+     */
+    void evict();
+
+public:
+
+    ParseCache(std::filesystem::path dir, uint64_t maxSize = 0);
+
+    /**
+     * Open the cache in the user's cache directory.
+     */
+    static std::unique_ptr<ParseCache> openDefault(uint64_t maxSize);
+
+    /**
+     * Compute the cache key for parsing `contents` as a file in the
+     * directory `basePath` with `settings`.
+     */
+    static Hash key(std::string_view contents, const SourcePath & basePath, const EvalSettings & settings);
+
+    /**
+     * Look up an entry and pass its contents to `decode`. If `decode`
+     * throws a `SerialisationError`, the entry is removed and `lookup()`
+     * returns `nullptr`, just like on a miss. Otherwise the entry is
+     * marked as recently used.
+     */
+    Expr * lookup(const Hash & key, fun<Expr *(std::string_view data)> decode);
+
+    /**
+     * Add an entry, and evict old entries if needed. Errors are
+     * ignored, since the cache is only an optimisation.
+     */
+    void insert(const Hash & key, std::string_view data);
+};
+
+} // namespace nix
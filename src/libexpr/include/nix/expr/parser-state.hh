@@ -163,6 +163,12 @@ struct ParserState
     static constexpr Expr::AstSymbols s = StaticEvalSymbols::create().exprSymbols;
     const EvalSettings & settings;
 
+    /**
+     * Whether the result can be put into the `ParseCache`. See
+     * `parseExprFromBuf()`.
+     */
+    bool cacheable = true;
+
     void dupAttr(const AttrSelectionPath & attrPath, const PosIdx pos, const PosIdx prevPos);
     void dupAttr(Symbol attr, const PosIdx pos, const PosIdx prevPos);
     void addAttr(
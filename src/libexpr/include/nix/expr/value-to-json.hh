@@ -22,6 +22,14 @@ void printValueAsJSON(
     NixStringContext & context,
     bool copyToStore = true);
 
+/**
+ * Force the parts of `v` that `printValueAsJSON()` needs in parallel
+ * (see `eval-cores`). Evaluation errors are ignored, since they are
+ * memoised and reported by the subsequent `printValueAsJSON()`. This
+ * is a no-op if parallel evaluation is disabled.
+ */
+void prefetchValueAsJSON(EvalState & state, Value & v, const PosIdx pos);
+
 MakeError(JSONSerializationError, Error);
 
 } // namespace nix
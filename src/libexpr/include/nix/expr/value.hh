@@ -64,6 +64,9 @@ enum InternalType {
     tListN = tFirstSingleUntaggable,
     tString,
     tPath,
+    /* Only used in parallel evaluation, see `EvalState::forceValue()`. */
+    tPending,
+    tAwaited,
     tNumberOfInternalTypes, // Must be last
 };
 
@@ -566,6 +569,38 @@ protected:
     {
         return false;
     }
+
+public:
+    /**
+     * Whether values can be forced by several threads at once. See
+     * `EvalState::forceValue()`.
+     */
+    static constexpr bool threadSafe = false;
+
+    void loadAcquire(ValueStorage & out) const noexcept
+    {
+        unreachable();
+    }
+
+    bool tryLock(ValueStorage & observed, uint32_t owner) noexcept
+    {
+        unreachable();
+    }
+
+    bool tryMarkAwaited(const ValueStorage & observed) noexcept
+    {
+        unreachable();
+    }
+
+    bool finish(const ValueStorage & result) noexcept
+    {
+        unreachable();
+    }
+
+    uint32_t pendingOwner() const noexcept
+    {
+        unreachable();
+    }
 };
 
 namespace detail {
@@ -645,6 +680,8 @@ class alignas(16)
         pdString,
         pdPath,
         pdPairOfPointers, //< layout: Pair of pointers payload
+        pdPending, //< layout: The owning thread in the upper bits of the first dword
+        pdAwaited,
     };
 
 #if defined(__x86_64__) && defined(__SSE2__)
@@ -816,6 +853,10 @@ protected:
             return static_cast<InternalType>(tFirstSingleUntaggable + (pd - pdListN));
         case pdPairOfPointers:
             return static_cast<InternalType>(tFirstPairOfPointers + (payload[1] & discriminatorMask));
+        case pdPending:
+            return tPending;
+        case pdAwaited:
+            return tAwaited;
         [[unlikely]] default:
             nixUnreachableWhenHardened();
         }
@@ -962,6 +1003,97 @@ protected:
     {
         setSingleDWordPayload<tFailed>(std::bit_cast<PackedPointer>(failed));
     }
+
+    /* Support for forcing values from multiple threads. The state of a
+       value is determined by its first dword alone: a thread takes
+       ownership of a thunk by atomically replacing the first dword
+       with `pdPending`, and publishes the result by writing the second
+       dword and then atomically replacing the first one. So a reader
+       that sees a final first dword also sees the matching second
+       one. */
+
+    PackedPointer * dwords() noexcept
+    {
+        return reinterpret_cast<PackedPointer *>(&payloadWords);
+    }
+
+    const PackedPointer * dwords() const noexcept
+    {
+        return reinterpret_cast<const PackedPointer *>(&payloadWords);
+    }
+
+public:
+    /**
+     * Whether values can be forced by several threads at once. See
+     * `EvalState::forceValue()`.
+     */
+    static constexpr bool threadSafe = true;
+
+    /**
+     * Copy this value into `out` such that the second dword is at
+     * least as new as the first.
+     */
+    void loadAcquire(ValueStorage & out) const noexcept
+    {
+        Payload payload;
+        payload[0] = __atomic_load_n(&dwords()[0], __ATOMIC_ACQUIRE);
+        payload[1] = __atomic_load_n(&dwords()[1], __ATOMIC_RELAXED);
+        out.updatePayload(payload);
+    }
+
+    /**
+     * Move this value from the state in `observed` (a thunk or
+     * application) to the pending state owned by the thread `owner`.
+     * On success, `observed` is updated to the exact state that was
+     * replaced.
+     */
+    bool tryLock(ValueStorage & observed, uint32_t owner) noexcept
+    {
+        auto expected = observed.loadPayload()[0];
+        PackedPointer desired = pdPending | (PackedPointer(owner) << discriminatorBits);
+        if (!__atomic_compare_exchange_n(
+                &dwords()[0], &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return false;
+        /* Nobody else writes the second dword of a pending value, but
+           `observed` may have been loaded from a previous state. */
+        observed.updatePayload({expected, __atomic_load_n(&dwords()[1], __ATOMIC_RELAXED)});
+        return true;
+    }
+
+    /**
+     * Tell the owner of the pending value `observed` that another
+     * thread is waiting for it. Returns false if the value is no
+     * longer pending.
+     */
+    bool tryMarkAwaited(const ValueStorage & observed) noexcept
+    {
+        auto expected = observed.loadPayload()[0];
+        if (getPrimaryDiscriminator(expected) == pdAwaited)
+            return true;
+        auto desired = (expected & ~discriminatorMask) | pdAwaited;
+        return __atomic_compare_exchange_n(&dwords()[0], &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+               || getPrimaryDiscriminator(expected) == pdAwaited;
+    }
+
+    /**
+     * Replace a pending value owned by the calling thread by `result`.
+     * Returns true if other threads are waiting for it.
+     */
+    bool finish(const ValueStorage & result) noexcept
+    {
+        auto payload = result.loadPayload();
+        __atomic_store_n(&dwords()[1], payload[1], __ATOMIC_RELAXED);
+        auto prev = __atomic_exchange_n(&dwords()[0], payload[0], __ATOMIC_ACQ_REL);
+        return getPrimaryDiscriminator(prev) == pdAwaited;
+    }
+
+    /**
+     * The thread that owns a pending value.
+     */
+    uint32_t pendingOwner() const noexcept
+    {
+        return loadPayload()[0] >> discriminatorBits;
+    }
 };
 
 /**
@@ -1243,6 +1375,14 @@ public:
         return isa<tFailed>();
     }
 
+    /**
+     * Whether another thread is currently forcing this value.
+     */
+    inline bool isPending() const
+    {
+        return isa<tPending, tAwaited>();
+    }
+
     /**
      * Returns the normal type of a Value. This only returns nThunk if
      * the Value hasn't been forceValue'd
@@ -1274,6 +1414,8 @@ public:
             t[tListN] = nList;
             t[tString] = nString;
             t[tPath] = nPath;
+            t[tPending] = nThunk;
+            t[tAwaited] = nThunk;
             return t;
         }();
 
@@ -1532,7 +1674,7 @@ extern ExprBlackHole eBlackHole;
 
 bool Value::isBlackhole() const
 {
-    return isThunk() && thunk().expr == (Expr *) &eBlackHole;
+    return isPending() || (isThunk() && thunk().expr == (Expr *) &eBlackHole);
 }
 
 void Value::mkBlackhole()
@@ -360,6 +360,7 @@ void ExprSelect::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv>
         es.exprEnvs.insert(std::make_pair(this, env));
 
     e->bindVars(es, env);
+    var = dynamic_cast<ExprVar *>(e);
     if (def)
         def->bindVars(es, env);
     for (auto & i : getAttrPath())
@@ -0,0 +1,254 @@
+#include "nix/expr/parallel-eval.hh"
+#include "nix/expr/eval-gc.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/expr/value.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/signals.hh"
+
+namespace nix {
+
+/**
+ * The executor and queue of the calling thread, if it's a worker.
+ */
+static thread_local Executor * currentExecutor = nullptr;
+static thread_local size_t currentQueue = 0;
+
+/**
+ * Same as the main thread, see `EvalState::EvalState()`.
+ */
+static constexpr size_t workerStackSize = 60 * 1024 * 1024;
+
+static unsigned int evalThreads(const EvalSettings & settings)
+{
+    auto nrThreads = settings.evalCores ? settings.evalCores.get() : Settings::getDefaultCores();
+    if (nrThreads <= 1)
+        return 1;
+#ifdef _WIN32
+    return 1;
+#else
+    if (!Value::threadSafe)
+        return 1;
+    if (settings.traceFunctionCalls || settings.evalProfilerMode != EvalProfilerMode::disabled) {
+        warn("ignoring 'eval-cores' because function call tracing or the evaluation profiler is enabled");
+        return 1;
+    }
+    return nrThreads;
+#endif
+}
+
+Executor::Executor(const EvalSettings & settings)
+    : Executor(evalThreads(settings))
+{
+}
+
+Executor::Executor(unsigned int nrThreads)
+    : enabled(nrThreads > 1)
+{
+    if (!enabled)
+        return;
+
+#ifndef _WIN32
+    /* The calling thread helps out in `wait()`, so it counts as one
+       of the threads. */
+    auto nrWorkers = nrThreads - 1;
+
+    for (size_t i = 0; i < nrWorkers + 1; ++i)
+        queues.push_back(std::make_unique<Sync<std::deque<Task>>>());
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, workerStackSize);
+
+    struct Start
+    {
+        Executor * executor;
+        size_t self;
+    };
+
+    for (size_t i = 0; i < nrWorkers; ++i) {
+        pthread_t thread;
+        /* With Boehm GC, this is `GC_pthread_create()`, which registers
+           the thread with the collector. */
+        auto start = new Start{this, i};
+        if (int err = pthread_create(
+                &thread,
+                &attr,
+                [](void * arg) -> void * {
+                    auto start = static_cast<Start *>(arg);
+                    auto [executor, self] = *start;
+                    delete start;
+                    executor->worker(self);
+                    return nullptr;
+                },
+                start)) {
+            delete start;
+            pthread_attr_destroy(&attr);
+            throw SysError(err, "creating evaluator thread");
+        }
+        threads.push_back(thread);
+    }
+
+    pthread_attr_destroy(&attr);
+
+    debug("evaluating with %d threads", nrThreads);
+#endif
+}
+
+Executor::~Executor()
+{
+#ifndef _WIN32
+    state.lock()->quit = true;
+    wakeup.notify_all();
+    for (auto & thread : threads)
+        pthread_join(thread, nullptr);
+#endif
+}
+
+size_t Executor::myQueue()
+{
+    return currentExecutor == this ? currentQueue : queues.size() - 1;
+}
+
+std::vector<std::future<void>> Executor::spawn(std::vector<Work> && items)
+{
+    std::vector<std::future<void>> futures;
+    futures.reserve(items.size());
+
+    if (!enabled) {
+        for (auto & work : items) {
+            Task task{.work = std::move(work)};
+            futures.push_back(task.promise.get_future());
+            run(task);
+        }
+        return futures;
+    }
+
+    {
+        auto queue(queues[myQueue()]->lock());
+        for (auto & work : items) {
+            Task task{.work = std::move(work)};
+            futures.push_back(task.promise.get_future());
+            queue->push_back(std::move(task));
+        }
+    }
+
+    queued += items.size();
+
+    /* Acquire the lock so that workers that just found no work are
+       either already waiting or will see the new work. */
+    {
+        auto state_(state.lock());
+    }
+    if (items.size() == 1)
+        wakeup.notify_one();
+    else
+        wakeup.notify_all();
+    if (waiters)
+        taskDone.notify_all();
+
+    return futures;
+}
+
+std::optional<Executor::Task> Executor::takeTask(size_t self)
+{
+    if (!queued)
+        return std::nullopt;
+
+    /* Newest work from our own queue first, since it's most likely to
+       be related to what we did last. */
+    {
+        auto queue(queues[self]->lock());
+        if (!queue->empty()) {
+            auto task = std::move(queue->back());
+            queue->pop_back();
+            queued--;
+            return task;
+        }
+    }
+
+    /* Otherwise steal the oldest work from the others, which is
+       likely to be the biggest chunk. */
+    for (size_t i = 1; i < queues.size(); ++i) {
+        auto queue(queues[(self + i) % queues.size()]->lock());
+        if (!queue->empty()) {
+            auto task = std::move(queue->front());
+            queue->pop_front();
+            queued--;
+            return task;
+        }
+    }
+
+    return std::nullopt;
+}
+
+void Executor::run(Task & task)
+{
+    try {
+        task.work();
+        task.promise.set_value();
+    } catch (...) {
+        task.promise.set_exception(std::current_exception());
+    }
+
+    /* Pairs with the fence in `wait()`: either the waiter sees that
+       the future is ready, or we see the waiter. */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters) {
+        {
+            auto state_(state.lock());
+        }
+        taskDone.notify_all();
+    }
+}
+
+void Executor::worker(size_t self)
+{
+    currentExecutor = this;
+    currentQueue = self;
+
+    while (true) {
+        if (auto task = takeTask(self)) {
+            run(*task);
+            continue;
+        }
+
+        auto state_(state.lock());
+        if (state_->quit)
+            break;
+        if (!queued)
+            state_.wait(wakeup);
+    }
+}
+
+void Executor::wait(std::vector<std::future<void>> & futures)
+{
+    auto isReady = [](std::future<void> & future) {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    };
+
+    for (auto & future : futures) {
+        while (!isReady(future)) {
+            if (auto task = takeTask(myQueue())) {
+                run(*task);
+                continue;
+            }
+
+            /* Block until a task finishes or new work is queued. */
+            waiters++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            {
+                auto state_(state.lock());
+                if (!queued && !isReady(future))
+                    state_.wait(taskDone);
+            }
+            waiters--;
+        }
+    }
+
+    checkInterrupt();
+
+    for (auto & future : futures)
+        future.get();
+}
+
+} // namespace nix
@@ -0,0 +1,1002 @@
+#include "nix/expr/parse-cache.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/file-system-at.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/signals.hh"
+#include "nix/util/users.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+#ifndef _WIN32
+#  include <sys/mman.h>
+#endif
+
+namespace nix {
+
+/* Bump this whenever the format or the meaning of any field
+   changes. Since the cache key includes the Nix version, this is only
+   needed for changes within a version. */
+static constexpr uint32_t parseCacheVersion = 1;
+
+static constexpr std::string_view parseCacheMagic = "nix-parse-cache\n";
+
+namespace {
+
+enum class Tag : uint8_t {
+    Int,
+    Float,
+    String,
+    Path,
+    Var,
+    InheritFrom,
+    Select,
+    OpHasAttr,
+    Attrs,
+    List,
+    Lambda,
+    Call,
+    Let,
+    With,
+    If,
+    Assert,
+    OpNot,
+    OpEq,
+    OpNEq,
+    OpAnd,
+    OpOr,
+    OpImpl,
+    OpConcatLists,
+    OpUpdate,
+    ConcatStrings,
+    Pos,
+};
+
+/**
+ * Thrown by `Serialiser` when it encounters something that can't be
+ * cached.
+ */
+struct Uncacheable
+{};
+
+/**
+ * Every node is written after its children, so that the reader can
+ * construct them bottom-up. Nodes refer to each other by their index
+ * in the file plus one (so that 0 means `nullptr`). Since nodes are
+ * written once, shared subexpressions stay shared.
+ */
+struct Serialiser
+{
+    const PosTable::Origin & origin;
+    const SymbolTable & symbols;
+    const SourcePath & basePath;
+    const ref<SourceAccessor> & rootFS;
+
+    std::string nodes;
+    uint32_t nrNodes = 0;
+    boost::unordered_flat_map<const Expr *, uint32_t> nodeIds;
+
+    std::string symbolTable;
+    boost::unordered_flat_map<Symbol, uint32_t, std::hash<Symbol>> symbolIds;
+
+    template<typename T>
+    static void put(std::string & out, T n)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.append(reinterpret_cast<const char *>(&n), sizeof(n));
+    }
+
+    void put(uint8_t n)
+    {
+        put(nodes, n);
+    }
+
+    void put(uint32_t n)
+    {
+        put(nodes, n);
+    }
+
+    void put(std::string_view s)
+    {
+        put(nodes, (uint32_t) s.size());
+        nodes.append(s);
+    }
+
+    void put(Tag tag)
+    {
+        put((uint8_t) tag);
+    }
+
+    void put(PosIdx pos)
+    {
+        if (!pos)
+            return put((uint32_t) 0);
+        auto offset = origin.offsetOf(pos);
+        if (offset > origin.size)
+            throw Uncacheable();
+        put(offset + 1);
+    }
+
+    void put(Symbol sym)
+    {
+        if (!sym)
+            return put((uint32_t) 0);
+        auto [i, inserted] = symbolIds.try_emplace(sym, symbolIds.size() + 1);
+        if (inserted) {
+            std::string_view s = symbols[sym];
+            put(symbolTable, (uint32_t) s.size());
+            symbolTable.append(s);
+        }
+        put(i->second);
+    }
+
+    void putAttrPath(std::span<const AttrName> attrPath)
+    {
+        put((uint32_t) attrPath.size());
+        for (auto & i : attrPath) {
+            if (i.symbol) {
+                put((uint8_t) 0);
+                put(i.symbol);
+            } else {
+                put((uint8_t) 1);
+                put(node(i.expr));
+            }
+        }
+    }
+
+    /**
+     * Return the node reference for `e`, writing it (and its
+     * children) if necessary.
+     */
+    uint32_t node(const Expr * e)
+    {
+        if (!e)
+            return 0;
+        if (auto i = nodeIds.find(e); i != nodeIds.end())
+            return i->second;
+
+        write(e);
+
+        auto id = ++nrNodes;
+        nodeIds.emplace(e, id);
+        return id;
+    }
+
+    void writeBinOp(Tag tag, PosIdx pos, Expr * e1, Expr * e2)
+    {
+        auto r1 = node(e1), r2 = node(e2);
+        put(tag);
+        put(pos);
+        put(r1);
+        put(r2);
+    }
+
+    void write(const Expr * e0)
+    {
+        if (auto e = dynamic_cast<const ExprInt *>(e0)) {
+            put(Tag::Int);
+            put(nodes, e->v.integer().value);
+        }
+
+        else if (auto e = dynamic_cast<const ExprFloat *>(e0)) {
+            put(Tag::Float);
+            put(nodes, e->v.fpoint());
+        }
+
+        else if (auto e = dynamic_cast<const ExprString *>(e0)) {
+            put(Tag::String);
+            put(e->v.string_view());
+        }
+
+        else if (auto e = dynamic_cast<const ExprPath *>(e0)) {
+            /* Path literals are resolved against the root or the
+               directory of the file. The latter is part of the cache
+               key. */
+            put(Tag::Path);
+            if (e->accessor == rootFS)
+                put((uint8_t) 0);
+            else if (e->accessor == basePath.accessor)
+                put((uint8_t) 1);
+            else
+                throw Uncacheable();
+            put(std::string_view(e->v.pathStrView()));
+        }
+
+        else if (auto e = dynamic_cast<const ExprInheritFrom *>(e0)) {
+            put(Tag::InheritFrom);
+            put(e->pos);
+            put(e->displ);
+        }
+
+        else if (auto e = dynamic_cast<const ExprVar *>(e0)) {
+            put(Tag::Var);
+            put(e->pos);
+            put(e->name);
+        }
+
+        else if (auto e = dynamic_cast<const ExprSelect *>(e0)) {
+            auto re = node(e->e), rdef = node(e->def);
+            for (auto & i : e->getAttrPath())
+                if (!i.symbol)
+                    node(i.expr);
+            put(Tag::Select);
+            put(e->pos);
+            put(re);
+            put(rdef);
+            putAttrPath(e->getAttrPath());
+        }
+
+        else if (auto e = dynamic_cast<const ExprOpHasAttr *>(e0)) {
+            auto re = node(e->e);
+            for (auto & i : e->attrPath)
+                if (!i.symbol)
+                    node(i.expr);
+            put(Tag::OpHasAttr);
+            put(re);
+            putAttrPath(e->attrPath);
+        }
+
+        else if (auto e = dynamic_cast<const ExprAttrs *>(e0)) {
+            std::vector<uint32_t> attrs, inheritFrom, dynamicAttrs;
+            for (auto & [name, def] : *e->attrs)
+                attrs.push_back(node(def.e));
+            if (e->inheritFromExprs)
+                for (auto from : *e->inheritFromExprs)
+                    inheritFrom.push_back(node(from));
+            for (auto & def : *e->dynamicAttrs) {
+                dynamicAttrs.push_back(node(def.nameExpr));
+                dynamicAttrs.push_back(node(def.valueExpr));
+            }
+
+            put(Tag::Attrs);
+            put((uint8_t) e->recursive);
+            put(e->pos);
+
+            put((uint32_t) attrs.size());
+            size_t n = 0;
+            for (auto & [name, def] : *e->attrs) {
+                put(name);
+                put((uint8_t) def.kind);
+                put(def.pos);
+                put(attrs[n++]);
+            }
+
+            /* Distinguish between no `inherit (...)` and an empty list. */
+            put((uint32_t) (e->inheritFromExprs ? inheritFrom.size() + 1 : 0));
+            for (auto r : inheritFrom)
+                put(r);
+
+            put((uint32_t) e->dynamicAttrs->size());
+            n = 0;
+            for (auto & def : *e->dynamicAttrs) {
+                put(def.pos);
+                put(dynamicAttrs[n++]);
+                put(dynamicAttrs[n++]);
+            }
+        }
+
+        else if (auto e = dynamic_cast<const ExprList *>(e0)) {
+            std::vector<uint32_t> elems;
+            for (auto elem : e->elems)
+                elems.push_back(node(elem));
+            put(Tag::List);
+            put((uint32_t) elems.size());
+            for (auto r : elems)
+                put(r);
+        }
+
+        else if (auto e = dynamic_cast<const ExprLambda *>(e0)) {
+            auto formals = e->getFormals();
+            std::vector<uint32_t> defs;
+            if (formals)
+                for (auto & formal : formals->formals)
+                    defs.push_back(node(formal.def));
+            auto body = node(e->body);
+
+            put(Tag::Lambda);
+            put(e->pos);
+            put(e->name);
+            put(e->arg);
+            put(e->docComment.begin);
+            put(e->docComment.end);
+            put(body);
+            put((uint8_t) (formals ? 1 + formals->ellipsis : 0));
+            if (formals) {
+                put((uint32_t) formals->formals.size());
+                size_t n = 0;
+                for (auto & formal : formals->formals) {
+                    put(formal.pos);
+                    put(formal.name);
+                    put(defs[n++]);
+                }
+            }
+        }
+
+        else if (auto e = dynamic_cast<const ExprCall *>(e0)) {
+            /* These produce a warning while parsing, which we'd lose. */
+            if (e->cursedOrEndPos)
+                throw Uncacheable();
+            auto fun = node(e->fun);
+            std::vector<uint32_t> args;
+            for (auto arg : *e->args)
+                args.push_back(node(arg));
+            put(Tag::Call);
+            put(e->pos);
+            put(fun);
+            put((uint32_t) args.size());
+            for (auto r : args)
+                put(r);
+        }
+
+        else if (auto e = dynamic_cast<const ExprLet *>(e0)) {
+            auto attrs = node(e->attrs), body = node(e->body);
+            put(Tag::Let);
+            put(attrs);
+            put(body);
+        }
+
+        else if (auto e = dynamic_cast<const ExprWith *>(e0)) {
+            auto attrs = node(e->attrs), body = node(e->body);
+            put(Tag::With);
+            put(e->pos);
+            put(attrs);
+            put(body);
+        }
+
+        else if (auto e = dynamic_cast<const ExprIf *>(e0)) {
+            auto cond = node(e->cond), then = node(e->then), else_ = node(e->else_);
+            put(Tag::If);
+            put(e->pos);
+            put(cond);
+            put(then);
+            put(else_);
+        }
+
+        else if (auto e = dynamic_cast<const ExprAssert *>(e0)) {
+            auto cond = node(e->cond), body = node(e->body);
+            put(Tag::Assert);
+            put(e->pos);
+            put(cond);
+            put(body);
+        }
+
+        else if (auto e = dynamic_cast<const ExprOpNot *>(e0)) {
+            auto r = node(e->e);
+            put(Tag::OpNot);
+            put(r);
+        }
+
+        else if (auto e = dynamic_cast<const ExprOpEq *>(e0))
+            writeBinOp(Tag::OpEq, e->pos, e->e1, e->e2);
+        else if (auto e = dynamic_cast<const ExprOpNEq *>(e0))
+            writeBinOp(Tag::OpNEq, e->pos, e->e1, e->e2);
+        else if (auto e = dynamic_cast<const ExprOpAnd *>(e0))
+            writeBinOp(Tag::OpAnd, e->pos, e->e1, e->e2);
+        else if (auto e = dynamic_cast<const ExprOpOr *>(e0))
+            writeBinOp(Tag::OpOr, e->pos, e->e1, e->e2);
+        else if (auto e = dynamic_cast<const ExprOpImpl *>(e0))
+            writeBinOp(Tag::OpImpl, e->pos, e->e1, e->e2);
+        else if (auto e = dynamic_cast<const ExprOpConcatLists *>(e0))
+            writeBinOp(Tag::OpConcatLists, e->pos, e->e1, e->e2);
+        else if (auto e = dynamic_cast<const ExprOpUpdate *>(e0))
+            writeBinOp(Tag::OpUpdate, e->pos, e->e1, e->e2);
+
+        else if (auto e = dynamic_cast<const ExprConcatStrings *>(e0)) {
+            std::vector<uint32_t> parts;
+            for (auto & [pos, part] : e->es)
+                parts.push_back(node(part));
+            put(Tag::ConcatStrings);
+            put(e->pos);
+            put((uint8_t) e->forceString);
+            put((uint32_t) parts.size());
+            size_t n = 0;
+            for (auto & [pos, part] : e->es) {
+                put(pos);
+                put(parts[n++]);
+            }
+        }
+
+        else if (auto e = dynamic_cast<const ExprPos *>(e0)) {
+            put(Tag::Pos);
+            put(e->pos);
+        }
+
+        else
+            throw Uncacheable();
+    }
+};
+
+struct Deserialiser
+{
+    std::string_view data;
+    const PosTable::Origin & origin;
+    SymbolTable & symbols;
+    PosTable & positions;
+    Exprs & exprs;
+    const SourcePath & basePath;
+    const ref<SourceAccessor> & rootFS;
+
+    /**
+     * Whether to construct the expression. Entries are first read with
+     * this unset to check that they are well-formed, because nodes
+     * can't be freed from the `Exprs` arena if a corrupt entry is
+     * detected halfway through.
+     */
+    bool build;
+
+    std::vector<Symbol> symbolTable;
+    uint32_t nrSymbols = 0;
+    std::vector<Tag> nodeTags;
+    std::vector<Expr *> nodes;
+
+    [[noreturn]] static void corrupt()
+    {
+        throw SerialisationError("parse cache entry is corrupt");
+    }
+
+    template<typename T>
+    T get()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (data.size() < sizeof(T))
+            corrupt();
+        T n;
+        std::memcpy(&n, data.data(), sizeof(T));
+        data.remove_prefix(sizeof(T));
+        return n;
+    }
+
+    /**
+     * Read a number of items, each of which takes at least a byte, so
+     * that corrupt entries can't make us allocate huge amounts of memory.
+     */
+    uint32_t getCount()
+    {
+        auto n = get<uint32_t>();
+        if (n > data.size())
+            corrupt();
+        return n;
+    }
+
+    std::string_view getString()
+    {
+        auto len = get<uint32_t>();
+        if (data.size() < len)
+            corrupt();
+        auto s = data.substr(0, len);
+        data.remove_prefix(len);
+        return s;
+    }
+
+    PosIdx getPos()
+    {
+        auto offset = get<uint32_t>();
+        if (!offset)
+            return noPos;
+        if (offset - 1 > origin.size)
+            corrupt();
+        return build ? positions.add(origin, offset - 1) : noPos;
+    }
+
+    Symbol getSymbol()
+    {
+        auto i = get<uint32_t>();
+        if (!i)
+            return {};
+        if (i > nrSymbols)
+            corrupt();
+        return build ? symbolTable[i - 1] : Symbol();
+    }
+
+    /**
+     * Read a reference to a node that has already been read, and
+     * return its index plus one, or 0 for `nullptr`.
+     */
+    uint32_t getRef(bool optional = false)
+    {
+        auto i = get<uint32_t>();
+        if (!i) {
+            if (!optional)
+                corrupt();
+            return 0;
+        }
+        if (i > nodeTags.size())
+            corrupt();
+        return i;
+    }
+
+    Expr * getExpr(bool optional = false)
+    {
+        auto i = getRef(optional);
+        return i && build ? nodes[i - 1] : nullptr;
+    }
+
+    template<class C>
+    C * make(auto &&... args)
+    {
+        return build ? exprs.add<C>(std::forward<decltype(args)>(args)...) : nullptr;
+    }
+
+    std::vector<AttrName> getAttrPath()
+    {
+        std::vector<AttrName> attrPath;
+        auto n = getCount();
+        for (uint32_t i = 0; i < n; ++i)
+            if (get<uint8_t>() == 0)
+                attrPath.emplace_back(getSymbol());
+            else
+                attrPath.emplace_back(getExpr());
+        return attrPath;
+    }
+
+    template<class C>
+    Expr * readBinOp()
+    {
+        auto pos = getPos();
+        auto e1 = getExpr();
+        auto e2 = getExpr();
+        return make<C>(pos, e1, e2);
+    }
+
+    Expr * read(Tag tag)
+    {
+        switch (tag) {
+
+        case Tag::Int:
+            return make<ExprInt>(get<NixInt::Inner>());
+
+        case Tag::Float:
+            return make<ExprFloat>(get<NixFloat>());
+
+        case Tag::String:
+            return make<ExprString>(exprs.alloc, getString());
+
+        case Tag::Path: {
+            auto accessor = get<uint8_t>() ? basePath.accessor : rootFS;
+            return make<ExprPath>(exprs.alloc, accessor, getString());
+        }
+
+        case Tag::Var: {
+            auto pos = getPos();
+            return make<ExprVar>(pos, getSymbol());
+        }
+
+        case Tag::InheritFrom: {
+            auto pos = getPos();
+            return make<ExprInheritFrom>(pos, get<Displacement>());
+        }
+
+        case Tag::Select: {
+            auto pos = getPos();
+            auto e = getExpr();
+            auto def = getExpr(true);
+            auto attrPath = getAttrPath();
+            return make<ExprSelect>(exprs.alloc, pos, e, std::span<const AttrName>(attrPath), def);
+        }
+
+        case Tag::OpHasAttr: {
+            auto e = getExpr();
+            auto attrPath = getAttrPath();
+            return make<ExprOpHasAttr>(exprs.alloc, e, std::span<AttrName>(attrPath));
+        }
+
+        case Tag::Attrs: {
+            auto recursive = get<uint8_t>();
+            auto e = make<ExprAttrs>(getPos());
+            if (e)
+                e->recursive = recursive;
+            auto nAttrs = get<uint32_t>();
+            for (uint32_t i = 0; i < nAttrs; ++i) {
+                auto name = getSymbol();
+                auto kind = get<uint8_t>();
+                if (kind > (uint8_t) ExprAttrs::AttrDef::Kind::InheritedFrom)
+                    corrupt();
+                auto pos = getPos();
+                auto value = getExpr();
+                if (e)
+                    e->attrs->emplace(name, ExprAttrs::AttrDef(value, pos, (ExprAttrs::AttrDef::Kind) kind));
+            }
+            if (auto nInheritFrom = get<uint32_t>()) {
+                if (e)
+                    e->inheritFromExprs = std::make_unique<std::pmr::vector<Expr *>>();
+                for (uint32_t i = 1; i < nInheritFrom; ++i) {
+                    auto from = getExpr();
+                    if (e)
+                        e->inheritFromExprs->push_back(from);
+                }
+            }
+            auto nDynamic = get<uint32_t>();
+            for (uint32_t i = 0; i < nDynamic; ++i) {
+                auto pos = getPos();
+                auto nameExpr = getExpr();
+                auto valueExpr = getExpr();
+                if (e)
+                    e->dynamicAttrs->emplace_back(nameExpr, valueExpr, pos);
+            }
+            return e;
+        }
+
+        case Tag::List: {
+            std::vector<Expr *> elems(getCount());
+            for (auto & elem : elems)
+                elem = getExpr();
+            return make<ExprList>(exprs.alloc, std::span<Expr *>(elems));
+        }
+
+        case Tag::Lambda: {
+            auto pos = getPos();
+            auto name = getSymbol();
+            auto arg = getSymbol();
+            DocComment docComment{.begin = getPos(), .end = getPos()};
+            auto body = getExpr();
+            auto hasFormals = get<uint8_t>();
+            if (hasFormals > 2)
+                corrupt();
+            ExprLambda * e;
+            if (hasFormals) {
+                FormalsBuilder formals;
+                formals.ellipsis = hasFormals == 2;
+                auto nFormals = get<uint32_t>();
+                if (nFormals > std::numeric_limits<uint16_t>::max())
+                    corrupt();
+                for (uint32_t i = 0; i < nFormals; ++i) {
+                    auto pos = getPos();
+                    auto name = getSymbol();
+                    formals.formals.push_back({.pos = pos, .name = name, .def = getExpr(true)});
+                }
+                /* Symbol IDs differ between processes, so re-establish
+                   the ordering that `FormalsBuilder` requires. */
+                std::sort(formals.formals.begin(), formals.formals.end(), [](const Formal & a, const Formal & b) {
+                    return std::tie(a.name, a.pos) < std::tie(b.name, b.pos);
+                });
+                e = make<ExprLambda>(positions, exprs.alloc, pos, arg, formals, body);
+            } else
+                e = make<ExprLambda>(pos, arg, body);
+            if (e) {
+                e->name = name;
+                e->docComment = docComment;
+            }
+            return e;
+        }
+
+        case Tag::Call: {
+            auto pos = getPos();
+            auto fun = getExpr();
+            std::pmr::vector<Expr *> args(getCount());
+            for (auto & arg : args)
+                arg = getExpr();
+            return make<ExprCall>(pos, fun, std::move(args));
+        }
+
+        case Tag::Let: {
+            auto i = getRef();
+            if (nodeTags[i - 1] != Tag::Attrs)
+                corrupt();
+            auto body = getExpr();
+            return make<ExprLet>(build ? static_cast<ExprAttrs *>(nodes[i - 1]) : nullptr, body);
+        }
+
+        case Tag::With: {
+            auto pos = getPos();
+            auto attrs = getExpr();
+            return make<ExprWith>(pos, attrs, getExpr());
+        }
+
+        case Tag::If: {
+            auto pos = getPos();
+            auto cond = getExpr();
+            auto then = getExpr();
+            return make<ExprIf>(pos, cond, then, getExpr());
+        }
+
+        case Tag::Assert: {
+            auto pos = getPos();
+            auto cond = getExpr();
+            return make<ExprAssert>(pos, cond, getExpr());
+        }
+
+        case Tag::OpNot:
+            return make<ExprOpNot>(getExpr());
+
+        case Tag::OpEq:
+            return readBinOp<ExprOpEq>();
+        case Tag::OpNEq:
+            return readBinOp<ExprOpNEq>();
+        case Tag::OpAnd:
+            return readBinOp<ExprOpAnd>();
+        case Tag::OpOr:
+            return readBinOp<ExprOpOr>();
+        case Tag::OpImpl:
+            return readBinOp<ExprOpImpl>();
+        case Tag::OpConcatLists:
+            return readBinOp<ExprOpConcatLists>();
+        case Tag::OpUpdate:
+            return readBinOp<ExprOpUpdate>();
+
+        case Tag::ConcatStrings: {
+            auto pos = getPos();
+            auto forceString = get<uint8_t>();
+            std::vector<std::pair<PosIdx, Expr *>> parts(getCount());
+            for (auto & part : parts) {
+                part.first = getPos();
+                part.second = getExpr();
+            }
+            return make<ExprConcatStrings>(
+                exprs.alloc, pos, forceString, std::span<std::pair<PosIdx, Expr *>>(parts));
+        }
+
+        case Tag::Pos:
+            return make<ExprPos>(getPos());
+
+        default:
+            corrupt();
+        }
+    }
+
+    /**
+     * Read a complete entry. Returns the root expression, or `nullptr`
+     * if `build` is not set.
+     */
+    Expr * readEntry(DocCommentMap & docComments)
+    {
+        if (!data.starts_with(parseCacheMagic))
+            corrupt();
+        data.remove_prefix(parseCacheMagic.size());
+        if (get<uint32_t>() != parseCacheVersion)
+            corrupt();
+
+        nrSymbols = getCount();
+        if (build)
+            symbolTable.reserve(nrSymbols);
+        for (uint32_t i = 0; i < nrSymbols; ++i) {
+            auto s = getString();
+            if (build)
+                symbolTable.push_back(symbols.create(s));
+        }
+
+        auto nNodes = getCount();
+        nodeTags.reserve(nNodes);
+        if (build)
+            nodes.reserve(nNodes);
+        for (uint32_t i = 0; i < nNodes; ++i) {
+            auto tag = get<Tag>();
+            auto e = read(tag);
+            nodeTags.push_back(tag);
+            if (build)
+                nodes.push_back(e);
+        }
+
+        auto root = getExpr();
+
+        auto nDocComments = get<uint32_t>();
+        for (uint32_t i = 0; i < nDocComments; ++i) {
+            auto pos = getPos();
+            DocComment docComment{.begin = getPos(), .end = getPos()};
+            if (build)
+                docComments.emplace(pos, docComment);
+        }
+
+        if (!data.empty())
+            corrupt();
+
+        return root;
+    }
+};
+
+} // namespace
+
+std::optional<std::string> serialiseParsedExpr(
+    Expr * e,
+    const PosTable::Origin & origin,
+    const DocCommentMap & docComments,
+    const SymbolTable & symbols,
+    const SourcePath & basePath,
+    const ref<SourceAccessor> & rootFS)
+{
+    Serialiser ser{
+        .origin = origin,
+        .symbols = symbols,
+        .basePath = basePath,
+        .rootFS = rootFS,
+    };
+
+    try {
+        auto root = ser.node(e);
+
+        ser.put(root);
+        ser.put((uint32_t) docComments.size());
+        for (auto & [pos, docComment] : docComments) {
+            ser.put(pos);
+            ser.put(docComment.begin);
+            ser.put(docComment.end);
+        }
+
+        std::string res;
+        res.append(parseCacheMagic);
+        Serialiser::put(res, parseCacheVersion);
+        Serialiser::put(res, (uint32_t) ser.symbolIds.size());
+        res.append(ser.symbolTable);
+        Serialiser::put(res, ser.nrNodes);
+        res.append(ser.nodes);
+        return res;
+    } catch (Uncacheable &) {
+        return std::nullopt;
+    }
+}
+
+Expr * deserialiseParsedExpr(
+    std::string_view data,
+    const PosTable::Origin & origin,
+    DocCommentMap & docComments,
+    SymbolTable & symbols,
+    PosTable & positions,
+    Exprs & exprs,
+    const SourcePath & basePath,
+    const ref<SourceAccessor> & rootFS)
+{
+    auto deserialiser = [&](bool build) {
+        return Deserialiser{
+            .data = data,
+            .origin = origin,
+            .symbols = symbols,
+            .positions = positions,
+            .exprs = exprs,
+            .basePath = basePath,
+            .rootFS = rootFS,
+            .build = build,
+        };
+    };
+
+    deserialiser(false).readEntry(docComments);
+    return deserialiser(true).readEntry(docComments);
+}
+
+ParseCache::ParseCache(std::filesystem::path dir, uint64_t maxSize)
+    : dir(std::move(dir))
+    , maxSize(maxSize)
+{
+    createDirs(this->dir);
+}
+
+std::unique_ptr<ParseCache> ParseCache::openDefault(uint64_t maxSize)
+{
+    return std::make_unique<ParseCache>(getCacheDir() / "parse-cache-v1", maxSize);
+}
+
+Hash ParseCache::key(std::string_view contents, const SourcePath & basePath, const EvalSettings & settings)
+{
+    HashSink sink(HashAlgorithm::SHA256);
+    /* Everything besides the contents that can affect the result of
+       parsing. Parses that produce warnings are not cached, but the
+       lint settings still matter since they could turn a cached file
+       into an error. */
+    sink(fmt("%d\n%s\n%s\n", parseCacheVersion, nixVersion, basePath.path.abs()));
+    sink(
+        fmt("%d %d %d\n",
+            (int) settings.lintShortPathLiterals.get(),
+            (int) settings.lintAbsolutePathLiterals.get(),
+            (int) settings.lintUrlLiterals.get()));
+    sink(experimentalFeatureSettings.isEnabled(Xp::PipeOperators) ? "pipe-operators\n" : "\n");
+    sink(contents);
+    return sink.finish().hash;
+}
+
+Expr * ParseCache::lookup(const Hash & key, fun<Expr *(std::string_view data)> decode)
+{
+    auto path = dir / key.to_string(HashFormat::Nix32, false);
+
+    try {
+#ifndef _WIN32
+        AutoCloseFD fd = openFileReadonly(path);
+        if (!fd)
+            return nullptr;
+
+        auto size = nix::fstat(fd.get()).st_size;
+        if (!size)
+            throw SerialisationError("parse cache entry is empty");
+
+        auto p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+        if (p == MAP_FAILED)
+            throw SysError("mapping %s", PathFmt(path));
+        Finally unmap([&]() { munmap(p, size); });
+
+        auto e = decode(std::string_view(static_cast<const char *>(p), size));
+#else
+        if (!pathExists(path))
+            return nullptr;
+        auto e = decode(readFile(path));
+#endif
+
+        /* Mark the entry as recently used. */
+        if (maxSize)
+            try {
+                auto now = time(nullptr);
+                setWriteTime(path, now, now, false);
+            } catch (SystemError &) {
+            }
+
+        return e;
+    } catch (SerialisationError & e) {
+        debug("removing parse cache entry %s: %s", PathFmt(path), e.msg());
+        try {
+            std::filesystem::remove(path);
+        } catch (std::filesystem::filesystem_error &) {
+        }
+        return nullptr;
+    }
+}
+
+void ParseCache::insert(const Hash & key, std::string_view data)
+{
+    auto path = dir / key.to_string(HashFormat::Nix32, false);
+
+    try {
+        /* Write to a temporary file and rename it into place, so that
+           concurrent readers never see a partial entry. */
+        auto tmpPath = makeTempPath(dir, ".tmp");
+        writeFile(tmpPath, data);
+        std::filesystem::rename(tmpPath, path);
+    } catch (std::exception & e) {
+        debug("cannot write parse cache entry %s: %s", PathFmt(path), e.what());
+        return;
+    }
+
+    /* Scanning the cache is expensive, so only check its size on the
+       first insertion and then after every 1/16th of `maxSize`. */
+    if (maxSize) {
+        auto interval = std::max<uint64_t>(maxSize / 16, 1);
+        auto before = bytesWritten.fetch_add(data.size());
+        if (before == 0 || before / interval != (before + data.size()) / interval)
+            try {
+                evict();
+            } catch (std::exception & e) {
+                debug("cannot evict parse cache entries: %s", e.what());
+            }
+    }
+}
+
+void ParseCache::evict()
+{
+    struct Entry
+    {
+        std::filesystem::path path;
+        time_t lastUsed;
+        uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+
+    for (auto & dirent : DirectoryIterator{dir}) {
+        checkInterrupt();
+        auto path = dirent.path();
+        /* Skip temporary files that are still being written. */
+        if (path.filename().string().starts_with("."))
+            continue;
+        auto st = maybeLstat(path);
+        if (!st)
+            continue;
+        entries.push_back({.path = path, .lastUsed = st->st_mtime, .size = (uint64_t) st->st_size});
+        totalSize += st->st_size;
+    }
+
+    if (totalSize <= maxSize)
+        return;
+
+    std::ranges::sort(entries, {}, &Entry::lastUsed);
+
+    /* Concurrent processes may both evict entries, which at worst
+       removes more entries than necessary. */
+    for (auto & entry : entries) {
+        if (totalSize <= maxSize)
+            break;
+        debug("evicting %s from the parse cache", PathFmt(entry.path));
+        tryUnlink(entry.path);
+        totalSize -= entry.size;
+    }
+}
+
+} // namespace nix
@@ -64,17 +64,26 @@ namespace nix {
 
 typedef boost::unordered_flat_map<PosIdx, DocComment, std::hash<PosIdx>> DocCommentMap;
 
+/**
+ * Parse a Nix expression from a buffer. `origin` must have been added
+ * to `positions` for this buffer.
+ *
+ * @param cacheable If not null, set to false if the result depends on
+ * more than the buffer and `basePath`, or if parsing produced warnings,
+ * so the result can't be put into the `ParseCache`.
+ */
 Expr * parseExprFromBuf(
     char * text,
     size_t length,
-    Pos::Origin origin,
+    const PosTable::Origin & origin,
     const SourcePath & basePath,
     Exprs & exprs,
     SymbolTable & symbols,
     const EvalSettings & settings,
     PosTable & positions,
     DocCommentMap & docComments,
-    const ref<SourceAccessor> rootFS);
+    const ref<SourceAccessor> rootFS,
+    bool * cacheable = nullptr);
 
 /**
  * Puts the lexer in REPL bindings mode before the first token. This causes
@@ -371,6 +380,7 @@ expr_simple
   }
   | URI {
       diagnose(state->settings.lintUrlLiterals, [&](bool fatal) -> std::optional<ParseError> {
+          state->cacheable = false;
           return ParseError({
               .msg = HintFmt("URL literals are %s. Consider using a string literal \"%s\" instead",
                   fatal ? "disallowed" : "discouraged",
@@ -417,6 +427,7 @@ path_start
 
     if (literal.front() == '/') {
         diagnose(state->settings.lintAbsolutePathLiterals, [&](bool) -> std::optional<ParseError> {
+            state->cacheable = false;
             return ParseError({
                 .msg = HintFmt("absolute path literals are not portable. Consider replacing path literal '%s' by a string, relative path, or parameter", literal),
                 .pos = state->positions[CUR_POS]
@@ -434,11 +445,13 @@ path_start
     } else {
         /* check for short path literals */
         diagnose(state->settings.lintShortPathLiterals, [&](bool) -> std::optional<ParseError> {
-            if (literal.front() != '.')
+            if (literal.front() != '.') {
+                state->cacheable = false;
                 return ParseError({
                     .msg = HintFmt("relative path literal '%s' should be prefixed with '.' for clarity: './%s'", literal, literal),
                     .pos = state->positions[CUR_POS]
                 });
+            }
             return std::nullopt;
         });
 
@@ -451,6 +464,8 @@ path_start
   }
   | HPATH {
     std::string_view literal($1.p, $1.l);
+    /* Depends on the environment. */
+    state->cacheable = false;
     if (state->settings.pureEval) {
         throw Error(
             "the path '%s' can not be resolved in pure mode",
@@ -597,20 +612,21 @@ namespace nix {
 Expr * parseExprFromBuf(
     char * text,
     size_t length,
-    Pos::Origin origin,
+    const PosTable::Origin & origin,
     const SourcePath & basePath,
     Exprs & exprs,
     SymbolTable & symbols,
     const EvalSettings & settings,
     PosTable & positions,
     DocCommentMap & docComments,
-    const ref<SourceAccessor> rootFS)
+    const ref<SourceAccessor> rootFS,
+    bool * cacheable)
 {
     yyscan_t scanner;
     LexerState lexerState {
         .positionToDocComment = docComments,
         .positions = positions,
-        .origin = positions.addOrigin(origin, length),
+        .origin = origin,
     };
     ParserState state {
         .lexerState = lexerState,
@@ -630,6 +646,9 @@ Expr * parseExprFromBuf(
     Parser parser(scanner, &state);
     parser.parse();
 
+    if (cacheable)
+        *cacheable = state.cacheable;
+
     return state.result;
 }
 
@@ -13,6 +13,7 @@
 #include "nix/util/mounted-source-accessor.hh"
 #include "nix/util/util.hh"
 #include "nix/util/os-string.hh"
+#include "nix/util/posix-regex.hh"
 #include "nix/util/processes.hh"
 #include "nix/expr/value-to-json.hh"
 #include "nix/expr/value-to-xml.hh"
@@ -32,7 +33,6 @@
 #include <algorithm>
 #include <cstring>
 #include <sstream>
-#include <regex>
 
 #ifndef _WIN32
 #  include <dlfcn.h>
@@ -52,10 +52,10 @@ RegisterPrimOp::PrimOps & RegisterPrimOp::primOps()
  * Miscellaneous
  *************************************************************/
 
-static inline Value * mkString(EvalState & state, const std::csub_match & match)
+static inline Value * mkString(EvalState & state, std::string_view s)
 {
     Value * v = state.allocValue();
-    v->mkString({match.first, match.second}, state.mem);
+    v->mkString(s, state.mem);
     return v;
 }
 
@@ -1288,6 +1288,7 @@ static RegisterPrimOp primop_deepSeq({
 static void prim_trace(EvalState & state, const PosIdx pos, Value ** args, Value & v)
 {
     state.forceValue(*args[0], pos);
+    state.nrSideEffects++;
     if (args[0]->type() == nString)
         printError("trace: %1%", args[0]->string_view());
     else
@@ -1323,6 +1324,8 @@ static void prim_warn(EvalState & state, const PosIdx pos, Value ** args, Value
     auto msgStr =
         state.forceString(*args[0], pos, "while evaluating the first argument; the message passed to builtins.warn");
 
+    state.nrSideEffects++;
+
     {
         ErrorInfo info{
             .level = lvlWarn,
@@ -2133,6 +2136,7 @@ static RegisterPrimOp primop_readFile({
       Return the contents of the file *path* as a string.
     )",
     .impl = prim_readFile,
+    .memoise = true,
 });
 
 /* Find a file in the Nix search path. Used to implement <x> paths,
@@ -2348,6 +2352,7 @@ static RegisterPrimOp primop_hashFile({
       of `"md5"`, `"sha1"`, `"sha256"` or `"sha512"`.
     )",
     .impl = prim_hashFile,
+    .memoise = true,
 });
 
 static const Value & fileTypeToString(EvalState & state, SourceAccessor::Type type)
@@ -2669,6 +2674,7 @@ static RegisterPrimOp primop_fromJSON({
       returns the value `{ x = [ 1 2 3 ]; y = null; }`.
     )",
     .impl = prim_fromJSON,
+    .memoise = true,
 });
 
 /* Store a string in the Nix store as a source file that can be used
@@ -4905,29 +4911,39 @@ struct RegexCache
 {
     struct Entry
     {
-        ref<const std::regex> regex;
+        ref<const PosixRegex> regex;
 
-        Entry(const char * s, size_t count)
-            : regex(make_ref<const std::regex>(s, count, std::regex::extended))
+        Entry(std::string_view s)
+            : regex(make_ref<const PosixRegex>(s))
         {
         }
     };
 
     boost::concurrent_flat_map<std::string, Entry, StringViewHash, std::equal_to<>> cache;
 
-    ref<const std::regex> get(std::string_view re)
+    ref<const PosixRegex> get(std::string_view re)
     {
-        std::optional<ref<const std::regex>> regex;
+        std::optional<ref<const PosixRegex>> regex;
         cache.try_emplace_and_cvisit(
             re,
-            /*s=*/re.data(),
-            /*count=*/re.size(),
+            re,
             [&regex](const auto & kv) { regex = kv.second.regex; },
             [&regex](const auto & kv) { regex = kv.second.regex; });
         return *regex;
     }
 };
 
+/**
+ * Return subexpression `i` of a match in `s`, or `null` if it did not
+ * participate in the match.
+ */
+static Value * subexpression(EvalState & state, std::string_view s, const PosixRegex::Groups & groups, size_t i)
+{
+    if (groups[2 * i] == PosixRegex::npos)
+        return &Value::vNull;
+    return mkString(state, s.substr(groups[2 * i], groups[2 * i + 1] - groups[2 * i]));
+}
+
 ref<RegexCache> makeRegexCache()
 {
     return make_ref<RegexCache>();
@@ -4945,24 +4961,21 @@ void prim_match(EvalState & state, const PosIdx pos, Value ** args, Value & v)
         const auto str =
             state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.match");
 
-        std::cmatch match;
-        if (!std::regex_match(str.begin(), str.end(), match, *regex)) {
+        PosixRegex::Groups groups;
+        if (!regex->match(str, groups)) {
             v.mkNull();
             return;
         }
 
         // the first match is the whole string
-        auto list = state.buildList(match.size() - 1);
+        auto list = state.buildList(regex->subexpressions());
         for (const auto & [i, v2] : enumerate(list))
-            if (!match[i + 1].matched)
-                v2 = &Value::vNull;
-            else
-                v2 = mkString(state, match[i + 1]);
+            v2 = subexpression(state, str, groups, i + 1);
         v.mkList(list);
 
     } catch (std::regex_error & e) {
         if (e.code() == std::regex_constants::error_space) {
-            // limit is _GLIBCXX_REGEX_STATE_LIMIT for libstdc++
+            // PosixRegex limits the size of the compiled expression
             state.error<EvalError>("memory limit exceeded by regular expression '%s'", re).atPos(pos).debugThrow();
         } else
             state.error<EvalError>("invalid regular expression '%s'", re).atPos(pos).debugThrow();
@@ -5019,53 +5032,37 @@ void prim_split(EvalState & state, const PosIdx pos, Value ** args, Value & v)
         const auto str =
             state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.split");
 
-        auto begin = std::cregex_iterator(str.begin(), str.end(), *regex);
-        auto end = std::cregex_iterator();
-
-        // Any matches results are surrounded by non-matching results.
-        const size_t len = std::distance(begin, end);
-        auto list = state.buildList(2 * len + 1);
-        size_t idx = 0;
-
-        if (len == 0) {
-            list[0] = args[1];
-            v.mkList(list);
-            return;
-        }
-
-        for (auto i = begin; i != end; ++i) {
-            assert(idx <= 2 * len + 1 - 3);
-            const auto & match = *i;
-
+        ValueVector matches;
+        size_t prev = 0;
+        regex->forEachMatch(str, [&](const PosixRegex::Groups & groups) {
             // Add a string for non-matched characters.
-            list[idx++] = mkString(state, match.prefix());
+            matches.push_back(mkString(state, str.substr(prev, groups[0] - prev)));
 
             // Add a list for matched substrings.
-            const size_t slen = match.size() - 1;
-
-            // Start at 1, because the first match is the whole string.
-            auto list2 = state.buildList(slen);
-            for (const auto & [si, v2] : enumerate(list2)) {
-                if (!match[si + 1].matched)
-                    v2 = &Value::vNull;
-                else
-                    v2 = mkString(state, match[si + 1]);
-            }
+            auto list2 = state.buildList(regex->subexpressions());
+            for (const auto & [si, v2] : enumerate(list2))
+                v2 = subexpression(state, str, groups, si + 1);
+            (matches.emplace_back(state.allocValue()))->mkList(list2);
 
-            (list[idx++] = state.allocValue())->mkList(list2);
+            prev = groups[1];
+        });
 
-            // Add a string for non-matched suffix characters.
-            if (idx == 2 * len)
-                list[idx++] = mkString(state, match.suffix());
+        if (matches.empty()) {
+            auto list = state.buildList(1);
+            list[0] = args[1];
+            v.mkList(list);
+            return;
         }
 
-        assert(idx == 2 * len + 1);
-
+        // Any matches results are surrounded by non-matching results.
+        auto list = state.buildList(matches.size() + 1);
+        std::copy(matches.begin(), matches.end(), list.begin());
+        list[matches.size()] = mkString(state, str.substr(prev));
         v.mkList(list);
 
     } catch (std::regex_error & e) {
         if (e.code() == std::regex_constants::error_space) {
-            // limit is _GLIBCXX_REGEX_STATE_LIMIT for libstdc++
+            // PosixRegex limits the size of the compiled expression
             state.error<EvalError>("memory limit exceeded by regular expression '%s'", re).atPos(pos).debugThrow();
         } else
             state.error<EvalError>("invalid regular expression '%s'", re).atPos(pos).debugThrow();
@@ -187,6 +187,7 @@ static RegisterPrimOp primop_fromTOML(
 
       returns the value `{ s = "a"; table = { y = 2; }; x = 1; }`.
     )",
-     .impl = prim_fromTOML});
+     .impl = prim_fromTOML,
+     .memoise = true});
 
 } // namespace nix
@@ -1,10 +1,12 @@
 #include "nix/expr/value-to-json.hh"
 #include "nix/expr/eval-inline.hh"
+#include "nix/expr/parallel-eval.hh"
 #include "nix/store/store-api.hh"
 #include "nix/util/signals.hh"
 
 #include <cstdlib>
 #include <nlohmann/json.hpp>
+#include <boost/unordered/concurrent_flat_set.hpp>
 
 namespace nix {
 using json = nlohmann::json;
@@ -104,6 +106,48 @@ json printValueAsJSON(
     return out;
 }
 
+void prefetchValueAsJSON(EvalState & state, Value & v, const PosIdx pos)
+{
+    if (!state.executor->enabled)
+        return;
+
+    boost::concurrent_flat_set<const Value *> seen;
+
+    [&](this const auto & recurse, Value & v, const PosIdx pos) -> void {
+        if (!seen.insert(&v))
+            return;
+
+        try {
+            state.forceValue(v, pos);
+        } catch (Error &) {
+            return;
+        }
+
+        std::vector<Executor::Work> work;
+
+        auto spawn = [&](Value & child, const PosIdx pos) {
+            if (child.type() == nThunk || child.type() == nAttrs || child.type() == nList)
+                work.push_back([&recurse, &child, pos]() { recurse(child, pos); });
+        };
+
+        if (v.type() == nAttrs) {
+            /* Like `printValueAsJSON()`, don't descend into values that
+               are converted to strings. */
+            if (v.attrs()->get(state.s.toString))
+                return;
+            if (auto i = v.attrs()->get(state.s.outPath))
+                spawn(*i->value, i->pos);
+            else
+                for (auto & a : *v.attrs())
+                    spawn(*a.value, a.pos);
+        } else if (v.type() == nList)
+            for (auto elem : v.listView())
+                spawn(*elem, pos);
+
+        state.executor->runAll(std::move(work));
+    }(v, pos);
+}
+
 void printValueAsJSON(
     EvalState & state,
     bool strict,
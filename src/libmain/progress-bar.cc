@@ -405,6 +405,15 @@ public:
         else if (type == resFetchStatus) {
             auto i = state->its.find(act);
             assert(i != state->its.end());
+            /* Show the status of hidden activities (like copying a
+               path that is being substituted) on their nearest visible
+               ancestor. */
+            while (!i->second->visible) {
+                auto j = state->its.find(i->second->parent);
+                if (j == state->its.end())
+                    break;
+                i = j;
+            }
             ActInfo & actInfo = *i->second;
             actInfo.lastLine = getS(fields, 0);
             update(*state);
@@ -0,0 +1,40 @@
+#include "nix/store/build/build-time-history.hh"
+#include "nix/util/file-system.hh"
+
+#include <gtest/gtest.h>
+
+namespace nix {
+
+using namespace std::chrono_literals;
+
+TEST(BuildTimeHistory, recordAndLookup)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dbPath = tmpDir / "build-times.sqlite";
+
+    {
+        BuildTimeHistory history(dbPath);
+
+        ASSERT_EQ(history.lookup("foo-1.0"), std::nullopt);
+        ASSERT_EQ(history.mean(), std::nullopt);
+
+        history.record("foo-1.0", 1000ms);
+        history.record("bar-2.0", 3000ms);
+
+        ASSERT_EQ(history.lookup("foo-1.0"), 1000ms);
+        ASSERT_EQ(history.lookup("bar-2.0"), 3000ms);
+        ASSERT_EQ(history.mean(), 2000ms);
+
+        /* Repeated builds are averaged with the previous time. */
+        history.record("foo-1.0", 3000ms);
+        ASSERT_EQ(history.lookup("foo-1.0"), 2000ms);
+    }
+
+    /* The times survive reopening the database. */
+    BuildTimeHistory history(dbPath);
+    ASSERT_EQ(history.lookup("foo-1.0"), 2000ms);
+    ASSERT_EQ(history.lookup("baz"), std::nullopt);
+}
+
+} // namespace nix
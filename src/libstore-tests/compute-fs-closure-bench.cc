@@ -0,0 +1,109 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/local-store.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/hash.hh"
+
+#ifndef _WIN32
+
+#  include <random>
+
+namespace nix {
+
+/**
+ * Register `pathCount` paths in a fresh local store. Each path refers
+ * to a few random earlier paths, and the last path refers to all
+ * paths without referrers, so that its closure is the whole store,
+ * like a system closure.
+ */
+static StorePath makeClosure(LocalStore & store, int pathCount)
+{
+    std::mt19937 urng(0);
+
+    std::vector<StorePath> paths;
+    StorePathSet roots;
+    ValidPathInfos infos;
+
+    for (int i = 0; i < pathCount; ++i) {
+        auto path = StorePath::random(fmt("compute-fs-closure-bench-%d", i));
+        ValidPathInfo info{path, UnkeyedValidPathInfo(store, Hash::dummy)};
+        info.narSize = 1024 + i;
+        if (i > 0) {
+            auto dist = std::uniform_int_distribution<int>(0, i - 1);
+            for (int j = 0; j < 5; ++j) {
+                auto & ref = paths[dist(urng)];
+                info.references.insert(ref);
+                roots.erase(ref);
+            }
+        }
+        paths.push_back(path);
+        roots.insert(path);
+        infos.emplace(path, std::move(info));
+    }
+
+    auto top = StorePath::random("compute-fs-closure-bench-top");
+    ValidPathInfo info{top, UnkeyedValidPathInfo(store, Hash::dummy)};
+    info.references = std::move(roots);
+    infos.emplace(top, std::move(info));
+
+    store.registerValidPaths(infos);
+
+    return top;
+}
+
+/**
+ * Compare the closure computation of `LocalStore` (`batched` = 1)
+ * with the generic one that queries the path info of each path
+ * (`batched` = 0).
+ */
+static void BM_ComputeFSClosure(benchmark::State & state)
+{
+    const int pathCount = state.range(0);
+    const bool batched = state.range(1);
+
+    auto tmpRoot = createTempDir();
+    createDirs(tmpRoot / "nix/store");
+
+    std::shared_ptr<Store> store = openStore(fmt("local?root=%s", tmpRoot.string()));
+    auto localStore = std::dynamic_pointer_cast<LocalStore>(store);
+    if (!localStore)
+        throw Error("expected local store");
+
+    auto top = makeClosure(*localStore, pathCount);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        localStore->clearPathInfoCache();
+        StorePathSet closure;
+        state.ResumeTiming();
+
+        if (batched)
+            localStore->computeFSClosure(StorePathSet{top}, closure);
+        else
+            localStore->Store::computeFSClosure(StorePathSet{top}, closure);
+
+        benchmark::DoNotOptimize(closure);
+        state.PauseTiming();
+        assert(closure.size() == size_t(pathCount) + 1);
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * (pathCount + 1));
+
+    localStore.reset();
+    store.reset();
+    deletePath(tmpRoot);
+}
+
+BENCHMARK(BM_ComputeFSClosure)
+    ->ArgNames({"paths", "batched"})
+    ->Args({1'000, 0})
+    ->Args({1'000, 1})
+    ->Args({40'000, 0})
+    ->Args({40'000, 1})
+    ->Unit(benchmark::kMillisecond);
+
+} // namespace nix
+
+#endif
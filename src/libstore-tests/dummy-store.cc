@@ -94,6 +94,39 @@ TEST(DummyStore, realisation_read)
     EXPECT_EQ(*value2, value);
 }
 
+TEST(DummyStore, queryPathInfos_mixedBatch)
+{
+    initLibStore(/*loadConfig=*/false);
+
+    auto store = [] {
+        auto cfg = make_ref<DummyStoreConfig>(StoreReference::Params{});
+        cfg->readOnly = false;
+        return cfg->openDummyStore();
+    }();
+
+    /* The dummy store uses the default implementation, which queries
+       each path concurrently. */
+    StorePathSet valid, invalid;
+    for (int i = 0; i < 10; ++i) {
+        Derivation drv;
+        drv.name = fmt("drv-%d", i);
+        valid.insert(store->writeDerivation(drv));
+        invalid.insert(StorePath::random(fmt("invalid-%d", i)));
+    }
+
+    StorePathSet query = valid;
+    query.insert(invalid.begin(), invalid.end());
+
+    auto infos = store->queryPathInfos(query);
+    EXPECT_EQ(infos.size(), valid.size());
+    for (auto & path : invalid)
+        EXPECT_FALSE(infos.contains(path));
+
+    store->clearPathInfoCache();
+    for (auto & path : valid)
+        EXPECT_EQ(*infos.at(path), *store->queryPathInfo(path));
+}
+
 /* ----------------------------------------------------------------------------
  * JSON
  * --------------------------------------------------------------------------*/
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 
 #include "nix/store/local-store.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/file-system.hh"
 
 // Needed for template specialisations. This is not good! When we
 // overhaul how store configs work, this should be fixed.
@@ -72,4 +74,135 @@ TEST(LocalStore, constructConfig_to_string)
     EXPECT_EQ(config.getReference().to_string(), "local");
 }
 
+#ifndef _WIN32
+
+/**
+ * A store with `size` paths, where path `i` refers to paths `i / 2` and
+ * `i - 3` (where those exist), and path 0 refers to itself.
+ */
+static std::vector<StorePath> makeStoreGraph(LocalStore & store, size_t size = 20)
+{
+    std::vector<StorePath> paths;
+    ValidPathInfos infos;
+    for (size_t i = 0; i < size; ++i) {
+        auto path = StorePath::random(fmt("closure-%d", i));
+        ValidPathInfo info{path, UnkeyedValidPathInfo(store, Hash::dummy)};
+        if (i == 0)
+            info.references.insert(path);
+        else
+            info.references.insert(paths[i / 2]);
+        if (i >= 3)
+            info.references.insert(paths[i - 3]);
+        paths.push_back(path);
+        infos.emplace(path, std::move(info));
+    }
+    store.registerValidPaths(infos);
+    return paths;
+}
+
+TEST(LocalStore, computeFSClosure_matchesGeneric)
+{
+    auto tmpRoot = createTempDir();
+    AutoDelete delTmpRoot(tmpRoot);
+    createDirs(tmpRoot / "nix" / "store");
+    auto store = openStore(fmt("local?root=%s", tmpRoot.string())).cast<LocalStore>();
+
+    auto paths = makeStoreGraph(*store);
+    auto invalid = StorePath::random("closure-invalid");
+
+    struct Case
+    {
+        StorePathSet start;
+        /**
+         * Paths already in the output set, which the traversal must
+         * not go past.
+         */
+        StorePathSet out;
+    };
+
+    std::vector<Case> cases{
+        {{paths[19]}, {}},
+        {{paths[0]}, {}},
+        {{paths[19], paths[4]}, {}},
+        {{paths[19]}, {paths[9]}},
+        {{paths[19]}, {paths[16], paths[9]}},
+        {{paths[19], paths[9]}, {paths[9]}},
+        {{paths[19]}, {invalid}},
+        {{}, {paths[3]}},
+    };
+
+    for (bool flipDirection : {false, true}) {
+        for (auto & c : cases) {
+            StorePathSet batched = c.out, generic = c.out;
+            store->computeFSClosure(c.start, batched, flipDirection);
+            store->Store::computeFSClosure(c.start, generic, flipDirection);
+            EXPECT_EQ(batched, generic);
+        }
+
+        /* The generic implementation merely looks up the referrers of
+           an invalid path, but needs its path info to follow its
+           references. */
+        StorePathSet batched, generic;
+        if (flipDirection) {
+            store->computeFSClosure(StorePathSet{paths[1], invalid}, batched, true);
+            store->Store::computeFSClosure(StorePathSet{paths[1], invalid}, generic, true);
+            EXPECT_EQ(batched, generic);
+        } else {
+            EXPECT_THROW(store->computeFSClosure(StorePathSet{paths[1], invalid}, batched), InvalidPath);
+            EXPECT_THROW(store->Store::computeFSClosure(StorePathSet{paths[1], invalid}, generic), InvalidPath);
+        }
+
+        /* An invalid path that is already in the output set isn't
+           looked at at all. */
+        batched = generic = {invalid};
+        store->computeFSClosure(StorePathSet{invalid}, batched, flipDirection);
+        store->Store::computeFSClosure(StorePathSet{invalid}, generic, flipDirection);
+        EXPECT_EQ(batched, generic);
+    }
+}
+
+TEST(LocalStore, queryPathInfos_mixedBatch)
+{
+    auto tmpRoot = createTempDir();
+    AutoDelete delTmpRoot(tmpRoot);
+    createDirs(tmpRoot / "nix" / "store");
+    auto store = openStore(fmt("local?root=%s", tmpRoot.string())).cast<LocalStore>();
+
+    /* More paths than fit in one batch of SQL queries. */
+    auto paths = makeStoreGraph(*store, 1200);
+
+    StorePathSet invalid;
+    for (int i = 0; i < 100; ++i)
+        invalid.insert(StorePath::random(fmt("invalid-%d", i)));
+    /* A valid hash part with the wrong name. */
+    invalid.insert(StorePath(fmt("%s-wrong-name", paths[7].hashPart())));
+
+    StorePathSet query(paths.begin(), paths.end());
+    query.insert(invalid.begin(), invalid.end());
+
+    /* Some of the paths are already in the path info cache. */
+    store->queryPathInfo(paths[3]);
+    EXPECT_THROW(store->queryPathInfo(*invalid.begin()), InvalidPath);
+
+    auto infos = store->queryPathInfos(query);
+    EXPECT_EQ(infos.size(), paths.size());
+
+    /* The results, including the invalid paths, went into the cache. */
+    for (auto & path : paths)
+        EXPECT_EQ(store->queryPathInfoFromClientCache(path), std::make_optional(infos.at(path).get_ptr()));
+    for (auto & path : invalid) {
+        EXPECT_FALSE(infos.contains(path));
+        EXPECT_EQ(store->queryPathInfoFromClientCache(path), std::make_optional(nullptr));
+    }
+
+    /* They match what we get by querying one path at a time. */
+    store->clearPathInfoCache();
+    for (auto & path : paths)
+        EXPECT_EQ(*infos.at(path), *store->queryPathInfo(path));
+    for (auto & path : invalid)
+        EXPECT_THROW(store->queryPathInfo(path), InvalidPath);
+}
+
+#endif
+
 } // namespace nix
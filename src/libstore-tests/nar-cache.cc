@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/nar-cache.hh"
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <thread>
+
+namespace nix {
+
+static std::string makeNar(std::string_view contents)
+{
+    StringSink sink;
+    dumpString(contents, sink);
+    return std::move(sink.s);
+}
+
+struct TestNar
+{
+    std::string nar;
+    Hash narHash;
+
+    TestNar(std::string_view contents)
+        : nar(makeNar(contents))
+        , narHash(hashString(HashAlgorithm::SHA256, nar))
+    {
+    }
+
+    fun<void(Sink &)> populate(int & calls) const
+    {
+        return [this, &calls](Sink & sink) {
+            calls++;
+            sink(nar);
+        };
+    }
+};
+
+static std::filesystem::path cacheFile(const std::filesystem::path & cacheDir, const TestNar & nar)
+{
+    return cacheDir / (nar.narHash.to_string(HashFormat::Nix32, false) + ".nar");
+}
+
+TEST(NarCache, fetchesEachNarOnce)
+{
+    TestNar nar("hello");
+    int calls = 0;
+
+    NarCache cache;
+    ASSERT_EQ(cache.get(nar.narHash), nullptr);
+    ASSERT_EQ(cache.getOrInsert(nar.narHash, nar.populate(calls))->readFile(CanonPath::root), "hello");
+    ASSERT_EQ(cache.getOrInsert(nar.narHash, nar.populate(calls))->readFile(CanonPath::root), "hello");
+    ASSERT_EQ(calls, 1);
+    ASSERT_EQ(cache.getStats().misses, 1u);
+}
+
+TEST(NarCache, sharesNarsOnDisk)
+{
+    auto cacheDir = createTempDir();
+    AutoDelete delCacheDir(cacheDir);
+
+    TestNar nar("hello");
+    int calls = 0;
+
+    {
+        NarCache cache(cacheDir);
+        cache.getOrInsert(nar.narHash, nar.populate(calls));
+    }
+
+    NarCache cache(cacheDir);
+    ASSERT_EQ(cache.getOrInsert(nar.narHash, nar.populate(calls))->readFile(CanonPath::root), "hello");
+    ASSERT_EQ(calls, 1);
+    ASSERT_EQ(cache.getStats().hits, 1u);
+    ASSERT_EQ(cache.getStats().misses, 0u);
+}
+
+TEST(NarCache, concurrentMissesFetchOnce)
+{
+    auto cacheDir = createTempDir();
+    AutoDelete delCacheDir(cacheDir);
+
+    TestNar nar("hello");
+    std::atomic<int> calls = 0;
+
+    auto run = [&]() {
+        NarCache cache(cacheDir);
+        auto accessor = cache.getOrInsert(nar.narHash, [&](Sink & sink) {
+            calls++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            sink(nar.nar);
+        });
+        ASSERT_EQ(accessor->readFile(CanonPath::root), "hello");
+    };
+
+    std::thread t1(run), t2(run);
+    t1.join();
+    t2.join();
+
+    ASSERT_EQ(calls, 1);
+}
+
+TEST(NarCache, evictsLeastRecentlyUsedNars)
+{
+    auto cacheDir = createTempDir();
+    AutoDelete delCacheDir(cacheDir);
+
+    TestNar nar1(std::string(10000, '1')), nar2(std::string(10000, '2')), nar3(std::string(10000, '3'));
+    int calls = 0;
+
+    {
+        NarCache cache(cacheDir);
+        cache.getOrInsert(nar1.narHash, nar1.populate(calls));
+        cache.getOrInsert(nar2.narHash, nar2.populate(calls));
+    }
+
+    /* Make `nar1` the least recently used NAR, and then use it again. */
+    auto now = time(nullptr);
+    setWriteTime(cacheFile(cacheDir, nar1), now - 200, now - 200);
+    setWriteTime(cacheFile(cacheDir, nar2), now - 100, now - 100);
+    NarCache{cacheDir}.get(nar1.narHash);
+
+    /* There is only room for two NARs, so adding a third one evicts
+       `nar2`. */
+    NarCache cache(cacheDir, 25000);
+    cache.getOrInsert(nar3.narHash, nar3.populate(calls));
+
+    ASSERT_TRUE(pathExists(cacheFile(cacheDir, nar1)));
+    ASSERT_FALSE(pathExists(cacheFile(cacheDir, nar2)));
+    ASSERT_TRUE(pathExists(cacheFile(cacheDir, nar3)));
+    ASSERT_EQ(cache.getStats().evictions, 1u);
+}
+
+TEST(NarCache, evictionRemovesStaleFiles)
+{
+    auto cacheDir = createTempDir();
+    AutoDelete delCacheDir(cacheDir);
+
+    TestNar nar1("1"), nar2("2");
+    int calls = 0;
+
+    auto makeFile = [&](const std::string & name, time_t mtime) {
+        auto path = cacheDir / name;
+        writeFile(path, "junk");
+        setWriteTime(path, mtime, mtime);
+        return path;
+    };
+
+    /* Leftovers from interrupted processes, and the same kind of
+       files from a process that is still writing them. */
+    auto now = time(nullptr);
+    auto staleTemp = makeFile("foo.nar.tmp-1-2", now - 7200);
+    auto staleListing = makeFile("foo.ls", now - 7200);
+    auto freshTemp = makeFile("bar.nar.tmp-3-4", now);
+    auto freshListing = makeFile("bar.ls", now);
+
+    NarCache cache(cacheDir, 1000000);
+    cache.getOrInsert(nar1.narHash, nar1.populate(calls));
+
+    ASSERT_FALSE(pathExists(staleTemp));
+    ASSERT_FALSE(pathExists(staleListing));
+    ASSERT_TRUE(pathExists(freshTemp));
+    ASSERT_TRUE(pathExists(freshListing));
+    ASSERT_EQ(cache.getStats().staleFiles, 2u);
+    ASSERT_EQ(cache.getStats().evictions, 0u);
+
+    /* Complete entries are left alone, and no temporary files are
+       left behind by publishing them. */
+    cache.getOrInsert(nar2.narHash, nar2.populate(calls));
+    ASSERT_TRUE(pathExists(cacheFile(cacheDir, nar1)));
+    ASSERT_TRUE(pathExists(cacheFile(cacheDir, nar2)));
+    for (auto & dirent : DirectoryIterator{cacheDir})
+        ASSERT_TRUE(dirent.path() == freshTemp || dirent.path().filename().string().find(".tmp-") == std::string::npos);
+}
+
+} // namespace nix
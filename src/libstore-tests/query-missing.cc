@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "nix/store/dummy-store-impl.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/callback.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/memory-source-accessor.hh"
+#include "nix/util/sync.hh"
+
+#include "nix/store/tests/libstore.hh"
+
+namespace nix {
+
+/**
+ * A substituter that answers path info queries from another store on a
+ * separate thread after a delay, like a binary cache would, and keeps
+ * track of how many queries are in flight at the same time.
+ */
+struct SlowSubstituter : virtual Store
+{
+    ref<const DummyStoreConfig> config;
+    ref<Store> next;
+
+    std::atomic<size_t> queries{0};
+    std::atomic<size_t> inFlight{0};
+    std::atomic<size_t> maxInFlight{0};
+
+    Sync<std::vector<std::thread>> threads;
+
+    SlowSubstituter(ref<const DummyStoreConfig> config, ref<Store> next)
+        : Store{*config}
+        , config(config)
+        , next(next)
+    {
+    }
+
+    ~SlowSubstituter()
+    {
+        for (auto & thread : *threads.lock())
+            thread.join();
+    }
+
+    void queryPathInfoUncached(
+        const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override
+    {
+        queries++;
+        auto n = ++inFlight;
+        auto max = maxInFlight.load();
+        while (n > max && !maxInFlight.compare_exchange_weak(max, n))
+            ;
+
+        auto callbackPtr = std::make_shared<decltype(callback)>(std::move(callback));
+        threads.lock()->emplace_back([this, path, callbackPtr]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            std::shared_ptr<const ValidPathInfo> info;
+            try {
+                info = next->queryPathInfo(path).get_ptr();
+            } catch (InvalidPath &) {
+            }
+            inFlight--;
+            (*callbackPtr)(std::move(info));
+        });
+    }
+
+    void queryRealisationUncached(
+        const DrvOutput &, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept override
+    {
+        callback(nullptr);
+    }
+
+    std::optional<StorePath> queryPathFromHashPart(const std::string & hashPart) override
+    {
+        unsupported("queryPathFromHashPart");
+    }
+
+    void addToStore(const ValidPathInfo & info, Source & narSource, RepairFlag repair, CheckSigsFlag checkSigs) override
+    {
+        unsupported("addToStore");
+    }
+
+    StorePath addToStoreFromDump(
+        Source & dump,
+        std::string_view name,
+        FileSerialisationMethod dumpMethod,
+        ContentAddressMethod hashMethod,
+        HashAlgorithm hashAlgo,
+        const StorePathSet & references,
+        RepairFlag repair) override
+    {
+        unsupported("addToStoreFromDump");
+    }
+
+    using Store::registerDrvOutput;
+
+    void registerDrvOutput(const Realisation & output) override
+    {
+        unsupported("registerDrvOutput");
+    }
+
+    ref<SourceAccessor> getFSAccessor(bool requireValidPath) override
+    {
+        unsupported("getFSAccessor");
+    }
+
+    std::shared_ptr<SourceAccessor> getFSAccessor(const StorePath & path, bool requireValidPath) override
+    {
+        unsupported("getFSAccessor");
+    }
+
+    std::optional<TrustedFlag> isTrustedClient() override
+    {
+        return Trusted;
+    }
+
+private:
+
+    void anchor() override {}
+};
+
+class QueryMissingTest : public LibStoreTest
+{
+protected:
+    ref<DummyStore> source = [] {
+        auto config = make_ref<DummyStoreConfig>(DummyStoreConfig::Params{});
+        config->readOnly = false;
+        return config->openDummyStore();
+    }();
+
+    ref<SlowSubstituter> makeSubstituter()
+    {
+        return make_ref<SlowSubstituter>(make_ref<DummyStoreConfig>(DummyStoreConfig::Params{}), source);
+    }
+
+    StorePath addToSource(const std::string & name)
+    {
+        auto accessor = make_ref<MemorySourceAccessor>();
+        accessor->root = MemorySourceAccessor::File{MemorySourceAccessor::File::Regular{
+            .executable = false,
+            .contents = name,
+        }};
+        return source->addToStore(
+            name, SourcePath{accessor}, ContentAddressMethod::Raw::NixArchive, HashAlgorithm::SHA256);
+    }
+};
+
+TEST_F(QueryMissingTest, boundsConcurrentLookupsAndMatchesUnbatched)
+{
+    auto & workerSettings = settings.getWorkerSettings();
+    auto oldMaxSubstituterQueries = workerSettings.maxSubstituterQueries.get();
+    Finally restoreSettings([&]() { workerSettings.maxSubstituterQueries.assign(oldMaxSubstituterQueries); });
+    workerSettings.maxSubstituterQueries.assign(4);
+
+    /* Paths that the substituter has, and paths that nobody has. */
+    std::vector<DerivedPath> targets;
+    StorePathSet substitutable, unknown;
+    for (int i = 0; i < 30; ++i) {
+        auto path = addToSource(fmt("substitutable-%d", i));
+        substitutable.insert(path);
+        targets.push_back(DerivedPath::Opaque{path});
+    }
+    for (int i = 0; i < 10; ++i) {
+        auto path = StorePath::random(fmt("unknown-%d", i));
+        unknown.insert(path);
+        targets.push_back(DerivedPath::Opaque{path});
+    }
+
+    auto sub = makeSubstituter();
+    auto batched = store->queryMissing(targets, {sub});
+
+    EXPECT_EQ(batched.willSubstitute, substitutable);
+    EXPECT_EQ(batched.unknown, unknown);
+    EXPECT_TRUE(batched.willBuild.empty());
+
+    /* Every path was looked up once, and the lookups overlapped without
+       exceeding the limit. */
+    EXPECT_EQ(sub->queries.load(), targets.size());
+    EXPECT_GT(sub->maxInFlight.load(), 1u);
+    EXPECT_LE(sub->maxInFlight.load(), 4u);
+
+    /* Looking up the targets one at a time gives the same result. */
+    auto unbatchedSub = makeSubstituter();
+    MissingPaths unbatched;
+    for (auto & target : targets) {
+        auto res = store->queryMissing({target}, {unbatchedSub});
+        unbatched.willSubstitute.insert(res.willSubstitute.begin(), res.willSubstitute.end());
+        unbatched.unknown.insert(res.unknown.begin(), res.unknown.end());
+        unbatched.downloadSize += res.downloadSize;
+        unbatched.narSize += res.narSize;
+    }
+    EXPECT_EQ(unbatchedSub->maxInFlight.load(), 1u);
+
+    EXPECT_EQ(batched.willSubstitute, unbatched.willSubstitute);
+    EXPECT_EQ(batched.unknown, unbatched.unknown);
+    EXPECT_EQ(batched.downloadSize, unbatched.downloadSize);
+    EXPECT_EQ(batched.narSize, unbatched.narSize);
+}
+
+TEST_F(QueryMissingTest, cachedAnswersDontTakeLookups)
+{
+    auto path = addToSource("cached");
+
+    auto sub = makeSubstituter();
+    store->queryMissing({DerivedPath::Opaque{path}}, {sub});
+    store->queryMissing({DerivedPath::Opaque{path}, DerivedPath::Opaque{StorePath::random("unknown")}}, {sub});
+
+    /* The second call only asked about the unknown path. */
+    EXPECT_EQ(sub->queries.load(), 2u);
+}
+
+} // namespace nix
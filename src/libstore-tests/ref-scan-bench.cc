@@ -45,7 +45,8 @@ randomBytesWithReferences(std::mt19937 & urng, std::size_t size, double charWeig
 
     while (res.size() < size) {
         auto c = genDist(urng);
-        if (c == 0)
+        /* Don't let resize() below truncate a reference. */
+        if (c == 0 && res.size() + StorePath::HashLen <= size)
             refGen();
         else
             charGen();
@@ -55,17 +56,39 @@ randomBytesWithReferences(std::mt19937 & urng, std::size_t size, double charWeig
     return res;
 }
 
-// Benchmark reference scanning
-static void BM_RefScanSinkRandom(benchmark::State & state)
+/**
+ * Like randomBytesWithReferences(), but the filler is lower-case
+ * text, which is mostly made of base-32 characters. This is the
+ * worst case for skipping ahead and is typical of debug info and
+ * scripts.
+ */
+static std::string randomTextWithReferences(std::mt19937 & urng, std::size_t size, StringSet & hashes)
 {
-    auto size = state.range();
-    auto chunkSize = 4199;
+    static constexpr std::string_view alphabet = "abcdefghijklmnopqrstuvwxyz0123456789_ \n";
 
-    std::mt19937 urng(0);
-    StringSet hashes;
-    auto bytes = randomBytesWithReferences(urng, size, /*charWeight=*/100.0, hashes);
-    assert(hashes.size() > 0);
+    std::string res;
+    res.reserve(size);
 
+    auto charDist = std::uniform_int_distribution<std::size_t>(0, alphabet.size() - 1);
+    std::discrete_distribution<std::size_t> genDist{1.0, StorePath::HashLen * 1000.0};
+
+    while (res.size() < size) {
+        if (genDist(urng) == 0 && res.size() + StorePath::HashLen < size) {
+            std::string ref;
+            randomReference(urng, std::back_inserter(ref));
+            hashes.insert(ref);
+            res += ref;
+            res += '/';
+        } else
+            res.push_back(alphabet[charDist(urng)]);
+    }
+
+    res.resize(size);
+    return res;
+}
+
+static void runRefScan(benchmark::State & state, const std::string & bytes, const StringSet & hashes, size_t chunkSize)
+{
     std::size_t processed = 0;
 
     for (auto _ : state) {
@@ -90,6 +113,43 @@ static void BM_RefScanSinkRandom(benchmark::State & state)
     state.SetBytesProcessed(processed);
 }
 
+// Benchmark reference scanning
+static void BM_RefScanSinkRandom(benchmark::State & state)
+{
+    std::mt19937 urng(0);
+    StringSet hashes;
+    auto bytes = randomBytesWithReferences(urng, state.range(), /*charWeight=*/100.0, hashes);
+    assert(hashes.size() > 0);
+
+    runRefScan(state, bytes, hashes, 4199);
+}
+
 BENCHMARK(BM_RefScanSinkRandom)->Arg(10'000)->Arg(100'000)->Arg(1'000'000)->Arg(5'000'000)->Arg(10'000'000);
 
+/* Large outputs are fed to the scanner in the 64 KiB chunks used
+   when dumping a NAR, and references are rare. This is the case that
+   dominates when registering multi-GB outputs. */
+
+static void BM_RefScanSinkLargeBinary(benchmark::State & state)
+{
+    std::mt19937 urng(0);
+    StringSet hashes;
+    auto bytes = randomBytesWithReferences(urng, state.range(), /*charWeight=*/100'000.0, hashes);
+
+    runRefScan(state, bytes, hashes, 65536);
+}
+
+BENCHMARK(BM_RefScanSinkLargeBinary)->Arg(100'000'000)->Arg(1'000'000'000)->Unit(benchmark::kMillisecond);
+
+static void BM_RefScanSinkLargeText(benchmark::State & state)
+{
+    std::mt19937 urng(0);
+    StringSet hashes;
+    auto bytes = randomTextWithReferences(urng, state.range(), hashes);
+
+    runRefScan(state, bytes, hashes, 65536);
+}
+
+BENCHMARK(BM_RefScanSinkLargeText)->Arg(100'000'000)->Arg(1'000'000'000)->Unit(benchmark::kMillisecond);
+
 } // namespace nix
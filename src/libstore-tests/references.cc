@@ -81,6 +81,43 @@ TEST(references, scan)
     }
 }
 
+TEST(references, scanAtBlockBoundaries)
+{
+    std::string hash1 = "dc04vv14dak1c1r48qa0m23vr9jy8sm0";
+    std::string hash2 = "zc842j0rz61mjsp3h3wp5ly71ak6qgdn";
+
+    /* The scanner classifies the input in 64-byte blocks, so check
+       references that start and end around block boundaries, both
+       surrounded by binary data and embedded in longer runs of
+       base-32 characters. */
+    for (auto filler : {'\0', 'a'}) {
+        for (size_t offset = 0; offset < 140; ++offset) {
+            auto s = std::string(offset, filler) + hash1 + std::string(offset % 7, filler) + hash2;
+
+            {
+                RefScanSink scanner(StringSet{hash1, hash2});
+                scanner(s);
+                ASSERT_EQ(scanner.getResult(), StringSet({hash1, hash2})) << "offset " << offset;
+            }
+
+            {
+                RefScanSink scanner(StringSet{hash1, hash2});
+                for (size_t pos = 0; pos < s.size(); pos += 61)
+                    scanner(((std::string_view) s).substr(pos, 61));
+                ASSERT_EQ(scanner.getResult(), StringSet({hash1, hash2})) << "offset " << offset;
+            }
+        }
+    }
+
+    {
+        /* A near miss differing in the last character. */
+        RefScanSink scanner(StringSet{hash1});
+        auto s = std::string(100, 'x') + hash1.substr(0, 31) + "1" + std::string(100, 'x');
+        scanner(s);
+        ASSERT_EQ(scanner.getResult(), StringSet{});
+    }
+}
+
 TEST(references, scanForReferencesDeep)
 {
     using File = MemorySourceAccessor::File;
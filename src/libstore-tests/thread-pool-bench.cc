@@ -0,0 +1,179 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/util/thread-pool.hh"
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+
+namespace nix {
+
+/**
+ * The previous `ThreadPool` design: a single queue protected by a
+ * single mutex, which every enqueue and dequeue has to take. Kept
+ * here as a baseline.
+ */
+class CentralQueuePool
+{
+    size_t maxThreads;
+    std::mutex mutex;
+    std::condition_variable work;
+    std::queue<std::function<void()>> pending;
+    std::vector<std::thread> workers;
+    size_t active = 0;
+    bool draining = false, quit = false;
+
+    void doWork()
+    {
+        bool didWork = false;
+        while (true) {
+            std::function<void()> w;
+            {
+                std::unique_lock lock(mutex);
+                if (didWork) {
+                    assert(active);
+                    active--;
+                    if (!active && draining)
+                        work.notify_all();
+                }
+                while (true) {
+                    if (quit)
+                        return;
+                    if (!pending.empty())
+                        break;
+                    if (!active && draining) {
+                        quit = true;
+                        work.notify_all();
+                        return;
+                    }
+                    work.wait(lock);
+                }
+                w = std::move(pending.front());
+                pending.pop();
+                active++;
+            }
+            w();
+            didWork = true;
+        }
+    }
+
+public:
+
+    CentralQueuePool(size_t maxThreads)
+        : maxThreads(maxThreads)
+    {
+    }
+
+    ~CentralQueuePool()
+    {
+        {
+            std::unique_lock lock(mutex);
+            quit = true;
+        }
+        work.notify_all();
+        for (auto & thr : workers)
+            thr.join();
+    }
+
+    void enqueue(std::function<void()> t)
+    {
+        std::unique_lock lock(mutex);
+        pending.push(std::move(t));
+        if (pending.size() > workers.size() + 1 && workers.size() + 1 < maxThreads)
+            workers.emplace_back(&CentralQueuePool::doWork, this);
+        work.notify_one();
+    }
+
+    void process()
+    {
+        {
+            std::unique_lock lock(mutex);
+            draining = true;
+        }
+        doWork();
+    }
+};
+
+/**
+ * A fan-out heavy workload like `processGraph()` on a large closure:
+ * every item does a little work and enqueues `fanOut` children,
+ * `depth` levels deep.
+ */
+template<typename Pool>
+static void runFanOut(Pool & pool, std::atomic<size_t> & done, int fanOut, int depth, size_t workPerItem)
+{
+    std::function<void(int)> item = [&](int level) {
+        size_t x = level;
+        for (size_t i = 0; i < workPerItem; ++i)
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        benchmark::DoNotOptimize(x);
+        done++;
+        if (level < depth)
+            for (int i = 0; i < fanOut; ++i)
+                pool.enqueue([&, level]() { item(level + 1); });
+    };
+
+    pool.enqueue([&]() { item(0); });
+    pool.process();
+}
+
+template<typename Pool>
+static void BM_ThreadPoolFanOut(benchmark::State & state)
+{
+    const auto threads = state.range(0);
+    const int fanOut = 8;
+    const int depth = 5;
+    const size_t workPerItem = state.range(1);
+
+    size_t items = 0;
+    for (auto _ : state) {
+        Pool pool(threads);
+        std::atomic<size_t> done{0};
+        runFanOut(pool, done, fanOut, depth, workPerItem);
+        items += done;
+    }
+
+    state.SetItemsProcessed(items);
+}
+
+BENCHMARK_TEMPLATE(BM_ThreadPoolFanOut, CentralQueuePool)
+    ->ArgsProduct({{4, 16, 64}, {0, 1000}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_ThreadPoolFanOut, ThreadPool)
+    ->ArgsProduct({{4, 16, 64}, {0, 1000}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+/**
+ * `processGraph()` on a wide DAG, which is what `copyPaths()` and
+ * `computeFSClosure()` callers effectively do.
+ */
+static void BM_ProcessGraph(benchmark::State & state)
+{
+    const size_t nodeCount = 50000;
+
+    std::set<size_t> nodes;
+    for (size_t i = 0; i < nodeCount; ++i)
+        nodes.insert(i);
+
+    for (auto _ : state) {
+        std::atomic<size_t> done{0};
+        processGraph<size_t>(
+            nodes,
+            [&](const size_t & node) {
+                std::set<size_t> deps;
+                if (node)
+                    deps.insert(node / 4);
+                return deps;
+            },
+            [&](const size_t & node) { done++; });
+    }
+
+    state.SetItemsProcessed(state.iterations() * nodeCount);
+}
+
+BENCHMARK(BM_ProcessGraph)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+} // namespace nix
@@ -976,6 +976,39 @@ TEST_F(WorkerProtoTest, handshake_features)
         }));
 }
 
+TEST_F(WorkerProtoTest, readTaggedReply)
+{
+    struct TestConnection : WorkerProto::BasicClientConnection
+    {
+        void closeWrite() override {}
+    };
+
+    Pipe toClient;
+    toClient.create();
+
+    {
+        FdSink out{toClient.writeSide.get()};
+        out << STDERR_NEXT << "working on it\n";
+        out << STDERR_TAGGED_REPLY << 7 << 1 << 42;
+        out << STDERR_TAGGED_REPLY << 3 << 0 << Error("request %d failed", 3);
+        out.flush();
+    }
+
+    TestConnection conn;
+    conn.from = FdSource{toClient.readSide.get()};
+    conn.protoVersion = defaultVersion;
+
+    auto [tag1, ex1] = conn.readTaggedReply();
+    EXPECT_EQ(tag1, 7u);
+    EXPECT_FALSE(ex1);
+    EXPECT_EQ(readInt(conn.from), 42u);
+
+    auto [tag2, ex2] = conn.readTaggedReply();
+    EXPECT_EQ(tag2, 3u);
+    ASSERT_TRUE(ex2);
+    EXPECT_THROW(std::rethrow_exception(ex2), Error);
+}
+
 TEST_F(WorkerProtoTest, handshake_client_replay)
 {
     CharacterizationTest::readTest("handshake-to-client.bin", [&](std::string toClientLog) {
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/build/worker.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/finally.hh"
+
+#include "nix/store/tests/libstore.hh"
+
+namespace nix {
+
+/**
+ * A goal that waits for `dependencies`, then for a build slot, and
+ * records when it got one.
+ */
+struct SlotGoal : Goal
+{
+    double cost;
+    std::vector<std::string> & order;
+
+    SlotGoal(Worker & worker, std::string name_, double cost, std::vector<std::string> & order, Goals dependencies)
+        : Goal(worker, run(std::move(dependencies)))
+        , cost(cost)
+        , order(order)
+    {
+        name = std::move(name_);
+    }
+
+    Co run(Goals dependencies)
+    {
+        co_await await(std::move(dependencies));
+        co_await waitForBuildSlot();
+        order.push_back(name);
+        co_return amDone(ecSuccess);
+    }
+
+    std::string key() override
+    {
+        return name;
+    }
+
+    JobCategory jobCategory() const override
+    {
+        return JobCategory::Build;
+    }
+
+    double estimatedCost() override
+    {
+        return cost;
+    }
+};
+
+class WorkerSchedulingTest : public LibStoreTest
+{};
+
+TEST_F(WorkerSchedulingTest, buildSlotsFollowTheCriticalPath)
+{
+    auto & workerSettings = settings.getWorkerSettings();
+    auto oldMaxBuildJobs = workerSettings.maxBuildJobs.get();
+    auto oldScheduleCriticalPath = workerSettings.scheduleCriticalPath.get();
+    auto oldBuildTimeHistory = workerSettings.buildTimeHistory.get();
+    Finally restoreSettings([&]() {
+        workerSettings.maxBuildJobs.assign(oldMaxBuildJobs);
+        workerSettings.scheduleCriticalPath.assign(oldScheduleCriticalPath);
+        workerSettings.buildTimeHistory.assign(oldBuildTimeHistory);
+    });
+    workerSettings.maxBuildJobs.assign(1);
+    workerSettings.scheduleCriticalPath.assign(true);
+    workerSettings.buildTimeHistory.assign(false);
+
+    Worker worker{*store, *store};
+    std::vector<std::string> order;
+
+    auto makeGoal = [&](std::string name, double cost, Goals dependencies = {}) {
+        auto goal = std::make_shared<SlotGoal>(worker, name, cost, order, std::move(dependencies));
+        worker.wakeUp(goal);
+        return goal;
+    };
+
+    /* The cheap goal comes first in key order, and `leaf` is cheaper
+       than `mid` itself, but `top` depends on it. */
+    auto cheap = makeGoal("a-cheap", 2);
+    auto leaf = makeGoal("b-leaf", 1);
+    auto mid = makeGoal("c-mid", 5);
+    auto top = makeGoal("d-top", 10, {leaf});
+
+    worker.run({cheap, leaf, mid, top});
+
+    EXPECT_EQ(order, (std::vector<std::string>{"b-leaf", "d-top", "c-mid", "a-cheap"}));
+    for (auto & goal : {cheap, leaf, mid, top})
+        EXPECT_EQ(goal->exitCode, Goal::ecSuccess);
+}
+
+} // namespace nix
@@ -6,6 +6,8 @@
 #include "nix/store/dummy-store-impl.hh"
 #include "nix/store/globals.hh"
 #include "nix/util/memory-source-accessor.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/finally.hh"
 
 #include "nix/store/tests/libstore.hh"
 #include "nix/util/tests/json-characterization.hh"
@@ -174,6 +176,75 @@ TEST_F(WorkerSubstitutionTest, singleRootStoreObjectWithSingleDepStoreObject)
     ASSERT_EQ(upcast_goal(goal)->exitCode, Goal::ecSuccess);
 }
 
+TEST_F(WorkerSubstitutionTest, goalTrace)
+{
+    auto addToSubstituter = [&](std::string name) {
+        return substituter->addToStore(
+            name,
+            SourcePath{
+                [&] {
+                    auto sc = make_ref<MemorySourceAccessor>();
+                    sc->root = MemorySourceAccessor::File{MemorySourceAccessor::File::Regular{
+                        .executable = false,
+                        .contents = "Hello, " + name + "!",
+                    }};
+                    return sc;
+                }(),
+            },
+            ContentAddressMethod::Raw::NixArchive,
+            HashAlgorithm::SHA256);
+    };
+    std::vector<StorePath> paths{addToSubstituter("hello"), addToSubstituter("world")};
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto traceFile = tmpDir / "trace.json";
+
+    auto & workerSettings = settings.getWorkerSettings();
+    workerSettings.goalTraceFile = AbsolutePath{traceFile};
+    Finally resetTraceFile([&]() { workerSettings.goalTraceFile = std::nullopt; });
+
+    /* The trace is appended to when each worker is destroyed, so both
+       workers' goals end up in it. */
+    for (auto & path : paths) {
+        Worker worker{*dummyStore, *dummyStore};
+        ref<Store> substituterAsStore = substituter;
+        worker.getSubstituters = [substituterAsStore]() -> std::list<ref<Store>> { return {substituterAsStore}; };
+
+        auto goal = worker.makePathSubstitutionGoal(path);
+        worker.run({upcast_goal(goal)});
+        ASSERT_EQ(upcast_goal(goal)->exitCode, Goal::ecSuccess);
+    }
+
+    /* The file is an unterminated JSON array of events. */
+    auto contents = readFile(traceFile);
+    ASSERT_TRUE(contents.starts_with("[\n"));
+    ASSERT_TRUE(contents.ends_with(",\n"));
+    auto trace = nlohmann::json::parse(contents.substr(0, contents.size() - 2) + "]");
+
+    std::set<std::string> phases;
+    std::set<uint64_t> workerTracks, goalTracks;
+    bool sawSlots = false;
+    for (auto & event : trace) {
+        if (event.at("ph") == "M" && event.at("name") == "thread_name")
+            (event.at("args").at("name") == "worker" ? workerTracks : goalTracks).insert(event.at("tid").get<uint64_t>());
+        if (event.at("ph") == "X" && event.at("cat") == "goal") {
+            phases.insert(event.at("name"));
+            ASSERT_GE(event.at("dur").get<int64_t>(), 0);
+        }
+        if (event.at("ph") == "C")
+            sawSlots = true;
+    }
+
+    ASSERT_TRUE(phases.contains("queued"));
+    ASSERT_TRUE(phases.contains("substituting"));
+    ASSERT_TRUE(sawSlots);
+    ASSERT_EQ(workerTracks.size(), 2u);
+    ASSERT_GE(goalTracks.size(), 2u);
+    for (auto track : workerTracks)
+        ASSERT_FALSE(goalTracks.contains(track));
+}
+
 TEST_F(WorkerSubstitutionTest, floatingDerivationOutput)
 {
     EnableExperimentalFeature enableCA{"ca-derivations"};
@@ -1,5 +1,6 @@
 #include "nix/util/archive.hh"
 #include "nix/store/binary-cache-store.hh"
+#include "nix/util/chunking.hh"
 #include "nix/util/compression.hh"
 #include "nix/store/derivations.hh"
 #include "nix/util/source-accessor.hh"
@@ -12,7 +13,9 @@
 #include "nix/util/callback.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/json-utils.hh"
 
+#include <algorithm>
 #include <chrono>
 #include <future>
 #include <regex>
@@ -118,6 +121,40 @@ std::optional<std::string> BinaryCacheStore::getFile(const std::string & path)
     return std::move(sink.s);
 }
 
+/**
+ * A sink that passes `length` bytes of the data written to it,
+ * starting at `offset`, to another sink.
+ */
+struct RangeSink : Sink
+{
+    Sink & next;
+    uint64_t skip, left;
+
+    RangeSink(Sink & next, uint64_t offset, uint64_t length)
+        : next(next)
+        , skip(offset)
+        , left(length)
+    {
+    }
+
+    void operator()(std::string_view data) override
+    {
+        auto n = std::min<uint64_t>(skip, data.size());
+        skip -= n;
+        data.remove_prefix(n);
+        n = std::min<uint64_t>(left, data.size());
+        if (n)
+            next(data.substr(0, n));
+        left -= n;
+    }
+};
+
+void BinaryCacheStore::getFileRange(const std::string & path, uint64_t offset, uint64_t length, Sink & sink)
+{
+    RangeSink rangeSink(sink, offset, length);
+    getFile(path, rangeSink);
+}
+
 std::string BinaryCacheStore::narInfoFileFor(const StorePath & storePath)
 {
     return std::string(storePath.hashPart()) + ".narinfo";
@@ -138,6 +175,88 @@ void BinaryCacheStore::writeNarInfo(ref<NarInfo> narInfo)
             std::shared_ptr<NarInfo>(narInfo));
 }
 
+/**
+ * The file name extension of NARs and NAR chunks compressed with
+ * `method`.
+ */
+static std::string compressionExtension(CompressionAlgo method)
+{
+    return method == CompressionAlgo::xz       ? ".xz"
+           : method == CompressionAlgo::bzip2  ? ".bz2"
+           : method == CompressionAlgo::zstd   ? ".zst"
+           : method == CompressionAlgo::lzip   ? ".lzip"
+           : method == CompressionAlgo::lz4    ? ".lz4"
+           : method == CompressionAlgo::brotli ? ".br"
+                                               : "";
+}
+
+/**
+ * The `Compression` of NARs that are stored as chunks. The `URL` of
+ * such NARs points to a `ChunkManifest`.
+ */
+static constexpr std::string_view chunkedCompression = "chunked";
+
+/**
+ * The list of chunks of a NAR stored with `chunk-nars`, in order.
+ * Chunks are identified by the SHA-256 hash of their uncompressed
+ * contents, and stored in the binary cache as
+ * `chunks/<hash><extension>`.
+ */
+struct ChunkManifest
+{
+    CompressionAlgo compression;
+
+    struct Chunk
+    {
+        Hash hash;
+        uint64_t size;
+    };
+
+    std::vector<Chunk> chunks;
+
+    std::string chunkPath(const Hash & hash) const
+    {
+        return "chunks/" + hash.to_string(HashFormat::Nix32, false) + compressionExtension(compression);
+    }
+
+    std::string to_string() const
+    {
+        auto jsonChunks = nlohmann::json::array();
+        for (auto & chunk : chunks)
+            jsonChunks.push_back({
+                {"hash", chunk.hash.to_string(HashFormat::Nix32, false)},
+                {"size", chunk.size},
+            });
+        nlohmann::json j = {
+            {"version", 1},
+            {"compression", showCompressionAlgo(compression)},
+            {"chunks", std::move(jsonChunks)},
+        };
+        return j.dump();
+    }
+
+    static ChunkManifest parse(const std::string & s, std::string_view whence)
+    {
+        try {
+            auto json = nlohmann::json::parse(s);
+            auto & obj = getObject(json);
+            if (getUnsigned(valueAt(obj, "version")) != 1)
+                throw Error("unsupported version");
+            ChunkManifest manifest{.compression = parseCompressionAlgo(getString(valueAt(obj, "compression")))};
+            for (auto & chunk : getArray(valueAt(obj, "chunks"))) {
+                auto & chunkObj = getObject(chunk);
+                manifest.chunks.push_back({
+                    .hash = Hash::parseNonSRIUnprefixed(getString(valueAt(chunkObj, "hash")), HashAlgorithm::SHA256),
+                    .size = getUnsigned(valueAt(chunkObj, "size")),
+                });
+            }
+            return manifest;
+        } catch (std::exception & e) {
+            throw Error("chunk manifest '%s' is corrupt: %s", whence, e.what());
+        }
+    }
+};
+
 ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
     Source & narSource, RepairFlag repair, CheckSigsFlag checkSigs, fun<ValidPathInfo(HashResult)> mkInfo)
 {
@@ -151,18 +270,49 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
     HashSink fileHashSink{HashAlgorithm::SHA256};
     std::shared_ptr<NarAccessor> narAccessor;
     HashSink narHashSink{HashAlgorithm::SHA256};
+
+    /* With `chunk-nars`, the NAR is split into chunks instead, and the
+       compressed chunks are written to disk one after the other. Each
+       distinct chunk is recorded with its position in the file. */
+    ChunkManifest manifest{.compression = config.compression};
+    struct ChunkLocation
+    {
+        uint64_t offset, size;
+    };
+
+    std::map<Hash, ChunkLocation> chunkLocations;
+    uint64_t chunksSize = 0;
+
+    std::vector<CompressionSink::Frame> frames;
+
     {
         FdSink fileSink(fdTemp.get());
         TeeSink teeSinkCompressed{fileSink, fileHashSink};
-        bool parallel = config.parallelCompression.overridden ? config.parallelCompression.get()
-                                                              : config.compression.get() == CompressionAlgo::zstd;
-        auto compressionSink =
-            makeCompressionSink(config.compression, teeSinkCompressed, parallel, config.compressionLevel);
+        std::shared_ptr<FinishSink> compressionSink;
+        if (config.chunkNars)
+            compressionSink = std::make_shared<ChunkingSink>([&](std::string_view chunk) {
+                auto hash = hashString(HashAlgorithm::SHA256, chunk);
+                manifest.chunks.push_back({.hash = hash, .size = chunk.size()});
+                if (chunkLocations.contains(hash))
+                    return;
+                auto compressed = compress(config.compression, chunk, false, config.compressionLevel);
+                chunkLocations.emplace(hash, ChunkLocation{.offset = chunksSize, .size = compressed.size()});
+                chunksSize += compressed.size();
+                teeSinkCompressed(compressed);
+            });
+        else {
+            bool parallel = config.parallelCompression.overridden ? config.parallelCompression.get()
+                                                                  : config.compression.get() == CompressionAlgo::zstd;
+            compressionSink =
+                makeCompressionSink(config.compression, teeSinkCompressed, parallel, config.compressionLevel).get_ptr();
+        }
         TeeSink teeSinkUncompressed{*compressionSink, narHashSink};
         TeeSource teeSource{narSource, teeSinkUncompressed};
         narAccessor = makeNarAccessor(parseNarListing(teeSource));
         compressionSink->finish();
         fileSink.flush();
+        if (auto sink = std::dynamic_pointer_cast<CompressionSink>(compressionSink))
+            frames = sink->getFrames();
     }
 
     auto now2 = std::chrono::steady_clock::now();
@@ -174,13 +324,19 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
     narInfo->fileHash = fileHash;
     narInfo->fileSize = fileSize;
     narInfo->url = "nar/" + narInfo->fileHash->to_string(HashFormat::Nix32, false) + ".nar"
-                   + (config.compression == CompressionAlgo::xz       ? ".xz"
-                      : config.compression == CompressionAlgo::bzip2  ? ".bz2"
-                      : config.compression == CompressionAlgo::zstd   ? ".zst"
-                      : config.compression == CompressionAlgo::lzip   ? ".lzip"
-                      : config.compression == CompressionAlgo::lz4    ? ".lz4"
-                      : config.compression == CompressionAlgo::brotli ? ".br"
-                                                                      : "");
+                   + compressionExtension(config.compression);
+
+    /* A chunked NAR is identified by its manifest. Its file size is
+       the total size of the manifest and its distinct chunks, i.e. the
+       most that substituting it downloads. */
+    std::string manifestData;
+    if (config.chunkNars) {
+        manifestData = manifest.to_string();
+        narInfo->compression = chunkedCompression;
+        narInfo->fileHash = hashString(HashAlgorithm::SHA256, manifestData);
+        narInfo->fileSize = fileSize + manifestData.size();
+        narInfo->url = "nar/" + narInfo->fileHash->to_string(HashFormat::Nix32, false) + ".chunks";
+    }
 
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now2 - now1).count();
     printMsg(
@@ -212,13 +368,29 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
             {"root", narAccessor->getListing()},
         };
 
+        /* If the files in the NAR can be read without fetching all of
+           it, i.e. if it's uncompressed or consists of independently
+           compressed frames, record the NAR file and where its frames
+           start, followed by its end. See getIndexedNarAccessor(). */
+        if (!config.chunkNars && (config.compression == CompressionAlgo::none || !frames.empty())) {
+            nlohmann::json nar = {{"url", narInfo->url}};
+            if (!frames.empty()) {
+                auto jsonFrames = nlohmann::json::array();
+                for (auto & frame : frames)
+                    jsonFrames.push_back({frame.uncompressedOffset, frame.compressedOffset});
+                jsonFrames.push_back({info.narSize, fileSize});
+                nar["frames"] = std::move(jsonFrames);
+            }
+            j["nar"] = std::move(nar);
+        }
+
         upsertFile(std::string(info.path.hashPart()) + ".ls", j.dump(), "application/json");
     }
 
     /* Optionally maintain an index of DWARF debug info files
        consisting of JSON files named 'debuginfo/<build-id>' that
        specify the NAR file and member containing the debug info. */
-    if (config.writeDebugInfo) {
+    if (config.writeDebugInfo && !config.chunkNars) {
 
         CanonPath buildIdDir("lib/debug/.build-id");
 
@@ -271,8 +443,54 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
         }
     }
 
+    if (config.chunkNars) {
+        /* Upload the chunks that the binary cache doesn't have yet,
+           and then the manifest, so that a manifest never refers to
+           missing chunks. */
+        std::atomic<uint64_t> chunksUploaded{0}, bytesUploaded{0};
+
+        ThreadPool threadPool(25);
+
+        auto doChunk = [&](const Hash & hash, ChunkLocation location) {
+            checkInterrupt();
+
+            auto path = manifest.chunkPath(hash);
+            if (!repair && fileExists(path))
+                return;
+
+            StringSink data;
+            copyFdRange(fdTemp.get(), location.offset, location.size, data);
+            upsertFile(path, std::move(data.s), "application/x-nix-nar-chunk");
+
+            chunksUploaded++;
+            bytesUploaded += location.size;
+        };
+
+        for (auto & [hash, location] : chunkLocations)
+            threadPool.enqueue(std::bind(doChunk, hash, location));
+
+        threadPool.process();
+
+        printMsg(
+            lvlTalkative,
+            "uploaded %d of %d chunks (%d of %d bytes) of '%s'",
+            chunksUploaded,
+            chunkLocations.size(),
+            bytesUploaded,
+            chunksSize,
+            printStorePath(narInfo->path));
+
+        if (repair || !fileExists(narInfo->url)) {
+            stats.narWrite++;
+            upsertFile(narInfo->url, std::move(manifestData), "application/json");
+        } else
+            stats.narWriteAverted++;
+
+        fileSize = bytesUploaded;
+    }
+
     /* Atomically write the NAR file. */
-    if (repair || !fileExists(narInfo->url)) {
+    else if (repair || !fileExists(narInfo->url)) {
         FdSource source{fdTemp.get()};
         source.restart(); /* Seek back to the start of the file. */
         stats.narWrite++;
@@ -423,6 +641,11 @@ void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
             stats.narReadBytes += narSize;
         }};
 
+    if (info->compression == chunkedCompression) {
+        narFromChunks(*info, uncompressedSink);
+        return;
+    }
+
     auto decompressor = makeDecompressionSink(info->compression, uncompressedSink);
 
     try {
@@ -436,6 +659,212 @@ void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
     // Note: don't do anything here because it's never reached if we're called as a coroutine.
 }
 
+std::shared_ptr<SourceAccessor> BinaryCacheStore::getIndexedNarAccessor(const StorePath & storePath)
+{
+    if (rangesUnsupported)
+        return nullptr;
+
+    auto info = queryPathInfo(storePath).cast<const NarInfo>();
+
+    bool compressed = info->compression != "none";
+    if (compressed && info->compression != "zstd")
+        return nullptr;
+
+    auto listingFile = std::string(storePath.hashPart()) + ".ls";
+    auto listingData = getFile(listingFile);
+    if (!listingData)
+        return nullptr;
+
+    /* The start of each frame of the NAR file, followed by its end. */
+    std::vector<CompressionSink::Frame> frames;
+    std::optional<NarListing> listing;
+
+    try {
+        auto json = nlohmann::json::parse(*listingData);
+        auto & obj = getObject(json);
+
+        /* Listings written by older versions of Nix don't have an
+           index, and the index is only valid for the NAR file that it
+           was written for. */
+        auto * nar = optionalValueAt(obj, "nar");
+        if (!nar || getString(valueAt(getObject(*nar), "url")) != info->url)
+            return nullptr;
+
+        if (compressed) {
+            for (auto & frame : getArray(valueAt(getObject(*nar), "frames"))) {
+                auto & offsets = getArray(frame);
+                if (offsets.size() != 2)
+                    throw Error("frame offsets must be a pair");
+                frames.push_back({
+                    .uncompressedOffset = getUnsigned(offsets[0]),
+                    .compressedOffset = getUnsigned(offsets[1]),
+                });
+            }
+            if (frames.size() < 2 || frames.front().uncompressedOffset != 0
+                || !std::ranges::is_sorted(frames, {}, &CompressionSink::Frame::uncompressedOffset))
+                throw Error("invalid frame offsets");
+        }
+
+        listing = valueAt(obj, "root").get<NarListing>();
+    } catch (std::exception & e) {
+        warn(
+            "ignoring corrupt NAR listing '%s' in binary cache '%s': %s",
+            listingFile,
+            config.getHumanReadableURI(),
+            e.what());
+        return nullptr;
+    }
+
+    auto getNarBytes = [this, self(shared_from_this()), info, frames(std::move(frames))](
+                           uint64_t offset, uint64_t length, Sink & sink) {
+        if (!length)
+            return;
+
+        try {
+            if (frames.empty()) {
+                getFileRange(info->url, offset, length, sink);
+                return;
+            }
+
+            /* Fetch and decompress the frames that contain the
+               requested bytes. */
+            auto first = std::ranges::upper_bound(frames, offset, {}, &CompressionSink::Frame::uncompressedOffset) - 1;
+            auto last =
+                std::ranges::lower_bound(frames, offset + length, {}, &CompressionSink::Frame::uncompressedOffset);
+            if (last == frames.end())
+                throw Error(
+                    "NAR listing of '%s' in binary cache '%s' is inconsistent with the NAR",
+                    printStorePath(info->path),
+                    config.getHumanReadableURI());
+
+            RangeSink rangeSink(sink, offset - first->uncompressedOffset, length);
+            auto decompressor = makeDecompressionSink(info->compression, rangeSink);
+            getFileRange(
+                info->url, first->compressedOffset, last->compressedOffset - first->compressedOffset, *decompressor);
+            decompressor->finish();
+
+            if (rangeSink.left)
+                throw Error(
+                    "NAR file '%s' in binary cache '%s' is truncated", info->url, config.getHumanReadableURI());
+
+            debug(
+                "fetched %d bytes of '%s' to read %d bytes of its NAR",
+                last->compressedOffset - first->compressedOffset,
+                info->url,
+                length);
+        } catch (NoSuchBinaryCacheFile & e) {
+            throw SubstituteGone(std::move(e.info()));
+        }
+    };
+
+    return makeLazyNarAccessor(std::move(*listing), std::move(getNarBytes)).get_ptr();
+}
+
+void BinaryCacheStore::narFromChunks(const NarInfo & info, Sink & sink)
+{
+    auto manifestData = getFile(info.url);
+    if (!manifestData)
+        throw SubstituteGone(
+            "chunk manifest '%s' does not exist in binary cache '%s'", info.url, config.getHumanReadableURI());
+
+    auto manifest = ChunkManifest::parse(*manifestData, info.url);
+
+    std::optional<std::filesystem::path> chunkCacheDir = config.localChunkCache.get();
+    if (chunkCacheDir)
+        createDirs(*chunkCacheDir);
+
+    auto localChunkPath = [&](const Hash & hash) { return *chunkCacheDir / hash.to_string(HashFormat::Nix32, false); };
+
+    auto isValidChunk = [&](const ChunkManifest::Chunk & chunk, std::string_view data) {
+        return data.size() == chunk.size && hashString(HashAlgorithm::SHA256, data) == chunk.hash;
+    };
+
+    /* Download the chunks that are not in the local chunk cache, up to
+       `maxDownloads` at a time ahead of the one being written. */
+    static constexpr size_t maxDownloads = 16;
+
+    std::map<size_t, std::future<std::optional<std::string>>> downloads;
+    size_t nextDownload = 0;
+    uint64_t chunksDownloaded = 0, bytesDownloaded = 0;
+
+    auto startDownload = [&](size_t i) {
+        auto promise = std::make_shared<std::promise<std::optional<std::string>>>();
+        downloads.emplace(i, promise->get_future());
+        getFile(manifest.chunkPath(manifest.chunks[i].hash), {[promise](std::future<std::optional<std::string>> result) {
+                    try {
+                        promise->set_value(result.get());
+                    } catch (...) {
+                        promise->set_exception(std::current_exception());
+                    }
+                }});
+    };
+
+    for (size_t i = 0; i < manifest.chunks.size(); ++i) {
+        checkInterrupt();
+
+        auto & chunk = manifest.chunks[i];
+
+        for (; nextDownload < manifest.chunks.size() && downloads.size() < maxDownloads; ++nextDownload)
+            if (!chunkCacheDir || !pathExists(localChunkPath(manifest.chunks[nextDownload].hash)))
+                startDownload(nextDownload);
+
+        std::optional<std::string> data;
+
+        if (!downloads.contains(i)) {
+            try {
+                data = readFile(localChunkPath(chunk.hash));
+            } catch (SystemError &) {
+            }
+            if (data && !isValidChunk(chunk, *data)) {
+                warn("chunk %s in the local chunk cache is corrupt", PathFmt(localChunkPath(chunk.hash)));
+                data.reset();
+            }
+            if (!data)
+                startDownload(i);
+        }
+
+        if (auto download = downloads.extract(i)) {
+            auto compressed = download.mapped().get();
+            if (!compressed)
+                throw SubstituteGone(
+                    "chunk '%s' does not exist in binary cache '%s'",
+                    manifest.chunkPath(chunk.hash),
+                    config.getHumanReadableURI());
+            chunksDownloaded++;
+            bytesDownloaded += compressed->size();
+
+            data = decompress(showCompressionAlgo(manifest.compression), *compressed);
+            if (!isValidChunk(chunk, *data))
+                throw Error(
+                    "chunk '%s' from binary cache '%s' is corrupt",
+                    manifest.chunkPath(chunk.hash),
+                    config.getHumanReadableURI());
+
+            if (chunkCacheDir) {
+                try {
+                    auto path = localChunkPath(chunk.hash);
+                    auto tmp = makeTempPath(path);
+                    AutoDelete del(tmp, false);
+                    writeFile(tmp, *data);
+                    std::filesystem::rename(tmp, path);
+                    del.cancel();
+                } catch (...) {
+                    ignoreExceptionExceptInterrupt();
+                }
+            }
+        }
+
+        sink(*data);
+    }
+
+    debug(
+        "downloaded %d of %d chunks (%d bytes) of '%s'",
+        chunksDownloaded,
+        manifest.chunks.size(),
+        bytesDownloaded,
+        printStorePath(info.path));
+}
+
 void BinaryCacheStore::queryPathInfoUncached(
     const StorePath & storePath, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
@@ -566,7 +995,8 @@ void BinaryCacheStore::registerDrvOutput(const Realisation & info)
 
 ref<RemoteFSAccessor> BinaryCacheStore::getRemoteFSAccessor(bool requireValidPath)
 {
-    return make_ref<RemoteFSAccessor>(ref<Store>(shared_from_this()), requireValidPath, config.localNarCache);
+    return make_ref<RemoteFSAccessor>(
+        ref<Store>(shared_from_this()), requireValidPath, config.localNarCache, config.localNarCacheSize);
 }
 
 ref<SourceAccessor> BinaryCacheStore::getFSAccessor(bool requireValidPath)
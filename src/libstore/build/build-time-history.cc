@@ -0,0 +1,82 @@
+#include "nix/store/build/build-time-history.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/users.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+static const char * schema = R"sql(
+
+create table if not exists BuildTimes (
+    name      text primary key not null,
+    millis    integer not null,
+    timestamp integer not null
+);
+
+)sql";
+
+struct BuildTimeHistory::State
+{
+    SQLite db;
+    SQLiteStmt lookup, mean, record;
+};
+
+BuildTimeHistory::BuildTimeHistory(const std::filesystem::path & dbPath)
+    : state(std::make_unique<State>())
+{
+    createDirs(dbPath.parent_path());
+
+    state->db = SQLite(dbPath, SQLite::Settings{.useWAL = true});
+
+    state->db.isCache();
+
+    state->db.exec(schema);
+
+    state->lookup.create(state->db, "select millis from BuildTimes where name = ?");
+
+    state->mean.create(state->db, "select cast(avg(millis) as integer) from BuildTimes");
+
+    state->record.create(
+        state->db,
+        "insert into BuildTimes(name, millis, timestamp) values (?1, ?2, ?3) "
+        "on conflict (name) do update set millis = (millis + ?2) / 2, timestamp = ?3");
+}
+
+BuildTimeHistory::~BuildTimeHistory() = default;
+
+std::unique_ptr<BuildTimeHistory> BuildTimeHistory::openDefault()
+{
+    return std::make_unique<BuildTimeHistory>(getCacheDir() / "build-times-v1.sqlite");
+}
+
+std::optional<std::chrono::milliseconds> BuildTimeHistory::lookup(std::string_view drvName)
+{
+    return retrySQLite<std::optional<std::chrono::milliseconds>>(
+        [&]() -> std::optional<std::chrono::milliseconds> {
+            auto query(state->lookup.use()(drvName));
+            if (!query.next())
+                return std::nullopt;
+            return std::chrono::milliseconds(query.getInt(0));
+        });
+}
+
+std::optional<std::chrono::milliseconds> BuildTimeHistory::mean()
+{
+    return retrySQLite<std::optional<std::chrono::milliseconds>>(
+        [&]() -> std::optional<std::chrono::milliseconds> {
+            auto query(state->mean.use());
+            if (!query.next() || query.isNull(0))
+                return std::nullopt;
+            return std::chrono::milliseconds(query.getInt(0));
+        });
+}
+
+void BuildTimeHistory::record(std::string_view drvName, std::chrono::milliseconds duration)
+{
+    retrySQLite<void>([&]() {
+        state->record.use()(drvName)(static_cast<int64_t>(duration.count()))(static_cast<int64_t>(time(nullptr)))
+            .exec();
+    });
+}
+
+} // namespace nix
@@ -51,6 +51,13 @@ std::string DerivationBuildingGoal::key()
     return "dd$" + std::string(drvPath.name()) + "$" + worker.store.printStorePath(drvPath);
 }
 
+double DerivationBuildingGoal::estimatedCost()
+{
+    if (!cost)
+        cost = worker.estimatedBuildTime(drvPath);
+    return *cost;
+}
+
 std::string showKnownOutputs(const StoreDirConfig & store, const Derivation & drv)
 {
     std::string msg;
@@ -471,6 +478,10 @@ Goal::Co DerivationBuildingGoal::tryToBuild(StorePathSet inputPaths)
                 fmt("waiting for lock on %s",
                     Magenta(concatMapStringsSep(", ", lockFiles, [](auto & p) { return "'" + p.string() + "'"; }))));
 
+            /* Give up our build slot, if any, while someone else holds
+               the lock. */
+            gotBuildSlot = false;
+
             /* Wait then try locking again, repeat until success (returned
                boolean is true). */
             do {
@@ -529,7 +540,10 @@ Goal::Co DerivationBuildingGoal::tryToBuild(StorePathSet inputPaths)
                 co_return Return{};
             case rpPostpone:
                 /* Not now; wait until at least one child finishes or
-                   the wake-up timeout expires. */
+                   the wake-up timeout expires. Give up our build slot,
+                   if any, so we don't skip the queue if we end up
+                   building locally after all. */
+                gotBuildSlot = false;
                 break;
             }
         }
@@ -687,6 +701,8 @@ Goal::Co DerivationBuildingGoal::buildWithHook(
     fds.insert(hook->fromHook.readSide.get());
     fds.insert(hook->builderOut.readSide.get());
     worker.childStarted(shared_from_this(), fds, false, false);
+    setPhase(GoalPhase::Building);
+    buildStartTime = std::chrono::steady_clock::now();
 
     buildResult.startTime = time(nullptr); // inexact
 
@@ -785,6 +801,7 @@ Goal::Co DerivationBuildingGoal::buildWithHook(
 
     /* So the child is gone now. */
     worker.childTerminated(this);
+    setPhase(GoalPhase::Working);
 
     /* Close the read side of the logger pipe. */
     hook->builderOut.readSide.close();
@@ -804,6 +821,8 @@ Goal::Co DerivationBuildingGoal::buildWithHook(
         co_return doneFailure(std::move(e));
     }
 
+    worker.recordBuildTime(drvPath, std::chrono::steady_clock::now() - buildStartTime);
+
     /* Compute the FS closure of the outputs and register them as
        being valid. */
     auto builtOutputs =
@@ -897,9 +916,14 @@ Goal::Co DerivationBuildingGoal::buildLocally(
     while (true) {
 
         unsigned int curBuilds = worker.getNrLocalBuilds();
-        if (curBuilds >= worker.settings.maxBuildJobs) {
+        /* A slot we were handed is only good for this attempt. If we
+           have to wait for a build user and come back here, we queue
+           up again behind goals with a longer critical path. */
+        bool haveBuildSlot = std::exchange(gotBuildSlot, false);
+        if (curBuilds >= worker.settings.maxBuildJobs || (worker.settings.scheduleCriticalPath && !haveBuildSlot)) {
             outputLocks.unlock();
             co_await waitForBuildSlot();
+            gotBuildSlot = true;
             co_return tryToBuild(std::move(inputPaths));
         }
 
@@ -1014,6 +1038,8 @@ Goal::Co DerivationBuildingGoal::buildLocally(
     actLock.reset();
 
     worker.childStarted(shared_from_this(), {builderOut}, true, true);
+    setPhase(GoalPhase::Building);
+    buildStartTime = std::chrono::steady_clock::now();
 
     started();
 
@@ -1044,6 +1070,8 @@ Goal::Co DerivationBuildingGoal::buildLocally(
     trace("build done");
 
     SingleDrvOutputs builtOutputs;
+    auto buildTime = std::chrono::steady_clock::now() - buildStartTime;
+    setPhase(GoalPhase::RegisteringOutputs);
     try {
         builtOutputs = builder->unprepareBuild();
     } catch (BuilderFailureError & e) {
@@ -1055,6 +1083,8 @@ Goal::Co DerivationBuildingGoal::buildLocally(
         outputLocks.unlock();
         co_return doneFailure(std::move(e));
     }
+    setPhase(GoalPhase::Working);
+    worker.recordBuildTime(drvPath, buildTime);
     {
         builder.reset();
         StorePathSet outputPaths;
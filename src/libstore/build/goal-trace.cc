@@ -0,0 +1,159 @@
+#include "nix/store/build/goal-trace.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/file-descriptor.hh"
+
+#include <atomic>
+#include <fcntl.h>
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+static std::string_view showGoalPhase(GoalPhase phase)
+{
+    switch (phase) {
+    case GoalPhase::Queued:
+        return "queued";
+    case GoalPhase::Working:
+        return "working";
+    case GoalPhase::WaitingForDependencies:
+        return "waiting for dependencies";
+    case GoalPhase::WaitingForBuildSlot:
+        return "waiting for build slot";
+    case GoalPhase::WaitingForLock:
+        return "waiting for lock";
+    case GoalPhase::Building:
+        return "building";
+    case GoalPhase::RegisteringOutputs:
+        return "registering outputs";
+    case GoalPhase::Substituting:
+        return "substituting";
+    default:
+        unreachable();
+    }
+}
+
+/**
+ * Track IDs are unique within the process, since several workers can
+ * write to the same trace.
+ */
+static std::atomic<uint64_t> nextTrack{1};
+
+GoalTrace::GoalTrace(std::filesystem::path path)
+    : path(std::move(path))
+    , workerTrack(nextTrack++)
+{
+}
+
+void GoalTrace::recordPhase(Goal & goal, GoalPhase phase, time_point begin, time_point end)
+{
+    if (!goal.traceId) {
+        goal.traceId = nextTrack++;
+        goalTracks.push_back({goal.traceId, goal.getName()});
+    }
+    spans.push_back({goal.traceId, std::string(showGoalPhase(phase)), begin, end});
+}
+
+void GoalTrace::recordLoop(std::string_view what, time_point begin, time_point end)
+{
+    if (end - begin >= minLoopSpan)
+        spans.push_back({workerTrack, std::string(what), begin, end});
+}
+
+void GoalTrace::recordSlots(size_t builds, size_t substitutions)
+{
+    slots.push_back({std::chrono::steady_clock::now(), builds, substitutions});
+}
+
+void GoalTrace::write()
+{
+    /* The steady clock is the same for all processes, so the spans of
+       different workers line up. */
+    auto micros = [&](time_point t) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+    };
+
+    auto pid = getpid();
+
+    std::string out;
+
+    auto add = [&](nlohmann::json event) {
+        out += event.dump();
+        out += ",\n";
+    };
+
+    auto nameTrack = [&](uint64_t track, std::string_view name) {
+        add({
+            {"ph", "M"},
+            {"name", "thread_name"},
+            {"pid", pid},
+            {"tid", track},
+            {"args", {{"name", name}}},
+        });
+        /* Keep the tracks in the order in which the goals started. */
+        add({
+            {"ph", "M"},
+            {"name", "thread_sort_index"},
+            {"pid", pid},
+            {"tid", track},
+            {"args", {{"sort_index", track}}},
+        });
+    };
+
+    nameTrack(workerTrack, "worker");
+    for (auto & [track, name] : goalTracks)
+        nameTrack(track, name);
+
+    for (auto & span : spans)
+        add({
+            {"ph", "X"},
+            {"name", span.name},
+            {"cat", span.track == workerTrack ? "worker" : "goal"},
+            {"pid", pid},
+            {"tid", span.track},
+            {"ts", micros(span.begin)},
+            {"dur", micros(span.end) - micros(span.begin)},
+        });
+
+    for (auto & s : slots)
+        add({
+            {"ph", "C"},
+            {"name", "slots"},
+            {"pid", pid},
+            {"ts", micros(s.time)},
+            {"args", {{"builds", s.builds}, {"substitutions", s.substitutions}}},
+        });
+
+    /* Every worker appends its events, so that e.g. the builds done
+       for import-from-derivation and the final build end up in the
+       same trace. The JSON array format of traces may be left
+       unterminated for this reason. Whoever creates the file starts
+       the array. */
+    AutoCloseFD fd = toDescriptor(open(
+        path.string().c_str(),
+        O_CREAT | O_EXCL | O_APPEND | O_WRONLY
+#ifndef _WIN32
+            | O_CLOEXEC
+#endif
+        ,
+        0644));
+    if (fd)
+        out = "[\n" + out;
+    else if (errno == EEXIST)
+        fd = toDescriptor(open(
+            path.string().c_str(),
+            O_APPEND | O_WRONLY
+#ifndef _WIN32
+                | O_CLOEXEC
+#endif
+            ));
+    if (!fd)
+        throw SysError("opening goal trace file %s", PathFmt(path));
+
+    writeFull(fd.get(), out);
+}
+
+} // namespace nix
@@ -1,5 +1,6 @@
 #include "nix/store/build/goal.hh"
 #include "nix/store/build/worker.hh"
+#include "nix/store/build/goal-trace.hh"
 #include "nix/store/worker-settings.hh"
 
 namespace nix {
@@ -179,7 +180,11 @@ Co Goal::await(Goals new_waitees)
         for (auto waitee : waitees) {
             addToWeakGoals(waitee->waiters, shared_from_this());
         }
+        if (worker.settings.scheduleCriticalPath)
+            propagateCriticalPath();
+        setPhase(GoalPhase::WaitingForDependencies);
         co_await Suspend{};
+        setPhase(GoalPhase::Working);
         assert(waitees.empty());
     }
     co_return Return{};
@@ -206,6 +211,8 @@ Goal::Done Goal::amDone(ExitCode result)
     assert(result == ecSuccess || result == ecFailed || result == ecNoSubstituters);
     exitCode = result;
 
+    endPhase(std::chrono::steady_clock::now());
+
     // Log the failure if we have one and shouldn't preserve it.
     // Only log for actual failures (ecFailed), not for ecNoSubstituters
     // which indicates "couldn't substitute, will try building" - that's
@@ -264,11 +271,45 @@ void Goal::trace(std::string_view s)
     debug("%1%: %2%", name, s);
 }
 
+void Goal::propagateCriticalPath()
+{
+    /* The graph can be deep, so don't recurse. */
+    std::vector<Goal *> todo{this};
+    while (!todo.empty()) {
+        auto goal = todo.back();
+        todo.pop_back();
+        auto path = goal->criticalPath();
+        for (auto & waitee : goal->waitees)
+            if (waitee->waitersCriticalPath < path) {
+                waitee->waitersCriticalPath = path;
+                todo.push_back(waitee.get());
+            }
+    }
+}
+
+void Goal::setPhase(GoalPhase newPhase)
+{
+    if (newPhase == phase)
+        return;
+    auto now = std::chrono::steady_clock::now();
+    endPhase(now);
+    phase = newPhase;
+    phaseStart = now;
+}
+
+void Goal::endPhase(std::chrono::steady_clock::time_point now)
+{
+    if (worker.goalTrace)
+        worker.goalTrace->recordPhase(*this, phase, phaseStart, now);
+}
+
 void Goal::work()
 {
     assert(top_co);
     assert(top_co->handle);
     assert(top_co->handle.promise().alive);
+    if (phase == GoalPhase::Queued)
+        setPhase(GoalPhase::Working);
     top_co->handle.resume();
     // We either should be in a state where we can be work()-ed again,
     // or we should be done.
@@ -303,7 +344,9 @@ Goal::Co Goal::yield()
 Goal::Co Goal::waitForAWhile()
 {
     worker.waitForAWhile(shared_from_this());
+    setPhase(GoalPhase::WaitingForLock);
     co_await Suspend{};
+    setPhase(GoalPhase::Working);
     co_return Return{};
 }
 
@@ -317,7 +360,9 @@ Goal::Co Goal::waitUntilWoken()
 Goal::Co Goal::waitForBuildSlot()
 {
     worker.waitForBuildSlot(shared_from_this());
+    setPhase(GoalPhase::WaitingForBuildSlot);
     co_await Suspend{};
+    setPhase(GoalPhase::Working);
     co_return Return{};
 }
 
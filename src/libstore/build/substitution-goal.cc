@@ -250,8 +250,10 @@ Goal::Co PathSubstitutionGoal::tryToRun(
 
     /* Use up the substitution slot. */
     worker.childStarted(shared_from_this(), /*channels=*/{}, /*inBuildSlot=*/true, /*respectTimeouts=*/false);
+    setPhase(GoalPhase::Substituting);
     /* Suspend until the thread finishes. */
     co_await waitUntilWoken();
+    setPhase(GoalPhase::Working);
 
     trace("substitute finished");
 
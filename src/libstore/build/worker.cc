@@ -8,6 +8,8 @@
 #include "nix/store/build/derivation-resolution-goal.hh"
 #include "nix/store/build/derivation-building-goal.hh"
 #include "nix/store/build/derivation-trampoline-goal.hh"
+#include "nix/store/build/goal-trace.hh"
+#include "nix/store/build/build-time-history.hh"
 #ifndef _WIN32 // TODO Enable building on Windows
 #  include "nix/store/build/hook-instance.hh"
 #endif
@@ -40,6 +42,16 @@ Worker::Worker(Store & store, Store & evalStore)
     nrLocalBuilds = 0;
     nrSubstitutions = 0;
     lastWokenUp = steady_time_point::min();
+    if (auto & path = settings.goalTraceFile.get())
+        goalTrace = std::make_unique<GoalTrace>(*path);
+    if (settings.scheduleCriticalPath && settings.buildTimeHistory) {
+        try {
+            buildTimes = BuildTimeHistory::openDefault();
+        } catch (Error & e) {
+            e.addTrace({}, "while opening the build time history");
+            logWarning(e.info());
+        }
+    }
 }
 
 Worker::~Worker()
@@ -50,6 +62,14 @@ Worker::~Worker()
        their destructors). */
     topGoals.clear();
 
+    if (goalTrace) {
+        try {
+            goalTrace->write();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
     assert(expectedSubstitutions == 0);
     assert(expectedDownloadSize == 0);
     assert(expectedNarSize == 0);
@@ -216,6 +236,8 @@ void Worker::childStarted(
             /* Doesn't make sense, since there are only building and substitution slots. */
             unreachable();
         }
+        if (goalTrace)
+            goalTrace->recordSlots(nrLocalBuilds, nrSubstitutions);
     }
 }
 
@@ -246,9 +268,17 @@ void Worker::childTerminated(Goal * goal, JobCategory jobCategory)
             /* Doesn't make sense, since there are only building and substitution slots. */
             unreachable();
         }
+        if (goalTrace)
+            goalTrace->recordSlots(nrLocalBuilds, nrSubstitutions);
     }
 
     children.erase(i);
+
+    /* With critical path scheduling, build slots are handed out by
+       handOutBuildSlots() once all awake goals have run. */
+    if (jobCategory == JobCategory::Build && settings.scheduleCriticalPath)
+        return;
+
     auto & waiting = jobCategory == JobCategory::Substitution ? wantingToSubstitute : wantingToBuild;
 
     /* Wake up goals waiting for a build slot. Wake at most one waiter to avoid
@@ -272,7 +302,9 @@ void Worker::waitForBuildSlot(GoalPtr goal)
         if (goal->jobCategory() == JobCategory::Substitution)
             return getNrSubstitutions() < settings.maxSubstitutionJobs;
         else
-            return getNrLocalBuilds() < settings.maxBuildJobs;
+            /* With critical path scheduling, we first need to know
+               who else wants a slot. */
+            return !settings.scheduleCriticalPath && getNrLocalBuilds() < settings.maxBuildJobs;
     }();
 
     if (slotAvailable)
@@ -281,6 +313,80 @@ void Worker::waitForBuildSlot(GoalPtr goal)
         addToWeakGoals(goal->jobCategory() == JobCategory::Substitution ? wantingToSubstitute : wantingToBuild, goal);
 }
 
+bool Worker::handOutBuildSlots()
+{
+    if (!settings.scheduleCriticalPath)
+        return false;
+
+    bool wokeUp = false;
+
+    size_t maxBuildJobs = settings.maxBuildJobs;
+    for (auto free = maxBuildJobs > nrLocalBuilds ? maxBuildJobs - nrLocalBuilds : 0; free; --free) {
+        GoalPtr best;
+        double bestPath = 0;
+        for (auto i = wantingToBuild.begin(); i != wantingToBuild.end();) {
+            auto goal = i->lock();
+            if (!goal) {
+                i = wantingToBuild.erase(i);
+                continue;
+            }
+            if (!best || goal->criticalPath() > bestPath) {
+                best = goal;
+                bestPath = goal->criticalPath();
+            }
+            ++i;
+        }
+        if (!best)
+            break;
+        best->trace(fmt("got build slot, critical path %.1f", bestPath));
+        wantingToBuild.erase(best);
+        wakeUp(best);
+        wokeUp = true;
+    }
+
+    return wokeUp;
+}
+
+double Worker::estimatedBuildTime(const StorePath & drvPath)
+{
+    if (!buildTimes)
+        return 1;
+    try {
+        auto name = Derivation::nameFromPath(drvPath);
+        if (auto i = buildTimeEstimates.find(name); i != buildTimeEstimates.end())
+            return i->second;
+        double estimate;
+        if (auto time = buildTimes->lookup(name))
+            estimate = std::chrono::duration<double>(*time).count();
+        else {
+            if (!defaultBuildTime) {
+                auto mean = buildTimes->mean();
+                defaultBuildTime = mean ? std::chrono::duration<double>(*mean).count() : 1;
+            }
+            estimate = *defaultBuildTime;
+        }
+        buildTimeEstimates.emplace(std::string(name), estimate);
+        return estimate;
+    } catch (Error & e) {
+        logWarning(e.info());
+        buildTimes.reset();
+    }
+    return 1;
+}
+
+void Worker::recordBuildTime(const StorePath & drvPath, std::chrono::steady_clock::duration duration)
+{
+    if (!buildTimes)
+        return;
+    try {
+        buildTimes->record(
+            Derivation::nameFromPath(drvPath), std::chrono::duration_cast<std::chrono::milliseconds>(duration));
+    } catch (Error & e) {
+        logWarning(e.info());
+        buildTimes.reset();
+    }
+}
+
 void Worker::waitForAWhile(GoalPtr goal)
 {
     goal->trace("wait for a while");
@@ -321,18 +427,22 @@ void Worker::run(const Goals & _topGoals)
                 checkInterrupt();
 
                 std::chrono::time_point<std::chrono::steady_clock> startTime;
-                if (verbosity >= lvlVomit)
+                if (verbosity >= lvlVomit || goalTrace)
                     startTime = std::chrono::steady_clock::now();
 
                 goal->work();
 
                 /* Useful for tracing which goals hod the event loop. */
-                vomit(
-                    "worker event loop worked goal '%1%' for %2$.3fms",
-                    goal->name,
-                    std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
-                        std::chrono::steady_clock::now() - startTime)
-                        .count());
+                if (verbosity >= lvlVomit || goalTrace) {
+                    auto endTime = std::chrono::steady_clock::now();
+                    vomit(
+                        "worker event loop worked goal '%1%' for %2$.3fms",
+                        goal->name,
+                        std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(endTime - startTime)
+                            .count());
+                    if (goalTrace)
+                        goalTrace->recordLoop(goal->name, startTime, endTime);
+                }
 
                 if (topGoals.empty())
                     break; // stuff may have been cancelled
@@ -342,9 +452,18 @@ void Worker::run(const Goals & _topGoals)
         if (topGoals.empty())
             break;
 
+        if (handOutBuildSlots())
+            continue;
+
         /* Wait for input or completion callbacks. */
-        if (!children.empty() || !waitingForAWhile.empty() || !waitingForCompletion.empty())
-            waitForInput();
+        if (!children.empty() || !waitingForAWhile.empty() || !waitingForCompletion.empty()) {
+            if (goalTrace) {
+                auto startTime = std::chrono::steady_clock::now();
+                waitForInput();
+                goalTrace->recordLoop("waiting for input", startTime, std::chrono::steady_clock::now());
+            } else
+                waitForInput();
+        }
         else if (awake.empty() && 0U == settings.maxBuildJobs) {
             if (Machine::parseConfig({nix::settings.thisSystem}, nix::settings.getWorkerSettings().builders).empty())
                 throw Error(
@@ -23,7 +23,10 @@
 #  include "nix/util/monitor-fd.hh"
 #endif
 
+#include <condition_variable>
+#include <queue>
 #include <sstream>
+#include <thread>
 
 namespace nix::daemon {
 
@@ -122,6 +125,25 @@ struct TunnelLogger : public Logger
         to.flush();
     }
 
+    /* Send the reply to a tagged request, preceded by any log messages
+       that were produced since the last operation. This is only called
+       between untagged operations, so the client is expecting
+       messages. */
+    void sendTaggedReply(std::string_view reply)
+    {
+        auto state(state_.lock());
+
+        assert(!state->canSendStderr);
+
+        for (auto & msg : state->pendingMsgs)
+            to(msg);
+
+        state->pendingMsgs.clear();
+
+        to(reply);
+        to.flush();
+    }
+
     /* stopWork() means that we're done; stop sending stderr to the
        client. */
     void stopWork(const Error * ex = nullptr)
@@ -312,6 +334,223 @@ struct ClientSettings
     }
 };
 
+/**
+ * Runs tagged requests (see `WorkerProto::featurePipelinedQueries`) on
+ * a few threads, so that slow queries don't hold up the replies to
+ * later ones.
+ */
+struct TaggedRequestExecutor
+{
+    static constexpr size_t maxThreads = 4;
+
+    struct State
+    {
+        std::queue<std::function<void()>> pending;
+        size_t running = 0;
+        size_t idle = 0;
+        bool quit = false;
+        std::vector<std::thread> threads;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable wakeup, done;
+
+    ~TaggedRequestExecutor()
+    {
+        std::vector<std::thread> threads;
+        {
+            auto state(state_.lock());
+            state->quit = true;
+            std::swap(threads, state->threads);
+        }
+        wakeup.notify_all();
+        for (auto & thread : threads)
+            thread.join();
+    }
+
+    void enqueue(std::function<void()> work)
+    {
+        auto state(state_.lock());
+        state->pending.push(std::move(work));
+        if (!state->idle && state->threads.size() < maxThreads)
+            state->threads.emplace_back([this]() { run(); });
+        else
+            wakeup.notify_one();
+    }
+
+    /**
+     * Wait until all tagged requests have been answered.
+     */
+    void drain()
+    {
+        auto state(state_.lock());
+        state.wait(done, [&]() { return state->pending.empty() && !state->running; });
+    }
+
+private:
+
+    void run()
+    {
+        while (true) {
+            std::function<void()> work;
+            {
+                auto state(state_.lock());
+                state->idle++;
+                state.wait(wakeup, [&]() { return state->quit || !state->pending.empty(); });
+                state->idle--;
+                if (state->quit)
+                    return;
+                work = std::move(state->pending.front());
+                state->pending.pop();
+                state->running++;
+            }
+
+            /* Work items report their own errors to the client. */
+            work();
+
+            auto state(state_.lock());
+            state->running--;
+            if (state->pending.empty() && !state->running)
+                done.notify_all();
+        }
+    }
+};
+
+/**
+ * Read a tagged request and queue it on `executor`, which sends the
+ * reply when it's done.
+ */
+static void performTaggedOp(
+    TunnelLogger * logger,
+    ref<Store> store,
+    WorkerProto::BasicServerConnection & conn,
+    TaggedRequestExecutor & executor)
+{
+    WorkerProto::ReadConn rconn(conn);
+
+    auto tag = readNum<uint64_t>(conn.from);
+    auto op = (WorkerProto::Op) readInt(conn.from);
+
+    /* We can't skip over the arguments of an op we don't know, so
+       this is fatal. */
+    if (!WorkerProto::isPipelinable(op))
+        throw Error("operation %1% cannot be sent as a tagged request", op);
+
+    auto version = conn.protoVersion;
+
+    auto sendReply = [logger, tag](std::function<void(Sink &)> writeResult) {
+        StringSink reply;
+        try {
+            StringSink result;
+            writeResult(result);
+            reply << STDERR_TAGGED_REPLY << tag << 1;
+            reply(result.s);
+        } catch (Error & e) {
+            reply.s.clear();
+            reply << STDERR_TAGGED_REPLY << tag << 0 << e;
+        } catch (std::exception & e) {
+            reply.s.clear();
+            reply << STDERR_TAGGED_REPLY << tag << 0 << Error(e.what());
+        }
+        try {
+            logger->sendTaggedReply(reply.s);
+        } catch (...) {
+            /* The client is gone; the main loop will notice. */
+        }
+    };
+
+    /* Read the arguments now, since they follow in the stream, but do
+       the work on the executor. */
+    std::function<void(Sink &)> work;
+
+    try {
+        switch (op) {
+
+        case WorkerProto::Op::IsValidPath: {
+            auto path = WorkerProto::Serialise<StorePath>::read(*store, rconn);
+            work = [store, path](Sink & to) { to << store->isValidPath(path); };
+            break;
+        }
+
+        case WorkerProto::Op::QueryPathInfo: {
+            auto path = WorkerProto::Serialise<StorePath>::read(*store, rconn);
+            work = [store, path, version](Sink & to) {
+                std::shared_ptr<const ValidPathInfo> info;
+                try {
+                    info = store->queryPathInfo(path);
+                } catch (InvalidPath &) {
+                }
+                if (info) {
+                    to << 1;
+                    WorkerProto::write(
+                        *store,
+                        WorkerProto::WriteConn{.to = to, .version = version},
+                        static_cast<const UnkeyedValidPathInfo &>(*info));
+                } else
+                    to << 0;
+            };
+            break;
+        }
+
+        case WorkerProto::Op::QueryPathFromHashPart: {
+            auto hashPart = readString(conn.from);
+            work = [store, hashPart, version](Sink & to) {
+                WorkerProto::write(
+                    *store,
+                    WorkerProto::WriteConn{.to = to, .version = version},
+                    store->queryPathFromHashPart(hashPart));
+            };
+            break;
+        }
+
+        case WorkerProto::Op::QueryReferrers:
+        case WorkerProto::Op::AddToStore:
+        case WorkerProto::Op::AddTextToStore:
+        case WorkerProto::Op::BuildPaths:
+        case WorkerProto::Op::EnsurePath:
+        case WorkerProto::Op::AddTempRoot:
+        case WorkerProto::Op::AddIndirectRoot:
+        case WorkerProto::Op::SyncWithGC:
+        case WorkerProto::Op::FindRoots:
+        case WorkerProto::Op::QueryDeriver:
+        case WorkerProto::Op::SetOptions:
+        case WorkerProto::Op::CollectGarbage:
+        case WorkerProto::Op::QuerySubstitutablePathInfo:
+        case WorkerProto::Op::QueryDerivationOutputs:
+        case WorkerProto::Op::QueryAllValidPaths:
+        case WorkerProto::Op::QueryDerivationOutputNames:
+        case WorkerProto::Op::QuerySubstitutablePathInfos:
+        case WorkerProto::Op::QueryValidPaths:
+        case WorkerProto::Op::QuerySubstitutablePaths:
+        case WorkerProto::Op::QueryValidDerivers:
+        case WorkerProto::Op::OptimiseStore:
+        case WorkerProto::Op::VerifyStore:
+        case WorkerProto::Op::BuildDerivation:
+        case WorkerProto::Op::AddSignatures:
+        case WorkerProto::Op::NarFromPath:
+        case WorkerProto::Op::AddToStoreNar:
+        case WorkerProto::Op::QueryMissing:
+        case WorkerProto::Op::QueryDerivationOutputMap:
+        case WorkerProto::Op::RegisterDrvOutput:
+        case WorkerProto::Op::QueryRealisation:
+        case WorkerProto::Op::AddMultipleToStore:
+        case WorkerProto::Op::AddBuildLog:
+        case WorkerProto::Op::BuildPathsWithResults:
+        case WorkerProto::Op::AddPermRoot:
+        case WorkerProto::Op::TaggedRequest:
+        case WorkerProto::Op::QueryPathInfos:
+            unreachable();
+        }
+    } catch (Error &) {
+        /* The arguments were read in full, so we can carry on. */
+        sendReply([&](Sink &) { throw; });
+        return;
+    }
+
+    executor.enqueue([sendReply, work]() { sendReply(work); });
+}
+
 static void performOp(
     TunnelLogger * logger,
     ref<Store> store,
@@ -886,6 +1125,18 @@ static void performOp(
         break;
     }
 
+    case WorkerProto::Op::QueryPathInfos: {
+        auto paths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        logger->startWork();
+        auto infos = store->queryPathInfos(paths);
+        logger->stopWork();
+        std::map<StorePath, UnkeyedValidPathInfo> res;
+        for (auto & [path, info] : infos)
+            res.insert_or_assign(path, static_cast<const UnkeyedValidPathInfo &>(*info));
+        WorkerProto::write(*store, wconn, res);
+        break;
+    }
+
     case WorkerProto::Op::OptimiseStore:
         logger->startWork();
         store->optimiseStore();
@@ -1026,6 +1277,9 @@ static void performOp(
         break;
     }
 
+    /* Only valid when pipelined queries were negotiated, in which
+       case it is handled by `performTaggedOp()`. */
+    case WorkerProto::Op::TaggedRequest:
     default:
         throw Error("invalid operation %1%", op);
     }
@@ -1090,6 +1344,10 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
             .remoteTrustsUs = trusted ? store->isTrustedClient() : std::optional{NotTrusted},
         });
 
+    /* Tagged requests may still be running when we're done, so this
+       must be destroyed before `conn` and the logger. */
+    TaggedRequestExecutor taggedRequests;
+
     /* Send startup error messages to the client. */
     tunnelLogger->startWork();
 
@@ -1113,6 +1371,16 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
 
             opCount++;
 
+            if (op == WorkerProto::Op::TaggedRequest
+                && conn.protoVersion.features.contains(WorkerProto::featurePipelinedQueries)) {
+                performTaggedOp(tunnelLogger, store, conn, taggedRequests);
+                continue;
+            }
+
+            /* Untagged operations are answered in order, after
+               everything that came before. */
+            taggedRequests.drain();
+
             debug("performing daemon worker op: %d", op);
 
             try {
@@ -190,6 +190,13 @@ struct curlFileTransfer : public FileTransfer
          */
         bool hasContentEncoding:1 = false;
 
+        /**
+         * Whether the server responded to a range request with the
+         * entire file and we have received the end of the range, so
+         * the rest of the response can be dropped.
+         */
+        bool rangeDone:1 = false;
+
         /**
          * Server-provided minimum retry delay, parsed from the `Retry-After`
          * response header. Reset on each new HTTP status line, and consumed
@@ -199,6 +206,13 @@ struct curlFileTransfer : public FileTransfer
 
         curl_off_t writtenToSink = 0;
 
+        /**
+         * The number of bytes of the response body received so far,
+         * if the server responded to a range request with the entire
+         * file.
+         */
+        uint64_t fullBodyOffset = 0;
+
         std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
 
         inline static const std::set<long> successfulStatuses{
@@ -241,6 +255,24 @@ struct curlFileTransfer : public FileTransfer
                     (*errorSink)(data);
                 }
 
+                /* If the server doesn't support range requests, extract
+                   the requested range (minus what we got in previous
+                   attempts) from the entire file. */
+                if (this->request.range && getHTTPStatus() == HttpStatus::Ok) {
+                    result.rangeIgnored = true;
+                    auto pos = fullBodyOffset;
+                    fullBodyOffset += data.size();
+                    uint64_t start = this->request.range->offset + (this->request.dataCallback ? writtenToSink : 0);
+                    uint64_t end = this->request.range->offset + this->request.range->length;
+                    if (fullBodyOffset >= end)
+                        rangeDone = true;
+                    if (pos + data.size() <= start || pos >= end)
+                        return;
+                    if (pos < start)
+                        data.remove_prefix(start - pos);
+                    data = data.substr(0, end - std::max(pos, start));
+                }
+
                 if (this->request.dataCallback) {
                     auto httpStatus = getHTTPStatus();
 
@@ -342,6 +374,12 @@ struct curlFileTransfer : public FileTransfer
                 curl_easy_pause(req, CURLPAUSE_RECV);
             }
 
+            /* Don't download the rest of the file if we already have
+               the requested range. This makes curl fail with
+               CURLE_WRITE_ERROR, which finish() treats as success. */
+            if (rangeDone)
+                return 0;
+
             return realSize;
         } catch (...) {
             callbackException = std::current_exception();
@@ -373,6 +411,9 @@ struct curlFileTransfer : public FileTransfer
                 result.data.clear();
                 result.bodySize = 0;
                 statusMsg = trim(match.str(1));
+                result.rangeIgnored = false;
+                fullBodyOffset = 0;
+                rangeDone = false;
                 acceptRanges = false;
                 hasContentEncoding = false;
                 retryAfterMs = std::nullopt;
@@ -576,9 +617,9 @@ struct curlFileTransfer : public FileTransfer
 
             /* Enable transparent decompression for downloads.
                Skip for uploads (Accept-Encoding is meaningless when sending data)
-               and when resuming from an offset (byte ranges don't work with
-               compressed content). */
-            if (writtenToSink == 0 && !request.data)
+               and for range requests and when resuming from an offset (byte
+               ranges don't work with compressed content). */
+            if (writtenToSink == 0 && !request.data && !request.range)
                 /* Empty string means to enable all supported (that libcurl has
                    been linked to support) encodings. */
                 curl_easy_setopt(req, CURLOPT_ACCEPT_ENCODING, "");
@@ -663,7 +704,12 @@ struct curlFileTransfer : public FileTransfer
             curl_easy_setopt(req, CURLOPT_NETRC_FILE, fileTransfer.settings.netrcFile.get().string().c_str());
             curl_easy_setopt(req, CURLOPT_NETRC, CURL_NETRC_OPTIONAL);
 
-            if (writtenToSink)
+            if (request.range) {
+                assert(request.range->length);
+                auto start = request.range->offset + writtenToSink;
+                auto end = request.range->offset + request.range->length - 1;
+                curl_easy_setopt(req, CURLOPT_RANGE, fmt("%d-%d", start, end).c_str());
+            } else if (writtenToSink)
                 curl_easy_setopt(req, CURLOPT_RESUME_FROM_LARGE, writtenToSink);
 
             /* Note that the underlying strings get copied by libcurl, so the path -> string conversion is ok:
@@ -733,6 +779,9 @@ struct curlFileTransfer : public FileTransfer
                 httpStatus = std::to_underlying(HttpStatus::NotModified);
             }
 
+            if (code == CURLE_WRITE_ERROR && rangeDone)
+                code = CURLE_OK;
+
             if (callbackException)
                 failEx(callbackException);
 
@@ -872,7 +921,7 @@ struct curlFileTransfer : public FileTransfer
                 // byte ranges AND the response to be uncompressed (the Range
                 // applies to the encoded stream, but the sink saw decoded bytes).
                 if (request.dataCallback && writtenToSink != 0)
-                    return acceptRanges && !hasContentEncoding;
+                    return (acceptRanges || request.range) && !hasContentEncoding;
                 return true;
             }();
 
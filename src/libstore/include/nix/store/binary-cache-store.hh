@@ -35,7 +35,15 @@ public:
         )"};
 
     Setting<bool> writeNARListing{
-        this, false, "write-nar-listing", "Whether to write a JSON file that lists the files in each NAR."};
+        this,
+        false,
+        "write-nar-listing",
+        R"(
+          Whether to write a JSON file that lists the files in each NAR.
+
+          For NARs compressed with `zstd` or `none`, the listing also records where each file is in the compressed NAR.
+          Commands such as `nix store cat` then only download the part of the NAR that contains the file.
+        )"};
 
     Setting<bool> writeDebugInfo{
         this,
@@ -58,6 +66,39 @@ public:
         "local-nar-cache",
         "Path to a local cache of NARs fetched from this binary cache, used by commands such as `nix store cat`."};
 
+    Setting<uint64_t> localNarCacheSize{
+        this,
+        0,
+        "local-nar-cache-size",
+        R"(
+          The maximum size in bytes of the `local-nar-cache`, or `0` for no limit.
+          When adding a NAR makes the cache larger, the least recently used NARs are deleted from it.
+        )"};
+
+    Setting<bool> chunkNars{
+        this,
+        false,
+        "chunk-nars",
+        R"(
+          Whether to split NARs into content-defined chunks of about 64 KiB.
+          Each chunk is compressed with `compression` and stored once under `chunks/`, named after the hash of its contents.
+          A manifest under `nar/` lists the chunks of each NAR.
+          NARs that are largely identical, such as different versions of a package, share most of their chunks, and chunks that the cache already has are not uploaded again.
+
+          Paths added this way can only be substituted by versions of Nix that support chunked NARs.
+          `index-debug-info` has no effect on them.
+        )"};
+
+    Setting<std::optional<AbsolutePath>> localChunkCache{
+        this,
+        std::nullopt,
+        "local-chunk-cache",
+        R"(
+          Path to a local store of the uncompressed chunks of NARs fetched from this binary cache (see `chunk-nars`).
+          When substituting a chunked NAR, only the chunks missing from it are downloaded.
+          Chunks are named after the hash of their contents, so several binary caches can share the same directory.
+        )"};
+
     Setting<bool> parallelCompression{
         this,
         false,
@@ -128,6 +169,13 @@ protected:
      */
     std::string makeRealisationPath(const DrvOutput & id);
 
+    /**
+     * Set once the cache has answered a range request with the entire
+     * file. getIndexedNarAccessor() then returns `nullptr`, so that
+     * callers fetch and cache the whole NAR once instead.
+     */
+    std::atomic<bool> rangesUnsupported{false};
+
 public:
 
     virtual bool fileExists(const std::string & path) = 0;
@@ -157,6 +205,12 @@ public:
      */
     virtual void getFile(const std::string & path, Sink & sink);
 
+    /**
+     * Dump `length` bytes of the specified file, starting at `offset`,
+     * to a sink. The default implementation fetches the entire file.
+     */
+    virtual void getFileRange(const std::string & path, uint64_t offset, uint64_t length, Sink & sink);
+
     /**
      * Get the contents of /nix-cache-info. Return std::nullopt if it
      * doesn't exist.
@@ -186,6 +240,13 @@ private:
     ref<const ValidPathInfo> addToStoreCommon(
         Source & narSource, RepairFlag repair, CheckSigsFlag checkSigs, fun<ValidPathInfo(HashResult)> mkInfo);
 
+    /**
+     * Write the NAR described by a chunk manifest (see `chunk-nars`) to
+     * `sink`, taking chunks from the `local-chunk-cache` where
+     * possible.
+     */
+    void narFromChunks(const NarInfo & info, Sink & sink);
+
     /**
      * Same as `getFSAccessor`, but with a more preceise return type.
      */
@@ -228,6 +289,14 @@ public:
 
     void narFromPath(const StorePath & path, Sink & sink) override;
 
+    /**
+     * Return an accessor for the NAR of `path` that only fetches the
+     * parts of the NAR file needed to read a file, using the index
+     * written by `write-nar-listing`. Returns `nullptr` if the NAR has
+     * no such index, or if the cache doesn't support range requests.
+     */
+    std::shared_ptr<SourceAccessor> getIndexedNarAccessor(const StorePath & path);
+
     ref<SourceAccessor> getFSAccessor(bool requireValidPath = true) override;
 
     std::shared_ptr<SourceAccessor> getFSAccessor(const StorePath &, bool requireValidPath = true) override;
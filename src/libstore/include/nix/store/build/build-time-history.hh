@@ -0,0 +1,48 @@
+#pragma once
+///@file
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+namespace nix {
+
+/**
+ * How long derivations took to build in previous runs, keyed by
+ * derivation name. Used to estimate the critical path of a build, see
+ * the `schedule-critical-path` setting.
+ */
+class BuildTimeHistory
+{
+    struct State;
+
+    std::unique_ptr<State> state;
+
+public:
+
+    BuildTimeHistory(const std::filesystem::path & dbPath);
+
+    ~BuildTimeHistory();
+
+    /**
+     * Open the database in the user's cache directory.
+     */
+    static std::unique_ptr<BuildTimeHistory> openDefault();
+
+    std::optional<std::chrono::milliseconds> lookup(std::string_view drvName);
+
+    /**
+     * The mean of all recorded build times, if any.
+     */
+    std::optional<std::chrono::milliseconds> mean();
+
+    /**
+     * Record a build time. Repeated builds of the same name are
+     * averaged, weighting recent builds more.
+     */
+    void record(std::string_view drvName, std::chrono::milliseconds duration);
+};
+
+} // namespace nix
@@ -68,6 +68,24 @@ private:
 
     std::unique_ptr<MaintainCount<uint64_t>> mcRunningBuilds;
 
+    /**
+     * Memoised result of `estimatedCost()`.
+     */
+    std::optional<double> cost;
+
+    /**
+     * When the builder was started, for recording the build time.
+     */
+    std::chrono::steady_clock::time_point buildStartTime;
+
+    /**
+     * Whether the worker has handed us a build slot. Only used if
+     * `schedule-critical-path` is enabled, in which case every local
+     * build has to wait for the worker to hand it a slot. Cleared when
+     * the slot is used or given up.
+     */
+    bool gotBuildSlot = false;
+
     std::string key() override;
 
     struct LocalBuildCapability
@@ -125,6 +143,8 @@ private:
     {
         return JobCategory::Build;
     };
+
+    double estimatedCost() override;
 };
 
 } // namespace nix
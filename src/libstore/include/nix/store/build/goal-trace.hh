@@ -0,0 +1,89 @@
+#pragma once
+///@file
+
+#include "nix/store/build/goal.hh"
+
+#include <chrono>
+#include <filesystem>
+
+namespace nix {
+
+/**
+ * Records what the goals of a `Worker` spend their time on, and writes
+ * it out in the Chrome trace event format, which Perfetto and
+ * `chrome://tracing` can display. See the `goal-trace-file` setting.
+ *
+ * Every goal gets its own track, showing its phases (`GoalPhase`) over
+ * time. The worker's own track shows the iterations of its event loop
+ * that took a noticeable amount of time. Each worker appends its tracks
+ * to the file, so that the workers of one or more Nix processes can
+ * share a trace.
+ */
+class GoalTrace
+{
+public:
+
+    using time_point = std::chrono::steady_clock::time_point;
+
+    GoalTrace(std::filesystem::path path);
+
+    /**
+     * Record that `goal` was in `phase` from `begin` to `end`.
+     */
+    void recordPhase(Goal & goal, GoalPhase phase, time_point begin, time_point end);
+
+    /**
+     * Record a span of time spent in the worker's event loop, e.g.
+     * running a goal or waiting for input. Spans shorter than
+     * `minLoopSpan` are dropped, since there are far too many of them.
+     */
+    void recordLoop(std::string_view what, time_point begin, time_point end);
+
+    static constexpr auto minLoopSpan = std::chrono::milliseconds(1);
+
+    /**
+     * Record the number of occupied build and substitution slots.
+     */
+    void recordSlots(size_t builds, size_t substitutions);
+
+    /**
+     * Append the trace to the file.
+     */
+    void write();
+
+private:
+
+    std::filesystem::path path;
+
+    /**
+     * The track of the worker itself.
+     */
+    uint64_t workerTrack;
+
+    /**
+     * The `Goal::traceId` and name of each goal track.
+     */
+    std::vector<std::pair<uint64_t, std::string>> goalTracks;
+
+    struct Span
+    {
+        /**
+         * `Goal::traceId`, or `workerTrack`.
+         */
+        uint64_t track;
+        std::string name;
+        time_point begin, end;
+    };
+
+    std::vector<Span> spans;
+
+    struct Slots
+    {
+        time_point time;
+        size_t builds, substitutions;
+    };
+
+    std::vector<Slots> slots;
+};
+
+} // namespace nix
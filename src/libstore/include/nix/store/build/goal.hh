@@ -4,6 +4,7 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/build-result.hh"
 
+#include <chrono>
 #include <coroutine>
 #include <queue>
 #include <variant>
@@ -72,6 +73,31 @@ enum struct JobCategory {
     Administration,
 };
 
+/**
+ * What a goal is doing. This is only used to record where the time
+ * goes, see the `goal-trace-file` setting.
+ */
+enum struct GoalPhase {
+    /**
+     * The goal has been created, but hasn't run yet.
+     */
+    Queued,
+    /**
+     * The goal is running its own logic, or waiting for something
+     * not covered by the other phases.
+     */
+    Working,
+    WaitingForDependencies,
+    WaitingForBuildSlot,
+    /**
+     * Waiting to retry after failing to acquire a lock.
+     */
+    WaitingForLock,
+    Building,
+    RegisteringOutputs,
+    Substituting,
+};
+
 struct Goal : public std::enable_shared_from_this<Goal>
 {
     /**
@@ -121,6 +147,21 @@ private:
      */
     std::optional<std::string> cachedKey;
 
+    GoalPhase phase = GoalPhase::Queued;
+
+    std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+
+    /**
+     * Record the end of the current phase in the worker's goal trace,
+     * if any.
+     */
+    void endPhase(std::chrono::steady_clock::time_point now);
+
+    /**
+     * The longest `criticalPath()` of the goals waiting for this one.
+     */
+    double waitersCriticalPath = 0;
+
     ChildEvents childEvents;
 
 public:
@@ -163,6 +204,12 @@ public:
      */
     BuildResult buildResult;
 
+    /**
+     * Identifies this goal in the worker's goal trace, or 0 if it
+     * hasn't been recorded there yet.
+     */
+    uint64_t traceId = 0;
+
     /**
      * Suspend our goal and wait until we get `work`-ed again.
      * `co_await`-able by @ref Co.
@@ -624,6 +671,25 @@ public:
      */
     virtual JobCategory jobCategory() const = 0;
 
+    /**
+     * Estimated cost of the work done by this goal itself, for
+     * critical path scheduling. See `schedule-critical-path`.
+     */
+    virtual double estimatedCost()
+    {
+        return 0;
+    }
+
+    /**
+     * The estimated cost of the most expensive chain of goals from this
+     * one to a top-level goal, including this goal. Only maintained if
+     * `schedule-critical-path` is enabled.
+     */
+    double criticalPath()
+    {
+        return waitersCriticalPath + estimatedCost();
+    }
+
 protected:
     Co await(Goals waitees);
 
@@ -642,6 +708,19 @@ protected:
 
     Co waitForBuildSlot();
     Co yield();
+
+    /**
+     * Record that the goal is now doing something else.
+     */
+    void setPhase(GoalPhase phase);
+
+private:
+
+    /**
+     * Raise the `criticalPath()` of the goals that this goal (directly
+     * or indirectly) waits for to at least our own.
+     */
+    void propagateCriticalPath();
 };
 
 void addToWeakGoals(WeakGoals & goals, GoalPtr p);
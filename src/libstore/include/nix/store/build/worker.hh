@@ -24,6 +24,8 @@ struct DerivationResolutionGoal;
 struct DerivationBuildingGoal;
 struct PathSubstitutionGoal;
 class DrvOutputSubstitutionGoal;
+class GoalTrace;
+class BuildTimeHistory;
 
 /**
  * Workaround for not being able to declare a something like
@@ -213,6 +215,26 @@ public:
     std::unique_ptr<HookInstance> hook;
 #endif
 
+    /**
+     * Where the goals record their timings, if `goal-trace-file` is
+     * set.
+     */
+    std::unique_ptr<GoalTrace> goalTrace;
+
+    /**
+     * How long derivations took to build in the past, if
+     * `schedule-critical-path` and `build-time-history` are enabled.
+     */
+    std::unique_ptr<BuildTimeHistory> buildTimes;
+
+    /**
+     * Cached results of `estimatedBuildTime()` by derivation name, and
+     * the estimate for derivations without history, so that we don't
+     * query `buildTimes` for every goal.
+     */
+    std::map<std::string, double, std::less<>> buildTimeEstimates;
+    std::optional<double> defaultBuildTime;
+
     uint64_t expectedBuilds = 0;
     uint64_t doneBuilds = 0;
     uint64_t failedBuilds = 0;
@@ -349,6 +371,25 @@ public:
      */
     void waitForBuildSlot(GoalPtr goal);
 
+    /**
+     * If `schedule-critical-path` is enabled, hand the free build slots
+     * to the waiting goals with the longest critical path. Returns
+     * whether any goal was woken up.
+     */
+    bool handOutBuildSlots();
+
+    /**
+     * The expected cost of building `drvPath`, for critical path
+     * scheduling: the build time in seconds recorded in previous runs,
+     * or 1 if there is no history.
+     */
+    double estimatedBuildTime(const StorePath & drvPath);
+
+    /**
+     * Remember how long it took to build `drvPath`.
+     */
+    void recordBuildTime(const StorePath & drvPath, std::chrono::steady_clock::duration duration);
+
     /**
      * Wait for a few seconds and then retry this goal.  Used when
      * waiting for a lock held by another process.  This kind of
@@ -281,6 +281,24 @@ struct FileTransferRequest
     std::optional<UploadData> data;
     std::string mimeType;
 
+    struct ByteRange
+    {
+        uint64_t offset;
+
+        /**
+         * Must be non-zero.
+         */
+        uint64_t length;
+    };
+
+    /**
+     * If set, only download this range of bytes of the file. If the
+     * server doesn't support range requests, the range is extracted
+     * from the response, which is aborted once the range is complete,
+     * and `FileTransferResult::rangeIgnored` is set.
+     */
+    std::optional<ByteRange> range;
+
     /**
      * Callbacked invoked with a chunk of received data.
      * Can pause the transfer by returning PauseTransfer::Yes. No data must be consumed
@@ -387,6 +405,12 @@ struct FileTransferResult
 
     uint64_t bodySize = 0;
 
+    /**
+     * Whether the server ignored `FileTransferRequest::range` and
+     * sent the entire file.
+     */
+    bool rangeIgnored = false;
+
     /**
      * An "immutable" URL for this resource (i.e. one whose contents
      * will never change), as returned by the `Link: <url>;
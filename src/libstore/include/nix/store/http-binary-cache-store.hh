@@ -155,6 +155,8 @@ protected:
 
     void getFile(const std::string & path, Sink & sink) override;
 
+    void getFileRange(const std::string & path, uint64_t offset, uint64_t length, Sink & sink) override;
+
     void getFile(const std::string & path, Callback<std::optional<std::string>> callback) noexcept override;
 
     std::optional<std::string> getNixCacheInfo() override;
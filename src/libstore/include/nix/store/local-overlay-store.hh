@@ -159,6 +159,19 @@ private:
      */
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
+    using LocalStore::computeFSClosure;
+
+    /**
+     * Use the generic implementation, since the upper DB alone does
+     * not know the whole closure.
+     */
+    void computeFSClosure(
+        const StorePathSet & paths,
+        StorePathSet & out,
+        bool flipDirection = false,
+        bool includeOutputs = false,
+        bool includeDerivers = false) override;
+
     /**
      * Check the lower store and upper DB.
      */
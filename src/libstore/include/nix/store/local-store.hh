@@ -275,8 +275,44 @@ public:
     void queryPathInfoUncached(
         const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
+    /**
+     * Queries the paths in batches, with one query for the metadata
+     * and one for the references of each batch.
+     */
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosUncached(const StorePathSet & paths) override;
+
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
+    using Store::computeFSClosure;
+
+    /**
+     * Unless outputs or derivers are requested, this computes the
+     * closure with `queryClosure()` instead of querying the references
+     * of each path separately.
+     */
+    void computeFSClosure(
+        const StorePathSet & paths,
+        StorePathSet & out,
+        bool flipDirection = false,
+        bool includeOutputs = false,
+        bool includeDerivers = false) override;
+
+    /**
+     * Return the closure of `paths` under the references relation (or
+     * the referrers relation if `flipDirection` is set), together with
+     * the NAR size of each path in it. Invalid paths are omitted, and
+     * so is anything only reachable through a path in `exclude`.
+     *
+     * Without `exclude`, this is answered by a recursive query over
+     * the `Refs` table, so the cost is a handful of SQLite statements
+     * rather than one per path in the closure. With `exclude`, the
+     * graph is walked one level at a time, so that the cost depends on
+     * the paths outside of `exclude` rather than on its size.
+     */
+    std::map<StorePath, uint64_t>
+    queryClosure(const StorePathSet & paths, bool flipDirection = false, const StorePathSet & exclude = {});
+
     StorePathSet queryValidDerivers(const StorePath & path) override;
 
     std::map<std::string, std::optional<StorePath>>
@@ -487,6 +523,13 @@ private:
 
     std::shared_ptr<const ValidPathInfo> queryPathInfoInternal(State & state, const StorePath & path);
 
+    /**
+     * Parse the columns `id, hash, registrationTime, deriver, narSize,
+     * ultimate, sigs, ca` of a `ValidPaths` row, leaving the
+     * references empty.
+     */
+    std::shared_ptr<ValidPathInfo> readPathInfo(SQLiteStmt::Use & use, const StorePath & path);
+
     void updatePathInfo(State & state, const ValidPathInfo & info);
 
     void findRoots(const std::filesystem::path & path, std::filesystem::file_type type, Roots & roots);
@@ -0,0 +1,117 @@
+#pragma once
+///@file
+
+#include "nix/util/fun.hh"
+#include "nix/util/hash.hh"
+#include "nix/util/nar-accessor.hh"
+#include "nix/util/ref.hh"
+#include "nix/util/source-accessor.hh"
+
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <optional>
+
+namespace nix {
+
+/**
+ * A cache for NAR accessors with optional disk caching.
+ *
+ * The disk cache can be shared by concurrent processes. Entries are
+ * published atomically, and a process that is about to fetch a NAR
+ * first waits for any other process fetching the same NAR, so that
+ * it can use the result instead. If the cache exceeds its maximum
+ * size, the least recently used NARs are evicted.
+ */
+class NarCache
+{
+public:
+
+    struct Stats
+    {
+        /**
+         * NARs found in the disk cache.
+         */
+        uint64_t hits = 0;
+
+        /**
+         * NARs that had to be fetched.
+         */
+        uint64_t misses = 0;
+
+        /**
+         * NARs evicted from the disk cache by this process.
+         */
+        uint64_t evictions = 0;
+
+        /**
+         * Leftover temporary files and listings without a NAR deleted
+         * from the disk cache by this process.
+         */
+        uint64_t staleFiles = 0;
+    };
+
+private:
+
+    /**
+     * Optional directory for caching NARs and listings on disk.
+     */
+    std::optional<std::filesystem::path> cacheDir;
+
+    /**
+     * Maximum total size in bytes of the NARs and listings in
+     * `cacheDir`, or 0 for no limit.
+     */
+    uint64_t maxSize;
+
+    /**
+     * Map from NAR hash to NAR accessor.
+     */
+    std::map<Hash, ref<SourceAccessor>> nars;
+
+    Stats stats;
+
+    std::filesystem::path makeCacheFile(const Hash & narHash, const std::string & ext);
+
+    /**
+     * Look up a NAR in the disk cache, and mark it as recently used.
+     */
+    std::shared_ptr<SourceAccessor> getFromDisk(const Hash & narHash);
+
+    /**
+     * Delete the least recently used NARs from the disk cache until
+     * it is no larger than `maxSize`, except for `keep`. Also delete
+     * files left behind by interrupted processes.
+     */
+    void evict(const Hash & keep);
+
+public:
+
+    /**
+     * Create a NAR cache with an optional cache directory for disk storage.
+     */
+    NarCache(std::optional<std::filesystem::path> cacheDir = {}, uint64_t maxSize = 0);
+
+    /**
+     * Lookup a NAR accessor in memory or in the disk cache.
+     *
+     * @return nullptr if the NAR is not cached
+     */
+    std::shared_ptr<SourceAccessor> get(const Hash & narHash);
+
+    /**
+     * Lookup or create a NAR accessor, optionally using disk cache.
+     *
+     * @param narHash The NAR hash to use as cache key
+     * @param populate Function called with a Sink to populate the NAR if not cached
+     * @return The cached or newly created accessor
+     */
+    ref<SourceAccessor> getOrInsert(const Hash & narHash, fun<void(Sink &)> populate);
+
+    const Stats & getStats() const
+    {
+        return stats;
+    }
+};
+
+} // namespace nix
@@ -3,21 +3,57 @@
 
 #include "nix/util/hash.hh"
 
+#include <array>
+
 namespace nix {
 
+/**
+ * A sink that looks for occurrences of a set of store path hash parts
+ * in the data written to it.
+ *
+ * The data is classified in bulk (using SSE2 or AVX2 where the CPU
+ * supports it) to find runs of `refLength` base-32 characters, and
+ * every such run is probed against a flat open-addressing table of the
+ * hashes we are looking for. Scanning therefore does not allocate.
+ */
 class RefScanSink : public Sink
 {
-    StringSet hashes;
+public:
+
+    /**
+     * Length of the hash part of a store path, i.e. `StorePath::HashLen`.
+     */
+    static constexpr size_t refLength = 32;
+
+private:
+
+    struct Slot
+    {
+        std::array<char, refLength> key;
+        bool used = false;
+        bool found = false;
+    };
+
+    std::vector<Slot> table;
+    unsigned int tableShift = 64;
+
+    /**
+     * Number of hashes in `table` that have not been found yet. Once
+     * this drops to zero there is nothing left to scan for.
+     */
+    size_t remaining = 0;
+
     StringSet seen;
 
     std::string tail;
 
+    void search(std::string_view s);
+
+    void probe(const char * candidate);
+
 public:
 
-    RefScanSink(StringSet && hashes)
-        : hashes(hashes)
-    {
-    }
+    RefScanSink(StringSet && hashes);
 
     StringSet & getResult()
     {
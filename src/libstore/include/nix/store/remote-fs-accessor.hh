@@ -3,7 +3,7 @@
 
 #include "nix/util/source-accessor.hh"
 #include "nix/util/ref.hh"
-#include "nix/util/nar-cache.hh"
+#include "nix/store/nar-cache.hh"
 #include "nix/store/store-api.hh"
 
 namespace nix {
@@ -21,10 +21,18 @@ class RemoteFSAccessor : public SourceAccessor
 
     NarCache narCache;
 
+    /**
+     * Accessors for NARs in binary caches that have an index of the
+     * NAR, which only fetch the parts of the NAR that are read.
+     */
+    std::map<Hash, ref<SourceAccessor>> indexedNars;
+
     bool requireValidPath;
 
     std::pair<ref<SourceAccessor>, CanonPath> fetch(const CanonPath & path);
 
+    ref<SourceAccessor> accessNar(const StorePath & storePath, const Hash & narHash);
+
     friend struct BinaryCacheStore;
 
 public:
@@ -34,7 +42,11 @@ public:
      */
     std::shared_ptr<SourceAccessor> accessObject(const StorePath & path);
 
-    RemoteFSAccessor(ref<Store> store, bool requireValidPath = true, std::optional<AbsolutePath> cacheDir = {});
+    RemoteFSAccessor(
+        ref<Store> store,
+        bool requireValidPath = true,
+        std::optional<AbsolutePath> cacheDir = {},
+        uint64_t maxCacheSize = 0);
 
     std::optional<Stat> maybeLstat(const CanonPath & path) override;
 
@@ -2,6 +2,7 @@
 ///@file
 
 #include <limits>
+#include <memory>
 #include <set>
 #include <string>
 
@@ -40,6 +41,12 @@ public:
         std::numeric_limits<unsigned int>::max(),
         "max-connection-age",
         "Maximum age of a connection before it is closed."};
+
+    Setting<bool> pipelineQueries{
+        this,
+        true,
+        "pipeline-queries",
+        "Whether to send path info queries to the Nix daemon over a dedicated connection without waiting for the replies to earlier queries, if the daemon supports it."};
 };
 
 /**
@@ -58,6 +65,8 @@ public:
 
     RemoteStore(const Config & config);
 
+    ~RemoteStore();
+
     /* Implementations of abstract store API methods. */
 
     bool isValidPathUncached(const StorePath & path) override;
@@ -69,6 +78,9 @@ public:
     void queryPathInfoUncached(
         const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosUncached(const StorePathSet & paths) override;
+
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
     StorePathSet queryValidDerivers(const StorePath & path) override;
@@ -151,6 +163,8 @@ public:
 
     void addSignatures(const StorePath & storePath, const std::set<Signature> & sigs) override;
 
+    using Store::queryMissing;
+
     MissingPaths queryMissing(const std::vector<DerivedPath> & targets) override;
 
     void addBuildLog(const StorePath & drvPath, std::string_view log) override;
@@ -210,11 +224,39 @@ private:
 
     std::atomic_bool failed{false};
 
+    struct PipelinedConnection;
+
+    struct PipelinedState
+    {
+        bool tried = false;
+        std::unique_ptr<PipelinedConnection> conn;
+    };
+
+    /**
+     * The connection used for tagged requests, opened on first use if
+     * `pipeline-queries` is enabled.
+     */
+    Sync<PipelinedState> pipelined_;
+
+    /**
+     * Get the connection for tagged requests, or `nullptr` if the
+     * daemon doesn't support them or the connection has failed.
+     */
+    PipelinedConnection * getPipelinedConnection();
+
     /**
      * Track all active connection file descriptors (both idle and in-use).
      * Used by shutdownConnections() to break blocking I/O on interrupt.
+     * Shared with the connections, which remove themselves when they
+     * are closed.
+     */
+    ref<Sync<std::set<Descriptor>>> connectionFds = make_ref<Sync<std::set<Descriptor>>>();
+
+    /**
+     * Add `conn` to `connectionFds`, returning a reference to it that
+     * removes it again once the connection is dropped.
      */
-    Sync<std::set<Descriptor>> connectionFds;
+    ref<Connection> trackConnection(ref<Connection> conn);
 
     void copyDrvsFromEvalStore(const std::vector<DerivedPath> & paths, std::shared_ptr<Store> evalStore);
 };
@@ -17,6 +17,7 @@
 
 #include <nlohmann/json_fwd.hpp>
 #include <atomic>
+#include <list>
 #include <map>
 #include <memory>
 #include <string>
@@ -525,6 +526,13 @@ public:
      */
     std::optional<std::shared_ptr<const ValidPathInfo>> queryPathInfoFromClientCache(const StorePath & path);
 
+    /**
+     * Query information about a set of paths at once. Paths that are
+     * not valid are omitted from the result. Like queryPathInfo(), this
+     * uses and fills the path info caches.
+     */
+    std::map<StorePath, ref<const ValidPathInfo>> queryPathInfos(const StorePathSet & paths);
+
     /**
      * Query the information about a realisation.
      */
@@ -560,6 +568,15 @@ protected:
 
     virtual void
     queryPathInfoUncached(const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept = 0;
+
+    /**
+     * Query information about a set of paths, bypassing the caches.
+     * Paths that are not valid are omitted from the result. The default
+     * implementation calls queryPathInfoUncached() for every path
+     * concurrently; stores that can do better override this.
+     */
+    virtual std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosUncached(const StorePathSet & paths);
     virtual void queryRealisationUncached(
         const DrvOutput &, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept = 0;
 
@@ -996,6 +1013,12 @@ public:
      */
     virtual MissingPaths queryMissing(const std::vector<DerivedPath> & targets);
 
+    /**
+     * Like queryMissing(), but asks `substituters` (in that order)
+     * rather than the default substituters.
+     */
+    MissingPaths queryMissing(const std::vector<DerivedPath> & targets, const std::list<ref<Store>> & substituters);
+
     /**
      * Sort a set of paths topologically under the references
      * relation.  If p refers to q, then p precedes q in this list.
@@ -70,6 +70,17 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
     void
     processStderr(bool * daemonException, Sink * sink = 0, Source * source = 0, bool flush = true, bool block = true);
 
+    /**
+     * Read messages from the daemon until we get the reply to a
+     * tagged request (see `WorkerProto::featurePipelinedQueries`),
+     * forwarding any log messages to our logger.
+     *
+     * @return The tag of the request and, if the request failed, the
+     * error reported by the daemon. Otherwise the ordinary reply
+     * follows in `from`.
+     */
+    std::pair<uint64_t, std::exception_ptr> readTaggedReply();
+
     /**
      * Establishes connection, negotiating version.
      *
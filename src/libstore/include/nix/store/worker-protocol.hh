@@ -27,6 +27,7 @@ namespace nix {
 #define STDERR_START_ACTIVITY 0x53545254
 #define STDERR_STOP_ACTIVITY 0x53544f50
 #define STDERR_RESULT 0x52534c54
+#define STDERR_TAGGED_REPLY 0x54414752 // reply to a `WorkerProto::Op::TaggedRequest`
 
 struct StoreDirConfig;
 struct Source;
@@ -135,6 +136,36 @@ struct WorkerProto
      */
     static constexpr std::string_view featureDisableSetOptions = "disable-set-options";
 
+    /**
+     * Feature for pipelining queries with `WorkerProto::Op::TaggedRequest`.
+     *
+     * A tagged request is `TaggedRequest`, a client-chosen 64-bit tag,
+     * and then an ordinary request for an op accepted by
+     * `isPipelinable()`. The client doesn't need to wait for the reply
+     * before sending more requests. The daemon answers tagged requests
+     * in any order, each with a `STDERR_TAGGED_REPLY` message
+     * containing the tag, a success flag and then either the ordinary
+     * reply or an error. Log messages may be interleaved with these
+     * replies.
+     *
+     * The daemon finishes all outstanding tagged requests before it
+     * starts an untagged operation.
+     */
+    static constexpr std::string_view featurePipelinedQueries = "pipelined-queries";
+
+    /**
+     * Feature for querying the info of many paths at once with
+     * `WorkerProto::Op::QueryPathInfos`.
+     */
+    static constexpr std::string_view featureQueryPathInfos = "query-path-infos";
+
+    /**
+     * The operations that may be sent as a tagged request. These are
+     * cheap read-only queries that don't need to talk to the client
+     * while they run.
+     */
+    static bool isPipelinable(Op op);
+
     /**
      * A unidirectional read connection, to be used by the read half of the
      * canonical serializers below.
@@ -256,6 +287,8 @@ enum struct WorkerProto::Op : uint64_t {
     AddBuildLog = 45,
     BuildPathsWithResults = 46,
     AddPermRoot = 47,
+    TaggedRequest = 48,
+    QueryPathInfos = 49,
 };
 
 struct WorkerProto::ClientHandshakeInfo
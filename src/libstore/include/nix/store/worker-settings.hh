@@ -81,6 +81,49 @@ public:
         )",
         {"substitution-max-jobs"}};
 
+    Setting<unsigned int> maxSubstituterQueries{
+        this,
+        64,
+        "max-substituter-queries",
+        R"(
+          The maximum number of path info lookups (such as `.narinfo`
+          downloads) that Nix sends to [substituters](#conf-substituters)
+          at the same time while it determines what to build and what
+          to substitute. Lookups that can be answered from the local
+          cache of substituter metadata don't count towards this limit.
+          The minimum value is `1` and lower values are interpreted as `1`.
+        )"};
+
+    Setting<bool> scheduleCriticalPath{
+        this,
+        false,
+        "schedule-critical-path",
+        R"(
+          If set to `true`, Nix hands out build slots to the derivations
+          on the longest remaining chain of builds first, instead of in
+          the order in which they became ready to build. This keeps long
+          dependency chains (such as a compiler that everything else
+          depends on) from being starved by many short leaf builds, which
+          shortens large rebuilds when [`max-jobs`](#conf-max-jobs) is
+          the bottleneck.
+
+          The length of a chain is measured in the number of derivations
+          in it, or, if [`build-time-history`](#conf-build-time-history)
+          is enabled, in the time it took to build them previously.
+        )"};
+
+    Setting<bool> buildTimeHistory{
+        this,
+        true,
+        "build-time-history",
+        R"(
+          If set to `true` and [`schedule-critical-path`](#conf-schedule-critical-path)
+          is enabled, Nix records how long each derivation took to build
+          in a database in the user's cache directory, keyed by derivation
+          name, and uses these times to estimate which builds are on the
+          critical path of later builds.
+        )"};
+
     Setting<time_t> maxSilentTime{
         this,
         0,
@@ -361,6 +404,27 @@ public:
               /nix/store/scz72lskj03ihkcn42ias5mlp4i4gr1k-bash-4.4-p23-man
               /nix/store/a724znygmd1cac856j3gfsyvih3lw07j-bash-4.4-p23`.
         )"};
+
+    Setting<std::optional<AbsolutePath>> goalTraceFile{
+        this,
+        std::nullopt,
+        "goal-trace-file",
+        R"(
+          If set, Nix records what each goal of a build spends its time on
+          (waiting for dependencies, waiting for a build slot, building,
+          registering outputs, substituting, ...) and appends it to this
+          file when the build finishes. The file is in the Chrome trace
+          event format, so it can be opened in [Perfetto](https://ui.perfetto.dev)
+          or `chrome://tracing`.
+
+          Every build (including those for import-from-derivation, and
+          those of other Nix processes using the same file) adds its own
+          tracks, so delete the file to start a new trace.
+
+          The trace also records how many build and substitution slots
+          are in use over time, and the iterations of the build loop that
+          took longer than a millisecond.
+        )"};
 };
 
 } // namespace nix
@@ -99,6 +99,17 @@ protected:
         }
     }
 
+    void getFileRange(const std::string & path, uint64_t offset, uint64_t length, Sink & sink) override
+    {
+        auto path2 = checkBinaryCachePath(config->binaryCacheDir, path);
+        if (!pathExists(path2))
+            throw NoSuchBinaryCacheFile("file '%s' does not exist in binary cache", path);
+        auto fd = openFileReadonly(path2);
+        if (!fd)
+            throw NativeSysError("opening binary cache file %s", PathFmt(path2));
+        copyFdRange(fd.get(), offset, length, sink);
+    }
+
     StorePathSet queryAllValidPaths() override
     {
         StorePathSet paths;
@@ -164,6 +164,12 @@ void LocalOverlayStore::queryReferrers(const StorePath & path, StorePathSet & re
     lowerStore->queryReferrers(path, referrers);
 }
 
+void LocalOverlayStore::computeFSClosure(
+    const StorePathSet & paths, StorePathSet & out, bool flipDirection, bool includeOutputs, bool includeDerivers)
+{
+    Store::computeFSClosure(paths, out, flipDirection, includeOutputs, includeDerivers);
+}
+
 void LocalOverlayStore::queryGCReferrers(const StorePath & path, StorePathSet & referrers)
 {
     LocalStore::queryReferrers(path, referrers);
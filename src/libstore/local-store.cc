@@ -11,6 +11,7 @@
 #include "nix/util/topo-sort.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/compression.hh"
+#include "nix/util/pipeline.hh"
 #include "nix/util/signals.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
 #include "nix/util/posix-source-accessor.hh"
@@ -18,6 +19,8 @@
 #include "nix/util/users.hh"
 #include "nix/store/store-registration.hh"
 
+#include <boost/unordered/unordered_flat_set.hpp>
+
 #include <algorithm>
 #include <cstring>
 
@@ -754,45 +757,112 @@ void LocalStore::queryPathInfoUncached(
     }
 }
 
-std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State & state, const StorePath & path)
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+LocalStore::queryPathInfosUncached(const StorePathSet & paths)
 {
-    /* Get the path info. */
-    auto useQueryPathInfo(state.stmts->QueryPathInfo.use()(printStorePath(path)));
+    /* The paths are passed as bound parameters, so do them in batches
+       to stay below SQLite's limit on the number of parameters. */
+    static constexpr size_t maxPaths = 500;
 
-    if (!useQueryPathInfo.next())
-        return std::shared_ptr<ValidPathInfo>();
+    return retrySQLite<std::map<StorePath, std::shared_ptr<const ValidPathInfo>>>([&]() {
+        auto state(_state->lock());
+
+        std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+
+        auto i = paths.begin();
+        while (i != paths.end()) {
+            std::vector<const StorePath *> batch;
+            for (; i != paths.end() && batch.size() < maxPaths; ++i)
+                batch.push_back(&*i);
+
+            std::string params = "?";
+            for (size_t n = 1; n < batch.size(); ++n)
+                params += ", ?";
+
+            SQLiteStmt queryInfos(
+                state->db,
+                fmt("select id, hash, registrationTime, deriver, narSize, ultimate, sigs, ca, path from ValidPaths where path in (%s);",
+                    params));
+
+            auto useQueryInfos(queryInfos.use());
+            for (auto path : batch)
+                useQueryInfos(printStorePath(*path));
+
+            std::map<int64_t, std::shared_ptr<ValidPathInfo>> infos;
+            while (useQueryInfos.next()) {
+                auto info = readPathInfo(useQueryInfos, parseStorePath(useQueryInfos.getStr(8)));
+                infos.emplace(info->id, info);
+            }
+
+            if (infos.empty())
+                continue;
+
+            params = "?";
+            for (size_t n = 1; n < infos.size(); ++n)
+                params += ", ?";
+
+            SQLiteStmt queryReferences(
+                state->db,
+                fmt("select referrer, path from Refs join ValidPaths on reference = id where referrer in (%s);",
+                    params));
 
-    auto id = useQueryPathInfo.getInt(0);
+            auto useQueryReferences(queryReferences.use());
+            for (auto & [id, info] : infos)
+                useQueryReferences(id);
 
+            while (useQueryReferences.next())
+                infos.at(useQueryReferences.getInt(0))
+                    ->references.insert(parseStorePath(useQueryReferences.getStr(1)));
+
+            for (auto & [id, info] : infos)
+                res.insert_or_assign(info->path, std::move(info));
+        }
+
+        return res;
+    });
+}
+
+std::shared_ptr<ValidPathInfo> LocalStore::readPathInfo(SQLiteStmt::Use & use, const StorePath & path)
+{
     auto narHash = Hash::dummy;
     try {
-        narHash = Hash::parseAnyPrefixed(useQueryPathInfo.getStr(1));
+        narHash = Hash::parseAnyPrefixed(use.getStr(1));
     } catch (BadHash & e) {
         throw Error("invalid-path entry for '%s': %s", printStorePath(path), e.what());
     }
 
     auto info = std::make_shared<ValidPathInfo>(path, UnkeyedValidPathInfo(*this, narHash));
 
-    info->id = id;
+    info->id = use.getInt(0);
 
-    info->registrationTime = useQueryPathInfo.getInt(2);
+    info->registrationTime = use.getInt(2);
 
-    auto s = (const char *) sqlite3_column_text(state.stmts->QueryPathInfo, 3);
-    if (s)
-        info->deriver = parseStorePath(s);
+    if (!use.isNull(3))
+        info->deriver = parseStorePath(use.getStr(3));
 
     /* Note that narSize = NULL yields 0. */
-    info->narSize = useQueryPathInfo.getInt(4);
+    info->narSize = use.getInt(4);
+
+    info->ultimate = use.getInt(5) == 1;
 
-    info->ultimate = useQueryPathInfo.getInt(5) == 1;
+    if (!use.isNull(6))
+        info->sigs = Signature::parseMany(tokenizeString<StringSet>(use.getStr(6), " "));
+
+    if (!use.isNull(7))
+        info->ca = ContentAddress::parseOpt(use.getStr(7));
+
+    return info;
+}
+
+std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State & state, const StorePath & path)
+{
+    /* Get the path info. */
+    auto useQueryPathInfo(state.stmts->QueryPathInfo.use()(printStorePath(path)));
 
-    s = (const char *) sqlite3_column_text(state.stmts->QueryPathInfo, 6);
-    if (s)
-        info->sigs = Signature::parseMany(tokenizeString<StringSet>(s, " "));
+    if (!useQueryPathInfo.next())
+        return std::shared_ptr<ValidPathInfo>();
 
-    s = (const char *) sqlite3_column_text(state.stmts->QueryPathInfo, 7);
-    if (s)
-        info->ca = ContentAddress::parseOpt(s);
+    auto info = readPathInfo(useQueryPathInfo, path);
 
     /* Get the references. */
     auto useQueryReferences(state.stmts->QueryReferences.use()(info->id));
@@ -866,6 +936,163 @@ void LocalStore::queryReferrers(const StorePath & path, StorePathSet & referrers
     return retrySQLite<void>([&]() { queryReferrers(*_state->lock(), path, referrers); });
 }
 
+void LocalStore::computeFSClosure(
+    const StorePathSet & paths, StorePathSet & out, bool flipDirection, bool includeOutputs, bool includeDerivers)
+{
+    if (includeOutputs || includeDerivers)
+        return Store::computeFSClosure(paths, out, flipDirection, includeOutputs, includeDerivers);
+
+    /* Like Store::computeFSClosure(), don't go past the paths that
+       are already in `out`, so that callers accumulating several
+       closures in one set only pay for the new paths. */
+    StorePathSet newPaths;
+    for (auto & path : paths)
+        if (!out.contains(path))
+            newPaths.insert(path);
+
+    auto closure = queryClosure(newPaths, flipDirection, out);
+
+    /* Match Store::computeFSClosure(), which queries the path info of
+       each start path in the forward direction but merely looks up
+       the referrers of each start path in the reverse direction. */
+    for (auto & path : newPaths)
+        if (!closure.contains(path)) {
+            if (!flipDirection)
+                throw InvalidPath("path '%s' is not valid", printStorePath(path));
+            out.insert(path);
+        }
+
+    for (auto & [path, narSize] : closure)
+        out.insert(path);
+}
+
+std::map<StorePath, uint64_t>
+LocalStore::queryClosure(const StorePathSet & paths, bool flipDirection, const StorePathSet & exclude)
+{
+    /* Paths and IDs are passed as bound parameters, so do them in
+       batches to stay below SQLite's limit on the number of
+       parameters. */
+    static constexpr size_t maxParams = 500;
+
+    auto placeholders = [](std::string_view placeholder, size_t n) {
+        std::string s;
+        for (size_t i = 0; i < n; ++i) {
+            if (i)
+                s += ", ";
+            s += placeholder;
+        }
+        return s;
+    };
+
+    auto source = flipDirection ? "reference" : "referrer";
+    auto target = flipDirection ? "referrer" : "reference";
+
+    return retrySQLite<std::map<StorePath, uint64_t>>([&]() {
+        auto state(_state->lock());
+
+        SQLiteTxn txn(state->db);
+
+        std::map<StorePath, uint64_t> closure;
+
+        if (exclude.empty()) {
+            auto i = paths.begin();
+            while (i != paths.end()) {
+                std::vector<std::string> batch;
+                for (; i != paths.end() && batch.size() < maxParams; ++i)
+                    /* The closure of a path we have already seen is
+                       already included. */
+                    if (!closure.contains(*i))
+                        batch.push_back(printStorePath(*i));
+                if (batch.empty())
+                    break;
+
+                SQLiteStmt stmt(
+                    state->db,
+                    fmt(R"(
+                        with recursive Closure(id) as (
+                            values %s
+                            union
+                            select Refs.%s from Refs join Closure on Refs.%s = Closure.id
+                        )
+                        select path, narSize from Closure join ValidPaths on ValidPaths.id = Closure.id;
+                    )",
+                        placeholders("((select id from ValidPaths where path = ?))", batch.size()),
+                        target,
+                        source));
+
+                auto use(stmt.use());
+                for (auto & path : batch)
+                    use(path);
+
+                while (use.next())
+                    closure.insert_or_assign(parseStorePath(use.getStr(0)), use.isNull(1) ? 0 : use.getInt(1));
+            }
+        }
+
+        else {
+            /* A single recursive query could only stop at the excluded
+               paths if they were all copied into the database first.
+               Callers that accumulate a closure over many calls pass
+               everything they have so far, so that would make them
+               quadratic. Instead, walk the graph one level at a time
+               and check the excluded paths here, so that the cost only
+               depends on the paths that are not excluded. */
+            boost::unordered_flat_set<int64_t> seen;
+            std::vector<int64_t> frontier;
+
+            auto visit = [&](SQLiteStmt::Use & use, bool start) {
+                while (use.next()) {
+                    auto id = use.getInt(0);
+                    if (!seen.insert(id).second)
+                        continue;
+                    auto path = parseStorePath(use.getStr(1));
+                    if (!start && exclude.contains(path))
+                        continue;
+                    closure.insert_or_assign(std::move(path), use.isNull(2) ? 0 : use.getInt(2));
+                    frontier.push_back(id);
+                }
+            };
+
+            std::vector<std::string> batch;
+            for (auto i = paths.begin(); i != paths.end();) {
+                batch.clear();
+                for (; i != paths.end() && batch.size() < maxParams; ++i)
+                    batch.push_back(printStorePath(*i));
+                SQLiteStmt stmt(
+                    state->db,
+                    fmt("select id, path, narSize from ValidPaths where path in (%s);",
+                        placeholders("?", batch.size())));
+                auto use(stmt.use());
+                for (auto & path : batch)
+                    use(path);
+                visit(use, true);
+            }
+
+            while (!frontier.empty()) {
+                auto level = std::exchange(frontier, {});
+                for (size_t n = 0; n < level.size(); n += maxParams) {
+                    auto end = std::min(level.size(), n + maxParams);
+                    SQLiteStmt stmt(
+                        state->db,
+                        fmt("select ValidPaths.id, path, narSize from Refs join ValidPaths on ValidPaths.id = Refs.%s "
+                            "where Refs.%s in (%s);",
+                            target,
+                            source,
+                            placeholders("?", end - n)));
+                    auto use(stmt.use());
+                    for (size_t k = n; k < end; ++k)
+                        use(level[k]);
+                    visit(use, false);
+                }
+            }
+        }
+
+        txn.commit();
+
+        return closure;
+    });
+}
+
 StorePathSet LocalStore::queryValidDerivers(const StorePath & path)
 {
     return retrySQLite<StorePathSet>([&]() {
@@ -1060,13 +1287,15 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairF
                 deletePath(realPath);
 
                 /* While restoring the path from the NAR, compute the hash
-                   of the NAR. */
+                   of the NAR on another thread. */
                 HashSink hashSink(HashAlgorithm::SHA256);
+                ThreadedSink hashStage{hashSink};
 
-                TeeSource wrapperSource{source, hashSink};
+                TeeSource wrapperSource{source, hashStage};
 
                 restorePath(realPath, wrapperSource, config->getLocalSettings().fsyncStorePaths);
 
+                hashStage.finish();
                 auto hashResult = hashSink.finish();
 
                 if (hashResult.hash != info.narHash)
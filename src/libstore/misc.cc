@@ -9,6 +9,7 @@
 #include "nix/util/topo-sort.hh"
 #include "nix/util/callback.hh"
 #include "nix/util/closure.hh"
+#include "nix/util/finally.hh"
 #include "nix/store/filetransfer.hh"
 #include "nix/util/strings.hh"
 #include "nix/util/json-utils.hh"
@@ -86,18 +87,88 @@ const ContentAddress * getDerivationCA(const BasicDerivation & drv)
     return nullptr;
 }
 
-static asio::awaitable<void>
-querySubstitutablePathInfosAsync(Store & store, const StorePathCAMap & paths, SubstitutablePathInfos & infos)
+namespace {
+
+/**
+ * State shared by the substituter lookups of one `queryMissing()` or
+ * `querySubstitutablePathInfos()` call.
+ */
+struct SubstituterQueries
+{
+    /**
+     * The substituters to ask, in order of priority.
+     */
+    std::list<ref<Store>> substituters;
+
+    /**
+     * Bounds the number of lookups that are waiting for a substituter
+     * at the same time.
+     */
+    AsyncSemaphore slots{settings.getWorkerSettings().maxSubstituterQueries};
+
+    /**
+     * Number of lookups that had to ask a substituter.
+     */
+    size_t lookups = 0;
+
+    /**
+     * Number of lookups that were answered (positively or negatively)
+     * from a substituter's path info caches.
+     */
+    size_t cacheHits = 0;
+};
+
+} // namespace
+
+/**
+ * Ask `sub` about `subPath`. Answers from the client-side caches
+ * (including cached negative answers) don't take a query slot.
+ */
+static asio::awaitable<std::shared_ptr<const ValidPathInfo>>
+querySubstituter(SubstituterQueries & queries, ref<Store> sub, StorePath subPath)
+{
+    if (auto cached = sub->queryPathInfoFromClientCache(subPath)) {
+        queries.cacheHits++;
+        co_return *cached;
+    }
+
+    co_await queries.slots.acquire();
+    Finally release([&]() { queries.slots.release(); });
+
+    queries.lookups++;
+
+    try {
+        co_return co_await callbackToAwaitable<ref<const ValidPathInfo>>(
+            [subPath, sub](Callback<ref<const ValidPathInfo>> cb) { sub->queryPathInfo(subPath, std::move(cb)); });
+    } catch (InvalidPath &) {
+        co_return nullptr;
+    }
+}
+
+static asio::awaitable<void> querySubstitutablePathInfosAsync(
+    Store & store, SubstituterQueries & queries, const StorePathCAMap & paths, SubstitutablePathInfos & infos)
 {
     if (!settings.getWorkerSettings().useSubstitutes)
         co_return;
 
-    co_await forEachAsync(paths, [&store, &infos](auto path) -> asio::awaitable<void> {
-        std::optional<Error> lastStoresException = std::nullopt;
-        for (auto & sub : getDefaultSubstituters()) {
-            if (lastStoresException.has_value()) {
-                logError(lastStoresException->info());
-                lastStoresException.reset();
+    /* Ask the substituters in order of priority. Each one is asked about
+       all the paths that the previous ones didn't have, concurrently. */
+    StorePathCAMap left = paths;
+
+    /* The error, if any, that the last substituter we asked about a path
+       gave. */
+    std::map<StorePath, Error> errors;
+
+    for (auto & sub : queries.substituters) {
+        if (left.empty())
+            break;
+
+        StorePathSet found;
+
+        co_await forEachAsync(left, [&](auto path) -> asio::awaitable<void> {
+            if (auto i = errors.find(path.first); i != errors.end()) {
+                logError(i->second.info());
+                errors.erase(i);
             }
 
             auto subPath(path.first);
@@ -115,22 +186,21 @@ querySubstitutablePathInfosAsync(Store & store, const StorePathCAMap & paths, Su
                         sub->printStorePath(subPath),
                         sub->config.getHumanReadableURI());
             } else if (sub->storeDir != store.storeDir)
-                continue;
+                co_return;
 
             debug(
                 "checking substituter '%s' for path '%s'",
                 sub->config.getHumanReadableURI(),
                 sub->printStorePath(subPath));
             try {
-                auto info = co_await callbackToAwaitable<ref<const ValidPathInfo>>(
-                    [subPath, &sub](Callback<ref<const ValidPathInfo>> cb) {
-                        sub->queryPathInfo(subPath, std::move(cb));
-                    });
+                auto info = co_await querySubstituter(queries, sub, subPath);
+                if (!info)
+                    co_return;
 
                 if (sub->storeDir != store.storeDir && !(info->isContentAddressed(*sub) && info->references.empty()))
-                    continue;
+                    co_return;
 
-                auto narInfo = std::dynamic_pointer_cast<const NarInfo>(std::shared_ptr<const ValidPathInfo>(info));
+                auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
                 infos.insert_or_assign(
                     path.first,
                     SubstitutablePathInfo{
@@ -140,27 +210,32 @@ querySubstitutablePathInfosAsync(Store & store, const StorePathCAMap & paths, Su
                         .narSize = info->narSize,
                     });
 
-                break; /* We are done. */
-            } catch (InvalidPath &) {
+                found.insert(path.first);
             } catch (SubstituterDisabled &) {
             } catch (Error & e) {
-                lastStoresException = std::make_optional(std::move(e));
+                errors.insert_or_assign(path.first, std::move(e));
             }
-        }
-        if (lastStoresException.has_value()) {
-            if (!settings.getWorkerSettings().tryFallback) {
-                throw std::move(*lastStoresException);
-            } else
-                logError(lastStoresException->info());
-        }
-    });
+        });
+
+        for (auto & path : found)
+            left.erase(path);
+    }
+
+    for (auto & [path, e] : errors) {
+        if (!settings.getWorkerSettings().tryFallback)
+            throw std::move(e);
+        else
+            logError(e.info());
+    }
 }
 
 void Store::querySubstitutablePathInfos(const StorePathCAMap & paths, SubstitutablePathInfos & infos)
 {
     asio::io_context ctx;
     std::exception_ptr ex;
-    asio::co_spawn(ctx, querySubstitutablePathInfosAsync(*this, paths, infos), [&](std::exception_ptr e) { ex = e; });
+    SubstituterQueries queries{.substituters = getDefaultSubstituters()};
+    asio::co_spawn(
+        ctx, querySubstitutablePathInfosAsync(*this, queries, paths, infos), [&](std::exception_ptr e) { ex = e; });
     ctx.run();
     if (ex)
         std::rethrow_exception(ex);
@@ -177,11 +252,20 @@ static void collectDerivedPaths(
 }
 
 MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
+{
+    return queryMissing(targets, getDefaultSubstituters());
+}
+
+MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets, const std::list<ref<Store>> & substituters)
 {
     Activity act(*logger, lvlDebug, actUnknown, "querying info about missing paths");
 
+    auto startTime = std::chrono::steady_clock::now();
+
     MissingPaths res;
 
+    SubstituterQueries queries{.substituters = substituters};
+
     auto mustBuildDrv = [&](const StorePath & drvPath, const Derivation & drv, std::set<DerivedPath> & edges) {
         res.willBuild.insert(drvPath);
         for (const auto & [inputDrv, inputNode] : drv.inputDrvs.map)
@@ -250,7 +334,7 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
                                 continue;
 
                             bool found = false;
-                            for (auto & sub : getDefaultSubstituters()) {
+                            for (auto & sub : queries.substituters) {
                                 /* TODO: Asyncify this. */
                                 auto realisation = sub->queryRealisation({drvPath, outputName});
                                 if (!realisation)
@@ -270,31 +354,23 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
 
                     if (knownOutputPaths && settings.getWorkerSettings().useSubstitutes
                         && drvOptions.substitutesAllowed(settings.getWorkerSettings())) {
-                        bool mustBuild = false;
-                        StorePathSet substitutable;
                         auto * cap = getDerivationCA(*drv);
 
-                        /* Query all outputs concurrently (but not in parallel,
-                           computeClosure runs on a strand). If any one is not
-                           substitutable then discard all other outputs. */
-                        co_await forEachAsync(invalid, [&](const StorePath & outPath) -> asio::awaitable<void> {
-                            if (mustBuild)
-                                co_return;
-
-                            SubstitutablePathInfos infos;
-                            co_await querySubstitutablePathInfosAsync(
-                                *this, {{outPath, cap ? std::optional{*cap} : std::nullopt}}, infos);
+                        /* Query all outputs together, so that each
+                           substituter is asked about all of them at once. If
+                           any one is not substitutable then discard all other
+                           outputs. */
+                        StorePathCAMap outputs;
+                        for (auto & outPath : invalid)
+                            outputs.insert_or_assign(outPath, cap ? std::optional{*cap} : std::nullopt);
 
-                            if (infos.empty())
-                                mustBuild = true;
-                            else
-                                substitutable.insert(outPath);
-                        });
+                        SubstitutablePathInfos infos;
+                        co_await querySubstitutablePathInfosAsync(*this, queries, outputs, infos);
 
-                        if (mustBuild)
+                        if (infos.size() < invalid.size())
                             mustBuildDrv(drvPath, *drv, edges);
                         else
-                            for (auto & path : substitutable)
+                            for (auto & path : invalid)
                                 edges.insert(DerivedPath::Opaque{path});
                     } else {
                         mustBuildDrv(drvPath, *drv, edges);
@@ -305,7 +381,7 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
                         co_return;
 
                     SubstitutablePathInfos infos;
-                    co_await querySubstitutablePathInfosAsync(*this, {{bo.path, std::nullopt}}, infos);
+                    co_await querySubstitutablePathInfosAsync(*this, queries, {{bo.path, std::nullopt}}, infos);
 
                     if (infos.empty()) {
                         res.unknown.insert(bo.path);
@@ -331,6 +407,15 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
     std::set<DerivedPath> visited;
     computeClosure(std::move(startElts), visited, std::move(getEdges));
 
+    printMsg(
+        lvlTalkative,
+        "planned %d paths in %.2f s; %d substituter lookups, %d answered from cache",
+        visited.size(),
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count()
+            / 1000.0f,
+        queries.lookups,
+        queries.cacheHits);
+
     return res;
 }
 
@@ -0,0 +1,222 @@
+#include "nix/store/nar-cache.hh"
+#include "nix/store/pathlocks.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/signals.hh"
+
+#include <algorithm>
+#include <ctime>
+
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+NarCache::NarCache(std::optional<std::filesystem::path> cacheDir_, uint64_t maxSize)
+    : cacheDir(std::move(cacheDir_))
+    , maxSize(maxSize)
+{
+    if (cacheDir)
+        createDirs(*cacheDir);
+}
+
+std::filesystem::path NarCache::makeCacheFile(const Hash & narHash, const std::string & ext)
+{
+    auto res = *cacheDir / narHash.to_string(HashFormat::Nix32, false);
+    res += ".";
+    res += ext;
+    return res;
+}
+
+std::shared_ptr<SourceAccessor> NarCache::getFromDisk(const Hash & narHash)
+{
+    auto cacheFile = makeCacheFile(narHash, "nar");
+    auto listingFile = makeCacheFile(narHash, "ls");
+
+    if (!nix::pathExists(cacheFile))
+        return nullptr;
+
+    std::shared_ptr<SourceAccessor> accessor;
+
+    try {
+        accessor = makeLazyNarAccessor(
+                       nlohmann::json::parse(nix::readFile(listingFile)).template get<NarListing>(),
+                       seekableGetNarBytes(cacheFile))
+                       .get_ptr();
+    } catch (SystemError &) {
+    }
+
+    if (!accessor)
+        try {
+            accessor = makeNarAccessor(nix::readFile(cacheFile)).get_ptr();
+        } catch (SystemError &) {
+            /* The NAR was evicted by another process. */
+            return nullptr;
+        }
+
+    /* Mark the NAR as recently used. */
+    try {
+        auto now = time(nullptr);
+        setWriteTime(cacheFile, now, now);
+    } catch (...) {
+        ignoreExceptionExceptInterrupt();
+    }
+
+    stats.hits++;
+
+    return accessor;
+}
+
+std::shared_ptr<SourceAccessor> NarCache::get(const Hash & narHash)
+{
+    // Check in-memory cache first
+    if (auto * accessor = nix::get(nars, narHash))
+        return *accessor;
+
+    if (cacheDir)
+        if (auto accessor = getFromDisk(narHash)) {
+            nars.emplace(narHash, ref(accessor));
+            return accessor;
+        }
+
+    return nullptr;
+}
+
+ref<SourceAccessor> NarCache::getOrInsert(const Hash & narHash, fun<void(Sink &)> populate)
+{
+    if (auto accessor = get(narHash))
+        return ref(accessor);
+
+    auto cacheAccessor = [&](ref<SourceAccessor> accessor) {
+        nars.emplace(narHash, accessor);
+        return accessor;
+    };
+
+    auto getNar = [&]() {
+        stats.misses++;
+        StringSink sink;
+        populate(sink);
+        return std::move(sink.s);
+    };
+
+    if (cacheDir) {
+        auto cacheFile = makeCacheFile(narHash, "nar");
+        auto listingFile = makeCacheFile(narHash, "ls");
+
+        /* If another process is fetching this NAR, wait for it and
+           use its result. */
+        PathLocks lock({cacheFile}, fmt("waiting for another process to fetch %s", PathFmt(cacheFile)));
+        lock.setDeletion(true);
+
+        if (auto accessor = getFromDisk(narHash))
+            return cacheAccessor(ref(accessor));
+
+        auto nar = getNar();
+
+        auto writeAtomically = [&](const std::filesystem::path & path, std::string_view contents) {
+            auto tmp = makeTempPath(*cacheDir, path.filename().string() + ".tmp");
+            AutoDelete del(tmp, false);
+            writeFile(tmp, contents);
+            std::filesystem::rename(tmp, path);
+            del.cancel();
+        };
+
+        /* Write the listing first, since other processes only look
+           for it once the NAR exists. */
+        try {
+            StringSource source(nar);
+            nlohmann::json j = parseNarListing(source);
+            writeAtomically(listingFile, j.dump());
+            /* FIXME: do this asynchronously. */
+            writeAtomically(cacheFile, nar);
+        } catch (...) {
+            ignoreExceptionExceptInterrupt();
+        }
+
+        if (maxSize)
+            try {
+                evict(narHash);
+            } catch (...) {
+                ignoreExceptionExceptInterrupt();
+            }
+
+        return cacheAccessor(makeNarAccessor(std::move(nar)));
+    }
+
+    return cacheAccessor(makeNarAccessor(getNar()));
+}
+
+void NarCache::evict(const Hash & keep)
+{
+    /* One process evicting at a time is enough. */
+    PathLocks lock;
+    if (!lock.lockPaths({*cacheDir / "evict"}, "", false))
+        return;
+
+    struct Entry
+    {
+        std::filesystem::path cacheFile;
+        time_t lastUsed;
+        uint64_t size;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+
+    /* Temporary files and listings without a NAR that are older than
+       this were left behind by an interrupted process. Younger ones
+       may still be in the middle of being published. */
+    auto staleBefore = time(nullptr) - 3600;
+
+    auto removeIfStale = [&](const std::filesystem::path & path) {
+        auto st = maybeLstat(path);
+        if (!st || st->st_mtime >= staleBefore)
+            return;
+        debug("removing stale file %s from the NAR cache", PathFmt(path));
+        tryUnlink(path);
+        stats.staleFiles++;
+    };
+
+    for (auto & dirent : DirectoryIterator{*cacheDir}) {
+        checkInterrupt();
+        auto cacheFile = dirent.path();
+        if (cacheFile.filename().string().find(".tmp-") != std::string::npos) {
+            removeIfStale(cacheFile);
+            continue;
+        }
+        if (cacheFile.extension() == ".ls") {
+            if (!pathExists(std::filesystem::path(cacheFile).replace_extension(".nar")))
+                removeIfStale(cacheFile);
+            continue;
+        }
+        if (cacheFile.extension() != ".nar")
+            continue;
+        auto st = maybeLstat(cacheFile);
+        if (!st)
+            continue;
+        uint64_t size = st->st_size;
+        if (auto st2 = maybeLstat(std::filesystem::path(cacheFile).replace_extension(".ls")))
+            size += st2->st_size;
+        entries.push_back({.cacheFile = cacheFile, .lastUsed = st->st_mtime, .size = size});
+        totalSize += size;
+    }
+
+    if (totalSize <= maxSize)
+        return;
+
+    std::ranges::sort(entries, {}, &Entry::lastUsed);
+
+    auto keepFile = makeCacheFile(keep, "nar");
+
+    for (auto & entry : entries) {
+        if (totalSize <= maxSize)
+            break;
+        if (entry.cacheFile == keepFile)
+            continue;
+        debug("evicting %s from the NAR cache", PathFmt(entry.cacheFile));
+        tryUnlink(entry.cacheFile);
+        tryUnlink(std::filesystem::path(entry.cacheFile).replace_extension(".ls"));
+        totalSize -= entry.size;
+        stats.evictions++;
+    }
+}
+
+} // namespace nix
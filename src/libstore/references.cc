@@ -4,45 +4,239 @@
 #include "nix/util/base-nix-32.hh"
 
 #include <cstdlib>
+#include <cstring>
 #include <algorithm>
+#include <bit>
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#  include <immintrin.h>
+#endif
 
 namespace nix {
 
-static constexpr auto refLength = StorePath::HashLen;
+static constexpr auto refLength = RefScanSink::refLength;
+
+static_assert(refLength == StorePath::HashLen);
+
+namespace {
+
+/**
+ * Number of bytes classified per mask word.
+ */
+constexpr size_t blockSize = 64;
+
+/**
+ * Number of blocks classified per call of a `Classifier`, so that the
+ * indirect call is amortised over a reasonably large span.
+ */
+constexpr size_t blocksPerBatch = 64;
+
+/**
+ * Set bit `i` of `masks[n]` iff byte `n * blockSize + i` of `p` is a
+ * base-32 character.
+ */
+using Classifier = void (*)(const char * p, size_t nBlocks, uint64_t * masks);
+
+void classifyScalar(const char * p, size_t nBlocks, uint64_t * masks)
+{
+    for (size_t n = 0; n < nBlocks; ++n, p += blockSize) {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < blockSize; ++i)
+            if (BaseNix32::lookupReverse(p[i]))
+                mask |= uint64_t(1) << i;
+        masks[n] = mask;
+    }
+}
+
+#if defined(__x86_64__) && defined(__SSE2__)
+
+/* The base-32 alphabet is '0'-'9' and 'a'-'z' minus 'e', 'o', 't'
+   and 'u'. All of these are below 0x80, so signed byte comparisons
+   are sufficient: bytes >= 0x80 compare as negative and are
+   rejected by the lower bound checks. */
+
+void classifySse2(const char * p, size_t nBlocks, uint64_t * masks)
+{
+    const auto digitLo = _mm_set1_epi8('0' - 1), digitHi = _mm_set1_epi8('9' + 1);
+    const auto alphaLo = _mm_set1_epi8('a' - 1), alphaHi = _mm_set1_epi8('z' + 1);
+    const auto e = _mm_set1_epi8('e'), o = _mm_set1_epi8('o'), t = _mm_set1_epi8('t'), u = _mm_set1_epi8('u');
+
+    for (size_t n = 0; n < nBlocks; ++n, p += blockSize) {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < blockSize; i += 16) {
+            auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+            auto digit = _mm_and_si128(_mm_cmpgt_epi8(x, digitLo), _mm_cmplt_epi8(x, digitHi));
+            auto alpha = _mm_and_si128(_mm_cmpgt_epi8(x, alphaLo), _mm_cmplt_epi8(x, alphaHi));
+            auto omitted = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(x, e), _mm_cmpeq_epi8(x, o)),
+                _mm_or_si128(_mm_cmpeq_epi8(x, t), _mm_cmpeq_epi8(x, u)));
+            auto valid = _mm_or_si128(digit, _mm_andnot_si128(omitted, alpha));
+            mask |= uint64_t(uint32_t(_mm_movemask_epi8(valid))) << i;
+        }
+        masks[n] = mask;
+    }
+}
+
+[[gnu::target("avx2")]]
+void classifyAvx2(const char * p, size_t nBlocks, uint64_t * masks)
+{
+    const auto digitLo = _mm256_set1_epi8('0' - 1), digitHi = _mm256_set1_epi8('9' + 1);
+    const auto alphaLo = _mm256_set1_epi8('a' - 1), alphaHi = _mm256_set1_epi8('z' + 1);
+    const auto e = _mm256_set1_epi8('e'), o = _mm256_set1_epi8('o'), t = _mm256_set1_epi8('t'),
+               u = _mm256_set1_epi8('u');
+
+    for (size_t n = 0; n < nBlocks; ++n, p += blockSize) {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < blockSize; i += 32) {
+            auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+            auto digit = _mm256_and_si256(_mm256_cmpgt_epi8(x, digitLo), _mm256_cmpgt_epi8(digitHi, x));
+            auto alpha = _mm256_and_si256(_mm256_cmpgt_epi8(x, alphaLo), _mm256_cmpgt_epi8(alphaHi, x));
+            auto omitted = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(x, e), _mm256_cmpeq_epi8(x, o)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(x, t), _mm256_cmpeq_epi8(x, u)));
+            auto valid = _mm256_or_si256(digit, _mm256_andnot_si256(omitted, alpha));
+            mask |= uint64_t(uint32_t(_mm256_movemask_epi8(valid))) << i;
+        }
+        masks[n] = mask;
+    }
+}
+
+#endif
+
+Classifier pickClassifier()
+{
+#if defined(__x86_64__) && defined(__SSE2__)
+    if (__builtin_cpu_supports("avx2"))
+        return classifyAvx2;
+    return classifySse2;
+#else
+    return classifyScalar;
+#endif
+}
+
+const Classifier classify = pickClassifier();
+
+/**
+ * Given the classification masks of two consecutive blocks, return a
+ * mask whose bit `i` is set iff a run of `refLength` base-32
+ * characters ends at byte `i` of the second block.
+ */
+inline uint64_t runEnds(uint64_t prev, uint64_t cur)
+{
+    for (size_t k = 1; k < refLength; k *= 2) {
+        cur &= (cur << k) | (prev >> (blockSize - k));
+        prev &= prev << k;
+    }
+    return cur;
+}
+
+inline uint64_t hashCandidate(const char * p)
+{
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    /* The candidates are (mostly) random base-32 strings, so a
+       multiplicative hash of their first 8 bytes spreads them well. */
+    return word * 0x9e3779b97f4a7c15ULL;
+}
 
-static void search(std::string_view s, StringSet & hashes, StringSet & seen)
+} // namespace
+
+RefScanSink::RefScanSink(StringSet && hashes)
 {
-    for (size_t i = 0; i + refLength <= s.size();) {
-        int j;
-        bool match = true;
-        for (j = refLength - 1; j >= 0; --j)
-            if (!BaseNix32::lookupReverse(s[i + j])) {
-                i += j + 1;
-                match = false;
+    size_t size = 1;
+    tableShift = 64;
+    while (size < 2 * hashes.size()) {
+        size *= 2;
+        --tableShift;
+    }
+    table.resize(size);
+
+    for (auto & hash : hashes) {
+        /* Anything else could never be matched by the scanner. */
+        if (hash.size() != refLength)
+            continue;
+        auto i = tableShift == 64 ? 0 : hashCandidate(hash.data()) >> tableShift;
+        while (table[i].used) {
+            if (std::memcmp(table[i].key.data(), hash.data(), refLength) == 0)
                 break;
-            }
-        if (!match)
+            i = (i + 1) & (size - 1);
+        }
+        if (table[i].used)
+            continue;
+        std::memcpy(table[i].key.data(), hash.data(), refLength);
+        table[i].used = true;
+        ++remaining;
+    }
+}
+
+void RefScanSink::probe(const char * candidate)
+{
+    auto i = tableShift == 64 ? 0 : hashCandidate(candidate) >> tableShift;
+    for (; table[i].used; i = (i + 1) & (table.size() - 1)) {
+        auto & slot = table[i];
+        if (std::memcmp(slot.key.data(), candidate, refLength) != 0)
             continue;
-        std::string ref(s.substr(i, refLength));
-        if (hashes.erase(ref)) {
-            debug("found reference to '%1%' at offset '%2%'", ref, i);
-            seen.insert(ref);
+        if (!slot.found) {
+            std::string ref(candidate, refLength);
+            debug("found reference to '%1%'", ref);
+            slot.found = true;
+            --remaining;
+            seen.insert(std::move(ref));
         }
-        ++i;
+        return;
+    }
+}
+
+void RefScanSink::search(std::string_view s)
+{
+    uint64_t masks[blocksPerBatch];
+    uint64_t prev = 0;
+
+    auto processMasks = [&](const char * base, size_t nBlocks) {
+        for (size_t n = 0; n < nBlocks; ++n) {
+            auto cur = masks[n];
+            for (auto ends = runEnds(prev, cur); ends; ends &= ends - 1) {
+                auto end = n * blockSize + std::countr_zero(ends);
+                probe(base + end + 1 - refLength);
+            }
+            prev = cur;
+        }
+    };
+
+    size_t pos = 0;
+    while (remaining && s.size() - pos >= blockSize) {
+        auto nBlocks = std::min((s.size() - pos) / blockSize, blocksPerBatch);
+        classify(s.data() + pos, nBlocks, masks);
+        processMasks(s.data() + pos, nBlocks);
+        pos += nBlocks * blockSize;
+    }
+
+    if (remaining && pos < s.size()) {
+        /* Pad the final partial block with non-base-32 bytes. */
+        char last[blockSize];
+        std::memset(last, 0, blockSize);
+        std::memcpy(last, s.data() + pos, s.size() - pos);
+        classifyScalar(last, 1, masks);
+        /* Candidates may start in the previous block, so probe them
+           in `s` rather than in the padded copy. */
+        processMasks(s.data() + pos, 1);
     }
 }
 
 void RefScanSink::operator()(std::string_view data)
 {
+    if (!remaining)
+        return;
+
     /* It's possible that a reference spans the previous and current
        fragment, so search in the concatenation of the tail of the
        previous fragment and the start of the current fragment. */
     auto s = tail;
     auto tailLen = std::min(data.size(), refLength);
     s.append(data.data(), tailLen);
-    search(s, hashes, seen);
+    search(s);
 
-    search(data, hashes, seen);
+    search(data);
 
     auto rest = refLength - tailLen;
     if (rest < tail.size())
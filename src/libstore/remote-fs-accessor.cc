@@ -1,10 +1,12 @@
 #include "nix/store/remote-fs-accessor.hh"
+#include "nix/store/binary-cache-store.hh"
 
 namespace nix {
 
-RemoteFSAccessor::RemoteFSAccessor(ref<Store> store, bool requireValidPath, std::optional<AbsolutePath> cacheDir)
+RemoteFSAccessor::RemoteFSAccessor(
+    ref<Store> store, bool requireValidPath, std::optional<AbsolutePath> cacheDir, uint64_t maxCacheSize)
     : store(store)
-    , narCache(cacheDir)
+    , narCache(cacheDir, maxCacheSize)
     , requireValidPath(requireValidPath)
 {
 }
@@ -21,7 +23,7 @@ std::shared_ptr<SourceAccessor> RemoteFSAccessor::accessObject(const StorePath &
 {
     // Check if we already have the NAR hash for this store path
     if (auto * narHash = get(narHashes, storePath.hashPart()))
-        return narCache.getOrInsert(*narHash, [&](Sink & sink) { store->narFromPath(storePath, sink); });
+        return accessNar(storePath, *narHash);
 
     // Query the path info to get the NAR hash
     auto info = store->queryPathInfo(storePath);
@@ -29,8 +31,25 @@ std::shared_ptr<SourceAccessor> RemoteFSAccessor::accessObject(const StorePath &
     // Cache the mapping from store path to NAR hash
     narHashes.emplace(storePath.hashPart(), info->narHash);
 
+    return accessNar(storePath, info->narHash);
+}
+
+ref<SourceAccessor> RemoteFSAccessor::accessNar(const StorePath & storePath, const Hash & narHash)
+{
+    if (auto accessor = narCache.get(narHash))
+        return ref(accessor);
+
+    if (auto * accessor = get(indexedNars, narHash))
+        return *accessor;
+
+    /* If the binary cache has an index of the NAR, only fetch the
+       parts of it that we actually read. */
+    if (auto * binaryCacheStore = dynamic_cast<BinaryCacheStore *>(&*store))
+        if (auto accessor = binaryCacheStore->getIndexedNarAccessor(storePath))
+            return indexedNars.emplace(narHash, ref(accessor)).first->second;
+
     // Get or create the NAR accessor
-    return narCache.getOrInsert(info->narHash, [&](Sink & sink) { store->narFromPath(storePath, sink); });
+    return narCache.getOrInsert(narHash, [&](Sink & sink) { store->narFromPath(storePath, sink); });
 }
 
 std::optional<SourceAccessor::Stat> RemoteFSAccessor::maybeLstat(const CanonPath & path)
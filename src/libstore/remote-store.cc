@@ -20,6 +20,9 @@
 #include "nix/store/filetransfer.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/socket.hh"
+#include <future>
+#include <mutex>
+#include <thread>
 #include <variant>
 
 #ifndef _WIN32
@@ -48,8 +51,7 @@ RemoteStore::RemoteStore(const Config & config)
                       throw;
                   }
                   /* Track the connection FD for shutdownConnections() */
-                  connectionFds.lock()->insert(conn->from.fd);
-                  return conn;
+                  return trackConnection(conn);
               },
               [this](const ref<Connection> & r) {
                   return r->to.good() && r->from.good()
@@ -63,6 +65,221 @@ RemoteStore::RemoteStore(const Config & config)
 
 void RemoteStore::anchor() {}
 
+/**
+ * A connection used only for tagged requests (see
+ * `WorkerProto::featurePipelinedQueries`). Any number of threads can
+ * send requests on it without waiting for the replies, which a
+ * background thread reads and passes to the requests' handlers.
+ */
+struct RemoteStore::PipelinedConnection
+{
+    /**
+     * Called on the reader thread with the reply to a request, which
+     * the handler must read in full, or with the error the daemon
+     * reported for it. If the connection failed, it's called with
+     * neither, and the request should be retried on a regular
+     * connection.
+     */
+    using Handler = std::function<void(WorkerProto::ReadConn * reply, std::exception_ptr ex)>;
+
+    ref<Connection> conn;
+
+    struct State
+    {
+        uint64_t nextTag = 0;
+        std::map<uint64_t, Handler> pending;
+        bool failed = false;
+    };
+
+    Sync<State> state_;
+
+    /**
+     * Held while writing a request.
+     */
+    std::mutex writeLock;
+
+    std::thread reader;
+
+    PipelinedConnection(ref<Connection> conn)
+        : conn(conn)
+    {
+        reader = std::thread([this]() { readReplies(); });
+    }
+
+    ~PipelinedConnection()
+    {
+        /* Nobody can be waiting for a reply at this point, so just
+           forget about outstanding requests. */
+        {
+            auto state(state_.lock());
+            state->failed = true;
+            state->pending.clear();
+        }
+        try {
+            std::lock_guard lock(writeLock);
+            conn->closeWrite();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+        reader.join();
+    }
+
+    bool failed()
+    {
+        return state_.lock()->failed;
+    }
+
+    bool onReaderThread()
+    {
+        return std::this_thread::get_id() == reader.get_id();
+    }
+
+    /**
+     * Send a tagged request. `writeRequest` writes the ordinary
+     * request (op and arguments).
+     */
+    void send(fun<void(WorkerProto::WriteConn conn)> writeRequest, Handler handler);
+
+    void readReplies();
+
+    /**
+     * Mark the connection as failed, and retry all outstanding
+     * requests elsewhere.
+     */
+    void fail();
+};
+
+void RemoteStore::PipelinedConnection::send(fun<void(WorkerProto::WriteConn conn)> writeRequest, Handler handler)
+{
+    uint64_t tag;
+
+    {
+        auto state(state_.lock());
+        if (!state->failed) {
+            tag = state->nextTag++;
+            state->pending.insert_or_assign(tag, std::move(handler));
+            handler = nullptr;
+        }
+    }
+
+    if (handler) {
+        handler(nullptr, nullptr);
+        return;
+    }
+
+    try {
+        std::lock_guard lock(writeLock);
+        try {
+            conn->to << WorkerProto::Op::TaggedRequest << tag;
+            writeRequest(*conn);
+            conn->to.flush();
+        } catch (...) {
+            /* We may have sent part of the request, so the connection
+               is unusable. Make the daemon hang up, so that the reader
+               thread notices too. */
+            conn->closeWrite();
+            throw;
+        }
+    } catch (Error & e) {
+        debug("tagged request to the Nix daemon failed: %s", e.msg());
+        fail();
+    }
+}
+
+void RemoteStore::PipelinedConnection::readReplies()
+{
+    try {
+        while (true) {
+            auto [tag, ex] = conn->readTaggedReply();
+
+            Handler handler;
+            {
+                auto state(state_.lock());
+                auto i = state->pending.find(tag);
+                if (i == state->pending.end()) {
+                    if (state->failed)
+                        return;
+                    throw Error("got a reply from the Nix daemon for unknown tagged request %d", tag);
+                }
+                handler = std::move(i->second);
+                state->pending.erase(i);
+            }
+
+            WorkerProto::ReadConn reply(*conn);
+            handler(ex ? nullptr : &reply, ex);
+        }
+    } catch (Error & e) {
+        debug("pipelined connection to the Nix daemon failed: %s", e.msg());
+    } catch (...) {
+        /* E.g. Interrupted. The outstanding requests are retried on
+           regular connections, where it will be reported properly. */
+    }
+
+    fail();
+}
+
+void RemoteStore::PipelinedConnection::fail()
+{
+    std::map<uint64_t, Handler> pending;
+    {
+        auto state(state_.lock());
+        state->failed = true;
+        std::swap(pending, state->pending);
+    }
+
+    for (auto & [tag, handler] : pending)
+        handler(nullptr, nullptr);
+}
+
+RemoteStore::~RemoteStore()
+{
+    /* Stop the reader thread while the rest of the store is still
+       there. Don't hold the lock while joining it, since a handler may
+       still be running and need it. */
+    std::unique_ptr<PipelinedConnection> conn;
+    std::swap(conn, pipelined_.lock()->conn);
+    conn.reset();
+}
+
+ref<RemoteStore::Connection> RemoteStore::trackConnection(ref<Connection> conn)
+{
+    auto fd = conn->from.fd;
+    connectionFds->lock()->insert(fd);
+    /* Forget the FD before the connection closes it, so that
+       shutdownConnections() can't hit whatever reuses it. */
+    return ref<Connection>(std::shared_ptr<Connection>(
+        &*conn, [inner = conn.get_ptr(), fds = connectionFds, fd](Connection *) mutable {
+            fds->lock()->erase(fd);
+            inner.reset();
+        }));
+}
+
+RemoteStore::PipelinedConnection * RemoteStore::getPipelinedConnection()
+{
+    if (!config.pipelineQueries)
+        return nullptr;
+
+    auto pipelined(pipelined_.lock());
+
+    if (!pipelined->tried) {
+        pipelined->tried = true;
+        try {
+            auto conn = openConnectionWrapper();
+            initConnection(*conn);
+            if (conn->protoVersion.features.contains(WorkerProto::featurePipelinedQueries)) {
+                pipelined->conn = std::make_unique<PipelinedConnection>(trackConnection(conn));
+            }
+        } catch (Error & e) {
+            debug("not pipelining queries to '%s': %s", config.getHumanReadableURI(), e.msg());
+        }
+    }
+
+    if (pipelined->conn && !pipelined->conn->failed())
+        return pipelined->conn.get();
+
+    return nullptr;
+}
+
 ref<RemoteStore::Connection> RemoteStore::openConnectionWrapper()
 {
     if (failed) {
@@ -180,6 +397,31 @@ void RemoteStore::setOptions()
 
 bool RemoteStore::isValidPathUncached(const StorePath & path)
 {
+    if (auto pipelined = getPipelinedConnection(); pipelined && !pipelined->onReaderThread()) {
+        std::promise<std::optional<bool>> promise;
+        pipelined->send(
+            [&](WorkerProto::WriteConn conn) {
+                conn.to << WorkerProto::Op::IsValidPath;
+                WorkerProto::write(*this, conn, path);
+            },
+            [&](WorkerProto::ReadConn * reply, std::exception_ptr ex) {
+                if (ex)
+                    promise.set_exception(ex);
+                else if (!reply)
+                    promise.set_value(std::nullopt);
+                else {
+                    try {
+                        promise.set_value(readInt(reply->from));
+                    } catch (...) {
+                        promise.set_exception(std::current_exception());
+                        throw;
+                    }
+                }
+            });
+        if (auto valid = promise.get_future().get())
+            return *valid;
+    }
+
     auto conn(getConnection());
     conn->to << WorkerProto::Op::IsValidPath;
     WorkerProto::write(*this, *conn, path);
@@ -239,6 +481,44 @@ void RemoteStore::querySubstitutablePathInfos(const StorePathCAMap & pathsMap, S
 void RemoteStore::queryPathInfoUncached(
     const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
+    /* A handler on the reader thread must not wait for another reply,
+       since only that thread could read it. */
+    if (auto pipelined = getPipelinedConnection(); pipelined && !pipelined->onReaderThread()) {
+        auto callbackPtr = std::make_shared<decltype(callback)>(std::move(callback));
+        pipelined->send(
+            [this, path](WorkerProto::WriteConn conn) {
+                conn.to << WorkerProto::Op::QueryPathInfo;
+                WorkerProto::write(*this, conn, path);
+            },
+            [this, path, callbackPtr](WorkerProto::ReadConn * reply, std::exception_ptr ex) {
+                if (ex) {
+                    callbackPtr->rethrow(ex);
+                    return;
+                }
+                if (!reply) {
+                    /* The pipelined connection failed, so this will use
+                       a regular one. */
+                    queryPathInfoUncached(path, std::move(*callbackPtr));
+                    return;
+                }
+                std::optional<UnkeyedValidPathInfo> info;
+                try {
+                    bool valid;
+                    reply->from >> valid;
+                    if (valid)
+                        info = WorkerProto::Serialise<UnkeyedValidPathInfo>::read(*this, *reply);
+                } catch (...) {
+                    callbackPtr->rethrow();
+                    throw;
+                }
+                if (!info)
+                    (*callbackPtr)(nullptr);
+                else
+                    (*callbackPtr)(std::make_shared<ValidPathInfo>(StorePath{path}, *info));
+            });
+        return;
+    }
+
     try {
         auto info = ({
             auto conn(getConnection());
@@ -253,6 +533,26 @@ void RemoteStore::queryPathInfoUncached(
     }
 }
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+RemoteStore::queryPathInfosUncached(const StorePathSet & paths)
+{
+    {
+        auto conn(getConnection());
+        if (conn->protoVersion.features.contains(WorkerProto::featureQueryPathInfos)) {
+            conn->to << WorkerProto::Op::QueryPathInfos;
+            WorkerProto::write(*this, *conn, paths);
+            conn.processStderr();
+            std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+            for (auto & [path, info] :
+                 WorkerProto::Serialise<std::map<StorePath, UnkeyedValidPathInfo>>::read(*this, *conn))
+                res.insert_or_assign(path, std::make_shared<ValidPathInfo>(path, std::move(info)));
+            return res;
+        }
+    }
+
+    return Store::queryPathInfosUncached(paths);
+}
+
 void RemoteStore::queryReferrers(const StorePath & path, StorePathSet & referrers)
 {
     auto conn(getConnection());
@@ -820,7 +1120,7 @@ void RemoteStore::flushBadConnections()
 
 void RemoteStore::shutdownConnections()
 {
-    auto fds = connectionFds.lock();
+    auto fds = connectionFds->lock();
     for (auto fd : *fds) {
         /* Use shutdown() instead of close() to signal EOF to any blocking
            reads/writes without actually closing the FD (which would cause
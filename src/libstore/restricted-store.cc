@@ -143,6 +143,8 @@ public:
         unsupported("addSignatures");
     }
 
+    using Store::queryMissing;
+
     MissingPaths queryMissing(const std::vector<DerivedPath> & targets) override;
 
     virtual std::optional<std::string> getBuildLogExact(const StorePath & path) override
@@ -11,6 +11,7 @@
 #include "nix/util/util.hh"
 #include "nix/store/nar-info-disk-cache.hh"
 #include "nix/util/thread-pool.hh"
+#include "nix/util/pipeline.hh"
 #include "nix/util/archive.hh"
 #include "nix/util/callback.hh"
 #include "nix/util/git.hh"
@@ -637,6 +638,103 @@ void Store::queryPathInfo(const StorePath & storePath, Callback<ref<const ValidP
         }});
 }
 
+std::map<StorePath, ref<const ValidPathInfo>> Store::queryPathInfos(const StorePathSet & paths)
+{
+    std::map<StorePath, ref<const ValidPathInfo>> res;
+
+    StorePathSet uncached;
+    for (auto & path : paths) {
+        auto r = queryPathInfoFromClientCache(path);
+        if (!r)
+            uncached.insert(path);
+        else if (*r)
+            res.insert_or_assign(path, ref(*r));
+    }
+
+    if (uncached.empty())
+        return res;
+
+    auto infos = queryPathInfosUncached(uncached);
+
+    for (auto & path : uncached) {
+        auto i = infos.find(path);
+        std::shared_ptr<const ValidPathInfo> info = i != infos.end() ? i->second : nullptr;
+
+        if (diskCache)
+            diskCache->upsertNarInfo(
+                config.getReference().render(/*FIXME withParams=*/false), std::string(path.hashPart()), info);
+
+        pathInfoCache->lock()->upsert(path, PathInfoCacheValue{.value = info});
+
+        if (!info || !goodStorePath(path, info->path)) {
+            stats.narInfoMissing++;
+            continue;
+        }
+
+        res.insert_or_assign(path, ref(info));
+    }
+
+    return res;
+}
+
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>> Store::queryPathInfosUncached(const StorePathSet & paths)
+{
+    struct State
+    {
+        size_t left;
+        std::map<StorePath, std::shared_ptr<const ValidPathInfo>> infos;
+        std::exception_ptr exc;
+    };
+
+    Sync<State> state_(State{paths.size()});
+
+    std::condition_variable wakeup;
+    ThreadPool pool;
+
+    auto doQuery = [&](const StorePath & path) {
+        checkInterrupt();
+        queryPathInfoUncached(
+            path, {[path, &state_, &wakeup](std::future<std::shared_ptr<const ValidPathInfo>> fut) {
+                std::shared_ptr<const ValidPathInfo> info;
+                std::exception_ptr newExc{};
+
+                try {
+                    info = fut.get();
+                } catch (InvalidPath &) {
+                } catch (...) {
+                    newExc = std::current_exception();
+                }
+
+                auto state(state_.lock());
+
+                if (info)
+                    state->infos.insert_or_assign(path, info);
+
+                if (newExc)
+                    state->exc = newExc;
+
+                assert(state->left);
+                if (!--state->left)
+                    wakeup.notify_one();
+            }});
+    };
+
+    for (auto & path : paths)
+        pool.enqueue(std::bind(doQuery, path));
+
+    pool.process();
+
+    while (true) {
+        auto state(state_.lock());
+        if (!state->left) {
+            if (state->exc)
+                std::rethrow_exception(state->exc);
+            return std::move(state->infos);
+        }
+        state.wait(wakeup);
+    }
+}
+
 void Store::queryRealisation(
     const DrvOutput & id, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept
 {
@@ -928,14 +1026,15 @@ void copyStorePath(
     if (getEnv("_NIX_TEST_CONCURRENT_SUBSTITUTION"))
         std::this_thread::sleep_for(std::chrono::seconds(1));
 
-    auto source = sinkToSource(
+    /* Fetch (and decompress) the NAR on a separate thread while this
+       thread unpacks it into dstStore, so that the network, the
+       decompressor and the disk are all kept busy. Remote transfers
+       are received by yet another thread (see FileTransfer), and
+       LocalStore::addToStore() hashes the NAR on another one. */
+    ThreadedSource source(
         [&](Sink & sink) {
-            LambdaSink progressSink([&](std::string_view data) {
-                total += data.size();
-                act.progress(total, info->narSize);
-            });
-            TeeSink tee{sink, progressSink};
-            srcStore.narFromPath(storePath, tee);
+            PushActivity pact(act.id);
+            srcStore.narFromPath(storePath, sink);
         },
         [&]() {
             throw EndOfFile(
@@ -944,7 +1043,37 @@ void copyStorePath(
                 srcStore.config.getHumanReadableURI());
         });
 
-    dstStore.addToStore(*info, *source, repair, checkSigs);
+    auto lastStatus = std::chrono::steady_clock::now();
+    auto lastStats = source.getStats();
+
+    LambdaSink progressSink([&](std::string_view data) {
+        total += data.size();
+        act.progress(total, info->narSize);
+
+        /* Periodically show the throughput and which stage is the
+           bottleneck: a stage that rarely waits for the other is
+           busy all the time. */
+        auto now = std::chrono::steady_clock::now();
+        if (now < lastStatus + std::chrono::seconds(1))
+            return;
+        auto stats = source.getStats();
+        std::chrono::duration<double> elapsed = now - lastStatus;
+        auto busy = [&](std::chrono::nanoseconds waited) {
+            return std::clamp((int) (100 * (1 - waited / elapsed)), 0, 100);
+        };
+        act.result(
+            resFetchStatus,
+            fmt("%s/s, fetching %d%% busy, unpacking %d%% busy",
+                renderSize((int64_t) ((stats.bytesPopped - lastStats.bytesPopped) / elapsed.count())),
+                busy(stats.pushWait - lastStats.pushWait),
+                busy(stats.popWait - lastStats.popWait)));
+        lastStatus = now;
+        lastStats = stats;
+    });
+
+    TeeSource tee{source, progressSink};
+
+    dstStore.addToStore(*info, tee, repair, checkSigs);
 }
 
 std::map<StorePath, StorePath> copyPaths(
@@ -1010,6 +1139,10 @@ std::map<StorePath, StorePath> copyPaths(
 
     Activity act(*logger, lvlInfo, actCopyPaths, fmt("copying %d paths", missing.size()));
 
+    /* Fetch the metadata of all missing paths in one go, rather than
+       one path at a time in topoSortPaths() and the loop below. */
+    srcStore.queryPathInfos(missing);
+
     // In the general case, `addMultipleToStore` requires a sorted list of
     // store paths to add, so sort them right now
     auto sortedMissing = srcStore.topoSortPaths(missing);
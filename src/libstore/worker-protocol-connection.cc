@@ -30,6 +30,43 @@ static Logger::Fields readFields(Source & from)
     return fields;
 }
 
+/**
+ * Forward a log message from the daemon to our logger. Returns false
+ * if `msg` isn't a log message.
+ */
+static bool processLogMessage(uint64_t msg, Source & from)
+{
+    if (msg == STDERR_NEXT)
+        printError(chomp(readString(from)));
+
+    else if (msg == STDERR_START_ACTIVITY) {
+        auto act = readNum<ActivityId>(from);
+        auto lvl = (Verbosity) readInt(from);
+        auto type = (ActivityType) readInt(from);
+        auto s = readString(from);
+        auto fields = readFields(from);
+        auto parent = readNum<ActivityId>(from);
+        logger->startActivity(act, lvl, type, s, fields, parent);
+    }
+
+    else if (msg == STDERR_STOP_ACTIVITY) {
+        auto act = readNum<ActivityId>(from);
+        logger->stopActivity(act);
+    }
+
+    else if (msg == STDERR_RESULT) {
+        auto act = readNum<ActivityId>(from);
+        auto type = (ResultType) readInt(from);
+        auto fields = readFields(from);
+        logger->result(act, type, fields);
+    }
+
+    else
+        return false;
+
+    return true;
+}
+
 std::exception_ptr
 WorkerProto::BasicClientConnection::processStderrReturn(Sink * sink, Source * source, bool flush, bool block)
 {
@@ -72,30 +109,8 @@ WorkerProto::BasicClientConnection::processStderrReturn(Sink * sink, Source * so
             break;
         }
 
-        else if (msg == STDERR_NEXT)
-            printError(chomp(readString(from)));
-
-        else if (msg == STDERR_START_ACTIVITY) {
-            auto act = readNum<ActivityId>(from);
-            auto lvl = (Verbosity) readInt(from);
-            auto type = (ActivityType) readInt(from);
-            auto s = readString(from);
-            auto fields = readFields(from);
-            auto parent = readNum<ActivityId>(from);
-            logger->startActivity(act, lvl, type, s, fields, parent);
-        }
-
-        else if (msg == STDERR_STOP_ACTIVITY) {
-            auto act = readNum<ActivityId>(from);
-            logger->stopActivity(act);
-        }
-
-        else if (msg == STDERR_RESULT) {
-            auto act = readNum<ActivityId>(from);
-            auto type = (ResultType) readInt(from);
-            auto fields = readFields(from);
-            logger->result(act, type, fields);
-        }
+        else if (processLogMessage(msg, from))
+            ;
 
         else if (msg == STDERR_LAST) {
             assert(block);
@@ -144,6 +159,31 @@ void WorkerProto::BasicClientConnection::processStderr(
     }
 }
 
+std::pair<uint64_t, std::exception_ptr> WorkerProto::BasicClientConnection::readTaggedReply()
+{
+    while (true) {
+        auto msg = readNum<uint64_t>(from);
+
+        if (msg == STDERR_TAGGED_REPLY) {
+            auto tag = readNum<uint64_t>(from);
+            bool success;
+            from >> success;
+            if (success)
+                return {tag, nullptr};
+            return {tag, std::make_exception_ptr(readError(from))};
+        }
+
+        else if (msg == STDERR_ERROR)
+            throw readError(from);
+
+        else if (processLogMessage(msg, from))
+            ;
+
+        else
+            throw Error("got unexpected message type %x from Nix daemon while waiting for a tagged reply", msg);
+    }
+}
+
 static WorkerProto::Version::FeatureSet
 intersectFeatures(const WorkerProto::Version::FeatureSet & a, const WorkerProto::Version::FeatureSet & b)
 {
@@ -29,6 +29,8 @@ const WorkerProto::Version WorkerProto::latest = {
                 WorkerProto::featureRealisationWithPath,
             },
             std::string{WorkerProto::featureDeleteDeadSpecificReferrers},
+            std::string{WorkerProto::featurePipelinedQueries},
+            std::string{WorkerProto::featureQueryPathInfos},
         },
 };
 
@@ -55,6 +57,55 @@ std::partial_ordering WorkerProto::Version::operator<=>(const WorkerProto::Versi
     return std::partial_ordering::unordered;
 }
 
+bool WorkerProto::isPipelinable(Op op)
+{
+    switch (op) {
+    case Op::IsValidPath:
+    case Op::QueryPathInfo:
+    case Op::QueryPathFromHashPart:
+        return true;
+    case Op::QueryReferrers:
+    case Op::AddToStore:
+    case Op::AddTextToStore:
+    case Op::BuildPaths:
+    case Op::EnsurePath:
+    case Op::AddTempRoot:
+    case Op::AddIndirectRoot:
+    case Op::SyncWithGC:
+    case Op::FindRoots:
+    case Op::QueryDeriver:
+    case Op::SetOptions:
+    case Op::CollectGarbage:
+    case Op::QuerySubstitutablePathInfo:
+    case Op::QueryDerivationOutputs:
+    case Op::QueryAllValidPaths:
+    case Op::QueryDerivationOutputNames:
+    case Op::QuerySubstitutablePathInfos:
+    case Op::QueryValidPaths:
+    case Op::QuerySubstitutablePaths:
+    case Op::QueryValidDerivers:
+    case Op::OptimiseStore:
+    case Op::VerifyStore:
+    case Op::BuildDerivation:
+    case Op::AddSignatures:
+    case Op::NarFromPath:
+    case Op::AddToStoreNar:
+    case Op::QueryMissing:
+    case Op::QueryDerivationOutputMap:
+    case Op::RegisterDrvOutput:
+    case Op::QueryRealisation:
+    case Op::AddMultipleToStore:
+    case Op::AddBuildLog:
+    case Op::BuildPathsWithResults:
+    case Op::AddPermRoot:
+    case Op::TaggedRequest:
+    case Op::QueryPathInfos:
+        return false;
+    }
+    /* Not a valid op. */
+    return false;
+}
+
 /* protocol-specific definitions */
 
 BuildMode WorkerProto::Serialise<BuildMode>::read(const StoreDirConfig & store, WorkerProto::ReadConn conn)
@@ -1,4 +1,6 @@
 #include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/memory-source-accessor.hh"
 #include "nix/util/tests/characterization.hh"
 #include "nix/util/tests/gmock-matchers.hh"
 
@@ -58,4 +60,76 @@ INSTANTIATE_TEST_SUITE_P(
         // Test that the 'name' field cannot come before the 'node' field in a directory entry.
         std::pair{"name-after-node", "bad archive: expected tag 'name'"}));
 
+TEST(dumpPathParallel, matchesSequentialDump)
+{
+    using File = MemorySourceAccessor::File;
+
+    auto accessor = make_ref<MemorySourceAccessor>();
+    decltype(File::Directory::entries) dir;
+    for (size_t i = 0; i < 50; ++i)
+        dir.emplace(
+            fmt("file-%02d", i),
+            File::Regular{
+                .executable = i % 3 == 0,
+                /* Include some files spanning several chunks. */
+                .contents = std::string(i % 10 == 0 ? 3 * 1024 * 1024 + i : i * 7, 'a' + i % 26),
+            });
+    dir.emplace("link", File::Symlink{.target = "file-01"});
+    dir.emplace("empty-dir", File::Directory{});
+    dir.emplace("subdir", File::Directory{.entries = {{"nested", File::Regular{.contents = "nested"}}}});
+    accessor->root = File::Directory{.entries = std::move(dir)};
+
+    StringSink expected;
+    accessor->dumpPath(CanonPath::root, expected);
+
+    for (size_t nThreads : {1, 2, 8}) {
+        StringSink actual;
+        dumpPathParallel(*accessor, CanonPath::root, actual, defaultPathFilter, nThreads);
+        ASSERT_EQ(actual.s, expected.s) << nThreads << " threads";
+    }
+
+    /* A tree without regular files. */
+    StringSink expectedSymlink, actualSymlink;
+    accessor->dumpPath(CanonPath("link"), expectedSymlink);
+    dumpPathParallel(*accessor, CanonPath("link"), actualSymlink, defaultPathFilter, 4);
+    ASSERT_EQ(actualSymlink.s, expectedSymlink.s);
+}
+
+TEST(restorePath, fromFile)
+{
+    using File = MemorySourceAccessor::File;
+
+    /* Restoring from a file lets `FdSource` copy the file contents
+       inside the kernel, so check that this ends up at the right
+       offsets, for files that are smaller and larger than a block. */
+    auto accessor = make_ref<MemorySourceAccessor>();
+    decltype(File::Directory::entries) dir;
+    for (size_t i = 0; i < 20; ++i)
+        dir.emplace(
+            fmt("file-%02d", i),
+            File::Regular{
+                .executable = i % 3 == 0,
+                .contents = std::string(i % 5 == 0 ? 1024 * 1024 + i * 4096 : i * 13, 'a' + i % 26),
+            });
+    dir.emplace("link", File::Symlink{.target = "file-01"});
+    accessor->root = File::Directory{.entries = std::move(dir)};
+
+    StringSink nar;
+    accessor->dumpPath(CanonPath::root, nar);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    writeFile(tmpDir / "test.nar", nar.s);
+
+    AutoCloseFD fd = openFileReadonly(tmpDir / "test.nar");
+    ASSERT_TRUE(fd);
+    FdSource source(fd.get());
+    restorePath(tmpDir / "out", source);
+
+    StringSink restored;
+    dumpPath(tmpDir / "out", restored);
+    ASSERT_EQ(restored.s, nar.s);
+}
+
 } // namespace nix
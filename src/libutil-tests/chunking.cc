@@ -0,0 +1,81 @@
+#include "nix/util/chunking.hh"
+#include "nix/util/strings.hh"
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+
+namespace nix {
+
+static std::string randomData(size_t size, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::string data(size, 0);
+    for (auto & c : data)
+        c = (char) rng();
+    return data;
+}
+
+static std::vector<std::string> chunk(std::string_view data, size_t writeSize = 4096)
+{
+    std::vector<std::string> chunks;
+    ChunkingSink sink([&](std::string_view chunk) { chunks.emplace_back(chunk); });
+    for (size_t i = 0; i < data.size(); i += writeSize)
+        sink(data.substr(i, writeSize));
+    sink.finish();
+    return chunks;
+}
+
+TEST(ChunkingSink, chunksConcatenateToInput)
+{
+    auto data = randomData(4 * 1024 * 1024, 1);
+    auto chunks = chunk(data);
+    ASSERT_EQ(concatStringsSep("", chunks), data);
+}
+
+TEST(ChunkingSink, respectsSizeLimits)
+{
+    ChunkingSink::Params params;
+    auto chunks = chunk(randomData(4 * 1024 * 1024, 2));
+    ASSERT_GT(chunks.size(), 16u);
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        ASSERT_LE(chunks[i].size(), params.maxSize);
+        if (i + 1 < chunks.size()) {
+            ASSERT_GE(chunks[i].size(), params.minSize);
+        }
+    }
+
+    /* Data without any variation is cut at the maximum size. */
+    auto zeroes = chunk(std::string(1024 * 1024, 0));
+    ASSERT_EQ(zeroes.size(), 1024 * 1024 / params.maxSize);
+}
+
+TEST(ChunkingSink, boundariesDontDependOnWriteSizes)
+{
+    auto data = randomData(1024 * 1024, 3);
+    ASSERT_EQ(chunk(data, 1), chunk(data, 1024 * 1024));
+}
+
+TEST(ChunkingSink, insertionOnlyChangesNearbyChunks)
+{
+    auto data = randomData(4 * 1024 * 1024, 4);
+    auto data2 = data;
+    data2.insert(2 * 1024 * 1024, "hello world");
+
+    auto chunks = chunk(data);
+    auto chunks2 = chunk(data2);
+
+    std::set<std::string> set(chunks.begin(), chunks.end());
+    size_t shared = 0;
+    for (auto & c : chunks2)
+        shared += set.count(c);
+
+    ASSERT_GE(shared + 2, chunks.size());
+}
+
+TEST(ChunkingSink, emptyInputHasNoChunks)
+{
+    ASSERT_EQ(chunk(""), std::vector<std::string>{});
+}
+
+} // namespace nix
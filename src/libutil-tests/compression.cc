@@ -119,6 +119,68 @@ TEST(compress, zstdExactFrameBoundary)
     ASSERT_EQ(frameSize, compressed.size());
 }
 
+TEST(decompress, decompressZstdFramesWithoutContentSize)
+{
+    // Frames written by a streaming encoder don't record their size,
+    // so they can't be decoded in parallel. Mix them with frames that
+    // can.
+    auto streamingFrame = [](std::string_view str) {
+        std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx{ZSTD_createCCtx(), ZSTD_freeCCtx};
+        std::string out(ZSTD_compressBound(str.size()) + ZSTD_CStreamOutSize(), 0);
+        ZSTD_inBuffer in = {str.data(), str.size(), 0};
+        ZSTD_outBuffer outBuf = {out.data(), out.size(), 0};
+        while (ZSTD_compressStream2(cctx.get(), &outBuf, &in, ZSTD_e_end) != 0)
+            ;
+        out.resize(outBuf.pos);
+        EXPECT_EQ(ZSTD_getFrameContentSize(out.data(), out.size()), ZSTD_CONTENTSIZE_UNKNOWN);
+        return out;
+    };
+
+    std::string a(100000, 'a'), b(3 * 1024 * 1024, 'b'), c = "c";
+    auto compressed = compress(CompressionAlgo::zstd, a) + streamingFrame(b) + compress(CompressionAlgo::zstd, c)
+                      + streamingFrame("") + compress(CompressionAlgo::zstd, a);
+
+    // Feed the input in small pieces, so frames and frame headers are
+    // split across writes.
+    StringSink strSink;
+    auto sink = makeDecompressionSink("zstd", strSink);
+    for (size_t pos = 0; pos < compressed.size(); pos += 1000)
+        (*sink)(std::string_view(compressed).substr(pos, 1000));
+    sink->finish();
+
+    ASSERT_EQ(strSink.s, a + b + c + a);
+}
+
+TEST(decompress, decompressZstdFramesLargerThanNixWrites)
+{
+    // A frame that records a size bigger than the frames Nix writes is
+    // decoded as a stream rather than buffered, between frames that are
+    // decoded in parallel.
+    std::string big(20 * 1024 * 1024, 'b');
+    for (size_t i = 0; i < big.size(); i += 997)
+        big[i] = 'y';
+    std::string bigFrame(ZSTD_compressBound(big.size()), 0);
+    auto size = ZSTD_compress(bigFrame.data(), bigFrame.size(), big.data(), big.size(), 1);
+    ASSERT_FALSE(ZSTD_isError(size));
+    bigFrame.resize(size);
+    ASSERT_EQ(ZSTD_getFrameContentSize(bigFrame.data(), bigFrame.size()), big.size());
+
+    std::string small(40 * 1024 * 1024, 's');
+    auto compressed = compress(CompressionAlgo::zstd, small) + bigFrame + compress(CompressionAlgo::zstd, small);
+
+    ASSERT_EQ(decompress("zstd", compressed), small + big + small);
+}
+
+TEST(decompress, decompressTruncatedZstdThrowsCompressionError)
+{
+    std::string str(20 * 1024 * 1024, 'x');
+    auto compressed = compress(CompressionAlgo::zstd, str);
+
+    ASSERT_THROW(decompress("zstd", compressed.substr(0, compressed.size() - 1)), CompressionError);
+    ASSERT_THROW(decompress("zstd", ""), CompressionError);
+    ASSERT_THROW(decompress("zstd", "this is not zstd data at all"), CompressionError);
+}
+
 TEST(decompress, decompressInvalidInputThrowsCompressionError)
 {
     auto method = "bzip2";
@@ -156,4 +218,40 @@ TEST(makeCompressionSink, compressAndDecompress)
     ASSERT_STREQ(strSink.s.c_str(), inputString);
 }
 
+
+TEST(makeCompressionSink, zstdFramesCanBeDecompressedSeparately)
+{
+    std::string str(40 * 1024 * 1024, 'x');
+    for (size_t i = 0; i < str.size(); i += 997)
+        str[i] = (char) i;
+
+    StringSink strSink;
+    auto sink = makeCompressionSink(CompressionAlgo::zstd, strSink);
+    (*sink)(str);
+    sink->finish();
+
+    auto frames = sink->getFrames();
+    ASSERT_EQ(frames.size(), 3u);
+    ASSERT_EQ(frames[0].uncompressedOffset, 0u);
+    ASSERT_EQ(frames[0].compressedOffset, 0u);
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        bool last = i + 1 == frames.size();
+        auto start = frames[i].compressedOffset;
+        auto end = last ? strSink.s.size() : frames[i + 1].compressedOffset;
+        auto o = decompress("zstd", std::string_view(strSink.s).substr(start, end - start));
+        ASSERT_EQ(o.size(), (last ? str.size() : frames[i + 1].uncompressedOffset) - frames[i].uncompressedOffset);
+        ASSERT_EQ(o, str.substr(frames[i].uncompressedOffset, o.size()));
+    }
+}
+
+TEST(makeCompressionSink, otherMethodsHaveNoFrames)
+{
+    StringSink strSink;
+    auto sink = makeCompressionSink(CompressionAlgo::xz, strSink);
+    (*sink)("foo");
+    sink->finish();
+    ASSERT_TRUE(sink->getFrames().empty());
+}
+
 } // namespace nix
@@ -0,0 +1,112 @@
+#include "nix/util/pipeline.hh"
+#include <gtest/gtest.h>
+
+namespace nix {
+
+static std::string makeData(size_t size)
+{
+    std::string data;
+    data.reserve(size);
+    for (size_t i = 0; i < size; ++i)
+        data.push_back((char) (i * 7 % 251));
+    return data;
+}
+
+/* ----------------------------------------------------------------------------
+ * ThreadedSink
+ * --------------------------------------------------------------------------*/
+
+TEST(ThreadedSink, passesAllDataInOrder)
+{
+    auto data = makeData(1000000);
+    StringSink out;
+    ThreadedSink sink(out, 4096, 1000);
+    for (size_t i = 0; i < data.size(); i += 777)
+        sink(std::string_view(data).substr(i, 777));
+    sink.finish();
+    ASSERT_EQ(out.s, data);
+    ASSERT_EQ(sink.getStats().bytesPopped, data.size());
+}
+
+TEST(ThreadedSink, smallDataIsPassedOnFinish)
+{
+    StringSink out;
+    ThreadedSink sink(out);
+    sink("hello");
+    ASSERT_EQ(out.s, "");
+    sink.finish();
+    ASSERT_EQ(out.s, "hello");
+}
+
+TEST(ThreadedSink, rethrowsExceptionsOfNextSink)
+{
+    LambdaSink out([](std::string_view data) { throw Error("out of space"); });
+    ThreadedSink sink(out, 16, 4);
+    ASSERT_THROW(
+        {
+            for (int i = 0; i < 1000; ++i)
+                sink("data");
+            sink.finish();
+        },
+        Error);
+}
+
+/* ----------------------------------------------------------------------------
+ * ThreadedSource
+ * --------------------------------------------------------------------------*/
+
+TEST(ThreadedSource, readsAllDataInOrder)
+{
+    auto data = makeData(1000000);
+    ThreadedSource source(
+        [&](Sink & sink) {
+            for (size_t i = 0; i < data.size(); i += 777)
+                sink(std::string_view(data).substr(i, 777));
+        },
+        []() { throw EndOfFile("done"); },
+        4096,
+        1000);
+    ASSERT_EQ(source.drain(), data);
+    ASSERT_EQ(source.getStats().bytesPushed, data.size());
+}
+
+TEST(ThreadedSource, callsEofAtTheEnd)
+{
+    ThreadedSource source([&](Sink & sink) { sink("abc"); }, []() { throw EndOfFile("incomplete"); });
+    char buf[4];
+    source(buf, 3);
+    ASSERT_EQ(std::string_view(buf, 3), "abc");
+    ASSERT_THROW(source(buf, 1), EndOfFile);
+}
+
+TEST(ThreadedSource, rethrowsExceptionsOfWriter)
+{
+    ThreadedSource source([&](Sink & sink) { throw Error("connection reset"); });
+    char buf[1];
+    ASSERT_THROW(source(buf, 1), Error);
+}
+
+TEST(ThreadedSource, stopsWriterWhenDestroyed)
+{
+    bool writerStopped = false;
+    {
+        ThreadedSource source(
+            [&](Sink & sink) {
+                try {
+                    while (true)
+                        sink("data");
+                } catch (Error &) {
+                    writerStopped = true;
+                    throw;
+                }
+            },
+            []() { throw EndOfFile("done"); },
+            16,
+            4);
+        char buf[1];
+        source(buf, 1);
+    }
+    ASSERT_TRUE(writerStopped);
+}
+
+} // namespace nix
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include "nix/util/posix-regex.hh"
+
+namespace nix {
+
+/**
+ * The subexpressions of a match as strings, with "null" for ones that
+ * did not participate.
+ */
+static std::vector<std::string> show(std::string_view s, const PosixRegex::Groups & groups)
+{
+    std::vector<std::string> res;
+    for (size_t i = 0; i < groups.size(); i += 2)
+        res.push_back(
+            groups[i] == PosixRegex::npos ? "null" : std::string(s.substr(groups[i], groups[i + 1] - groups[i])));
+    return res;
+}
+
+static std::optional<std::vector<std::string>> match(std::string_view re, std::string_view s)
+{
+    PosixRegex regex(re);
+    PosixRegex::Groups groups;
+    if (!regex.match(s, groups))
+        return std::nullopt;
+    return show(s, groups);
+}
+
+static std::vector<std::vector<std::string>> matches(std::string_view re, std::string_view s)
+{
+    std::vector<std::vector<std::string>> res;
+    PosixRegex(re).forEachMatch(s, [&](const PosixRegex::Groups & groups) { res.push_back(show(s, groups)); });
+    return res;
+}
+
+using Strings = std::vector<std::string>;
+
+TEST(PosixRegex, match)
+{
+    ASSERT_EQ(match("abc", "abc"), Strings({"abc"}));
+    ASSERT_EQ(match("ab", "abc"), std::nullopt);
+    ASSERT_EQ(match("a(b)(c)", "abc"), Strings({"abc", "b", "c"}));
+    ASSERT_EQ(match("[[:space:]]+([[:upper:]]+)[[:space:]]+", "  FOO   "), Strings({"  FOO   ", "FOO"}));
+    ASSERT_EQ(match("(.*)\\.nix", "foo.bar.nix"), Strings({"foo.bar.nix", "foo.bar"}));
+    ASSERT_EQ(match("((.*)/)?([^/]*)\\.(nix|cc)", "foobar.cc"), Strings({"foobar.cc", "null", "null", "foobar", "cc"}));
+    ASSERT_EQ(match("^([0-9][0-9\\.]*)(.*)$", "1.2.3pre"), Strings({"1.2.3pre", "1.2.3", "pre"}));
+    ASSERT_EQ(match("a{2,3}", "aaaa"), std::nullopt);
+    ASSERT_EQ(match("[^]a]*", "bcd"), Strings({"bcd"}));
+}
+
+TEST(PosixRegex, leftmostLongest)
+{
+    ASSERT_EQ(matches("a|ab|abc", "xabcd"), std::vector({Strings({"abc"})}));
+    ASSERT_EQ(matches("(a|ab)(c|bcd)", "abcd"), std::vector({Strings({"abcd", "a", "bcd"})}));
+    ASSERT_EQ(matches("(a|b){0,1}a{2}?", "aa"), std::vector({Strings({"aa", "null"}), Strings({"", "null"})}));
+}
+
+TEST(PosixRegex, subexpressionsOfRepetitions)
+{
+    /* The last iteration counts, which may be an empty one. */
+    ASSERT_EQ(match("(a|b)*", "ab"), Strings({"ab", "b"}));
+    ASSERT_EQ(match("(b|)+", "b"), Strings({"b", ""}));
+    ASSERT_EQ(match("(a*)*", "b"), std::nullopt);
+    ASSERT_EQ(match("(a*)*", ""), Strings({"", ""}));
+
+    /* An iteration that consumes something may be followed by an
+       empty one, even if it's already an extra iteration. */
+    ASSERT_EQ(match("((a)?|[ab])+", "b"), Strings({"b", "", "null"}));
+    ASSERT_EQ(match("(((cb)*|x))+", "x"), Strings({"x", "", "", "null"}));
+    ASSERT_EQ(match("((([ab])*|(.)+))+", "cx"), Strings({"cx", "", "", "null", "x"}));
+}
+
+TEST(PosixRegex, emptyMatches)
+{
+    ASSERT_EQ(matches("fo*", "foobar"), std::vector({Strings({"foo"})}));
+    ASSERT_EQ(matches("o*", "xoo"), std::vector({Strings({""}), Strings({"oo"}), Strings({""})}));
+}
+
+TEST(PosixRegex, isLinear)
+{
+    /* This takes exponential time with a backtracking matcher. */
+    std::string s(100000, 'a');
+    ASSERT_EQ(match("(a|aa)*b", s), std::nullopt);
+    ASSERT_TRUE(match("(a|aa)*", s));
+}
+
+TEST(PosixRegex, errors)
+{
+    ASSERT_THROW(PosixRegex("("), std::regex_error);
+    ASSERT_THROW(PosixRegex("a)"), std::regex_error);
+    ASSERT_THROW(PosixRegex("[a"), std::regex_error);
+    ASSERT_THROW(PosixRegex("*a"), std::regex_error);
+    ASSERT_THROW(PosixRegex("a{2,1}"), std::regex_error);
+    ASSERT_THROW(PosixRegex("\\d"), std::regex_error);
+
+    try {
+        PosixRegex("(((a{1,1000}){1,1000}){1,1000})");
+        FAIL();
+    } catch (std::regex_error & e) {
+        ASSERT_EQ(e.code(), std::regex_constants::error_space);
+    }
+}
+
+} // namespace nix
@@ -0,0 +1,95 @@
+#include "nix/util/thread-pool.hh"
+#include <gtest/gtest.h>
+
+namespace nix {
+
+/* ----------------------------------------------------------------------------
+ * ThreadPool
+ * --------------------------------------------------------------------------*/
+
+TEST(ThreadPool, runsNestedWorkItems)
+{
+    for (size_t threads : {1, 2, 8}) {
+        ThreadPool pool(threads);
+        std::atomic<size_t> done{0};
+
+        std::function<void(int)> item = [&](int level) {
+            done++;
+            if (level < 5)
+                for (int i = 0; i < 4; ++i)
+                    pool.enqueue(
+                        [&, level]() { item(level + 1); },
+                        i == 0 ? ThreadPool::Priority::High : ThreadPool::Priority::Normal);
+        };
+
+        for (int i = 0; i < 3; ++i)
+            pool.enqueue([&]() { item(0); });
+
+        pool.process();
+
+        ASSERT_EQ(done, 3 * (1 + 4 + 16 + 64 + 256 + 1024));
+    }
+}
+
+TEST(ThreadPool, propagatesExceptions)
+{
+    ThreadPool pool(4);
+    std::atomic<size_t> done{0};
+
+    pool.enqueue([&]() {
+        for (int i = 0; i < 100; ++i)
+            pool.enqueue([&, i]() {
+                done++;
+                if (i == 50)
+                    throw Error("item %d failed", i);
+            });
+    });
+
+    ASSERT_THROW(pool.process(), Error);
+    ASSERT_GE(done, 1);
+}
+
+TEST(ThreadPool, highPriorityItemsRunFirst)
+{
+    /* With a single thread, items run in process() in a predictable
+       order. */
+    ThreadPool pool(1);
+    std::vector<int> order;
+
+    pool.enqueue([&]() { order.push_back(1); });
+    pool.enqueue([&]() { order.push_back(2); }, ThreadPool::Priority::High);
+    pool.enqueue([&]() { order.push_back(3); });
+
+    pool.process();
+
+    ASSERT_EQ(order, (std::vector<int>{2, 1, 3}));
+}
+
+TEST(processGraph, respectsDependencies)
+{
+    std::set<int> nodes;
+    for (int i = 0; i < 1000; ++i)
+        nodes.insert(i);
+
+    std::mutex mutex;
+    std::set<int> done;
+
+    processGraph<int>(
+        nodes,
+        [&](const int & node) {
+            std::set<int> deps;
+            if (node)
+                deps.insert(node / 3);
+            return deps;
+        },
+        [&](const int & node) {
+            std::lock_guard lock(mutex);
+            if (node)
+                ASSERT_TRUE(done.count(node / 3));
+            done.insert(node);
+        });
+
+    ASSERT_EQ(done.size(), nodes.size());
+}
+
+} // namespace nix
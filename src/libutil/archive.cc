@@ -1,5 +1,8 @@
 #include <cerrno>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <thread>
 
 #include <strings.h> // for strcasecmp
 
@@ -10,6 +13,8 @@
 #include "nix/util/source-path.hh"
 #include "nix/util/file-system.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/sync.hh"
 
 namespace nix {
 
@@ -24,6 +29,19 @@ struct ArchiveSettings : Config
 #endif
         "use-case-hack",
         "Whether to enable a macOS-specific hack for dealing with file name case collisions."};
+
+    Setting<unsigned int> narDumpThreads{
+        this,
+        4,
+        "nar-dump-threads",
+        R"(
+          The number of threads used to read files when serialising a
+          path in the file system to a Nix Archive, e.g. when adding a
+          path to the store or registering the outputs of a build. The
+          files are read ahead of the (single-threaded) hashing and
+          reference scanning of the archive, which is unchanged. A value
+          of 0 or 1 reads the files sequentially.
+        )"};
 };
 
 static ArchiveSettings archiveSettings;
@@ -38,19 +56,21 @@ static constexpr size_t narMaxDepth = 64;
 
 PathFilter defaultPathFilter = [](const std::string &) { return true; };
 
-void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter)
+/**
+ * Write the NAR serialisation of `rootPath` to `sink`, except that
+ * the contents of regular files (i.e. everything after the
+ * `contents` tag) are written by `dumpContents`. This is called
+ * with the (possibly scoped) accessor and path to use for reading
+ * the file, and the path of the file in `rootAccessor`.
+ */
+template<typename DumpContents>
+static void dumpTree(
+    SourceAccessor & rootAccessor,
+    const CanonPath & rootPath,
+    Sink & sink,
+    PathFilter & filter,
+    const DumpContents & dumpContents)
 {
-    auto dumpContents = [&sink](SourceAccessor & accessor, const CanonPath & path) {
-        sink << "contents";
-        std::optional<uint64_t> size;
-        accessor.readFile(path, sink, [&](uint64_t _size) {
-            size = _size;
-            sink << _size;
-        });
-        assert(size);
-        writePadding(*size, sink);
-    };
-
     sink << narVersionMagic1;
 
     [&sink, &filter, &dumpContents](
@@ -72,7 +92,8 @@ void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter &
             sink << "type" << "regular";
             if (st.isExecutable)
                 sink << "executable" << "";
-            dumpContents(accessor, path);
+            sink << "contents";
+            dumpContents(accessor, path, filterPath);
         }
 
         else if (st.type == tDirectory) {
@@ -112,7 +133,208 @@ void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter &
             throw Error("file '%s' has an unsupported type", path);
 
         sink << ")";
-    }(*this, path, path, 0);
+    }(rootAccessor, rootPath, rootPath, 0);
+}
+
+void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter)
+{
+    dumpTree(*this, path, sink, filter, [&sink](SourceAccessor & accessor, const CanonPath & path, const CanonPath &) {
+        std::optional<uint64_t> size;
+        accessor.readFile(path, sink, [&](uint64_t _size) {
+            size = _size;
+            sink << _size;
+        });
+        assert(size);
+        writePadding(*size, sink);
+    });
+}
+
+void dumpPathParallel(SourceAccessor & accessor, const CanonPath & path, Sink & sink, PathFilter & filter, size_t nThreads)
+{
+    if (nThreads <= 1)
+        return accessor.dumpPath(path, sink, filter);
+
+    /* First walk the tree (which is cheap compared to reading the
+       files) to collect the NAR framing and the regular files in
+       the order in which they appear in the NAR. `framing[i]`
+       precedes the contents of `files[i]`, and the last element of
+       `framing` follows the last file. */
+    std::vector<std::string> framing;
+    std::vector<CanonPath> files;
+    {
+        StringSink framingSink;
+        dumpTree(accessor, path, framingSink, filter, [&](SourceAccessor &, const CanonPath &, const CanonPath & rootPath) {
+            framing.push_back(std::move(framingSink.s));
+            framingSink.s.clear();
+            files.push_back(rootPath);
+        });
+        framing.push_back(std::move(framingSink.s));
+    }
+
+    if (files.empty()) {
+        sink(framing.back());
+        return;
+    }
+
+    /* Read the files on a set of worker threads. Each file is claimed
+       by one worker, which queues its contents in chunks. The calling
+       thread writes the framing and the queued chunks to `sink` in
+       NAR order. */
+    static constexpr size_t chunkSize = 1024 * 1024;
+    static constexpr size_t maxBytesInFlight = 64 * 1024 * 1024;
+
+    struct FileState
+    {
+        std::optional<uint64_t> size;
+        std::deque<std::string> chunks;
+        bool done = false;
+    };
+
+    struct State
+    {
+        std::vector<FileState> files;
+        size_t nextFile = 0;
+        size_t emitting = 0;
+        size_t bytesInFlight = 0;
+        bool quit = false;
+        std::exception_ptr exception;
+    };
+
+    Sync<State> state_;
+    state_.lock()->files.resize(files.size());
+    std::condition_variable wakeup;
+
+    struct Stop
+    {};
+
+    struct ChunkSink : Sink
+    {
+        Sync<State> & state_;
+        std::condition_variable & wakeup;
+        size_t file;
+        std::string buf;
+
+        ChunkSink(Sync<State> & state_, std::condition_variable & wakeup, size_t file)
+            : state_(state_)
+            , wakeup(wakeup)
+            , file(file)
+        {
+        }
+
+        void operator()(std::string_view data) override
+        {
+            while (!data.empty()) {
+                auto n = std::min(data.size(), chunkSize - buf.size());
+                buf.append(data.data(), n);
+                data.remove_prefix(n);
+                if (buf.size() == chunkSize)
+                    flush();
+            }
+        }
+
+        void flush()
+        {
+            auto state(state_.lock());
+            /* Apply back-pressure, except for the file currently being
+               written to the sink when it has nothing queued; that
+               guarantees progress. */
+            state.wait(wakeup, [&] {
+                return state->quit || state->bytesInFlight < maxBytesInFlight
+                       || (state->emitting == file && state->files[file].chunks.empty());
+            });
+            if (state->quit)
+                throw Stop();
+            if (!buf.empty()) {
+                state->bytesInFlight += buf.size();
+                state->files[file].chunks.push_back(std::move(buf));
+                buf.clear();
+            }
+            wakeup.notify_all();
+        }
+    };
+
+    auto worker = [&]() {
+        try {
+            while (true) {
+                size_t file;
+                {
+                    auto state(state_.lock());
+                    if (state->quit || state->nextFile == files.size())
+                        return;
+                    file = state->nextFile++;
+                }
+                ChunkSink chunkSink(state_, wakeup, file);
+                accessor.readFile(files[file], chunkSink, [&](uint64_t size) {
+                    auto state(state_.lock());
+                    state->files[file].size = size;
+                    wakeup.notify_all();
+                });
+                chunkSink.flush();
+                auto state(state_.lock());
+                state->files[file].done = true;
+                wakeup.notify_all();
+            }
+        } catch (Stop &) {
+        } catch (...) {
+            auto state(state_.lock());
+            if (!state->exception)
+                state->exception = std::current_exception();
+            state->quit = true;
+            wakeup.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+
+    Finally joinWorkers([&]() {
+        state_.lock()->quit = true;
+        wakeup.notify_all();
+        for (auto & thr : workers)
+            thr.join();
+    });
+
+    for (size_t i = 0; i < std::min(nThreads, files.size()); ++i)
+        workers.emplace_back(worker);
+
+    for (size_t file = 0; file < files.size(); ++file) {
+        sink(framing[file]);
+
+        uint64_t size;
+        {
+            auto state(state_.lock());
+            state->emitting = file;
+            wakeup.notify_all();
+            state.wait(wakeup, [&] { return state->exception || state->files[file].size; });
+            if (state->exception)
+                std::rethrow_exception(state->exception);
+            size = *state->files[file].size;
+        }
+
+        sink << size;
+
+        while (true) {
+            checkInterrupt();
+            std::string chunk;
+            {
+                auto state(state_.lock());
+                auto & fileState = state->files[file];
+                state.wait(wakeup, [&] { return state->exception || !fileState.chunks.empty() || fileState.done; });
+                if (state->exception)
+                    std::rethrow_exception(state->exception);
+                if (fileState.chunks.empty())
+                    break;
+                chunk = std::move(fileState.chunks.front());
+                fileState.chunks.pop_front();
+                state->bytesInFlight -= chunk.size();
+                wakeup.notify_all();
+            }
+            sink(chunk);
+        }
+
+        writePadding(size, sink);
+    }
+
+    sink(framing.back());
 }
 
 time_t dumpPathAndGetMtime(const std::filesystem::path & path, Sink & sink, PathFilter & filter)
@@ -125,7 +347,7 @@ time_t dumpPathAndGetMtime(const std::filesystem::path & path, Sink & sink, Path
 void dumpPath(const std::filesystem::path & path, Sink & sink, PathFilter & filter)
 {
     SourcePath path2 = makeFSSourceAccessor(absPath(path), /*trackLastModified=*/false);
-    path2.dumpPath(sink, filter);
+    dumpPathParallel(*path2.accessor, path2.path, sink, filter, archiveSettings.narDumpThreads);
 }
 
 void dumpString(std::string_view s, Sink & sink)
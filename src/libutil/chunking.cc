@@ -0,0 +1,93 @@
+#include "nix/util/chunking.hh"
+
+#include <array>
+#include <bit>
+
+namespace nix {
+
+/**
+ * Random values for the gear hash, generated by SplitMix64 from a
+ * fixed seed.
+ */
+static constexpr std::array<uint64_t, 256> gearTable = []() {
+    std::array<uint64_t, 256> table;
+    uint64_t state = 0x6e69782d63646331; // "nix-cdc1"
+    for (auto & x : table) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        x = z ^ (z >> 31);
+    }
+    return table;
+}();
+
+/**
+ * A mask of the `bits` most significant bits. These depend on the
+ * most recent 64 bytes, while the least significant ones only depend
+ * on the last few.
+ */
+static uint64_t topBits(unsigned int bits)
+{
+    return ~(uint64_t) 0 << (64 - bits);
+}
+
+ChunkingSink::ChunkingSink(ChunkCallback onChunk, Params params)
+    : onChunk(std::move(onChunk))
+    , params(params)
+    /* Normalised chunking: make boundaries less likely before the
+       average size and more likely after it, which narrows the
+       distribution of chunk sizes. */
+    , maskS(topBits(std::countr_zero(params.avgSize) + 2))
+    , maskL(topBits(std::countr_zero(params.avgSize) - 2))
+{
+    assert(std::has_single_bit(params.avgSize));
+    assert(params.minSize <= params.avgSize && params.avgSize <= params.maxSize);
+}
+
+size_t ChunkingSink::findBoundary()
+{
+    auto available = std::min(buffer.size() - start, params.maxSize);
+
+    /* Don't look for boundaries in the first `minSize` bytes. */
+    if (scanned < params.minSize) {
+        if (available < params.minSize)
+            return 0;
+        scanned = params.minSize;
+        hash = 0;
+    }
+
+    auto data = (const unsigned char *) buffer.data() + start;
+
+    for (; scanned < available; ++scanned) {
+        hash = (hash << 1) + gearTable[data[scanned]];
+        if (!(hash & (scanned < params.avgSize ? maskS : maskL)))
+            return scanned + 1;
+    }
+
+    return available == params.maxSize ? available : 0;
+}
+
+void ChunkingSink::operator()(std::string_view data)
+{
+    buffer.append(data);
+
+    while (auto size = findBoundary()) {
+        onChunk(std::string_view(buffer).substr(start, size));
+        start += size;
+        scanned = 0;
+    }
+
+    buffer.erase(0, start);
+    start = 0;
+}
+
+void ChunkingSink::finish()
+{
+    if (start < buffer.size())
+        onChunk(std::string_view(buffer).substr(start));
+    buffer.clear();
+    start = 0;
+    scanned = 0;
+}
+
+} // namespace nix
@@ -3,6 +3,7 @@
 #include "nix/util/tarfile.hh"
 #include "nix/util/logging.hh"
 #include "nix/util/current-process.hh"
+#include "nix/util/sync.hh"
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -13,12 +14,32 @@
 #include <brotli/encode.h>
 
 #include <zstd.h>
+#include <zstd_errors.h>
+#include <condition_variable>
+#include <deque>
 #include <thread>
 
 namespace nix {
 
 static const int COMPRESSION_LEVEL_DEFAULT = -1;
 
+static void checkZstd(size_t ret)
+{
+    if (ZSTD_isError(ret))
+        throw CompressionError("zstd error: %s", ZSTD_getErrorName(ret));
+}
+
+/**
+ * The number of threads that zstd may use for one stream.
+ */
+static unsigned zstdThreads(unsigned max)
+{
+    unsigned ncpu = getMaxCPU();
+    if (ncpu == 0)
+        ncpu = std::thread::hardware_concurrency();
+    return std::clamp(ncpu, 1U, max);
+}
+
 // Don't feed brotli too much at once.
 struct ChunkedCompressionSink : CompressionSink
 {
@@ -74,9 +95,8 @@ struct ArchiveDecompressionSource : Source
 
 /* Algorithms whose *compression* is handled by libarchive.  zstd is
    intentionally absent: ZstdMultiFrameCompressionSink compresses it
-   directly so the output is split into independent frames; zstd
-   *decompression* is still handled by libarchive via
-   ArchiveDecompressionSource. */
+   directly so the output is split into independent frames, and
+   ZstdDecompressionSink decodes those frames in parallel. */
 #define NIX_FOR_EACH_LA_ALGO(MACRO) \
     MACRO(bzip2)                    \
     MACRO(compress)                 \
@@ -246,6 +266,264 @@ struct BrotliDecompressionSink : ChunkedCompressionSink
     }
 };
 
+/**
+ * The amount of uncompressed input in each frame written by
+ * ZstdMultiFrameCompressionSink.
+ */
+static constexpr uint64_t zstdBytesPerFrame = 16 * 1024 * 1024;
+
+/**
+ * Zstd decompression that decodes independent frames concurrently, as
+ * written by ZstdMultiFrameCompressionSink.  Complete frames that carry
+ * their decompressed size are handed to a bounded set of worker
+ * threads, and the decoded frames are passed on to `nextSink` in order,
+ * from the calling thread. The output of the frames that have been
+ * read but not passed on is at most `maxBufferedOutput` bytes.
+ *
+ * Other frames (without a size, or larger than `maxParallelFrameSize`)
+ * are decoded in a streaming fashion on the calling
+ * thread, after all previous frames, so that e.g. NARs compressed as
+ * one huge frame don't have to be buffered in memory.
+ */
+struct ZstdDecompressionSink : FinishSink
+{
+    static constexpr uint64_t maxParallelFrameSize = zstdBytesPerFrame;
+
+    static constexpr uint64_t maxBufferedOutput = 4 * maxParallelFrameSize;
+
+    Sink & nextSink;
+
+    struct Job
+    {
+        std::string input;
+        uint64_t outputSize;
+        std::unique_ptr<char[]> output;
+        std::exception_ptr exception;
+        bool done = false;
+    };
+
+    struct State
+    {
+        std::deque<std::shared_ptr<Job>> queue;
+        bool quit = false;
+    };
+
+    Sync<State> state_;
+    std::condition_variable wakeup, jobDone;
+    std::vector<std::thread> workers;
+    unsigned maxWorkers;
+
+    /**
+     * Jobs that have not been passed on yet, in order.
+     */
+    std::deque<std::shared_ptr<Job>> inFlight;
+
+    /**
+     * The sum of the `outputSize` of the jobs in `inFlight`.
+     */
+    uint64_t inFlightOutput = 0;
+
+    /**
+     * Input that hasn't been split into frames yet.
+     */
+    std::string pending;
+    bool receivedInput = false;
+
+    /**
+     * Decoder for frames that are not decoded in parallel.
+     */
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{nullptr, ZSTD_freeDCtx};
+    std::vector<char> outbuf;
+    bool streaming = false;
+
+    ZstdDecompressionSink(Sink & nextSink)
+        : nextSink(nextSink)
+        , maxWorkers(zstdThreads(8))
+    {
+    }
+
+    ~ZstdDecompressionSink()
+    {
+        state_.lock()->quit = true;
+        wakeup.notify_all();
+        for (auto & thread : workers)
+            thread.join();
+    }
+
+    void operator()(std::string_view data) override
+    {
+        if (data.empty())
+            return;
+        receivedInput = true;
+        if (streaming)
+            data = decodeStreaming(data);
+        pending.append(data);
+        splitFrames();
+    }
+
+    void finish() override
+    {
+        if (!streaming)
+            splitFrames(true);
+        if (streaming || !pending.empty() || !receivedInput)
+            throw CompressionError("zstd data is truncated");
+        passOn(0);
+    }
+
+    /**
+     * Take complete frames off `pending`. If `final`, there is no more
+     * input.
+     */
+    void splitFrames(bool final = false)
+    {
+        /* The maximum size of a frame header (ZSTD_FRAMEHEADERSIZE_MAX,
+           which is not part of the stable API). */
+        constexpr size_t frameHeaderSizeMax = 18;
+
+        size_t pos = 0;
+        while (pos < pending.size()) {
+            std::string_view rest(pending.data() + pos, pending.size() - pos);
+
+            if (rest.size() < frameHeaderSizeMax && !final)
+                break;
+
+            auto contentSize = ZSTD_getFrameContentSize(rest.data(), rest.size());
+            if (contentSize == ZSTD_CONTENTSIZE_ERROR)
+                throw CompressionError("invalid zstd frame header");
+
+            if (contentSize <= maxParallelFrameSize) {
+                auto frameSize = ZSTD_findFrameCompressedSize(rest.data(), rest.size());
+                if (ZSTD_isError(frameSize) && ZSTD_getErrorCode(frameSize) == ZSTD_error_srcSize_wrong)
+                    /* The frame is incomplete. */
+                    break;
+                checkZstd(frameSize);
+                submit(rest.substr(0, frameSize), contentSize);
+                pos += frameSize;
+            } else {
+                /* The size is unknown or too big to decode the frame
+                   in one go. */
+                passOn(0);
+                if (!dctx) {
+                    dctx.reset(ZSTD_createDCtx());
+                    if (!dctx)
+                        throw CompressionError("unable to initialise zstd decoder");
+                    outbuf.resize(ZSTD_DStreamOutSize());
+                }
+                checkZstd(ZSTD_DCtx_reset(dctx.get(), ZSTD_reset_session_only));
+                streaming = true;
+                pos = pending.size() - decodeStreaming(rest).size();
+            }
+        }
+        pending.erase(0, pos);
+    }
+
+    /**
+     * Decode the current frame from `data`, returning the input after
+     * the end of the frame.
+     */
+    std::string_view decodeStreaming(std::string_view data)
+    {
+        ZSTD_inBuffer in = {data.data(), data.size(), 0};
+        while (true) {
+            checkInterrupt();
+            ZSTD_outBuffer out = {outbuf.data(), outbuf.size(), 0};
+            auto ret = ZSTD_decompressStream(dctx.get(), &out, &in);
+            checkZstd(ret);
+            if (out.pos > 0)
+                nextSink({outbuf.data(), out.pos});
+            if (ret == 0) {
+                streaming = false;
+                break;
+            }
+            /* Stop when the input is used up and the decoder has no
+               more output buffered. */
+            if (in.pos == in.size && out.pos < out.size)
+                break;
+        }
+        return data.substr(in.pos);
+    }
+
+    void submit(std::string_view frame, uint64_t outputSize)
+    {
+        /* Bound the memory used by frames that have been read but not
+           passed on. */
+        passOn(maxBufferedOutput - outputSize);
+
+        auto job = std::make_shared<Job>();
+        job->input = frame;
+        job->outputSize = outputSize;
+        inFlight.push_back(job);
+        inFlightOutput += outputSize;
+
+        state_.lock()->queue.push_back(job);
+        if (workers.size() < std::min<size_t>(maxWorkers, inFlight.size()))
+            workers.emplace_back([this]() { worker(); });
+        wakeup.notify_one();
+    }
+
+    /**
+     * Pass decoded frames on to `nextSink` in order, waiting until the
+     * output of the remaining frames is no more than `maxOutput` bytes.
+     */
+    void passOn(uint64_t maxOutput)
+    {
+        while (!inFlight.empty()) {
+            auto job = inFlight.front();
+            {
+                auto state(state_.lock());
+                if (inFlightOutput > maxOutput)
+                    while (!job->done)
+                        state.wait(jobDone);
+                else if (!job->done)
+                    return;
+            }
+            inFlight.pop_front();
+            inFlightOutput -= job->outputSize;
+            if (job->exception)
+                std::rethrow_exception(job->exception);
+            nextSink({job->output.get(), job->outputSize});
+        }
+    }
+
+    void worker()
+    {
+        std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{ZSTD_createDCtx(), ZSTD_freeDCtx};
+
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                auto state(state_.lock());
+                while (!state->quit && state->queue.empty())
+                    state.wait(wakeup);
+                if (state->quit)
+                    return;
+                job = std::move(state->queue.front());
+                state->queue.pop_front();
+            }
+
+            try {
+                if (!dctx)
+                    throw CompressionError("unable to initialise zstd decoder");
+                job->output = std::make_unique_for_overwrite<char[]>(job->outputSize);
+                auto size = ZSTD_decompressDCtx(
+                    dctx.get(), job->output.get(), job->outputSize, job->input.data(), job->input.size());
+                checkZstd(size);
+                if (size != job->outputSize)
+                    throw CompressionError("zstd frame has the wrong size");
+            } catch (...) {
+                job->exception = std::current_exception();
+            }
+            job->input = {};
+
+            {
+                auto state(state_.lock());
+                job->done = true;
+            }
+            jobDone.notify_one();
+        }
+    }
+};
+
 std::string decompress(const std::string & method, std::string_view in)
 {
     StringSink ssink;
@@ -261,6 +539,8 @@ std::unique_ptr<FinishSink> makeDecompressionSink(const std::string & method, Si
         return std::make_unique<NoneSink>(nextSink);
     else if (method == "br")
         return std::make_unique<BrotliDecompressionSink>(nextSink);
+    else if (method == "zstd")
+        return std::make_unique<ZstdDecompressionSink>(nextSink);
     else
         return sourceToSink([method, &nextSink](Source & source) {
             auto decompressionSource = std::make_unique<ArchiveDecompressionSource>(source, method);
@@ -329,10 +609,9 @@ struct BrotliCompressionSink : ChunkedCompressionSink
  * Zstd compression that cuts a new frame every `bytesPerFrame` of
  * uncompressed input.  The result is a concatenation of independent
  * frames, which any conformant zstd decoder (RFC 8878 §3.1) handles
- * transparently — including libarchive's, which is what the nix
- * substituter path uses for decompression.  Because each frame is
- * independent and carries its decompressed size, a parallel decoder
- * can split work across them.
+ * transparently.  Because each frame is independent and carries its
+ * decompressed size, ZstdDecompressionSink can decode them in
+ * parallel.
  *
  * Frame size is fixed at 16 MiB of input.  zstd's window size is
  * level-dependent (~2 MiB at the default level 3, up to 8 MiB at
@@ -354,8 +633,9 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
      * each frame's output offset up front.
      */
     std::vector<char> inbuf;
-    bool emittedAnyFrame = false;
-    static constexpr uint64_t bytesPerFrame = 16 * 1024 * 1024;
+    std::vector<Frame> frames;
+    uint64_t uncompressedSize = 0, compressedSize = 0;
+    static constexpr uint64_t bytesPerFrame = zstdBytesPerFrame;
 
     ZstdMultiFrameCompressionSink(Sink & nextSink, bool parallel, int level)
         : nextSink(nextSink)
@@ -368,16 +648,12 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
         if (level != COMPRESSION_LEVEL_DEFAULT)
             checkZstd(ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, level));
         if (parallel) {
-            unsigned ncpu = getMaxCPU();
-            if (ncpu == 0)
-                ncpu = std::thread::hardware_concurrency();
             /* Cap nbWorkers: zstd's MT engine splits each frame into
                per-worker jobs.  With 16 MiB frames, more than ~4
                workers yields diminishing returns (< 4 MiB per worker)
                and the thread synchronisation overhead can make
                compression slower than single-threaded. */
-            if (ncpu > 4)
-                ncpu = 4;
+            unsigned ncpu = zstdThreads(4);
             if (ncpu > 1)
                 /* Don't checkZstd(): if libzstd was built without
                    ZSTD_MULTITHREAD this returns an error, but per the
@@ -387,18 +663,14 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
         }
     }
 
-    void checkZstd(size_t ret)
-    {
-        if (ZSTD_isError(ret))
-            throw CompressionError("zstd error: %s", ZSTD_getErrorName(ret));
-    }
-
     /**
      * Compress all of `inbuf` as one complete frame, pledged at its
      * exact size so `Frame_Content_Size` lands in the header.
      */
     void emitFrame()
     {
+        frames.push_back({.uncompressedOffset = uncompressedSize, .compressedOffset = compressedSize});
+
         checkZstd(ZSTD_CCtx_reset(cctx.get(), ZSTD_reset_session_only));
         checkZstd(ZSTD_CCtx_setPledgedSrcSize(cctx.get(), inbuf.size()));
 
@@ -408,13 +680,15 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
             ZSTD_outBuffer out = {outbuf.data(), outbuf.size(), 0};
             size_t remaining = ZSTD_compressStream2(cctx.get(), &out, &in, ZSTD_e_end);
             checkZstd(remaining);
-            if (out.pos > 0)
+            if (out.pos > 0) {
                 nextSink({outbuf.data(), out.pos});
+                compressedSize += out.pos;
+            }
             if (remaining == 0)
                 break;
         }
+        uncompressedSize += inbuf.size();
         inbuf.clear();
-        emittedAnyFrame = true;
     }
 
     void writeUnbuffered(std::string_view data) override
@@ -438,9 +712,14 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
            never wrote anything — the output must contain at least one
            frame header to be valid zstd (otherwise the libarchive
            decoder chokes on round-tripped empty input). */
-        if (!inbuf.empty() || !emittedAnyFrame)
+        if (!inbuf.empty() || frames.empty())
             emitFrame();
     }
+
+    std::vector<Frame> getFrames() const override
+    {
+        return frames;
+    }
 };
 
 ref<CompressionSink> makeCompressionSink(CompressionAlgo method, Sink & nextSink, const bool parallel, int level)
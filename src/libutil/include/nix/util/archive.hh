@@ -57,6 +57,17 @@ namespace nix {
  */
 void dumpPath(const std::filesystem::path & path, Sink & sink, PathFilter & filter = defaultPathFilter);
 
+/**
+ * Like `SourceAccessor::dumpPath()`, but reads the contents of
+ * regular files on up to `nThreads` threads ahead of the thread that
+ * writes the archive to `sink`. The archive is identical to the one
+ * produced by `SourceAccessor::dumpPath()`.
+ *
+ * `accessor` must support concurrent `readFile()` calls.
+ */
+void dumpPathParallel(
+    SourceAccessor & accessor, const CanonPath & path, Sink & sink, PathFilter & filter, size_t nThreads);
+
 /**
  * Same as dumpPath(), but returns the last modified date of the path.
  */
@@ -13,6 +13,8 @@
 #include <boost/asio/associated_cancellation_slot.hpp>
 
 #include <concepts>
+#include <deque>
+#include <functional>
 
 namespace nix {
 
@@ -115,4 +117,55 @@ asio::awaitable<void> forEachAsync(Range && range, const F & f)
         asio::use_awaitable);
 }
 
+/**
+ * Limits how many coroutines can be in a section at the same time, e.g.
+ * to bound the number of outstanding network requests. Like
+ * `forEachAsync()`, this assumes that all users run on the same
+ * single-threaded executor, so it doesn't need any synchronisation.
+ */
+class AsyncSemaphore
+{
+    size_t available;
+
+    std::deque<std::function<void()>> waiters;
+
+public:
+
+    AsyncSemaphore(size_t count)
+        : available(std::max<size_t>(count, 1))
+    {
+    }
+
+    asio::awaitable<void> acquire()
+    {
+        if (available) {
+            available--;
+            co_return;
+        }
+
+        co_await asio::async_initiate<decltype(asio::use_awaitable), void()>(
+            [this](auto handler) {
+                auto executor = asio::get_associated_executor(handler);
+                auto h = std::make_shared<decltype(handler)>(std::move(handler));
+                waiters.push_back([executor, h]() { asio::post(executor, [h]() { std::move (*h)(); }); });
+            },
+            asio::use_awaitable);
+    }
+
+    /**
+     * Leave the section. If a coroutine is waiting in `acquire()`, it
+     * takes over our slot.
+     */
+    void release()
+    {
+        if (waiters.empty()) {
+            available++;
+            return;
+        }
+        auto w = std::move(waiters.front());
+        waiters.pop_front();
+        w();
+    }
+};
+
 } // namespace nix
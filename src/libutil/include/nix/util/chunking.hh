@@ -0,0 +1,76 @@
+#pragma once
+///@file
+
+#include "nix/util/serialise.hh"
+
+namespace nix {
+
+/**
+ * A sink that splits the data written to it into chunks at
+ * content-defined boundaries, using FastCDC ("FastCDC: a Fast and
+ * Efficient Content-Defined Chunking Approach for Data
+ * Deduplication", Xia et al., USENIX ATC 2016) with normalised
+ * chunking. Since a boundary only depends on the 64 bytes before it,
+ * inserting or removing data only changes the chunks around the edit,
+ * so similar inputs share most of their chunks.
+ *
+ * The boundaries are part of the format of chunked binary caches, so
+ * the gear table and the way it's used must never change.
+ */
+struct ChunkingSink : FinishSink
+{
+    struct Params
+    {
+        size_t minSize = 16 * 1024;
+
+        /**
+         * Must be a power of two.
+         */
+        size_t avgSize = 64 * 1024;
+
+        size_t maxSize = 256 * 1024;
+    };
+
+    using ChunkCallback = fun<void(std::string_view chunk)>;
+
+    ChunkingSink(ChunkCallback onChunk, Params params);
+
+    ChunkingSink(ChunkCallback onChunk)
+        : ChunkingSink(std::move(onChunk), Params{})
+    {
+    }
+
+    void operator()(std::string_view data) override;
+
+    /**
+     * Pass the last chunk, if any, to the callback.
+     */
+    void finish() override;
+
+private:
+
+    ChunkCallback onChunk;
+    const Params params;
+    const uint64_t maskS, maskL;
+
+    /**
+     * Data not yet passed to the callback, starting at `start`.
+     */
+    std::string buffer;
+    size_t start = 0;
+
+    /**
+     * The number of bytes of the current chunk that have been
+     * scanned for a boundary, and the rolling hash at that point.
+     */
+    size_t scanned = 0;
+    uint64_t hash = 0;
+
+    /**
+     * Return the size of the next chunk, or 0 if more data is needed
+     * to find its end.
+     */
+    size_t findBoundary();
+};
+
+} // namespace nix
@@ -7,6 +7,7 @@
 #include "nix/util/compression-algo.hh"
 
 #include <string>
+#include <vector>
 
 namespace nix {
 
@@ -15,6 +16,25 @@ struct CompressionSink : BufferedSink, FinishSink
     using BufferedSink::operator();
     using BufferedSink::writeUnbuffered;
     using FinishSink::finish;
+
+    /**
+     * The start of a part of the compressed output that can be
+     * decompressed on its own, e.g. a zstd frame.
+     */
+    struct Frame
+    {
+        uint64_t uncompressedOffset;
+        uint64_t compressedOffset;
+    };
+
+    /**
+     * Return the frames written so far, in order, or an empty vector
+     * if the output can only be decompressed from the start.
+     */
+    virtual std::vector<Frame> getFrames() const
+    {
+        return {};
+    }
 };
 
 std::string decompress(const std::string & method, std::string_view in);
@@ -0,0 +1,180 @@
+#pragma once
+///@file
+
+#include "nix/util/serialise.hh"
+#include "nix/util/sync.hh"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <thread>
+
+namespace nix {
+
+/**
+ * A queue of byte chunks between two stages of a pipeline that run on
+ * different threads. It holds at most `maxBuffered` bytes: the
+ * producer blocks while it is full and the consumer while it is
+ * empty, so every stage runs at the speed of the slowest one without
+ * unbounded buffering.
+ */
+class PipelineQueue
+{
+public:
+
+    /**
+     * Counters of the data passed through the queue and of the time
+     * each side spent waiting for the other.
+     */
+    struct Stats
+    {
+        uint64_t bytesPushed = 0;
+        uint64_t bytesPopped = 0;
+
+        /**
+         * Time the producer was blocked because the queue was full,
+         * i.e. the consumer was the bottleneck.
+         */
+        std::chrono::nanoseconds pushWait{0};
+
+        /**
+         * Time the consumer was blocked because the queue was empty,
+         * i.e. the producer was the bottleneck.
+         */
+        std::chrono::nanoseconds popWait{0};
+    };
+
+    PipelineQueue(size_t maxBuffered);
+
+    /**
+     * Append a chunk, blocking while the queue is full. If the
+     * pipeline has been aborted, this throws the exception passed to
+     * `abort()`, or an `Error` if there is none.
+     */
+    void push(std::string chunk);
+
+    /**
+     * Remove the next chunk, blocking while the queue is empty.
+     * Returns `std::nullopt` once the producer has called `close()`
+     * and all chunks have been popped, or rethrows the producer's
+     * exception if it passed one to `close()`.
+     */
+    std::optional<std::string> pop();
+
+    /**
+     * Called by the producer to signal that it won't push any more
+     * chunks, possibly because it failed with `ex`.
+     */
+    void close(std::exception_ptr ex = nullptr);
+
+    /**
+     * Stop the pipeline, because the consumer failed with `ex` or
+     * because either side is being destroyed. Queued chunks are
+     * discarded, `pop()` returns `std::nullopt` and `push()` throws.
+     */
+    void abort(std::exception_ptr ex = nullptr);
+
+    Stats getStats() const;
+
+private:
+
+    struct State
+    {
+        std::deque<std::string> chunks;
+        size_t buffered = 0;
+        bool closed = false, aborted = false;
+        std::exception_ptr producerEx, consumerEx;
+        Stats stats;
+    };
+
+    const size_t maxBuffered;
+
+    Sync<State> state_;
+
+    std::condition_variable wakeupProducer, wakeupConsumer;
+};
+
+/**
+ * A sink that passes the data written to it to another sink on a
+ * separate thread, so that the writer and `next` can run
+ * concurrently. Writes are collected into chunks of `chunkSize`
+ * bytes; the thread is only started once the first chunk is full, so
+ * small amounts of data are passed to `next` on the calling thread
+ * by `finish()`.
+ *
+ * `finish()` must be called to wait for `next` to process all data.
+ * It and `operator ()` rethrow any exception thrown by `next`.
+ * Destroying the sink without calling `finish()` discards pending
+ * data.
+ */
+class ThreadedSink : public FinishSink
+{
+public:
+
+    ThreadedSink(Sink & next, size_t maxBuffered = 4 * 1024 * 1024, size_t chunkSize = 64 * 1024);
+
+    ~ThreadedSink();
+
+    void operator()(std::string_view data) override;
+
+    void finish() override;
+
+    PipelineQueue::Stats getStats() const
+    {
+        return queue.getStats();
+    }
+
+private:
+
+    Sink & next;
+    const size_t chunkSize;
+    std::string pending;
+    PipelineQueue queue;
+    std::thread thread;
+    std::exception_ptr ex;
+};
+
+/**
+ * Like `sinkToSource()`, but runs `writer` on a separate thread
+ * (started by the first `read()`) rather than as a coroutine, so that
+ * the writer and the reader can run concurrently. The writer runs at
+ * most `maxBuffered` bytes ahead of the reader.
+ *
+ * The writer's exceptions are rethrown by `read()`. If the source is
+ * destroyed before the writer has finished, the writer's next write
+ * throws, and the destructor waits for it to return.
+ */
+class ThreadedSource : public Source
+{
+public:
+
+    ThreadedSource(
+        fun<void(Sink &)> writer,
+        fun<void()> eof = []() { throw EndOfFile("pipeline stage has finished"); },
+        size_t maxBuffered = 4 * 1024 * 1024,
+        size_t chunkSize = 64 * 1024);
+
+    ~ThreadedSource();
+
+    size_t read(char * data, size_t len) override;
+
+    PipelineQueue::Stats getStats() const
+    {
+        return queue.getStats();
+    }
+
+private:
+
+    fun<void(Sink &)> writer;
+    fun<void()> eof;
+    const size_t chunkSize;
+    PipelineQueue queue;
+    std::thread thread;
+    std::string cur;
+    size_t curPos = 0;
+    bool done = false;
+};
+
+} // namespace nix
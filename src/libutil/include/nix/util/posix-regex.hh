@@ -0,0 +1,138 @@
+#pragma once
+///@file
+
+#include <bitset>
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace nix {
+
+/**
+ * A POSIX extended regular expression, matched in time linear in the
+ * length of the input (times the size of the expression), without
+ * backtracking or recursion.
+ *
+ * Matches are leftmost-longest as required by POSIX. (libstdc++'s
+ * `std::regex::extended` sometimes settles for a shorter match when an
+ * optional or repeated part could also have been skipped.) When several
+ * ways of matching give the same overall match, subexpressions are
+ * assigned as by a backtracking matcher that tries the left
+ * alternative first and repeats as often as possible, like libstdc++,
+ * including a final empty iteration of a `*` or `+` if possible. (One
+ * known difference remains: a bounded repetition such as `(x*){1,2}`
+ * of a subexpression that can match the empty string may split the
+ * input differently between its iterations.)
+ *
+ * `^` and `$` only match at the start and end of the input, `.`
+ * matches any character but NUL, and character classes use the
+ * classification of the "C" locale. Errors in the expression are
+ * reported by throwing `std::regex_error`, like `std::regex`.
+ */
+class PosixRegex
+{
+public:
+
+    /**
+     * Offsets of the subexpressions of a match: `2 * i` and
+     * `2 * i + 1` are the start and end of subexpression `i`, where
+     * subexpression 0 is the whole match. Both are `npos` if the
+     * subexpression did not participate in the match.
+     */
+    using Groups = std::vector<size_t>;
+
+    static constexpr size_t npos = std::string_view::npos;
+
+    PosixRegex(std::string_view pattern);
+
+    /**
+     * The number of parenthesised subexpressions.
+     */
+    size_t subexpressions() const
+    {
+        return nrGroups - 1;
+    }
+
+    /**
+     * Whether the regex matches all of `s`.
+     */
+    bool match(std::string_view s, Groups & groups) const;
+
+    /**
+     * Find the leftmost-longest match in `s` that starts at or after
+     * `from`.
+     *
+     * @param continuous Only look for matches that start at `from`.
+     * @param notNull Don't return empty matches.
+     */
+    bool search(std::string_view s, size_t from, Groups & groups, bool continuous = false, bool notNull = false) const;
+
+    /**
+     * Call `f` with every match in `s`, in the same order and with
+     * the same handling of empty matches as `std::regex_iterator`.
+     */
+    template<typename F>
+    void forEachMatch(std::string_view s, F && f) const
+    {
+        Groups groups;
+        size_t pos = 0;
+        bool notNull = false;
+        while (pos <= s.size()) {
+            if (!search(s, pos, groups, notNull, notNull)) {
+                if (!notNull)
+                    return;
+                /* An empty match can't be followed by another one at
+                   the same position, so retry one character later. */
+                notNull = false;
+                ++pos;
+                continue;
+            }
+            f(std::as_const(groups));
+            pos = groups[1];
+            notNull = groups[0] == groups[1];
+            if (notNull && pos == s.size())
+                return;
+        }
+    }
+
+private:
+
+    enum class Op : uint8_t {
+        Char,
+        Any,
+        Set,
+        Split,
+        Jump,
+        Save,
+        AssertBegin,
+        AssertEnd,
+        Match,
+    };
+
+    struct Inst
+    {
+        Op op;
+        uint32_t x = 0;
+        uint32_t y = 0;
+    };
+
+    std::vector<Inst> program;
+    std::vector<std::bitset<256>> sets;
+    size_t nrGroups = 1;
+
+    /**
+     * The characters that can start a match, if the regex doesn't
+     * match the empty string (`canSkip`).
+     */
+    std::bitset<256> firstChars;
+    bool canSkip = false;
+
+    struct Compiler;
+
+    bool run(std::string_view s, size_t from, Groups & groups, bool anchorStart, bool anchorEnd, bool notNull) const;
+};
+
+} // namespace nix
@@ -234,10 +234,25 @@ struct FdSource : BufferedSource, RestartableSource
 
     void skip(size_t len) override;
 
+    using Source::drainInto;
+
+    /**
+     * If `sink` is an `FdSink` and both descriptors refer to regular
+     * files, copy the data inside the kernel, using reflinks if the
+     * file system supports them. Otherwise, copy through a buffer.
+     */
+    void drainInto(Sink & sink, uint64_t len) override;
+
 protected:
     size_t readUnbuffered(char * data, size_t len) override;
 private:
     bool _good = true;
+
+    /**
+     * Whether to try copying data in the kernel in `drainInto()`.
+     * Reset when it fails, e.g. because `fd` is a pipe.
+     */
+    bool tryCopyFileRange = true;
 };
 
 /**
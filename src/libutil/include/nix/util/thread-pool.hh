@@ -9,6 +9,7 @@
 #include <functional>
 #include <thread>
 #include <map>
+#include <memory>
 #include <atomic>
 
 namespace nix {
@@ -16,8 +17,15 @@ namespace nix {
 MakeError(ThreadPoolShutDown, Error);
 
 /**
- * A simple thread pool that executes a queue of work items
- * (lambdas).
+ * A work-stealing thread pool that executes work items (lambdas).
+ *
+ * Every thread executing work items (including the one that calls
+ * `process()`) has its own deque. Items enqueued by a work item are
+ * pushed onto the deque of the thread running it without taking any
+ * lock, and that thread pops them again in LIFO order. Idle threads
+ * steal the oldest items from other threads' deques. Items enqueued
+ * from outside the pool, and high-priority items, go to shared
+ * queues that are checked before stealing.
  */
 class ThreadPool
 {
@@ -34,10 +42,19 @@ public:
      */
     typedef fun<void()> work_t;
 
+    enum struct Priority {
+        Normal,
+        /**
+         * Run before any normal-priority item that is not already
+         * running.
+         */
+        High,
+    };
+
     /**
      * Enqueue a function to be executed by the thread pool.
      */
-    void enqueue(work_t t);
+    void enqueue(work_t t, Priority priority = Priority::Normal);
 
     /**
      * Execute work items until the queue is empty.
@@ -63,22 +80,62 @@ private:
 
     size_t maxThreads;
 
+    /**
+     * A Chase-Lev work-stealing deque, one per thread slot. Slot 0
+     * belongs to the thread calling `process()`.
+     */
+    struct Deque;
+
+    std::vector<std::unique_ptr<Deque>> deques;
+
     struct State
     {
-        std::queue<work_t> pending;
-        size_t active = 0;
+        std::queue<std::unique_ptr<work_t>> pending;
+        std::queue<std::unique_ptr<work_t>> pendingHigh;
         std::exception_ptr exception;
         std::vector<std::thread> workers;
-        bool draining = false;
     };
 
     std::atomic_bool quit{false};
 
+    std::atomic_bool draining{false};
+
+    /**
+     * Number of queued items, in any queue. This can be transiently
+     * negative when an item is stolen before its owner has counted
+     * it.
+     */
+    std::atomic<int64_t> queued{0};
+
+    /**
+     * Number of items in `State::pending` and `State::pendingHigh`,
+     * so that threads can skip locking `state_` if they're empty.
+     */
+    std::atomic<size_t> queuedShared{0}, queuedHigh{0};
+
+    /**
+     * Number of items that have been enqueued but haven't finished
+     * running. Only running items (or the caller of `process()`) can
+     * enqueue more work, so once this drops to zero while draining,
+     * we're done.
+     */
+    std::atomic<size_t> unfinished{0};
+
+    std::atomic<size_t> sleeping{0};
+
+    std::atomic<size_t> nrWorkers{0};
+
     Sync<State> state_;
 
     std::condition_variable work;
 
-    void doWork(bool mainThread);
+    void doWork(size_t slot);
+
+    std::unique_ptr<work_t> findWork(size_t slot);
+
+    bool waitForWork();
+
+    void wakeUp();
 };
 
 /**
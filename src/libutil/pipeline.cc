@@ -0,0 +1,202 @@
+#include "nix/util/pipeline.hh"
+
+namespace nix {
+
+PipelineQueue::PipelineQueue(size_t maxBuffered)
+    : maxBuffered(maxBuffered)
+{
+}
+
+void PipelineQueue::push(std::string chunk)
+{
+    auto state(state_.lock());
+
+    /* Accept a chunk as long as there is any room left, so that
+       chunks bigger than `maxBuffered` don't block forever. */
+    if (!state->aborted && state->buffered >= maxBuffered) {
+        auto before = std::chrono::steady_clock::now();
+        state.wait(wakeupProducer, [&]() { return state->aborted || state->buffered < maxBuffered; });
+        state->stats.pushWait += std::chrono::steady_clock::now() - before;
+    }
+
+    if (state->aborted) {
+        if (state->consumerEx)
+            std::rethrow_exception(state->consumerEx);
+        throw Error("pipeline has been aborted");
+    }
+
+    assert(!state->closed);
+
+    state->buffered += chunk.size();
+    state->stats.bytesPushed += chunk.size();
+    state->chunks.push_back(std::move(chunk));
+    wakeupConsumer.notify_one();
+}
+
+std::optional<std::string> PipelineQueue::pop()
+{
+    auto state(state_.lock());
+
+    auto ready = [&]() { return state->aborted || state->closed || !state->chunks.empty(); };
+
+    if (!ready()) {
+        auto before = std::chrono::steady_clock::now();
+        state.wait(wakeupConsumer, ready);
+        state->stats.popWait += std::chrono::steady_clock::now() - before;
+    }
+
+    if (state->aborted)
+        return std::nullopt;
+
+    if (state->producerEx)
+        std::rethrow_exception(state->producerEx);
+
+    if (state->chunks.empty())
+        return std::nullopt;
+
+    auto chunk = std::move(state->chunks.front());
+    state->chunks.pop_front();
+    state->buffered -= chunk.size();
+    state->stats.bytesPopped += chunk.size();
+    wakeupProducer.notify_one();
+    return chunk;
+}
+
+void PipelineQueue::close(std::exception_ptr ex)
+{
+    auto state(state_.lock());
+    state->closed = true;
+    state->producerEx = ex;
+    wakeupConsumer.notify_all();
+}
+
+void PipelineQueue::abort(std::exception_ptr ex)
+{
+    auto state(state_.lock());
+    state->aborted = true;
+    state->consumerEx = ex;
+    state->chunks.clear();
+    state->buffered = 0;
+    wakeupProducer.notify_all();
+    wakeupConsumer.notify_all();
+}
+
+PipelineQueue::Stats PipelineQueue::getStats() const
+{
+    return state_.readLock()->stats;
+}
+
+ThreadedSink::ThreadedSink(Sink & next, size_t maxBuffered, size_t chunkSize)
+    : next(next)
+    , chunkSize(chunkSize)
+    , queue(maxBuffered)
+{
+}
+
+ThreadedSink::~ThreadedSink()
+{
+    if (thread.joinable()) {
+        queue.abort();
+        thread.join();
+    }
+}
+
+void ThreadedSink::operator()(std::string_view data)
+{
+    pending.append(data);
+
+    if (pending.size() < chunkSize)
+        return;
+
+    if (!thread.joinable())
+        thread = std::thread([this]() {
+            try {
+                while (auto chunk = queue.pop())
+                    next(*chunk);
+            } catch (...) {
+                ex = std::current_exception();
+                queue.abort(ex);
+            }
+        });
+
+    queue.push(std::move(pending));
+    pending = {};
+}
+
+void ThreadedSink::finish()
+{
+    if (!thread.joinable()) {
+        /* Not worth starting a thread for. */
+        if (!pending.empty())
+            next(pending);
+        pending.clear();
+        return;
+    }
+
+    if (!pending.empty())
+        queue.push(std::move(pending));
+    pending = {};
+    queue.close();
+    thread.join();
+
+    if (ex)
+        std::rethrow_exception(ex);
+}
+
+ThreadedSource::ThreadedSource(fun<void(Sink &)> writer, fun<void()> eof, size_t maxBuffered, size_t chunkSize)
+    : writer(writer)
+    , eof(eof)
+    , chunkSize(chunkSize)
+    , queue(maxBuffered)
+{
+}
+
+ThreadedSource::~ThreadedSource()
+{
+    if (thread.joinable()) {
+        queue.abort();
+        thread.join();
+    }
+}
+
+size_t ThreadedSource::read(char * data, size_t len)
+{
+    if (!thread.joinable())
+        thread = std::thread([this]() {
+            try {
+                std::string pending;
+                LambdaSink sink([&](std::string_view data) {
+                    pending.append(data);
+                    if (pending.size() >= chunkSize) {
+                        queue.push(std::move(pending));
+                        pending = {};
+                    }
+                });
+                writer(sink);
+                if (!pending.empty())
+                    queue.push(std::move(pending));
+                queue.close();
+            } catch (...) {
+                queue.close(std::current_exception());
+            }
+        });
+
+    while (curPos == cur.size()) {
+        if (done) {
+            eof();
+            unreachable();
+        }
+        if (auto chunk = queue.pop()) {
+            cur = std::move(*chunk);
+            curPos = 0;
+        } else
+            done = true;
+    }
+
+    size_t n = std::min(len, cur.size() - curPos);
+    memcpy(data, cur.data() + curPos, n);
+    curPos += n;
+    return n;
+}
+
+} // namespace nix
@@ -0,0 +1,648 @@
+#include "nix/util/posix-regex.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <optional>
+
+namespace nix {
+
+namespace {
+
+/**
+ * The maximum number of instructions in a compiled expression, like
+ * libstdc++'s `_GLIBCXX_REGEX_STATE_LIMIT`. This mostly limits the
+ * expansion of bounded repetitions such as `(a{1000}){1000}`.
+ */
+constexpr size_t maxProgramSize = 100'000;
+
+constexpr uint32_t unbounded = UINT32_MAX;
+
+[[noreturn]] void fail(std::regex_constants::error_type code)
+{
+    throw std::regex_error(code);
+}
+
+struct Node
+{
+    enum Kind { Empty, Char, Any, Set, Begin, End, Group, Concat, Alt, Repeat } kind;
+
+    /**
+     * The character, set or subexpression number.
+     */
+    uint32_t value = 0;
+
+    uint32_t min = 0, max = 0;
+
+    std::vector<uint32_t> children;
+};
+
+/**
+ * Add the characters of the class `name` (as in `[[:alpha:]]`) in the
+ * "C" locale to `set`.
+ */
+void addClass(std::bitset<256> & set, std::string_view name)
+{
+    auto isUpper = [](int c) { return c >= 'A' && c <= 'Z'; };
+    auto isLower = [](int c) { return c >= 'a' && c <= 'z'; };
+    auto isDigit = [](int c) { return c >= '0' && c <= '9'; };
+    auto isAlpha = [&](int c) { return isUpper(c) || isLower(c); };
+    auto isAlnum = [&](int c) { return isAlpha(c) || isDigit(c); };
+    auto isSpace = [](int c) { return c == ' ' || (c >= '\t' && c <= '\r'); };
+    auto isGraph = [](int c) { return c > ' ' && c < 127; };
+
+    std::function<bool(int)> pred;
+    if (name == "alpha")
+        pred = isAlpha;
+    else if (name == "digit" || name == "d")
+        pred = isDigit;
+    else if (name == "alnum")
+        pred = isAlnum;
+    else if (name == "upper")
+        pred = isUpper;
+    else if (name == "lower")
+        pred = isLower;
+    else if (name == "space" || name == "s")
+        pred = isSpace;
+    else if (name == "blank")
+        pred = [](int c) { return c == ' ' || c == '\t'; };
+    else if (name == "cntrl")
+        pred = [](int c) { return c < ' ' || c == 127; };
+    else if (name == "graph")
+        pred = isGraph;
+    else if (name == "print")
+        pred = [&](int c) { return isGraph(c) || c == ' '; };
+    else if (name == "punct")
+        pred = [&](int c) { return isGraph(c) && !isAlnum(c); };
+    else if (name == "xdigit")
+        pred = [&](int c) { return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); };
+    else if (name == "w")
+        pred = [&](int c) { return isAlnum(c) || c == '_'; };
+    else
+        fail(std::regex_constants::error_ctype);
+
+    for (int c = 0; c < 256; ++c)
+        if (pred(c))
+            set.set(c);
+}
+
+/**
+ * A recursive descent parser for the syntax accepted by libstdc++'s
+ * `std::regex::extended`.
+ */
+struct Parser
+{
+    std::string_view re;
+    size_t pos = 0;
+    std::vector<Node> & nodes;
+    std::vector<std::bitset<256>> & sets;
+    uint32_t nrGroups = 1;
+
+    bool atEnd() const
+    {
+        return pos == re.size();
+    }
+
+    uint32_t add(Node && node)
+    {
+        nodes.push_back(std::move(node));
+        return nodes.size() - 1;
+    }
+
+    uint32_t parseAlternation()
+    {
+        std::vector<uint32_t> alternatives{parseConcatenation()};
+        while (!atEnd() && re[pos] == '|') {
+            ++pos;
+            alternatives.push_back(parseConcatenation());
+        }
+        if (alternatives.size() == 1)
+            return alternatives[0];
+        return add({.kind = Node::Alt, .children = std::move(alternatives)});
+    }
+
+    uint32_t parseConcatenation()
+    {
+        std::vector<uint32_t> terms;
+        while (!atEnd() && re[pos] != '|' && re[pos] != ')') {
+            if (re[pos] == '^' || re[pos] == '$') {
+                terms.push_back(add({.kind = re[pos] == '^' ? Node::Begin : Node::End}));
+                ++pos;
+                continue;
+            }
+            auto term = parseAtom();
+            while (auto repeat = parseQuantifier(term))
+                term = *repeat;
+            terms.push_back(term);
+        }
+        if (terms.size() == 1)
+            return terms[0];
+        return add({.kind = terms.empty() ? Node::Empty : Node::Concat, .children = std::move(terms)});
+    }
+
+    uint32_t parseAtom()
+    {
+        auto c = re[pos++];
+        switch (c) {
+        case '.':
+            return add({.kind = Node::Any});
+        case '[':
+            return parseBracket();
+        case '(': {
+            auto group = nrGroups++;
+            auto child = parseAlternation();
+            if (atEnd() || re[pos] != ')')
+                fail(std::regex_constants::error_paren);
+            ++pos;
+            return add({.kind = Node::Group, .value = group, .children = {child}});
+        }
+        case '\\':
+            if (atEnd() || !std::strchr("^$\\.*+?()[]{}|", re[pos]))
+                fail(std::regex_constants::error_escape);
+            return add({.kind = Node::Char, .value = (unsigned char) re[pos++]});
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            fail(std::regex_constants::error_badrepeat);
+        default:
+            return add({.kind = Node::Char, .value = (unsigned char) c});
+        }
+    }
+
+    uint32_t parseNumber()
+    {
+        if (atEnd() || !std::isdigit((unsigned char) re[pos]))
+            fail(std::regex_constants::error_badbrace);
+        uint32_t n = 0;
+        while (!atEnd() && std::isdigit((unsigned char) re[pos])) {
+            n = n * 10 + (re[pos++] - '0');
+            if (n > maxProgramSize)
+                fail(std::regex_constants::error_space);
+        }
+        return n;
+    }
+
+    std::optional<uint32_t> parseQuantifier(uint32_t atom)
+    {
+        if (atEnd())
+            return std::nullopt;
+
+        uint32_t min, max;
+        switch (re[pos]) {
+        case '*':
+            min = 0, max = unbounded;
+            break;
+        case '+':
+            min = 1, max = unbounded;
+            break;
+        case '?':
+            min = 0, max = 1;
+            break;
+        case '{':
+            ++pos;
+            min = max = parseNumber();
+            if (!atEnd() && re[pos] == ',') {
+                ++pos;
+                max = !atEnd() && re[pos] == '}' ? unbounded : parseNumber();
+            }
+            if (atEnd() || re[pos] != '}')
+                fail(std::regex_constants::error_brace);
+            if (max < min)
+                fail(std::regex_constants::error_badbrace);
+            break;
+        default:
+            return std::nullopt;
+        }
+        ++pos;
+
+        return add({.kind = Node::Repeat, .min = min, .max = max, .children = {atom}});
+    }
+
+    /**
+     * Parse a collating element (`[.c.]`) or equivalence class
+     * (`[=c=]`), which must be a single character.
+     */
+    unsigned char parseCollatingElement()
+    {
+        auto kind = re[pos + 1];
+        auto end = re.find(std::string{kind, ']'}, pos + 2);
+        if (end == re.npos)
+            fail(std::regex_constants::error_brack);
+        if (end != pos + 3)
+            fail(std::regex_constants::error_collate);
+        auto c = re[pos + 2];
+        pos = end + 2;
+        return c;
+    }
+
+    bool atBracketSpecial(size_t i, std::string_view kinds)
+    {
+        return i + 1 < re.size() && re[i] == '[' && kinds.find(re[i + 1]) != kinds.npos;
+    }
+
+    uint32_t parseBracket()
+    {
+        std::bitset<256> set;
+
+        bool negate = !atEnd() && re[pos] == '^';
+        if (negate)
+            ++pos;
+
+        /* A ']' at the start is an ordinary character. */
+        for (bool first = true;; first = false) {
+            if (atEnd())
+                fail(std::regex_constants::error_brack);
+
+            if (re[pos] == ']' && !first) {
+                ++pos;
+                break;
+            }
+
+            if (atBracketSpecial(pos, ":")) {
+                auto end = re.find(":]", pos + 2);
+                if (end == re.npos)
+                    fail(std::regex_constants::error_brack);
+                addClass(set, re.substr(pos + 2, end - pos - 2));
+                pos = end + 2;
+                if (pos + 1 < re.size() && re[pos] == '-' && re[pos + 1] != ']')
+                    fail(std::regex_constants::error_range);
+                continue;
+            }
+
+            unsigned char lo = atBracketSpecial(pos, ".=") ? parseCollatingElement() : re[pos++];
+
+            /* A '-' before the closing ']' is an ordinary character. */
+            if (pos + 1 < re.size() && re[pos] == '-' && re[pos + 1] != ']') {
+                ++pos;
+                if (atBracketSpecial(pos, ":"))
+                    fail(std::regex_constants::error_range);
+                unsigned char hi = atBracketSpecial(pos, ".=") ? parseCollatingElement() : re[pos++];
+                if (hi < lo)
+                    fail(std::regex_constants::error_range);
+                for (unsigned int c = lo; c <= hi; ++c)
+                    set.set(c);
+            } else
+                set.set(lo);
+        }
+
+        if (negate)
+            set.flip();
+
+        sets.push_back(set);
+        return add({.kind = Node::Set, .value = uint32_t(sets.size() - 1)});
+    }
+};
+
+} // namespace
+
+struct PosixRegex::Compiler
+{
+    PosixRegex & regex;
+    const std::vector<Node> & nodes;
+
+    size_t emit(Op op, uint32_t x = 0, uint32_t y = 0)
+    {
+        if (regex.program.size() >= maxProgramSize)
+            fail(std::regex_constants::error_space);
+        regex.program.push_back({op, x, y});
+        return regex.program.size() - 1;
+    }
+
+    uint32_t next() const
+    {
+        return regex.program.size();
+    }
+
+    void compile(uint32_t n)
+    {
+        auto & node = nodes[n];
+        switch (node.kind) {
+        case Node::Empty:
+            break;
+        case Node::Char:
+            emit(Op::Char, node.value);
+            break;
+        case Node::Any:
+            emit(Op::Any);
+            break;
+        case Node::Set:
+            emit(Op::Set, node.value);
+            break;
+        case Node::Begin:
+            emit(Op::AssertBegin);
+            break;
+        case Node::End:
+            emit(Op::AssertEnd);
+            break;
+        case Node::Group:
+            emit(Op::Save, 2 * node.value);
+            compile(node.children[0]);
+            emit(Op::Save, 2 * node.value + 1);
+            break;
+        case Node::Concat:
+            for (auto child : node.children)
+                compile(child);
+            break;
+        case Node::Alt: {
+            /* Earlier alternatives have priority. */
+            std::vector<size_t> jumps;
+            for (size_t i = 0; i + 1 < node.children.size(); ++i) {
+                auto split = emit(Op::Split, next() + 1);
+                compile(node.children[i]);
+                jumps.push_back(emit(Op::Jump));
+                regex.program[split].y = next();
+            }
+            compile(node.children.back());
+            for (auto jump : jumps)
+                regex.program[jump].x = next();
+            break;
+        }
+        case Node::Repeat:
+            /* Repeating has priority over stopping. */
+            for (uint32_t i = 0; i < node.min; ++i)
+                compile(node.children[0]);
+            if (node.max == unbounded) {
+                /* Like libstdc++, allow one more iteration that
+                   doesn't consume anything (e.g. `(a|)*` matching
+                   "a" ends with an empty iteration). A thread coming
+                   back to the loop at the same position is dropped, so
+                   the loop is followed by a separate copy of the body
+                   for that. If that copy does consume something, the
+                   loop starts over. */
+                auto split = emit(Op::Split, next() + 1);
+                auto body = next();
+                compile(node.children[0]);
+                emit(Op::Split, body, next() + 1);
+                auto last = emit(Op::Split, next() + 1);
+                compile(node.children[0]);
+                emit(Op::Split, split, next() + 1);
+                regex.program[split].y = next();
+                regex.program[last].y = next();
+            } else {
+                std::vector<size_t> splits;
+                for (uint32_t i = node.min; i < node.max; ++i) {
+                    splits.push_back(emit(Op::Split, next() + 1));
+                    compile(node.children[0]);
+                }
+                for (auto split : splits)
+                    regex.program[split].y = next();
+            }
+            break;
+        }
+    }
+};
+
+PosixRegex::PosixRegex(std::string_view pattern)
+{
+    std::vector<Node> nodes;
+    Parser parser{.re = pattern, .nodes = nodes, .sets = sets};
+    auto root = parser.parseAlternation();
+    if (!parser.atEnd())
+        fail(std::regex_constants::error_paren);
+    nrGroups = parser.nrGroups;
+
+    Compiler compiler{.regex = *this, .nodes = nodes};
+    compiler.emit(Op::Save, 0);
+    compiler.compile(root);
+    compiler.emit(Op::Save, 1);
+    compiler.emit(Op::Match);
+
+    /* Find the characters that can start a match, so that searching
+       can skip over the others. */
+    std::vector<bool> seen(program.size());
+    std::vector<uint32_t> todo{0};
+    bool nullable = false;
+    while (!todo.empty()) {
+        auto pc = todo.back();
+        todo.pop_back();
+        if (seen[pc])
+            continue;
+        seen[pc] = true;
+        auto & inst = program[pc];
+        switch (inst.op) {
+        case Op::Char:
+            firstChars.set(inst.x);
+            break;
+        case Op::Any:
+            firstChars.set();
+            firstChars.reset(0);
+            break;
+        case Op::Set:
+            firstChars |= sets[inst.x];
+            break;
+        case Op::Split:
+            todo.push_back(inst.y);
+            [[fallthrough]];
+        case Op::Jump:
+            todo.push_back(inst.x);
+            break;
+        case Op::Save:
+        case Op::AssertBegin:
+        case Op::AssertEnd:
+            todo.push_back(pc + 1);
+            break;
+        case Op::Match:
+            nullable = true;
+            break;
+        }
+    }
+    canSkip = !nullable;
+}
+
+namespace {
+
+/**
+ * The threads of the matcher at one position: a sparse set of program
+ * counters in priority order, with the subexpression offsets of each
+ * thread.
+ */
+struct ThreadList
+{
+    std::vector<uint32_t> sparse, dense;
+    std::vector<size_t> slots;
+    size_t size = 0;
+
+    void reset(size_t programSize, size_t nrSlots)
+    {
+        if (sparse.size() < programSize) {
+            sparse.resize(programSize);
+            dense.resize(programSize);
+        }
+        if (slots.size() < programSize * nrSlots)
+            slots.resize(programSize * nrSlots);
+        size = 0;
+    }
+
+    bool contains(uint32_t pc) const
+    {
+        auto i = sparse[pc];
+        return i < size && dense[i] == pc;
+    }
+
+    size_t insert(uint32_t pc)
+    {
+        sparse[pc] = size;
+        dense[size] = pc;
+        return size++;
+    }
+};
+
+struct StackEntry
+{
+    uint32_t pc;
+    /**
+     * If `restore`, set slot `pc` back to `value`.
+     */
+    bool restore = false;
+    size_t value = 0;
+};
+
+} // namespace
+
+bool PosixRegex::run(
+    std::string_view s, size_t from, Groups & groups, bool anchorStart, bool anchorEnd, bool notNull) const
+{
+    thread_local ThreadList lists[2];
+    thread_local std::vector<StackEntry> stack;
+    thread_local std::vector<size_t> caps;
+
+    auto nrSlots = 2 * nrGroups;
+    auto clist = &lists[0], nlist = &lists[1];
+    clist->reset(program.size(), nrSlots);
+    nlist->reset(program.size(), nrSlots);
+    caps.resize(nrSlots);
+
+    /* Add the thread at `pc0` to `list`, following all the
+       instructions that don't consume a character. Threads are added
+       in priority order, and a thread that reaches a program counter
+       that is already in the list is dropped, since the earlier thread
+       has priority and the same future. */
+    auto addThread = [&](ThreadList & list, uint32_t pc0, size_t pos, size_t * caps) {
+        stack.push_back({.pc = pc0});
+        while (!stack.empty()) {
+            auto e = stack.back();
+            stack.pop_back();
+            if (e.restore) {
+                caps[e.pc] = e.value;
+                continue;
+            }
+            for (auto pc = e.pc; !list.contains(pc);) {
+                auto i = list.insert(pc);
+                auto & inst = program[pc];
+                if (inst.op == Op::Jump)
+                    pc = inst.x;
+                else if (inst.op == Op::Split) {
+                    stack.push_back({.pc = inst.y});
+                    pc = inst.x;
+                } else if (inst.op == Op::Save) {
+                    stack.push_back({.pc = inst.x, .restore = true, .value = caps[inst.x]});
+                    caps[inst.x] = pos;
+                    pc++;
+                } else if (inst.op == Op::AssertBegin) {
+                    if (pos != 0)
+                        break;
+                    pc++;
+                } else if (inst.op == Op::AssertEnd) {
+                    if (pos != s.size())
+                        break;
+                    pc++;
+                } else {
+                    std::copy_n(caps, nrSlots, &list.slots[i * nrSlots]);
+                    break;
+                }
+            }
+        }
+    };
+
+    bool found = false;
+    groups.assign(nrSlots, npos);
+
+    for (auto pos = from;; ++pos) {
+        /* Start a new thread at every position until there is a
+           match. It has the lowest priority, so threads are ordered by
+           where they started. */
+        if (!found && (pos == from || !anchorStart)) {
+            if (canSkip && clist->size == 0) {
+                if (!anchorStart)
+                    while (pos < s.size() && !firstChars[(unsigned char) s[pos]])
+                        ++pos;
+                if (pos == s.size() || !firstChars[(unsigned char) s[pos]])
+                    break;
+            }
+            std::fill(caps.begin(), caps.end(), npos);
+            addThread(*clist, 0, pos, caps.data());
+        }
+
+        if (clist->size == 0)
+            break;
+
+        nlist->size = 0;
+
+        auto c = pos < s.size() ? (unsigned char) s[pos] : -1;
+
+        for (size_t i = 0; i < clist->size; ++i) {
+            auto pc = clist->dense[i];
+            auto & inst = program[pc];
+            auto t = &clist->slots[i * nrSlots];
+
+            /* Threads that started after the best match so far can't
+               produce a better one. */
+            if (found && t[0] > groups[0])
+                continue;
+
+            switch (inst.op) {
+            case Op::Char:
+                if (c == (int) inst.x)
+                    addThread(*nlist, pc + 1, pos + 1, t);
+                break;
+            case Op::Any:
+                if (c > 0)
+                    addThread(*nlist, pc + 1, pos + 1, t);
+                break;
+            case Op::Set:
+                if (c >= 0 && sets[inst.x][c])
+                    addThread(*nlist, pc + 1, pos + 1, t);
+                break;
+            case Op::Match:
+                if (anchorEnd && pos != s.size())
+                    break;
+                if (notNull && t[0] == pos)
+                    break;
+                /* Prefer matches that start earlier, then longer ones,
+                   then the highest priority thread. */
+                if (!found || t[0] < groups[0] || (t[0] == groups[0] && pos > groups[1])) {
+                    std::copy_n(t, nrSlots, groups.begin());
+                    found = true;
+                }
+                break;
+            case Op::Split:
+            case Op::Jump:
+            case Op::Save:
+            case Op::AssertBegin:
+            case Op::AssertEnd:
+                /* Followed by `addThread()`, so never in a list. */
+                break;
+            }
+        }
+
+        if (pos == s.size())
+            break;
+
+        std::swap(clist, nlist);
+    }
+
+    return found;
+}
+
+bool PosixRegex::match(std::string_view s, Groups & groups) const
+{
+    return run(s, 0, groups, true, true, false);
+}
+
+bool PosixRegex::search(std::string_view s, size_t from, Groups & groups, bool continuous, bool notNull) const
+{
+    return run(s, from, groups, continuous, false, notNull);
+}
+
+} // namespace nix
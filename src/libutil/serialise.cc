@@ -4,6 +4,8 @@
 #include "nix/util/socket.hh"
 #include "nix/util/util.hh"
 
+#include "util-config-private.hh"
+
 #include <cstring>
 #include <cerrno>
 #include <limits>
@@ -18,6 +20,12 @@
 #  include <poll.h>
 #endif
 
+#ifdef __linux__
+#  include <linux/fs.h>
+#  include <sys/ioctl.h>
+#  include <sys/stat.h>
+#endif
+
 namespace nix {
 
 void BufferedSink::operator()(std::string_view data)
@@ -306,6 +314,103 @@ void FdSource::skip(size_t len)
         BufferedSource::skip(len);
 }
 
+#if HAVE_COPY_FILE_RANGE
+/**
+ * Copy up to `len` bytes from the current offset of `from` to the
+ * current offset of `to` without going through userspace, advancing
+ * both offsets. Whole file system blocks are cloned (shared with the
+ * source) where possible, e.g. on btrfs and XFS. Returns the number of
+ * bytes copied, which is less than `len` if the kernel can't copy
+ * between these files; the caller then has to copy the rest itself.
+ */
+static uint64_t copyFileRange(Descriptor from, Descriptor to, uint64_t len)
+{
+    uint64_t copied = 0;
+
+#  ifdef FICLONERANGE
+    /* Cloning only works on block boundaries. Since a NAR member is
+       always followed by padding or further NAR data, we can only
+       clone whole blocks and have to copy the tail. */
+    struct stat st;
+    if (::fstat(to, &st) == 0 && st.st_blksize > 0) {
+        uint64_t blockSize = st.st_blksize;
+        auto srcOffset = lseek(from, 0, SEEK_CUR);
+        auto dstOffset = lseek(to, 0, SEEK_CUR);
+        auto cloneLen = len - len % blockSize;
+        if (srcOffset >= 0 && dstOffset >= 0 && srcOffset % blockSize == 0 && dstOffset % blockSize == 0
+            && cloneLen) {
+            struct file_clone_range range{
+                .src_fd = from,
+                .src_offset = static_cast<uint64_t>(srcOffset),
+                .src_length = cloneLen,
+                .dest_offset = static_cast<uint64_t>(dstOffset),
+            };
+            if (ioctl(to, FICLONERANGE, &range) == 0) {
+                if (lseek(from, srcOffset + cloneLen, SEEK_SET) == -1)
+                    throw SysError("seeking in file");
+                if (lseek(to, dstOffset + cloneLen, SEEK_SET) == -1)
+                    throw SysError("seeking in file");
+                copied = cloneLen;
+            }
+        }
+    }
+#  endif
+
+    while (copied < len) {
+        checkInterrupt();
+        /* Copy in chunks so that we notice interrupts. */
+        auto chunk = std::min<uint64_t>(len - copied, 64 * 1024 * 1024);
+        auto n = copy_file_range(from, nullptr, to, nullptr, chunk, 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            /* Not supported between these files, e.g. because one of
+               them is a pipe or they're on different file systems. */
+            if (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF
+                || errno == EPERM)
+                break;
+            throw SysError("copying data between files");
+        }
+        if (n == 0)
+            break;
+        copied += n;
+    }
+
+    return copied;
+}
+#endif
+
+void FdSource::drainInto(Sink & sink, uint64_t len)
+{
+#if HAVE_COPY_FILE_RANGE
+    auto fdSink = dynamic_cast<FdSink *>(&sink);
+
+    if (fdSink && tryCopyFileRange && isSeekable) {
+        /* First hand out what we've already read. */
+        if (buffer && bufPosIn - bufPosOut) {
+            auto n = std::min<uint64_t>(len, bufPosIn - bufPosOut);
+            sink({buffer.get() + bufPosOut, static_cast<size_t>(n)});
+            bufPosOut += n;
+            if (bufPosIn == bufPosOut)
+                bufPosIn = bufPosOut = 0;
+            len -= n;
+        }
+
+        if (len) {
+            fdSink->flush();
+            auto n = copyFileRange(fd, fdSink->fd, len);
+            read += n;
+            fdSink->written += n;
+            len -= n;
+            if (len)
+                tryCopyFileRange = false;
+        }
+    }
+#endif
+
+    BufferedSource::drainInto(sink, len);
+}
+
 size_t StringSource::read(char * data, size_t len)
 {
     if (pos == s.size())
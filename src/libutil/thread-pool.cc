@@ -1,9 +1,124 @@
 #include "nix/util/thread-pool.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/util.hh"
+#include "nix/util/finally.hh"
 
 namespace nix {
 
+/* A deque owned by a single thread, which pushes and takes items at
+   the bottom, while other threads steal items from the top. This is
+   the algorithm from "Correct and Efficient Work-Stealing for Weak
+   Memory Models" (Lê et al., PPoPP 2013), using sequentially
+   consistent atomics throughout for simplicity. */
+struct ThreadPool::Deque
+{
+    struct Array
+    {
+        const int64_t size;
+        std::unique_ptr<std::atomic<work_t *>[]> items;
+
+        Array(int64_t size)
+            : size(size)
+            , items(new std::atomic<work_t *>[size])
+        {
+        }
+
+        work_t * get(int64_t i) const
+        {
+            return items[i & (size - 1)].load();
+        }
+
+        void put(int64_t i, work_t * item)
+        {
+            items[i & (size - 1)].store(item);
+        }
+    };
+
+    std::atomic<int64_t> top{0}, bottom{0};
+
+    std::atomic<Array *> array;
+
+    /**
+     * Arrays that have been replaced by a bigger one. Thieves may
+     * still be reading them, so they're only freed when the deque is
+     * destroyed.
+     */
+    std::vector<std::unique_ptr<Array>> arrays;
+
+    Deque()
+    {
+        arrays.push_back(std::make_unique<Array>(64));
+        array = arrays.back().get();
+    }
+
+    ~Deque()
+    {
+        while (auto item = take())
+            delete item;
+    }
+
+    /**
+     * Only to be called by the owner.
+     */
+    void push(work_t * item)
+    {
+        auto b = bottom.load();
+        auto t = top.load();
+        auto a = array.load();
+        if (b - t > a->size - 1) {
+            auto bigger = std::make_unique<Array>(a->size * 2);
+            for (auto i = t; i < b; ++i)
+                bigger->put(i, a->get(i));
+            a = bigger.get();
+            arrays.push_back(std::move(bigger));
+            array = a;
+        }
+        a->put(b, item);
+        bottom = b + 1;
+    }
+
+    /**
+     * Only to be called by the owner.
+     */
+    work_t * take()
+    {
+        auto b = bottom.load() - 1;
+        auto a = array.load();
+        bottom = b;
+        auto t = top.load();
+        if (t > b) {
+            bottom = b + 1;
+            return nullptr;
+        }
+        auto item = a->get(b);
+        if (t == b) {
+            /* Last item, race against thieves. */
+            if (!top.compare_exchange_strong(t, t + 1))
+                item = nullptr;
+            bottom = b + 1;
+        }
+        return item;
+    }
+
+    work_t * steal()
+    {
+        auto t = top.load();
+        auto b = bottom.load();
+        if (t >= b)
+            return nullptr;
+        auto item = array.load()->get(t);
+        if (!top.compare_exchange_strong(t, t + 1))
+            return nullptr;
+        return item;
+    }
+};
+
+/**
+ * The pool and slot of the thread pool worker running on this
+ * thread, if any.
+ */
+static thread_local std::pair<ThreadPool *, size_t> currentWorker{nullptr, 0};
+
 ThreadPool::ThreadPool(size_t _maxThreads)
     : maxThreads(_maxThreads)
 {
@@ -13,6 +128,9 @@ ThreadPool::ThreadPool(size_t _maxThreads)
             maxThreads = 1;
     }
 
+    for (size_t i = 0; i < maxThreads; ++i)
+        deques.push_back(std::make_unique<Deque>());
+
     debug("starting pool of %d threads", maxThreads - 1);
 }
 
@@ -41,25 +159,64 @@ void ThreadPool::shutdown()
         thr.join();
 }
 
-void ThreadPool::enqueue(work_t t)
+void ThreadPool::enqueue(work_t t, Priority priority)
 {
-    auto state(state_.lock());
-    if (quit)
-        throw ThreadPoolShutDown("cannot enqueue a work item while the thread pool is shutting down");
-    state->pending.push(std::move(t));
+    auto item = std::make_unique<work_t>(std::move(t));
+
+    if (priority == Priority::Normal && currentWorker.first == this) {
+        if (quit)
+            throw ThreadPoolShutDown("cannot enqueue a work item while the thread pool is shutting down");
+        /* Fast path: a work item is adding more work. */
+        unfinished++;
+        deques[currentWorker.second]->push(item.release());
+        queued++;
+    } else {
+        auto state(state_.lock());
+        if (quit)
+            throw ThreadPoolShutDown("cannot enqueue a work item while the thread pool is shutting down");
+        unfinished++;
+        if (priority == Priority::High) {
+            state->pendingHigh.push(std::move(item));
+            queuedHigh++;
+        } else {
+            state->pending.push(std::move(item));
+            queuedShared++;
+        }
+        queued++;
+    }
+
     /* Note: process() also executes items, so count it as a worker. */
-    if (state->pending.size() > state->workers.size() + 1 && state->workers.size() + 1 < maxThreads)
-        state->workers.emplace_back(&ThreadPool::doWork, this, false);
-    work.notify_one();
+    auto nrWorkers_ = nrWorkers.load();
+    if ((size_t) std::max<int64_t>(queued, 0) > nrWorkers_ + 1 && nrWorkers_ + 1 < maxThreads) {
+        auto state(state_.lock());
+        if (!quit && state->workers.size() + 1 < maxThreads) {
+            auto slot = state->workers.size() + 1;
+            state->workers.emplace_back(&ThreadPool::doWork, this, slot);
+            nrWorkers = state->workers.size();
+        }
+    }
+
+    wakeUp();
+}
+
+void ThreadPool::wakeUp()
+{
+    /* `queued` has been incremented before this load, and sleepers
+       increment `sleeping` before checking `queued`, so either they
+       see the new item or we see them. */
+    if (sleeping) {
+        auto state(state_.lock());
+        work.notify_one();
+    }
 }
 
 void ThreadPool::process()
 {
-    state_.lock()->draining = true;
+    draining = true;
 
     /* Do work until no more work is pending or active. */
     try {
-        doWork(true);
+        doWork(0);
 
         auto state(state_.lock());
 
@@ -79,86 +236,132 @@ void ThreadPool::process()
     }
 }
 
-void ThreadPool::doWork(bool mainThread)
+std::unique_ptr<ThreadPool::work_t> ThreadPool::findWork(size_t slot)
 {
-    ReceiveInterrupts receiveInterrupts;
+    auto takeShared = [&](bool high) -> std::unique_ptr<work_t> {
+        auto state(state_.lock());
+        auto & queue = high ? state->pendingHigh : state->pending;
+        if (queue.empty())
+            return nullptr;
+        auto item = std::move(queue.front());
+        queue.pop();
+        (high ? queuedHigh : queuedShared)--;
+        return item;
+    };
 
-#ifndef _WIN32 // Does Windows need anything similar for async exit handling?
-    if (!mainThread)
-        unix::interruptCheck = [&]() { return (bool) quit; };
-#endif
+    std::unique_ptr<work_t> item;
+
+    if (queuedHigh)
+        item = takeShared(true);
+
+    if (!item)
+        item.reset(deques[slot]->take());
+
+    if (!item && queuedShared)
+        item = takeShared(false);
 
-    bool didWork = false;
-    std::exception_ptr exc;
+    if (!item)
+        for (size_t i = 1; i < maxThreads && !item; ++i)
+            item.reset(deques[(slot + i) % maxThreads]->steal());
+
+    if (item)
+        queued--;
+
+    return item;
+}
+
+bool ThreadPool::waitForWork()
+{
+    auto state(state_.lock());
+
+    sleeping++;
+    Finally decrement([&]() { sleeping--; });
 
     while (true) {
-        std::function<void()> w;
-        {
-            auto state(state_.lock());
+        if (quit)
+            return false;
 
-            if (didWork) {
-                assert(state->active);
-                state->active--;
-
-                if (exc) {
-
-                    if (!state->exception) {
-                        state->exception = exc;
-                        // Tell the other workers to quit.
-                        quit = true;
-                        work.notify_all();
-                    } else {
-                        /* Print the exception, since we can't
-                           propagate it. */
-                        try {
-                            std::rethrow_exception(exc);
-                        } catch (const Interrupted &) {
-                            // The interrupted state may be picked up by multiple
-                            // workers, which is expected, so we should ignore
-                            // it silently and let the first one bubble up,
-                            // rethrown via the original state->exception.
-                        } catch (const ThreadPoolShutDown &) {
-                            // Similarly expected.
-                        } catch (std::exception & e) {
-                            ignoreExceptionExceptInterrupt();
-                        }
-                    }
-                }
-            }
+        if (queued > 0)
+            return true;
 
-            /* Wait until a work item is available or we're asked to
-               quit. */
-            while (true) {
-                if (quit)
-                    return;
-
-                if (!state->pending.empty())
-                    break;
-
-                /* If there are no active or pending items, and the
-                   main thread is running process(), then no new items
-                   can be added. So exit. */
-                if (!state->active && state->draining) {
-                    quit = true;
-                    work.notify_all();
-                    return;
-                }
+        /* If there are no active or pending items, and the main
+           thread is running process(), then no new items can be
+           added. So exit. */
+        if (!unfinished && draining) {
+            quit = true;
+            work.notify_all();
+            return false;
+        }
 
-                state.wait(work);
-            }
+        state.wait(work);
+    }
+}
+
+void ThreadPool::doWork(size_t slot)
+{
+    ReceiveInterrupts receiveInterrupts;
+
+#ifndef _WIN32 // Does Windows need anything similar for async exit handling?
+    if (slot != 0)
+        unix::interruptCheck = [&]() { return (bool) quit; };
+#endif
 
-            w = std::move(state->pending.front());
-            state->pending.pop();
-            state->active++;
+    /* Restore the previous value in case process() is called from a
+       work item of another pool. */
+    auto prevWorker = currentWorker;
+    currentWorker = {this, slot};
+    Finally restoreWorker([&]() { currentWorker = prevWorker; });
+
+    while (!quit) {
+        auto w = findWork(slot);
+
+        if (!w) {
+            if (!waitForWork())
+                return;
+            continue;
         }
 
+        std::exception_ptr exc;
+
         try {
-            w();
+            (*w)();
         } catch (...) {
             exc = std::current_exception();
         }
 
-        didWork = true;
+        w.reset();
+
+        if (exc) {
+            auto state(state_.lock());
+            if (!state->exception) {
+                state->exception = exc;
+                // Tell the other workers to quit.
+                quit = true;
+                work.notify_all();
+            } else {
+                /* Print the exception, since we can't
+                   propagate it. */
+                try {
+                    std::rethrow_exception(exc);
+                } catch (const Interrupted &) {
+                    // The interrupted state may be picked up by multiple
+                    // workers, which is expected, so we should ignore
+                    // it silently and let the first one bubble up,
+                    // rethrown via the original state->exception.
+                } catch (const ThreadPoolShutDown &) {
+                    // Similarly expected.
+                } catch (std::exception & e) {
+                    ignoreExceptionExceptInterrupt();
+                }
+            }
+        }
+
+        /* If this was the last item, wake up the sleeping threads so
+           they notice that we're done. */
+        if (--unfinished == 0 && draining && sleeping) {
+            auto state(state_.lock());
+            work.notify_all();
+        }
     }
 }
 
@@ -115,6 +115,7 @@ struct CmdEval : MixJSON, InstallableValueCommand, MixReadOnlyOption
         }
 
         else if (json) {
+            prefetchValueAsJSON(*state, *v, pos);
             printJSON(printValueAsJSON(*state, true, *v, pos, context, false));
         }
 
@@ -5,6 +5,7 @@
 #include "nix/expr/eval-inline.hh"
 #include "nix/expr/eval-settings.hh"
 #include "nix/expr/get-drvs.hh"
+#include "nix/expr/parallel-eval.hh"
 #include "nix/util/os-string.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/mounted-source-accessor.hh"
@@ -421,6 +422,35 @@ struct CmdFlakeCheck : FlakeCommand
             return std::nullopt;
         };
 
+        /* With `eval-cores`, evaluate the derivations in a per-system
+           output like `packages` in parallel before checking them one
+           by one. Errors are ignored here, since they are memoised and
+           reported by `checkDerivation()`. */
+        auto prefetchDerivations = [&](Value & vOutput) {
+            if (!state->executor->enabled)
+                return;
+            std::vector<Executor::Work> work;
+            for (auto & attr : *vOutput.attrs()) {
+                std::string_view system = state->symbols[attr.name];
+                if (!checkAllSystems && system != localSystem)
+                    continue;
+                try {
+                    state->forceAttrs(*attr.value, attr.pos, "");
+                } catch (Error &) {
+                    continue;
+                }
+                for (auto & attr2 : *attr.value->attrs())
+                    work.push_back([&state, &v(*attr2.value)]() {
+                        try {
+                            if (auto packageInfo = getDerivation(*state, v, false))
+                                packageInfo->queryDrvPath();
+                        } catch (Error &) {
+                        }
+                    });
+            }
+            state->executor->runAll(std::move(work));
+        };
+
         std::map<DerivedPath, std::vector<AttrPath>> attrPathsByDrv;
 
         auto checkApp = [&](const std::string & attrPath, Value & v, const PosIdx pos) {
@@ -604,6 +634,7 @@ struct CmdFlakeCheck : FlakeCommand
 
                     if (name == "checks") {
                         state->forceAttrs(vOutput, pos, "");
+                        prefetchDerivations(vOutput);
                         for (auto & attr : *vOutput.attrs()) {
                             std::string_view attr_name = state->symbols[attr.name];
                             checkSystemName(attr_name, attr.pos);
@@ -642,6 +673,7 @@ struct CmdFlakeCheck : FlakeCommand
 
                     else if (name == "packages" || name == "devShells") {
                         state->forceAttrs(vOutput, pos, "");
+                        prefetchDerivations(vOutput);
                         for (auto & attr : *vOutput.attrs()) {
                             const auto & attr_name = state->symbols[attr.name];
                             checkSystemName(attr_name, attr.pos);
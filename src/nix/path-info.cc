@@ -22,8 +22,10 @@ using nlohmann::json;
 static uint64_t getStoreObjectsTotalSize(Store & store, const StorePathSet & closure)
 {
     uint64_t totalNarSize = 0;
+    auto infos = store.queryPathInfos(closure);
     for (auto & p : closure) {
-        totalNarSize += store.queryPathInfo(p)->narSize;
+        auto i = infos.find(p);
+        totalNarSize += (i != infos.end() ? i->second : store.queryPathInfo(p))->narSize;
     }
     return totalNarSize;
 }
@@ -41,6 +43,9 @@ pathInfoToJSON(Store & store, const StorePathSet & storePaths, bool showClosureS
 {
     json::object_t jsonAllObjects = json::object();
 
+    /* Fill the path info cache with one query. */
+    store.queryPathInfos(storePaths);
+
     auto makeKey = [&](const StorePath & path) {
         return format == PathInfoJsonFormat::V1 ? store.printStorePath(path) : std::string(path.to_string());
     };
@@ -3,6 +3,7 @@
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-inline.hh"
 #include "nix/expr/eval-settings.hh"
+#include "nix/expr/parallel-eval.hh"
 #include "nix/store/names.hh"
 #include "nix/main/common-args.hh"
 #include "nix/main/shared.hh"
@@ -10,6 +11,7 @@
 #include "nix/expr/attr-path.hh"
 #include "nix/util/hilite.hh"
 #include "nix/util/strings-inline.hh"
+#include "nix/util/sync.hh"
 
 #include <regex>
 #include <nlohmann/json.hpp>
@@ -104,11 +106,17 @@ struct CmdSearch : SourceExprCommand, MixJSON
 
         auto state = getEvalState();
 
-        std::optional<nlohmann::json> jsonOut;
-        if (json)
-            jsonOut = json::object();
+        /* With `eval-cores`, attributes are visited by several threads
+           at once, so the results are collected under a lock. */
+        struct Output
+        {
+            std::optional<nlohmann::json> jsonOut;
+            uint64_t results = 0;
+        };
 
-        uint64_t results = 0;
+        Sync<Output> output_;
+        if (json)
+            output_.lock()->jsonOut = json::object();
 
         std::function<void(eval_cache::AttrCursor & cursor, const AttrPath & attrPath, bool initialRecurse)> visit;
 
@@ -119,12 +127,14 @@ struct CmdSearch : SourceExprCommand, MixJSON
             Activity act(*logger, lvlInfo, actUnknown, fmt("evaluating '%s'", attrPathStr));
             try {
                 auto recurse = [&]() {
+                    std::vector<Executor::Work> work;
                     for (const auto & attr : cursor.getAttrs()) {
                         auto cursor2 = cursor.getAttr(state->symbols[attr]);
                         auto attrPath2(attrPath);
                         attrPath2.push_back(attr);
-                        visit(*cursor2, attrPath2, false);
+                        work.push_back([cursor2, attrPath2, &visit]() { visit(*cursor2, attrPath2, false); });
                     }
+                    state->executor->runAll(std::move(work));
                 };
 
                 if (cursor.isDerivation()) {
@@ -165,15 +175,16 @@ struct CmdSearch : SourceExprCommand, MixJSON
                     }
 
                     if (found) {
-                        results++;
+                        auto output(output_.lock());
+                        output->results++;
                         if (json) {
-                            (*jsonOut)[attrPathStr] = {
+                            (*output->jsonOut)[attrPathStr] = {
                                 {"pname", name.name},
                                 {"version", name.version},
                                 {"description", description},
                             };
                         } else {
-                            if (results > 1)
+                            if (output->results > 1)
                                 logger->cout("");
                             logger->cout(
                                 "* %s%s",
@@ -209,10 +220,12 @@ struct CmdSearch : SourceExprCommand, MixJSON
         for (auto & cursor : installable->getCursors(*state))
             visit(*cursor, cursor->getAttrPath(), true);
 
+        auto output(output_.lock());
+
         if (json)
-            printJSON(*jsonOut);
+            printJSON(*output->jsonOut);
 
-        if (!json && !results)
+        if (!json && !output->results)
             throw Error("no results for the given search term(s)!");
     }
 };
@@ -251,6 +251,17 @@ mkdir "$narCache"
 
 [[ $(nix store cat --store "file://$cacheDir?local-nar-cache=$narCache" "$outPath/foobar") = FOOBAR ]]
 
+# A NAR cache that is too small only keeps the most recently used NAR.
+narCache2=$TEST_ROOT/nar-cache-2
+rm -rf "$narCache2"
+
+readarray -t closure < <(nix-store -qR "$outPath")
+[[ "${#closure[@]}" -gt 1 ]]
+for path in "${closure[@]}"; do
+    nix store ls --store "file://$cacheDir?local-nar-cache=$narCache2&local-nar-cache-size=1" "$path" > /dev/null
+done
+[[ $(find "$narCache2" -name '*.nar' | wc -l) = 1 ]]
+
 rm -rfv "$cacheDir/nar"
 
 [[ $(nix store cat --store "file://$cacheDir?local-nar-cache=$narCache" "$outPath/foobar") = FOOBAR ]]
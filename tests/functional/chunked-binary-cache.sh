@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+needLocalStore "'--no-require-sigs' can’t be used with the daemon"
+
+clearStore
+clearCache
+clearCacheCache
+
+# Two paths that only differ by a few bytes in the middle.
+head -c 1000000 /dev/urandom > "$TEST_ROOT/part1"
+head -c 1000000 /dev/urandom > "$TEST_ROOT/part2"
+mkdir -p "$TEST_ROOT/v1" "$TEST_ROOT/v2"
+cat "$TEST_ROOT/part1" "$TEST_ROOT/part2" > "$TEST_ROOT/v1/blob"
+{ cat "$TEST_ROOT/part1"; echo "hello"; cat "$TEST_ROOT/part2"; } > "$TEST_ROOT/v2/blob"
+path1=$(nix-store --add "$TEST_ROOT/v1")
+path2=$(nix-store --add "$TEST_ROOT/v2")
+
+cacheURI="file://$cacheDir?compression=zstd&chunk-nars=true"
+
+nix copy --to "$cacheURI" "$path1"
+
+grep -q "^Compression: chunked$" "$cacheDir/$(basename "$path1" | cut -c1-32).narinfo"
+[[ $(find "$cacheDir/nar" -type f | wc -l) = 1 ]]
+nrChunks1=$(find "$cacheDir/chunks" -type f | wc -l)
+(( nrChunks1 > 10 ))
+
+# Only the chunks around the difference (and the first and last ones,
+# which contain the file size and padding) are uploaded for the second
+# path.
+nix copy --to "$cacheURI" "$path2"
+nrChunks2=$(find "$cacheDir/chunks" -type f | wc -l)
+(( nrChunks2 > nrChunks1 && nrChunks2 <= nrChunks1 + 4 ))
+
+# Substitute the first path, filling a local chunk cache.
+chunkCache="$TEST_ROOT/chunk-cache"
+substituter="file://$cacheDir?local-chunk-cache=$chunkCache"
+
+clearStore
+nix-store --substituters "$substituter" --no-require-sigs -r "$path1"
+cmp "$path1/blob" "$TEST_ROOT/v1/blob"
+[[ $(find "$chunkCache" -type f | wc -l) = "$nrChunks1" ]]
+
+# Substituting the second path only needs the chunks that the first
+# one doesn't have, so it works after removing the others from the
+# binary cache.
+for chunk in "$chunkCache"/*; do
+    rm "$cacheDir/chunks/$(basename "$chunk").zst"
+done
+
+nix-store --substituters "$substituter" --no-require-sigs -r "$path2"
+cmp "$path2/blob" "$TEST_ROOT/v2/blob"
+
+# Without the local chunk cache, the missing chunks are an error.
+clearStore
+clearCacheCache
+expectStderr 1 nix-store --substituters "file://$cacheDir" --no-require-sigs -r "$path2" | grepQuiet "does not exist in binary cache"
@@ -99,3 +99,17 @@ expect_trace 'builtins.derivationStrict { name = "somepackage"; }' "
 expect_trace 'builtins.derivationStrict { }' "
 «string»:1:1:primop derivationStrict 1
 "
+
+# The sampling profiler only takes samples while evaluation uses CPU
+# time, so evaluate something expensive.
+profile=$(
+    nix-instantiate \
+        --eval-profiler sampling \
+        --eval-profiler-frequency 1000 \
+        --eval-profile-file /dev/stdout \
+        --eval --expr 'let fib = n: if n < 2 then n else fib (n - 1) + fib (n - 2); in fib 25'
+)
+grepQuiet "^«string»:1:[0-9]*:fib;«string»:1:[0-9]*:fib" <<< "$profile"
+
+expectStderr 1 nix-instantiate --eval-profiler sampling --eval-profiler-frequency 0 --expr 1 |
+    grepQuiet "requires a non-zero 'eval-profiler-frequency'"
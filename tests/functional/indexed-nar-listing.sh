@@ -0,0 +1,47 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+needLocalStore "'--no-require-sigs' can’t be used with the daemon"
+
+clearStore
+
+# A file that spans several zstd frames, followed by a small one.
+mkdir -p "$TEST_ROOT/indexed"
+head -c 40000000 /dev/urandom > "$TEST_ROOT/indexed/big"
+echo hello > "$TEST_ROOT/indexed/small"
+path=$(nix-store --add "$TEST_ROOT/indexed")
+
+listing="$cacheDir/$(basename "$path" | cut -c1-32).ls"
+
+for compression in zstd none; do
+    clearCache
+    clearCacheCache
+
+    nix copy --to "file://$cacheDir?compression=$compression&write-nar-listing=true" "$path"
+
+    narFile="$cacheDir/$(jq -r .nar.url < "$listing")"
+    if [[ $compression = zstd ]]; then
+        [[ $(jq '.nar.frames | length' < "$listing") = 4 ]]
+    else
+        [[ $(jq '.nar.frames' < "$listing") = null ]]
+    fi
+
+    # Overwrite the start of the NAR. Reading the small file still
+    # works, since only the part of the NAR that contains it is
+    # fetched.
+    dd if=/dev/zero of="$narFile" bs=1M count=1 conv=notrunc
+
+    for http in 0 1; do
+        [[ $(_NIX_FORCE_HTTP=$http nix store cat --store "file://$cacheDir" "$path/small") = hello ]]
+        [[ $(_NIX_FORCE_HTTP=$http nix store ls --store "file://$cacheDir" "$path") = $'./big\n./small' ]]
+        (! _NIX_FORCE_HTTP=$http nix store cat --store "file://$cacheDir" "$path/big" | cmp - "$TEST_ROOT/indexed/big")
+    done
+done
+
+# Without the index, the entire NAR is fetched.
+jq 'del(.nar)' < "$listing" > "$listing.tmp"
+mv "$listing.tmp" "$listing"
+(! nix store cat --store "file://$cacheDir" "$path/small")
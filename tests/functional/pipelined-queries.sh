@@ -0,0 +1,48 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+clearStore
+
+startDaemon
+
+# A chain of paths referring to each other, so that `--recursive` has to
+# query the path info of the references as the replies come in.
+valid=()
+prev=
+for i in $(seq 1 50); do
+    echo "$i $prev" > "$TEST_ROOT/pipelined-$i"
+    prev=$(nix-store --add "$TEST_ROOT/pipelined-$i")
+    valid+=("$prev")
+done
+
+# Invalid paths, mixed in with the valid ones.
+mixed=()
+for i in $(seq 1 50); do
+    mixed+=("${valid[$((i - 1))]}")
+    if (( i % 10 == 0 )); then
+        echo "invalid $i" > "$TEST_ROOT/pipelined-invalid-$i"
+        path=$(nix store add-file "$TEST_ROOT/pipelined-invalid-$i")
+        nix-store --delete "$path"
+        mixed+=("$path")
+    fi
+done
+
+query() {
+    nix path-info --json --json-format 2 --store "daemon?pipeline-queries=$1" "${@:2}" |
+        jq --sort-keys '.info | map_values(if . == null then null else {narHash, narSize, references} end)'
+}
+
+diff --unified --color=always <(query true --recursive "${valid[-1]}") <(query false --recursive "${valid[-1]}")
+diff --unified --color=always <(query true "${mixed[@]}") <(query false "${mixed[@]}")
+[[ $(query true "${mixed[@]}" | jq 'map(select(. == null)) | length') = 5 ]]
+
+# The queries went over the pipelined connection.
+if isDaemonNewer "2.35pre"; then
+    nix path-info --debug --store "daemon?pipeline-queries=true" "${mixed[@]}" > /dev/null 2> "$TEST_ROOT/pipelined.log"
+    (! grep -E 'not pipelining queries|pipelined connection to the Nix daemon failed' "$TEST_ROOT/pipelined.log")
+fi
+
+killDaemon
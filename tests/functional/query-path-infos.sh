@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+clearStore
+
+startDaemon
+
+# Valid paths with references, so that the infos aren't all alike.
+valid=()
+prev=
+for i in $(seq 1 20); do
+    echo "$i $prev" > "$TEST_ROOT/batched-$i"
+    prev=$(nix-store --add "$TEST_ROOT/batched-$i")
+    valid+=("$prev")
+done
+
+# Missing and invalid paths, mixed in with the valid ones.
+mixed=("${valid[@]}")
+for i in $(seq 1 5); do
+    echo "invalid $i" > "$TEST_ROOT/batched-invalid-$i"
+    path=$(nix store add-file "$TEST_ROOT/batched-invalid-$i")
+    nix-store --delete "$path"
+    mixed+=("$path")
+done
+mixed+=("$NIX_STORE_DIR/$(basename "${valid[0]}" | cut -c1-32)-wrong-name")
+
+query() {
+    nix path-info --json --json-format 2 --store "$1" "${@:2}" |
+        jq --sort-keys '.info | map_values(if . == null then null else {narHash, narSize, references} end)'
+}
+
+# The daemon gives the same answers as the local store, and as querying
+# one path at a time.
+diff --unified --color=always <(query local "${mixed[@]}") <(query daemon "${mixed[@]}")
+for path in "${mixed[@]}"; do
+    query daemon "$path"
+done | jq --slurp --sort-keys add > "$TEST_ROOT/one-at-a-time.json"
+diff --unified --color=always "$TEST_ROOT/one-at-a-time.json" <(query daemon "${mixed[@]}")
+[[ $(query daemon "${mixed[@]}" | jq 'map(select(. == null)) | length') = 6 ]]
+
+# The daemon was asked for all paths at once (`QueryPathInfos` is op 49).
+if isDaemonNewer "2.35pre"; then
+    nix path-info --debug --store daemon "${mixed[@]}" > /dev/null 2> "$TEST_ROOT/batched.log"
+    grep -q 'performing daemon worker op: 49' "$TEST_ROOT/batched.log"
+fi
+
+killDaemon